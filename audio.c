@@ -48,6 +48,15 @@
 #include <inttypes.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include <libintl.h>
 #define _(str) gettext(str)		///< gettext shortcut
@@ -91,6 +100,7 @@
 #include "iatomic.h"			// portable atomic_t
 
 #include "ringbuffer.h"
+#include "stats.h"
 #include "misc.h"
 #include "audio.h"
 
@@ -125,6 +135,8 @@ static const AudioModule NoopModule;	///< forward definition of noop module
 char AudioAlsaDriverBroken;		///< disable broken driver message
 char AudioAlsaNoCloseOpen;		///< disable alsa close/open fix
 char AudioAlsaCloseOpenDelay;		///< enable alsa close/open delay fix
+char AudioAlsaNoMmap;			///< disable alsa mmap access
+char AudioNoopSink;			///< noop plays: 1 real time, 2 fast
 
 static const char *AudioModuleName;	///< which audio module to use
 
@@ -137,19 +149,35 @@ static const char *AudioMixerDevice;	///< mixer device name
 static const char *AudioMixerChannel;	///< mixer channel name
 static char AudioDoingInit;		///> flag in init, reduce error
 static volatile char AudioRunning;	///< thread running / stopped
-static volatile char AudioPaused;	///< audio paused
+static volatile char AudioPaused;	///< audio paused (audio thread)
+static char AudioPauseRequested;	///< audio pause requested
 static volatile char AudioVideoIsReady;	///< video ready start early
 static int AudioSkip;			///< skip audio to sync to video
+static char AudioEarlyStart;		///< start audio at the running video
+    /// pts of first video frame
+static int64_t AudioVideoStartPts = INT64_C(0x8000000000000000);
+static uint32_t AudioVideoStartTicks;	///< ticks of first video frame
+static uint32_t AudioEnqueueTick;	///< ticks of last enqueue, 0 none
+static int AudioEnqueueGap;		///< filtered max. gap between enqueues
 
 static const int AudioBytesProSample = 2;	///< number of bytes per sample
 
 static int AudioBufferTime = 336;	///< audio buffer time in ms
 
+    /// early start: audio buffered more than the enqueue gap in ms
+#define AUDIO_EARLY_MARGIN 48
+    /// fraction bits of the fixed-point enqueue gap
+#define AUDIO_GAP_SHIFT 8
+
 #ifdef USE_AUDIO_THREAD
 static pthread_t AudioThread;		///< audio play thread
 static pthread_mutex_t AudioMutex;	///< audio condition mutex
-static pthread_cond_t AudioStartCond;	///< condition variable
+static pthread_cond_t AudioStartCond;	///< start, samples or commands
+static pthread_cond_t AudioDoneCond;	///< audio thread handled commands
 static char AudioThreadStop;		///< stop audio thread
+static char AudioThreadWaiting;		///< audio thread waits for samples
+    /// serialize command producers
+static pthread_mutex_t AudioCmdMutex = PTHREAD_MUTEX_INITIALIZER;
 #else
 static const int AudioThread;		///< dummy audio thread
 #endif
@@ -204,95 +232,76 @@ static const unsigned AudioRatesTable[AudioRatesMax] = {
 //	filter
 //----------------------------------------------------------------------------
 
+#define AUDIO_DSP_FRAMES 256		///< frames processed per dsp block
+
 static const int AudioNormSamples = 4096;	///< number of samples
 
 #define AudioNormMaxIndex 128		///< number of average values
     /// average of n last sample blocks
-static uint32_t AudioNormAverage[AudioNormMaxIndex];
+static float AudioNormAverage[AudioNormMaxIndex];
 static int AudioNormIndex;		///< index into average table
 static int AudioNormReady;		///< index counter
 static int AudioNormCounter;		///< sample counter
 
+    /// dither state of the enqueue dsp pass (must not be zero)
+static uint32_t AudioDitherEnqueue[4] = {
+    0x9E3779B9, 0x7F4A7C15, 0x85EBCA6B, 0xC2B2AE35
+};
+
+    /// dither state of the output software volume (must not be zero)
+static uint32_t AudioDitherOutput[4] = {
+    0x27D4EB2F, 0x165667B1, 0xD3A2646C, 0xFD7046C5
+};
+
 /**
 **	Audio normalizer.
 **
-**	@param samples	sample buffer
-**	@param count	number of bytes in sample buffer
+**	Collects the power of the samples and updates the normalize factor.
+**
+**	@param power	sum of the squared samples
+**	@param n	number of samples
 */
-static void AudioNormalizer(int16_t * samples, int count)
+static void AudioNormalizer(float power, int n)
 {
     int i;
-    int l;
-    int n;
-    uint32_t avg;
+    float avg;
     int factor;
-    int16_t *data;
-
-    // average samples
-    l = count / AudioBytesProSample;
-    data = samples;
-    do {
-	n = l;
-	if (AudioNormCounter + n > AudioNormSamples) {
-	    n = AudioNormSamples - AudioNormCounter;
-	}
-	avg = AudioNormAverage[AudioNormIndex];
-	for (i = 0; i < n; ++i) {
-	    int t;
-
-	    t = data[i];
-	    avg += (t * t) / AudioNormSamples;
-	}
-	AudioNormAverage[AudioNormIndex] = avg;
-	AudioNormCounter += n;
-	if (AudioNormCounter >= AudioNormSamples) {
-	    if (AudioNormReady < AudioNormMaxIndex) {
-		AudioNormReady++;
-	    } else {
-		avg = 0;
-		for (i = 0; i < AudioNormMaxIndex; ++i) {
-		    avg += AudioNormAverage[i] / AudioNormMaxIndex;
-		}
-
-		// calculate normalize factor
-		if (avg > 0) {
-		    factor = ((INT16_MAX / 8) * 1000U) / (uint32_t) sqrt(avg);
-		    // smooth normalize
-		    AudioNormalizeFactor =
-			(AudioNormalizeFactor * 500 + factor * 500) / 1000;
-		    if (AudioNormalizeFactor < AudioMinNormalize) {
-			AudioNormalizeFactor = AudioMinNormalize;
-		    }
-		    if (AudioNormalizeFactor > AudioMaxNormalize) {
-			AudioNormalizeFactor = AudioMaxNormalize;
-		    }
-		} else {
-		    factor = 1000;
-		}
-		Debug(4, "audio/noramlize: avg %8d, fac=%6.3f, norm=%6.3f\n",
-		    avg, factor / 1000.0, AudioNormalizeFactor / 1000.0);
-	    }
 
-	    AudioNormIndex = (AudioNormIndex + 1) % AudioNormMaxIndex;
-	    AudioNormCounter = 0;
-	    AudioNormAverage[AudioNormIndex] = 0U;
+    AudioNormAverage[AudioNormIndex] += power / AudioNormSamples;
+    AudioNormCounter += n;
+    if (AudioNormCounter < AudioNormSamples) {
+	return;
+    }
+    if (AudioNormReady < AudioNormMaxIndex) {
+	AudioNormReady++;
+    } else {
+	avg = 0.0f;
+	for (i = 0; i < AudioNormMaxIndex; ++i) {
+	    avg += AudioNormAverage[i] / AudioNormMaxIndex;
 	}
-	data += n;
-	l -= n;
-    } while (l > 0);
-
-    // apply normalize factor
-    for (i = 0; i < count / AudioBytesProSample; ++i) {
-	int t;
 
-	t = (samples[i] * AudioNormalizeFactor) / 1000;
-	if (t < INT16_MIN) {
-	    t = INT16_MIN;
-	} else if (t > INT16_MAX) {
-	    t = INT16_MAX;
+	// calculate normalize factor
+	if (avg >= 1.0f) {
+	    factor = ((INT16_MAX / 8) * 1000.0f) / sqrtf(avg);
+	    // smooth normalize
+	    AudioNormalizeFactor =
+		(AudioNormalizeFactor * 500 + factor * 500) / 1000;
+	    if (AudioNormalizeFactor < AudioMinNormalize) {
+		AudioNormalizeFactor = AudioMinNormalize;
+	    }
+	    if (AudioNormalizeFactor > AudioMaxNormalize) {
+		AudioNormalizeFactor = AudioMaxNormalize;
+	    }
+	} else {
+	    factor = 1000;
 	}
-	samples[i] = t;
+	Debug(4, "audio/noramlize: avg %8.0f, fac=%6.3f, norm=%6.3f\n", avg,
+	    factor / 1000.0, AudioNormalizeFactor / 1000.0);
     }
+
+    AudioNormIndex = (AudioNormIndex + 1) % AudioNormMaxIndex;
+    AudioNormCounter = 0;
+    AudioNormAverage[AudioNormIndex] = 0.0f;
 }
 
 /**
@@ -305,7 +314,7 @@ static void AudioResetNormalizer(void)
     AudioNormCounter = 0;
     AudioNormReady = 0;
     for (i = 0; i < AudioNormMaxIndex; ++i) {
-	AudioNormAverage[i] = 0U;
+	AudioNormAverage[i] = 0.0f;
     }
     AudioNormalizeFactor = 1000;
 }
@@ -313,336 +322,1155 @@ static void AudioResetNormalizer(void)
 /**
 **	Audio compression.
 **
-**	@param samples	sample buffer
-**	@param count	number of bytes in sample buffer
+**	Updates the compression factor from the loudest sample.
+**
+**	@param peak	absolute value of the loudest sample
 */
-static void AudioCompressor(int16_t * samples, int count)
+static void AudioCompressor(float peak)
 {
-    int max_sample;
-    int i;
     int factor;
 
-    // find loudest sample
-    max_sample = 0;
-    for (i = 0; i < count / AudioBytesProSample; ++i) {
-	int t;
+    if (peak < 1.0f) {			// silent nothing todo
+	return;
+    }
+    // calculate compression factor
+    factor = (INT16_MAX * 1000.0f) / peak;
+    // smooth compression (FIXME: make configurable?)
+    AudioCompressionFactor =
+	(AudioCompressionFactor * 950 + factor * 50) / 1000;
+    if (AudioCompressionFactor > factor) {
+	AudioCompressionFactor = factor;	// no clipping
+    }
+    if (AudioCompressionFactor > AudioMaxCompression) {
+	AudioCompressionFactor = AudioMaxCompression;
+    }
+
+    Debug(4, "audio/compress: max %5.0f, fac=%6.3f, com=%6.3f\n", peak,
+	factor / 1000.0, AudioCompressionFactor / 1000.0);
+}
+
+/**
+**	Reset compressor.
+*/
+static void AudioResetCompressor(void)
+{
+    AudioCompressionFactor = 2000;
+    if (AudioCompressionFactor > AudioMaxCompression) {
+	AudioCompressionFactor = AudioMaxCompression;
+    }
+}
+
+//----------------------------------------------------------------------------
+//	remix matrix
+//----------------------------------------------------------------------------
+
+/**
+**	Speaker positions.
+*/
+enum _audio_speaker_
+{
+    AudioSpeakerL,			///< front left
+    AudioSpeakerR,			///< front right
+    AudioSpeakerC,			///< front center
+    AudioSpeakerLFE,			///< low frequency effects
+    AudioSpeakerLs,			///< surround left
+    AudioSpeakerRs,			///< surround right
+    AudioSpeakerRl,			///< rear left
+    AudioSpeakerRr,			///< rear right
+    AudioSpeakerMax			///< number of speaker positions
+};
+
+/**
+**	Speaker position of each channel for 1 - 8 channels.
+**
+**	alsa L R  Ls Rs C  LFE Rl Rr
+*/
+static const char AudioSpeakerLayout[9][8] = {
+    {0},
+    {AudioSpeakerC},
+    {AudioSpeakerL, AudioSpeakerR},
+    {AudioSpeakerL, AudioSpeakerR, AudioSpeakerC},
+    {AudioSpeakerL, AudioSpeakerR, AudioSpeakerLs, AudioSpeakerRs},
+    {AudioSpeakerL, AudioSpeakerR, AudioSpeakerLs, AudioSpeakerRs,
+	AudioSpeakerC},
+    {AudioSpeakerL, AudioSpeakerR, AudioSpeakerLs, AudioSpeakerRs,
+	AudioSpeakerC, AudioSpeakerLFE},
+    {AudioSpeakerL, AudioSpeakerR, AudioSpeakerLs, AudioSpeakerRs,
+	AudioSpeakerC, AudioSpeakerRl, AudioSpeakerRr},
+    {AudioSpeakerL, AudioSpeakerR, AudioSpeakerLs, AudioSpeakerRs,
+	AudioSpeakerC, AudioSpeakerLFE, AudioSpeakerRl, AudioSpeakerRr},
+};
+
+/**
+**	Downmix surround to stereo factors /1000.
+**
+**	ffmpeg L  R  C	Ls Rs		-> alsa L R  Ls Rs C
+**	ffmpeg L  R  C	LFE Ls Rs	-> alsa L R  Ls Rs C  LFE
+**	ffmpeg L  R  C	LFE Ls Rs Rl Rr	-> alsa L R  Ls Rs C  LFE Rl Rr
+*/
+static const short AudioDownmixStereo[9][2][8] = {
+    {{0}}, {{0}}, {{0}},
+    {{600, 0, 400}, {0, 600, 400}},	// stereo or surround? =>stereo
+    {{600, 0, 400, 0}, {0, 600, 0, 400}},	// quad or surround? =>quad
+    {{500, 0, 200, 0, 300}, {0, 500, 0, 200, 300}},	// 5.0
+    {{400, 0, 200, 0, 300, 100}, {0, 400, 0, 200, 300, 100}},	// 5.1
+    {{400, 0, 200, 0, 300, 100, 0}, {0, 400, 0, 200, 300, 0, 100}},	// 7.0
+    {{400, 0, 150, 0, 250, 100, 100, 0},	// 7.1
+	{0, 400, 0, 150, 250, 100, 0, 100}},
+};
+
+static int AudioMixInChannels;		///< input channels of remix matrix
+static int AudioMixOutChannels;		///< output channels of remix matrix
+static int AudioMixIdentity;		///< flag: remix matrix is identity
+
+    /// number of non zero factors of each output channel
+static int AudioMixTaps[8];
+
+    /// input channel of each non zero factor
+static int AudioMixTapIndex[8][8];
+
+    /// non zero factors of each output channel
+static float AudioMixTapFactor[8][8];
+
+    /// flag: output channel is silent or an unscaled input channel
+static char AudioMixExact[8];
 
-	t = abs(samples[i]);
-	if (t > max_sample) {
-	    max_sample = t;
+/**
+**	Build remix matrix for @a in_chan input to @a out_chan output
+**	channels.
+**
+**	Every combination of 1 - 8 channels is supported.  Channels are
+**	placed by speaker position, missing speakers are folded into the
+**	nearest existing ones.  Output channels, which could clip, are
+**	scaled down.
+**
+**	@param in_chan	nr. of input channels
+**	@param out_chan	nr. of output channels
+*/
+static void AudioMixSetup(int in_chan, int out_chan)
+{
+    float matrix[8][8];
+    int have[AudioSpeakerMax];
+    int i;
+    int o;
+
+    memset(matrix, 0, sizeof(matrix));
+    if (out_chan <= 2 && in_chan > 2) {
+	// surround to stereo and mono, use the well tested factors
+	for (i = 0; i < in_chan; ++i) {
+	    float l;
+	    float r;
+
+	    l = AudioDownmixStereo[in_chan][0][i] / 1000.0f;
+	    r = AudioDownmixStereo[in_chan][1][i] / 1000.0f;
+	    if (out_chan == 1) {
+		matrix[0][i] = (l + r) / 2;
+	    } else {
+		matrix[0][i] = l;
+		matrix[1][i] = r;
+	    }
+	}
+    } else {
+	for (i = 0; i < AudioSpeakerMax; ++i) {
+	    have[i] = -1;
+	}
+	for (o = 0; o < out_chan; ++o) {
+	    have[(int)AudioSpeakerLayout[out_chan][o]] = o;
+	}
+	for (i = 0; i < in_chan; ++i) {
+	    int s;
+
+	    s = AudioSpeakerLayout[in_chan][i];
+	    if (have[s] >= 0) {		// speaker exists
+		matrix[have[s]][i] += 1.0f;
+		continue;
+	    }
+	    switch (s) {
+		case AudioSpeakerL:	// only mono output
+		case AudioSpeakerR:
+		    matrix[have[AudioSpeakerC]][i] += 0.5f;
+		    break;
+		case AudioSpeakerC:	// mono input is played full
+		    matrix[have[AudioSpeakerL]][i] +=
+			in_chan == 1 ? 1.0f : 0.70710678f;
+		    matrix[have[AudioSpeakerR]][i] +=
+			in_chan == 1 ? 1.0f : 0.70710678f;
+		    break;
+		case AudioSpeakerLFE:
+		    matrix[have[AudioSpeakerL]][i] += 0.5f;
+		    matrix[have[AudioSpeakerR]][i] += 0.5f;
+		    break;
+		case AudioSpeakerLs:
+		case AudioSpeakerRl:
+		    if (have[AudioSpeakerRl] >= 0) {
+			matrix[have[AudioSpeakerRl]][i] += 1.0f;
+		    } else if (have[AudioSpeakerLs] >= 0) {
+			matrix[have[AudioSpeakerLs]][i] += 1.0f;
+		    } else {
+			matrix[have[AudioSpeakerL]][i] += 0.70710678f;
+		    }
+		    break;
+		case AudioSpeakerRs:
+		case AudioSpeakerRr:
+		    if (have[AudioSpeakerRr] >= 0) {
+			matrix[have[AudioSpeakerRr]][i] += 1.0f;
+		    } else if (have[AudioSpeakerRs] >= 0) {
+			matrix[have[AudioSpeakerRs]][i] += 1.0f;
+		    } else {
+			matrix[have[AudioSpeakerR]][i] += 0.70710678f;
+		    }
+		    break;
+	    }
+	}
+	// scale down output channels, which could clip
+	for (o = 0; o < out_chan; ++o) {
+	    float sum;
+
+	    sum = 0.0f;
+	    for (i = 0; i < in_chan; ++i) {
+		sum += matrix[o][i];
+	    }
+	    if (sum > 1.0f) {
+		for (i = 0; i < in_chan; ++i) {
+		    matrix[o][i] /= sum;
+		}
+	    }
 	}
     }
 
-    // calculate compression factor
-    if (max_sample > 0) {
-	factor = (INT16_MAX * 1000) / max_sample;
-	// smooth compression (FIXME: make configurable?)
-	AudioCompressionFactor =
-	    (AudioCompressionFactor * 950 + factor * 50) / 1000;
-	if (AudioCompressionFactor > factor) {
-	    AudioCompressionFactor = factor;	// no clipping
+    AudioMixIdentity = in_chan == out_chan;
+    for (o = 0; o < out_chan; ++o) {
+	AudioMixTaps[o] = 0;
+	for (i = 0; i < in_chan; ++i) {
+	    if (matrix[o][i] != (o == i ? 1.0f : 0.0f)) {
+		AudioMixIdentity = 0;
+	    }
+	    if (matrix[o][i] != 0.0f) {
+		AudioMixTapIndex[o][AudioMixTaps[o]] = i;
+		AudioMixTapFactor[o][AudioMixTaps[o]] = matrix[o][i];
+		AudioMixTaps[o]++;
+	    }
+	}
+	AudioMixExact[o] = !AudioMixTaps[o] || (AudioMixTaps[o] == 1
+	    && AudioMixTapFactor[o][0] == 1.0f);
+    }
+    AudioMixInChannels = in_chan;
+    AudioMixOutChannels = out_chan;
+
+    Debug(3, "audio: remix %d -> %d channels%s\n", in_chan, out_chan,
+	AudioMixIdentity ? " (identity)" : "");
+}
+
+//----------------------------------------------------------------------------
+//	dsp kernels
+//----------------------------------------------------------------------------
+
+#if defined(__SSE2__)
+
+/**
+**	Triangular dither of +-1 sample, 4 xorshift generators.
+**
+**	@param state	generator state
+*/
+static inline __m128 AudioDspDither(__m128i * state)
+{
+    __m128i s;
+
+    s = *state;
+    s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+    s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+    s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+    *state = s;
+
+    // difference of two uniform 16 bit values
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(s,
+		    _mm_set1_epi32(0xFFFF)), _mm_srli_epi32(s, 16))),
+	_mm_set1_ps(1.0f / 65536.0f));
+}
+
+/**
+**	Convert 2x4 float samples to 8 rounded saturated s16 samples.
+*/
+static inline __m128i AudioDspPack(__m128 a, __m128 b)
+{
+    const __m128 max = _mm_set1_ps(INT16_MAX);
+    const __m128 min = _mm_set1_ps(INT16_MIN);
+
+    a = _mm_max_ps(_mm_min_ps(a, max), min);
+    b = _mm_max_ps(_mm_min_ps(b, max), min);
+    return _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+}
+
+#elif defined(__ARM_NEON)
+
+/**
+**	Triangular dither of +-1 sample, 4 xorshift generators.
+**
+**	@param state	generator state
+*/
+static inline float32x4_t AudioDspDither(uint32x4_t * state)
+{
+    uint32x4_t s;
+
+    s = *state;
+    s = veorq_u32(s, vshlq_n_u32(s, 13));
+    s = veorq_u32(s, vshrq_n_u32(s, 17));
+    s = veorq_u32(s, vshlq_n_u32(s, 5));
+    *state = s;
+
+    // difference of two uniform 16 bit values
+    return vmulq_n_f32(vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32
+		(vandq_u32(s, vdupq_n_u32(0xFFFF))),
+		vreinterpretq_s32_u32(vshrq_n_u32(s, 16)))),
+	1.0f / 65536.0f);
+}
+
+/**
+**	Convert 2x4 float samples to 8 rounded saturated s16 samples.
+*/
+static inline int16x8_t AudioDspPack(float32x4_t a, float32x4_t b)
+{
+    const uint32x4_t sign = vdupq_n_u32(0x80000000);
+    const uint32x4_t half = vreinterpretq_u32_f32(vdupq_n_f32(0.5f));
+
+    // round half away from zero, conversion truncates
+    a = vaddq_f32(a, vreinterpretq_f32_u32(vorrq_u32(vandq_u32
+		(vreinterpretq_u32_f32(a), sign), half)));
+    b = vaddq_f32(b, vreinterpretq_f32_u32(vorrq_u32(vandq_u32
+		(vreinterpretq_u32_f32(b), sign), half)));
+    return vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a)),
+	vqmovn_s32(vcvtq_s32_f32(b)));
+}
+
+#endif
+
+/**
+**	Triangular dither of +-1 sample.
+**
+**	@param state	generator state
+*/
+static inline float AudioDspDitherSample(uint32_t * state)
+{
+    uint32_t s;
+
+    s = *state;
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    *state = s;
+
+    return ((int)(s & 0xFFFF) - (int)(s >> 16)) * (1.0f / 65536.0f);
+}
+
+/**
+**	Convert float sample to rounded saturated s16 sample.
+*/
+static inline int16_t AudioDspPackSample(float x)
+{
+    if (x >= INT16_MAX) {
+	return INT16_MAX;
+    }
+    if (x <= INT16_MIN) {
+	return INT16_MIN;
+    }
+    return x < 0.0f ? (int)(x - 0.5f) : (int)(x + 0.5f);
+}
+
+/**
+**	Convert interleaved s16 samples to float planes.
+**
+**	@param in	interleaved input samples
+**	@param in_chan	nr. of input channels
+**	@param n	number of frames
+**	@param planes	float output planes
+*/
+static void AudioDspLoad(const int16_t * in, int in_chan, int n,
+    float planes[][AUDIO_DSP_FRAMES])
+{
+    int i;
+    int c;
+
+    i = 0;
+    if (in_chan == 2) {
+#if defined(__SSE2__)
+	for (; i + 4 <= n; i += 4) {
+	    __m128i v;
+	    __m128 a;
+	    __m128 b;
+
+	    v = _mm_loadu_si128((const __m128i *)(in + i * 2));
+	    a = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+	    b = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+	    _mm_storeu_ps(planes[0] + i, _mm_shuffle_ps(a, b,
+		    _MM_SHUFFLE(2, 0, 2, 0)));
+	    _mm_storeu_ps(planes[1] + i, _mm_shuffle_ps(a, b,
+		    _MM_SHUFFLE(3, 1, 3, 1)));
 	}
-	if (AudioCompressionFactor > AudioMaxCompression) {
-	    AudioCompressionFactor = AudioMaxCompression;
+#elif defined(__ARM_NEON)
+	for (; i + 4 <= n; i += 4) {
+	    int16x4x2_t v;
+
+	    v = vld2_s16(in + i * 2);
+	    vst1q_f32(planes[0] + i, vcvtq_f32_s32(vmovl_s16(v.val[0])));
+	    vst1q_f32(planes[1] + i, vcvtq_f32_s32(vmovl_s16(v.val[1])));
 	}
-    } else {
-	return;				// silent nothing todo
+#endif
     }
+    for (; i < n; ++i) {
+	for (c = 0; c < in_chan; ++c) {
+	    planes[c][i] = in[i * in_chan + c];
+	}
+    }
+}
 
-    Debug(4, "audio/compress: max %5d, fac=%6.3f, com=%6.3f\n", max_sample,
-	factor / 1000.0, AudioCompressionFactor / 1000.0);
+/**
+**	Remix float planes with the remix matrix.
+**
+**	@param in	float input planes
+**	@param n	number of frames
+**	@param out	float output planes
+*/
+static void AudioDspRemix(float in[][AUDIO_DSP_FRAMES], int n,
+    float out[][AUDIO_DSP_FRAMES])
+{
+    int o;
 
-    // apply compression factor
-    for (i = 0; i < count / AudioBytesProSample; ++i) {
+    for (o = 0; o < AudioMixOutChannels; ++o) {
+	const int *index;
+	const float *factor;
+	int taps;
+	int i;
 	int t;
 
-	t = (samples[i] * AudioCompressionFactor) / 1000;
-	if (t < INT16_MIN) {
-	    t = INT16_MIN;
-	} else if (t > INT16_MAX) {
-	    t = INT16_MAX;
+	taps = AudioMixTaps[o];
+	index = AudioMixTapIndex[o];
+	factor = AudioMixTapFactor[o];
+	i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= n; i += 4) {
+	    __m128 acc;
+
+	    acc = _mm_setzero_ps();
+	    for (t = 0; t < taps; ++t) {
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(factor[t]),
+			_mm_loadu_ps(in[index[t]] + i)));
+	    }
+	    _mm_storeu_ps(out[o] + i, acc);
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 4 <= n; i += 4) {
+	    float32x4_t acc;
+
+	    acc = vdupq_n_f32(0.0f);
+	    for (t = 0; t < taps; ++t) {
+		acc = vmlaq_n_f32(acc, vld1q_f32(in[index[t]] + i), factor[t]);
+	    }
+	    vst1q_f32(out[o] + i, acc);
+	}
+#endif
+	for (; i < n; ++i) {
+	    float acc;
+
+	    acc = 0.0f;
+	    for (t = 0; t < taps; ++t) {
+		acc += factor[t] * in[index[t]][i];
+	    }
+	    out[o][i] = acc;
+	}
+    }
+}
+
+/**
+**	Measure loudest sample and power of float planes.
+**
+**	@param planes	float planes
+**	@param chan	nr. of channels
+**	@param n	number of frames
+**	@param[out] peak	absolute value of the loudest sample
+**	@param[out] power	sum of the squared samples
+*/
+static void AudioDspMeasure(float planes[][AUDIO_DSP_FRAMES], int chan,
+    int n, float *peak, float *power)
+{
+    float max;
+    float sum;
+    int c;
+
+    max = 0.0f;
+    sum = 0.0f;
+    for (c = 0; c < chan; ++c) {
+	const float *p;
+	int i;
+
+	p = planes[c];
+	i = 0;
+#if defined(__SSE2__)
+	{
+	    __m128 vmax;
+	    __m128 vsum;
+	    float t[4];
+
+	    vmax = _mm_setzero_ps();
+	    vsum = _mm_setzero_ps();
+	    for (; i + 4 <= n; i += 4) {
+		__m128 x;
+
+		x = _mm_loadu_ps(p + i);
+		vmax = _mm_max_ps(vmax, _mm_andnot_ps(_mm_set1_ps(-0.0f), x));
+		vsum = _mm_add_ps(vsum, _mm_mul_ps(x, x));
+	    }
+	    _mm_storeu_ps(t, vmax);
+	    max = fmaxf(max, fmaxf(fmaxf(t[0], t[1]), fmaxf(t[2], t[3])));
+	    _mm_storeu_ps(t, vsum);
+	    sum += t[0] + t[1] + t[2] + t[3];
+	}
+#elif defined(__ARM_NEON)
+	{
+	    float32x4_t vmax;
+	    float32x4_t vsum;
+	    float t[4];
+
+	    vmax = vdupq_n_f32(0.0f);
+	    vsum = vdupq_n_f32(0.0f);
+	    for (; i + 4 <= n; i += 4) {
+		float32x4_t x;
+
+		x = vld1q_f32(p + i);
+		vmax = vmaxq_f32(vmax, vabsq_f32(x));
+		vsum = vmlaq_f32(vsum, x, x);
+	    }
+	    vst1q_f32(t, vmax);
+	    max = fmaxf(max, fmaxf(fmaxf(t[0], t[1]), fmaxf(t[2], t[3])));
+	    vst1q_f32(t, vsum);
+	    sum += t[0] + t[1] + t[2] + t[3];
+	}
+#endif
+	for (; i < n; ++i) {
+	    max = fmaxf(max, fabsf(p[i]));
+	    sum += p[i] * p[i];
+	}
+    }
+    *peak = max;
+    *power = sum;
+}
+
+/**
+**	Apply gain to float plane and convert it to s16 samples.
+**
+**	@param in	float input plane
+**	@param n	number of samples
+**	@param gain	gain factor
+**	@param dither	dither state, NULL for no dither
+**	@param out	s16 output samples
+*/
+static void AudioDspStore(const float *in, int n, float gain,
+    uint32_t * dither, int16_t * out)
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+	const __m128 g = _mm_set1_ps(gain);
+	__m128i s;
+
+	s = _mm_setzero_si128();
+	if (dither) {
+	    s = _mm_loadu_si128((const __m128i *)dither);
+	}
+	for (; i + 8 <= n; i += 8) {
+	    __m128 a;
+	    __m128 b;
+
+	    a = _mm_mul_ps(_mm_loadu_ps(in + i), g);
+	    b = _mm_mul_ps(_mm_loadu_ps(in + i + 4), g);
+	    if (dither) {
+		a = _mm_add_ps(a, AudioDspDither(&s));
+		b = _mm_add_ps(b, AudioDspDither(&s));
+	    }
+	    _mm_storeu_si128((__m128i *) (out + i), AudioDspPack(a, b));
+	}
+	if (dither) {
+	    _mm_storeu_si128((__m128i *) dither, s);
+	}
+    }
+#elif defined(__ARM_NEON)
+    {
+	uint32x4_t s;
+
+	s = vdupq_n_u32(0);
+	if (dither) {
+	    s = vld1q_u32(dither);
+	}
+	for (; i + 8 <= n; i += 8) {
+	    float32x4_t a;
+	    float32x4_t b;
+
+	    a = vmulq_n_f32(vld1q_f32(in + i), gain);
+	    b = vmulq_n_f32(vld1q_f32(in + i + 4), gain);
+	    if (dither) {
+		a = vaddq_f32(a, AudioDspDither(&s));
+		b = vaddq_f32(b, AudioDspDither(&s));
+	    }
+	    vst1q_s16(out + i, AudioDspPack(a, b));
+	}
+	if (dither) {
+	    vst1q_u32(dither, s);
+	}
+    }
+#endif
+    for (; i < n; ++i) {
+	float x;
+
+	x = in[i] * gain;
+	if (dither) {
+	    x += AudioDspDitherSample(dither);
+	}
+	out[i] = AudioDspPackSample(x);
+    }
+}
+
+/**
+**	Interleave s16 planes.
+**
+**	@param planes	s16 input planes
+**	@param chan	nr. of channels
+**	@param n	number of frames
+**	@param out	interleaved output samples
+*/
+static void AudioDspInterleave(int16_t planes[][AUDIO_DSP_FRAMES], int chan,
+    int n, int16_t * out)
+{
+    int i;
+    int c;
+
+    i = 0;
+    if (chan == 2) {
+#if defined(__SSE2__)
+	for (; i + 8 <= n; i += 8) {
+	    __m128i l;
+	    __m128i r;
+
+	    l = _mm_loadu_si128((const __m128i *)(planes[0] + i));
+	    r = _mm_loadu_si128((const __m128i *)(planes[1] + i));
+	    _mm_storeu_si128((__m128i *) (out + i * 2),
+		_mm_unpacklo_epi16(l, r));
+	    _mm_storeu_si128((__m128i *) (out + i * 2 + 8),
+		_mm_unpackhi_epi16(l, r));
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 8 <= n; i += 8) {
+	    int16x8x2_t v;
+
+	    v.val[0] = vld1q_s16(planes[0] + i);
+	    v.val[1] = vld1q_s16(planes[1] + i);
+	    vst2q_s16(out + i * 2, v);
+	}
+#endif
+    }
+    for (; i < n; ++i) {
+	for (c = 0; c < chan; ++c) {
+	    out[i * chan + c] = planes[c][i];
+	}
+    }
+}
+
+/**
+**	Audio dsp pass.
+**
+**	Remixes @a in_chan to @a out_chan channels and applies compression
+**	and normalize in one pass.  The samples are processed block wise as
+**	float planes, so each buffer is read and written only once.  @a in
+**	and @a out can be the same buffer, if the number of channels is
+**	equal.
+**
+**	@param in	input sample buffer
+**	@param in_chan	nr. of input channels
+**	@param frames	number of frames in sample buffer
+**	@param out	output sample buffer
+**	@param out_chan	nr. of output channels
+*/
+static void AudioDsp(const int16_t * in, int in_chan, int frames,
+    int16_t * out, int out_chan)
+{
+    float plane_in[8][AUDIO_DSP_FRAMES];
+    float plane_out[8][AUDIO_DSP_FRAMES];
+    int16_t plane_s16[8][AUDIO_DSP_FRAMES];
+
+    if (in_chan != AudioMixInChannels || out_chan != AudioMixOutChannels) {
+	AudioMixSetup(in_chan, out_chan);
+    }
+
+    while (frames > 0) {
+	float (*planes)[AUDIO_DSP_FRAMES];
+	float gain;
+	int n;
+	int c;
+
+	n = frames < AUDIO_DSP_FRAMES ? frames : AUDIO_DSP_FRAMES;
+
+	AudioDspLoad(in, in_chan, n, plane_in);
+	planes = plane_in;
+	if (!AudioMixIdentity) {
+	    AudioDspRemix(plane_in, n, plane_out);
+	    planes = plane_out;
+	}
+
+	gain = 1.0f;
+	if (AudioCompression || AudioNormalize) {
+	    float peak;
+	    float power;
+
+	    AudioDspMeasure(planes, out_chan, n, &peak, &power);
+	    if (AudioCompression) {
+		AudioCompressor(peak);
+		gain = AudioCompressionFactor / 1000.0f;
+	    }
+	    if (AudioNormalize) {	// measured after compression
+		AudioNormalizer(power * gain * gain, n * out_chan);
+		gain *= AudioNormalizeFactor / 1000.0f;
+	    }
+	}
+	// only requantization needs dither
+	for (c = 0; c < out_chan; ++c) {
+	    AudioDspStore(planes[c], n, gain, AudioMixExact[c]
+		&& gain == 1.0f ? NULL : AudioDitherEnqueue, plane_s16[c]);
+	}
+	AudioDspInterleave(plane_s16, out_chan, n, out);
+
+	in += n * in_chan;
+	out += n * out_chan;
+	frames -= n;
+    }
+}
+
+/**
+**	Audio software amplifier.
+**
+**	The input samples are not modified, so a partial write to the
+**	hardware can't amplify them twice.
+**
+**	@param in	input sample buffer
+**	@param out	output sample buffer
+**	@param count	number of bytes in sample buffer
+*/
+static void AudioSoftAmplifier(const int16_t * in, int16_t * out, int count)
+{
+    float gain;
+    int n;
+    int i;
+
+    // silence
+    if (AudioMute || !AudioAmplifier) {
+	memset(out, 0, count);
+	return;
+    }
+    if (AudioAmplifier == 1000) {	// unity gain
+	memcpy(out, in, count);
+	return;
+    }
+
+    gain = AudioAmplifier / 1000.0f;
+    n = count / AudioBytesProSample;
+    i = 0;
+#if defined(__SSE2__)
+    {
+	const __m128 g = _mm_set1_ps(gain);
+	__m128i s;
+
+	s = _mm_loadu_si128((const __m128i *)AudioDitherOutput);
+	for (; i + 8 <= n; i += 8) {
+	    __m128i v;
+	    __m128 a;
+	    __m128 b;
+
+	    v = _mm_loadu_si128((const __m128i *)(in + i));
+	    a = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+	    b = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+	    a = _mm_add_ps(_mm_mul_ps(a, g), AudioDspDither(&s));
+	    b = _mm_add_ps(_mm_mul_ps(b, g), AudioDspDither(&s));
+	    _mm_storeu_si128((__m128i *) (out + i), AudioDspPack(a, b));
 	}
-	samples[i] = t;
+	_mm_storeu_si128((__m128i *) AudioDitherOutput, s);
+    }
+#elif defined(__ARM_NEON)
+    {
+	uint32x4_t s;
+
+	s = vld1q_u32(AudioDitherOutput);
+	for (; i + 8 <= n; i += 8) {
+	    int16x8_t v;
+	    float32x4_t a;
+	    float32x4_t b;
+
+	    v = vld1q_s16(in + i);
+	    a = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+	    b = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+	    a = vaddq_f32(vmulq_n_f32(a, gain), AudioDspDither(&s));
+	    b = vaddq_f32(vmulq_n_f32(b, gain), AudioDspDither(&s));
+	    vst1q_s16(out + i, AudioDspPack(a, b));
+	}
+	vst1q_u32(AudioDitherOutput, s);
+    }
+#endif
+    for (; i < n; ++i) {
+	out[i] = AudioDspPackSample(in[i] * gain +
+	    AudioDspDitherSample(AudioDitherOutput));
     }
 }
 
+//----------------------------------------------------------------------------
+//	ring buffer
+//----------------------------------------------------------------------------
+
+#define AUDIO_RING_MAX 8		///< number of audio ring buffers
+
+/**
+**	Audio ring buffer.
+*/
+typedef struct _audio_ring_ring_
+{
+    char Passthrough;			///< flag: use pass-through (AC-3, ...)
+    int16_t PacketSize;			///< packet size
+    unsigned HwSampleRate;		///< hardware sample rate in Hz
+    unsigned HwChannels;		///< hardware number of channels
+    unsigned InSampleRate;		///< input sample rate in Hz
+    unsigned InChannels;		///< input number of channels
+    int64_t PTS;			///< pts clock
+    RingBuffer *RingBuffer;		///< sample ring buffer
+    atomic_t Skip;			///< bytes queued to skip, not yet done
+} AudioRingRing;
+
+    /// ring of audio ring buffers
+static AudioRingRing AudioRing[AUDIO_RING_MAX];
+static int AudioRingWrite;		///< audio ring write pointer
+static int AudioRingRead;		///< audio ring read pointer
+static atomic_t AudioRingFilled;	///< how many of the ring is used
+static unsigned AudioStartThreshold;	///< start play, if filled
+
+//----------------------------------------------------------------------------
+//	command queue
+//----------------------------------------------------------------------------
+
+#define AUDIO_CMD_MAX 16		///< size of command queue
+
+/**
+**	Audio thread command types.
+*/
+typedef enum _audio_cmd_type_
+{
+    AudioCmdNone,			///< command already handled
+    AudioCmdSegment,			///< play next ring buffer (new format)
+    AudioCmdFlush,			///< flush and play next ring buffer
+    AudioCmdPlay,			///< resume play-back
+    AudioCmdPause,			///< pause play-back
+    AudioCmdSkip,			///< skip bytes of ring buffer
+} AudioCmdType;
+
 /**
-**	Reset compressor.
+**	Audio thread command.
 */
-static void AudioResetCompressor(void)
+typedef struct _audio_cmd_
 {
-    AudioCompressionFactor = 2000;
-    if (AudioCompressionFactor > AudioMaxCompression) {
-	AudioCompressionFactor = AudioMaxCompression;
-    }
+    AudioCmdType Type;			///< command type
+    int Ring;				///< ring buffer of segment/flush/skip
+    unsigned Serial;			///< serial number of flush, skip bytes
+} AudioCmd;
+
+    /// command queue to the audio thread
+static AudioCmd AudioCmdQueue[AUDIO_CMD_MAX];
+static unsigned AudioCmdWrite;		///< queue write index (producers)
+static unsigned AudioCmdRead;		///< queue read index (audio thread)
+static unsigned AudioFlushSerial;	///< serial of last requested flush
+static unsigned AudioFlushDone;		///< serial of last done flush
+
+/**
+**	Check if the command queue is full.
+**
+**	@note must be called with AudioCmdMutex locked.
+*/
+static int AudioCmdFull(void)
+{
+    return AudioCmdWrite - __atomic_load_n(&AudioCmdRead,
+	__ATOMIC_ACQUIRE) >= AUDIO_CMD_MAX;
 }
 
 /**
-**	Audio software amplifier.
+**	Put command into the audio thread command queue.
 **
-**	@param samples	sample buffer
-**	@param count	number of bytes in sample buffer
+**	The queue has a single consumer, the audio thread.  The producers
+**	(decoder, VDR main thread) are serialized by AudioCmdMutex.
+**
+**	@param type	command type
+**	@param ring	ring buffer of segment/flush/skip
+**	@param serial	serial number of flush, bytes to skip
+**
+**	@retval -1	queue full
+**	@retval 0	okay
 **
-**	@todo FIXME: this does hard clipping
+**	@note must be called with AudioCmdMutex locked.
 */
-static void AudioSoftAmplifier(int16_t * samples, int count)
+static int AudioCmdPush(AudioCmdType type, int ring, unsigned serial)
 {
-    int i;
+    AudioCmd *cmd;
 
-    // silence
-    if (AudioMute || !AudioAmplifier) {
-	memset(samples, 0, count);
-	return;
+    if (AudioCmdFull()) {
+	return -1;
     }
+    cmd = &AudioCmdQueue[AudioCmdWrite % AUDIO_CMD_MAX];
+    cmd->Type = type;
+    cmd->Ring = ring;
+    cmd->Serial = serial;
+    __atomic_store_n(&AudioCmdWrite, AudioCmdWrite + 1, __ATOMIC_RELEASE);
 
-    for (i = 0; i < count / AudioBytesProSample; ++i) {
-	int t;
-
-	t = (samples[i] * AudioAmplifier) / 1000;
-	if (t < INT16_MIN) {
-	    t = INT16_MIN;
-	} else if (t > INT16_MAX) {
-	    t = INT16_MAX;
-	}
-	samples[i] = t;
-    }
+    return 0;
 }
 
-#ifdef USE_AUDIO_MIXER
-
 /**
-**	Upmix mono to stereo.
-**
-**	@param in	input sample buffer
-**	@param frames	number of frames in sample buffer
-**	@param out	output sample buffer
+**	Check if a flush is queued for the audio thread.
 */
-static void AudioMono2Stereo(const int16_t * in, int frames, int16_t * out)
+static int AudioCmdFlushPending(void)
 {
-    int i;
-
-    for (i = 0; i < frames; ++i) {
-	int t;
+    unsigned write;
+    unsigned read;
 
-	t = in[i];
-	out[i * 2 + 0] = t;
-	out[i * 2 + 1] = t;
+    write = __atomic_load_n(&AudioCmdWrite, __ATOMIC_ACQUIRE);
+    for (read = AudioCmdRead; read != write; ++read) {
+	if (AudioCmdQueue[read % AUDIO_CMD_MAX].Type == AudioCmdFlush) {
+	    return 1;
+	}
     }
+    return 0;
 }
 
 /**
-**	Downmix stereo to mono.
+**	Skip bytes of a ring buffer in audio thread.
 **
-**	@param in	input sample buffer
-**	@param frames	number of frames in sample buffer
-**	@param out	output sample buffer
+**	@param cmd	skip command
 */
-static void AudioStereo2Mono(const int16_t * in, int frames, int16_t * out)
+static void AudioCmdSkipDone(AudioCmd * cmd)
 {
-    int i;
-
-    for (i = 0; i < frames; i += 2) {
-	out[i / 2] = (in[i + 0] + in[i + 1]) / 2;
-    }
+    RingBufferReadAdvance(AudioRing[cmd->Ring].RingBuffer, cmd->Serial);
+    atomic_sub((int)cmd->Serial, &AudioRing[cmd->Ring].Skip);
+    cmd->Type = AudioCmdNone;
 }
 
 /**
-**	Downmix surround to stereo.
+**	Handle play/pause, skip and flush commands in audio thread.
 **
-**	ffmpeg L  R  C	Ls Rs		-> alsa L R  Ls Rs C
-**	ffmpeg L  R  C	LFE Ls Rs	-> alsa L R  Ls Rs C  LFE
-**	ffmpeg L  R  C	LFE Ls Rs Rl Rr	-> alsa L R  Ls Rs C  LFE Rl Rr
+**	Play and pause are handled at once, skips if their ring buffer is
+**	played.  All queued ring buffers up to the last flush are dropped.
+**	Segments after it stay queued, until the current ring buffer is
+**	played.
 **
-**	@param in	input sample buffer
-**	@param in_chan	nr. of input channels
-**	@param frames	number of frames in sample buffer
-**	@param out	output sample buffer
+**	@param[out] serial	serial number of last flush
+**
+**	@returns number of ring buffers dropped by flush, 0 no flush.
 */
-static void AudioSurround2Stereo(const int16_t * in, int in_chan, int frames,
-    int16_t * out)
+static int AudioCmdHandle(unsigned *serial)
 {
-    while (frames--) {
-	int l;
-	int r;
-
-	switch (in_chan) {
-	    case 3:			// stereo or surround? =>stereo
-		l = in[0] * 600;	// L
-		r = in[1] * 600;	// R
-		l += in[2] * 400;	// C
-		r += in[2] * 400;
+    unsigned write;
+    unsigned read;
+    unsigned next;
+    int segments;
+    int flush;
+
+    write = __atomic_load_n(&AudioCmdWrite, __ATOMIC_ACQUIRE);
+    next = AudioCmdRead;
+    segments = 0;
+    flush = 0;
+    for (read = AudioCmdRead; read != write; ++read) {
+	AudioCmd *cmd;
+
+	cmd = &AudioCmdQueue[read % AUDIO_CMD_MAX];
+	switch (cmd->Type) {
+	    case AudioCmdNone:
 		break;
-	    case 4:			// quad or surround? =>quad
-		l = in[0] * 600;	// L
-		r = in[1] * 600;	// R
-		l += in[2] * 400;	// Ls
-		r += in[3] * 400;	// Rs
+	    case AudioCmdSegment:
+		++segments;
 		break;
-	    case 5:			// 5.0
-		l = in[0] * 500;	// L
-		r = in[1] * 500;	// R
-		l += in[2] * 200;	// Ls
-		r += in[3] * 200;	// Rs
-		l += in[4] * 300;	// C
-		r += in[4] * 300;
+	    case AudioCmdFlush:
+		// skips of the dropped ring buffers are done
+		for (; next != read; ++next) {
+		    if (AudioCmdQueue[next % AUDIO_CMD_MAX].Type ==
+			AudioCmdSkip) {
+			AudioCmdSkipDone(&AudioCmdQueue[next % AUDIO_CMD_MAX]);
+		    }
+		}
+		flush = ++segments;
+		AudioRingRead = cmd->Ring;
+		*serial = cmd->Serial;
+		next = read + 1;
 		break;
-	    case 6:			// 5.1
-		l = in[0] * 400;	// L
-		r = in[1] * 400;	// R
-		l += in[2] * 200;	// Ls
-		r += in[3] * 200;	// Rs
-		l += in[4] * 300;	// C
-		r += in[4] * 300;
-		l += in[5] * 100;	// LFE
-		r += in[5] * 100;
+	    case AudioCmdPlay:
+		AudioPaused = 0;
+		cmd->Type = AudioCmdNone;
 		break;
-	    case 7:			// 7.0
-		l = in[0] * 400;	// L
-		r = in[1] * 400;	// R
-		l += in[2] * 200;	// Ls
-		r += in[3] * 200;	// Rs
-		l += in[4] * 300;	// C
-		r += in[4] * 300;
-		l += in[5] * 100;	// RL
-		r += in[6] * 100;	// RR
+	    case AudioCmdPause:
+		AudioPaused = 1;
+		cmd->Type = AudioCmdNone;
 		break;
-	    case 8:			// 7.1
-		l = in[0] * 400;	// L
-		r = in[1] * 400;	// R
-		l += in[2] * 150;	// Ls
-		r += in[3] * 150;	// Rs
-		l += in[4] * 250;	// C
-		r += in[4] * 250;
-		l += in[5] * 100;	// LFE
-		r += in[5] * 100;
-		l += in[6] * 100;	// RL
-		r += in[7] * 100;	// RR
+	    case AudioCmdSkip:
+		if (cmd->Ring == AudioRingRead) {
+		    AudioCmdSkipDone(cmd);
+		}
 		break;
-	    default:
-		abort();
 	}
-	in += in_chan;
-
-	out[0] = l / 1000;
-	out[1] = r / 1000;
-	out += 2;
     }
+    // drop everything up to the flush and handled commands
+    while (next != write && AudioCmdQueue[next % AUDIO_CMD_MAX].Type ==
+	AudioCmdNone) {
+	++next;
+    }
+    __atomic_store_n(&AudioCmdRead, next, __ATOMIC_RELEASE);
+
+    return flush;
 }
 
 /**
-**	Upmix @a in_chan channels to @a out_chan.
+**	Get next queued ring buffer in audio thread.
 **
-**	@param in	input sample buffer
-**	@param in_chan	nr. of input channels
-**	@param frames	number of frames in sample buffer
-**	@param out	output sample buffer
-**	@param out_chan	nr. of output channels
+**	@returns ring buffer index, -1 if no ring buffer is queued.
 */
-static void AudioUpmix(const int16_t * in, int in_chan, int frames,
-    int16_t * out, int out_chan)
+static int AudioCmdNextRing(void)
 {
-    while (frames--) {
-	int i;
-
-	for (i = 0; i < in_chan; ++i) {	// copy existing channels
-	    *out++ = *in++;
+    unsigned write;
+    int ring;
+
+    write = __atomic_load_n(&AudioCmdWrite, __ATOMIC_ACQUIRE);
+    while (AudioCmdRead != write) {
+	AudioCmd *cmd;
+
+	cmd = &AudioCmdQueue[AudioCmdRead % AUDIO_CMD_MAX];
+	if (cmd->Type == AudioCmdSegment) {
+	    ring = cmd->Ring;
+	    __atomic_store_n(&AudioCmdRead, AudioCmdRead + 1,
+		__ATOMIC_RELEASE);
+	    return ring;
 	}
-	for (; i < out_chan; ++i) {	// silents missing channels
-	    *out++ = 0;
+	if (cmd->Type != AudioCmdNone) {	// handle flush first
+	    break;
 	}
+	__atomic_store_n(&AudioCmdRead, AudioCmdRead + 1, __ATOMIC_RELEASE);
     }
+    return -1;
 }
 
 /**
-**	Resample ffmpeg sample format to hardware format.
+**	Wakeup audio thread.
 **
-**	FIXME: use libswresample for this and move it to codec.
-**	FIXME: ffmpeg to alsa conversion is already done in codec.c.
+**	@param start	start play-back
+*/
+static void AudioThreadWakeup(int start)
+{
+    if (AudioThread) {
+	pthread_mutex_lock(&AudioMutex);
+	if (start) {
+	    AudioRunning = 1;
+	}
+	pthread_cond_signal(&AudioStartCond);
+	pthread_mutex_unlock(&AudioMutex);
+    }
+}
+
+/**
+**	Wakeup audio thread, if it waits for new samples.
+*/
+static void AudioThreadSignal(void)
+{
+    // pairs with the fence in AudioThreadWait
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&AudioThreadWaiting, __ATOMIC_RELAXED)) {
+	AudioThreadWakeup(0);
+    }
+}
+
+#if defined(USE_ALSA) || defined(USE_OSS)
+
+/**
+**	Check if commands are queued for the audio thread.
+*/
+static int AudioCmdPending(void)
+{
+    return __atomic_load_n(&AudioCmdWrite, __ATOMIC_ACQUIRE) != AudioCmdRead;
+}
+
+/**
+**	Wait in audio thread for new samples or commands.
 **
-**	ffmpeg L  R  C	Ls Rs		-> alsa L R  Ls Rs C
-**	ffmpeg L  R  C	LFE Ls Rs	-> alsa L R  Ls Rs C  LFE
-**	ffmpeg L  R  C	LFE Ls Rs Rl Rr	-> alsa L R  Ls Rs C  LFE Rl Rr
+**	Used instead of sleeping, while the output waits for more samples.
 **
-**	@param in	input sample buffer
-**	@param in_chan	nr. of input channels
-**	@param frames	number of frames in sample buffer
-**	@param out	output sample buffer
-**	@param out_chan	nr. of output channels
+**	@param ms	max. time to wait in ms
 */
-static void AudioResample(const int16_t * in, int in_chan, int frames,
-    int16_t * out, int out_chan)
+static void AudioThreadWait(int ms)
 {
-    switch (in_chan * 8 + out_chan) {
-	case 1 * 8 + 1:
-	case 2 * 8 + 2:
-	case 3 * 8 + 3:
-	case 4 * 8 + 4:
-	case 5 * 8 + 5:
-	case 6 * 8 + 6:
-	case 7 * 8 + 7:
-	case 8 * 8 + 8:		// input = output channels
-	    memcpy(out, in, frames * in_chan * AudioBytesProSample);
-	    break;
-	case 2 * 8 + 1:
-	    AudioStereo2Mono(in, frames, out);
-	    break;
-	case 1 * 8 + 2:
-	    AudioMono2Stereo(in, frames, out);
-	    break;
-	case 3 * 8 + 2:
-	case 4 * 8 + 2:
-	case 5 * 8 + 2:
-	case 6 * 8 + 2:
-	case 7 * 8 + 2:
-	case 8 * 8 + 2:
-	    AudioSurround2Stereo(in, in_chan, frames, out);
-	    break;
-	case 5 * 8 + 6:
-	case 3 * 8 + 8:
-	case 5 * 8 + 8:
-	case 6 * 8 + 8:
-	    AudioUpmix(in, in_chan, frames, out, out_chan);
-	    break;
-
-	default:
-	    Error("audio: unsupported %d -> %d channels resample\n", in_chan,
-		out_chan);
-	    // play silence
-	    memset(out, 0, frames * out_chan * AudioBytesProSample);
+    struct timespec abstime;
+
+    clock_gettime(CLOCK_MONOTONIC, &abstime);
+    abstime.tv_nsec += ms * 1000 * 1000;
+    if (abstime.tv_nsec >= 1000 * 1000 * 1000) {
+	abstime.tv_sec++;
+	abstime.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    pthread_mutex_lock(&AudioMutex);
+    __atomic_store_n(&AudioThreadWaiting, 1, __ATOMIC_RELAXED);
+    // pairs with the fence in AudioThreadSignal
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!AudioThreadStop && !AudioCmdPending()
+	&& !RingBufferUsedBytes(AudioRing[AudioRingRead].RingBuffer)) {
+	if (pthread_cond_timedwait(&AudioStartCond, &AudioMutex,
+		&abstime) == ETIMEDOUT) {
 	    break;
+	}
     }
+    __atomic_store_n(&AudioThreadWaiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&AudioMutex);
 }
 
 #endif
 
-//----------------------------------------------------------------------------
-//	ring buffer
-//----------------------------------------------------------------------------
-
-#define AUDIO_RING_MAX 8		///< number of audio ring buffers
+/**
+**	Audio thread has handled commands.
+**
+**	@param serial	serial number of flush done, 0 no flush
+*/
+static void AudioCmdDone(unsigned serial)
+{
+    pthread_mutex_lock(&AudioMutex);
+    if (serial) {
+	AudioFlushDone = serial;
+    }
+    pthread_cond_broadcast(&AudioDoneCond);
+    pthread_mutex_unlock(&AudioMutex);
+}
 
 /**
-**	Audio ring buffer.
+**	Wait until the audio thread has handled commands.
+**
+**	@param serial	serial number of flush to wait for, 0 any command
+**	@param ms	max. time to wait in ms
 */
-typedef struct _audio_ring_ring_
+static void AudioCmdWait(unsigned serial, int ms)
 {
-    char FlushBuffers;			///< flag: flush buffers
-    char Passthrough;			///< flag: use pass-through (AC-3, ...)
-    int16_t PacketSize;			///< packet size
-    unsigned HwSampleRate;		///< hardware sample rate in Hz
-    unsigned HwChannels;		///< hardware number of channels
-    unsigned InSampleRate;		///< input sample rate in Hz
-    unsigned InChannels;		///< input number of channels
-    int64_t PTS;			///< pts clock
-    RingBuffer *RingBuffer;		///< sample ring buffer
-} AudioRingRing;
+    struct timespec abstime;
 
-    /// ring of audio ring buffers
-static AudioRingRing AudioRing[AUDIO_RING_MAX];
-static int AudioRingWrite;		///< audio ring write pointer
-static int AudioRingRead;		///< audio ring read pointer
-static atomic_t AudioRingFilled;	///< how many of the ring is used
-static unsigned AudioStartThreshold;	///< start play, if filled
+    clock_gettime(CLOCK_MONOTONIC, &abstime);
+    abstime.tv_nsec += ms * 1000 * 1000;
+    if (abstime.tv_nsec >= 1000 * 1000 * 1000) {
+	abstime.tv_sec++;
+	abstime.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    pthread_mutex_lock(&AudioMutex);
+    while (!serial || (int)(AudioFlushDone - serial) < 0) {
+	if (pthread_cond_timedwait(&AudioDoneCond, &AudioMutex,
+		&abstime) || !serial) {
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&AudioMutex);
+}
 
 /**
 **	Add sample-rate, number of channels change to ring.
@@ -678,14 +1506,16 @@ static int AudioRingAdd(unsigned sample_rate, int channels, int passthrough)
 	return -1;			// unsupported nr. of channels
     }
 
-    if (atomic_read(&AudioRingFilled) == AUDIO_RING_MAX) {	// no free slot
+    pthread_mutex_lock(&AudioCmdMutex);
+    // no free slot
+    if (atomic_read(&AudioRingFilled) == AUDIO_RING_MAX || AudioCmdFull()) {
+	pthread_mutex_unlock(&AudioCmdMutex);
 	// FIXME: can wait for ring buffer empty
 	Error(_("audio: out of ring buffers\n"));
 	return -1;
     }
     AudioRingWrite = (AudioRingWrite + 1) % AUDIO_RING_MAX;
 
-    AudioRing[AudioRingWrite].FlushBuffers = 0;
     AudioRing[AudioRingWrite].Passthrough = passthrough;
     AudioRing[AudioRingWrite].PacketSize = 0;
     AudioRing[AudioRingWrite].InSampleRate = sample_rate;
@@ -699,13 +1529,12 @@ static int AudioRingAdd(unsigned sample_rate, int channels, int passthrough)
 	atomic_read(&AudioRingFilled) + 1);
 
     atomic_inc(&AudioRingFilled);
+    AudioCmdPush(AudioCmdSegment, AudioRingWrite, 0);
+    pthread_mutex_unlock(&AudioCmdMutex);
 
 #ifdef USE_AUDIO_THREAD
-    if (AudioThread) {
-	// tell thread, that there is something todo
-	AudioRunning = 1;
-	pthread_cond_signal(&AudioStartCond);
-    }
+    // tell thread, that there is something todo
+    AudioThreadWakeup(1);
 #endif
 
     return 0;
@@ -720,7 +1549,7 @@ static void AudioRingInit(void)
 
     for (i = 0; i < AUDIO_RING_MAX; ++i) {
 	// ~2s 8ch 16bit
-	AudioRing[i].RingBuffer = RingBufferNew(AudioRingBufferSize);
+	AudioRing[i].RingBuffer = RingBufferNewMirrored(AudioRingBufferSize);
     }
     atomic_set(&AudioRingFilled, 0);
 }
@@ -739,9 +1568,14 @@ static void AudioRingExit(void)
 	}
 	AudioRing[i].HwSampleRate = 0;	// checked for valid setup
 	AudioRing[i].InSampleRate = 0;
+	atomic_set(&AudioRing[i].Skip, 0);
     }
     AudioRingRead = 0;
     AudioRingWrite = 0;
+    AudioCmdRead = 0;
+    AudioCmdWrite = 0;
+    AudioFlushSerial = 0;
+    AudioFlushDone = 0;
 }
 
 #ifdef USE_ALSA
@@ -756,7 +1590,7 @@ static void AudioRingExit(void)
 
 static snd_pcm_t *AlsaPCMHandle;	///< alsa pcm handle
 static char AlsaCanPause;		///< hw supports pause
-static int AlsaUseMmap;			///< use mmap
+static int AlsaUseMmap;			///< pcm uses mmap access
 
 static snd_mixer_t *AlsaMixer;		///< alsa mixer handle
 static snd_mixer_elem_t *AlsaMixerElem;	///< alsa pcm mixer element
@@ -766,6 +1600,71 @@ static int AlsaRatio;			///< internal -> mixer ratio * 1000
 //	alsa pcm
 //----------------------------------------------------------------------------
 
+/**
+**	Write samples directly into the alsa mmap area.
+**
+**	Software volume is applied while copying, the samples in the ring
+**	buffer are not modified.
+**
+**	@param p	samples
+**	@param frames	number of frames
+**	@param amplify	flag: apply software volume
+**
+**	@returns number of frames written or negative alsa error code.
+*/
+static snd_pcm_sframes_t AlsaMmapWrite(const void *p,
+    snd_pcm_uframes_t frames, int amplify)
+{
+    snd_pcm_sframes_t done;
+
+    done = 0;
+    while (frames > 0) {		// loop for mmap area wrap
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset;
+	snd_pcm_uframes_t n;
+	snd_pcm_sframes_t err;
+	ssize_t bytes;
+	void *dst;
+
+	n = frames;
+	if ((err = snd_pcm_mmap_begin(AlsaPCMHandle, &areas, &offset, &n)) < 0) {
+	    return done ? done : err;
+	}
+	if (!n) {
+	    break;
+	}
+	// interleaved: all channels share the first area
+	dst = (char *)areas[0].addr + (areas[0].first +
+	    offset * areas[0].step) / 8;
+	bytes = snd_pcm_frames_to_bytes(AlsaPCMHandle, n);
+	if (amplify) {
+	    AudioSoftAmplifier(p, dst, bytes);
+	} else {
+	    memcpy(dst, p, bytes);
+	}
+	err = snd_pcm_mmap_commit(AlsaPCMHandle, offset, n);
+	if (err < 0) {
+	    return done ? done : err;
+	}
+	done += err;
+	if ((snd_pcm_uframes_t) err != n) {
+	    break;
+	}
+	p = (const char *)p + bytes;
+	frames -= n;
+    }
+    // mmap commit doesn't start the stream like writei
+    if (done && snd_pcm_state(AlsaPCMHandle) == SND_PCM_STATE_PREPARED) {
+	int err;
+
+	if ((err = snd_pcm_start(AlsaPCMHandle)) < 0) {
+	    Error(_("audio/alsa: snd_pcm_start(): %s\n"), snd_strerror(err));
+	}
+    }
+
+    return done;
+}
+
 /**
 **	Play samples from ringbuffer.
 **
@@ -778,6 +1677,7 @@ static int AlsaRatio;			///< internal -> mixer ratio * 1000
 static int AlsaPlayRingbuffer(void)
 {
     int first;
+    int16_t buf[4096];
 
     first = 1;
     for (;;) {				// loop for ring buffer wrap
@@ -785,6 +1685,7 @@ static int AlsaPlayRingbuffer(void)
 	int n;
 	int err;
 	int frames;
+	int amplify;
 	const void *p;
 
 	// how many bytes can be written?
@@ -846,11 +1747,11 @@ static int AlsaPlayRingbuffer(void)
 	    break;
 	}
 	// muting pass-through AC-3, can produce disturbance
-	if (AudioMute || (AudioSoftVolume
-		&& !AudioRing[AudioRingRead].Passthrough)) {
-	    // FIXME: quick&dirty cast
-	    AudioSoftAmplifier((int16_t *) p, avail);
-	    // FIXME: if not all are written, we double amplify them
+	amplify = AudioMute || (AudioSoftVolume
+	    && !AudioRing[AudioRingRead].Passthrough);
+	if (amplify && !AlsaUseMmap && avail > (int)sizeof(buf)) {
+	    avail = snd_pcm_frames_to_bytes(AlsaPCMHandle,
+		snd_pcm_bytes_to_frames(AlsaPCMHandle, sizeof(buf)));
 	}
 	frames = snd_pcm_bytes_to_frames(AlsaPCMHandle, avail);
 #ifdef DEBUG
@@ -861,7 +1762,10 @@ static int AlsaPlayRingbuffer(void)
 
 	for (;;) {
 	    if (AlsaUseMmap) {
-		err = snd_pcm_mmap_writei(AlsaPCMHandle, p, frames);
+		err = AlsaMmapWrite(p, frames, amplify);
+	    } else if (amplify) {
+		AudioSoftAmplifier(p, buf, avail);
+		err = snd_pcm_writei(AlsaPCMHandle, buf, frames);
 	    } else {
 		err = snd_pcm_writei(AlsaPCMHandle, p, frames);
 	    }
@@ -981,7 +1885,7 @@ static int AlsaThread(void)
 	    return 0;
 	}
 
-	usleep(24 * 1000);		// let fill/empty the buffers
+	AudioThreadWait(24);		// let fill the buffers
     }
     return 1;
 }
@@ -1234,6 +2138,9 @@ static int AlsaSetup(int *freq, int *channels, int passthrough)
 	//Debug(3, "audio: %s ]\n", __FUNCTION__);
     }
 
+    // prefer mmap access, volume is applied while copying into the
+    // mmap area
+    AlsaUseMmap = !AudioAlsaNoMmap;
     for (;;) {
 	if ((err =
 		snd_pcm_set_params(AlsaPCMHandle, SND_PCM_FORMAT_S16,
@@ -1247,6 +2154,12 @@ static int AlsaSetup(int *freq, int *channels, int passthrough)
 			AlsaUseMmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED :
 			SND_PCM_ACCESS_RW_INTERLEAVED, *channels, *freq, 1,
 			72 * 1000))) {
+		if (AlsaUseMmap) {	// device has no mmap, try read/write
+		    Debug(3, "audio/alsa: mmap access failed: %s\n",
+			snd_strerror(err));
+		    AlsaUseMmap = 0;
+		    continue;
+		}
 
 		/*
 		   if ( err == -EBADFD ) {
@@ -1308,8 +2221,9 @@ static int AlsaSetup(int *freq, int *channels, int passthrough)
 	    buffer_size) * 1000 / (*freq * *channels * AudioBytesProSample),
 	period_size, snd_pcm_frames_to_bytes(AlsaPCMHandle,
 	    period_size) * 1000 / (*freq * *channels * AudioBytesProSample));
-    Debug(3, "audio/alsa: state %s\n",
-	snd_pcm_state_name(snd_pcm_state(AlsaPCMHandle)));
+    Debug(3, "audio/alsa: state %s, %s access\n",
+	snd_pcm_state_name(snd_pcm_state(AlsaPCMHandle)),
+	AlsaUseMmap ? "mmap" : "read/write");
 
     AudioStartThreshold = snd_pcm_frames_to_bytes(AlsaPCMHandle, period_size);
     // buffer time/delay in ms
@@ -1468,12 +2382,14 @@ static int OssFragmentTime;		///< fragment time in ms
 static int OssPlayRingbuffer(void)
 {
     int first;
+    int16_t buf[4096];
 
     first = 1;
     for (;;) {
 	audio_buf_info bi;
 	const void *p;
 	int n;
+	int amplify;
 
 	if (ioctl(OssPcmFildes, SNDCTL_DSP_GETOSPACE, &bi) == -1) {
 	    Error(_("audio/oss: ioctl(SNDCTL_DSP_GETOSPACE): %s\n"),
@@ -1496,10 +2412,15 @@ static int OssPlayRingbuffer(void)
 	    break;			// bi.bytes could become negative!
 	}
 
-	if (AudioSoftVolume && !AudioRing[AudioRingRead].Passthrough) {
-	    // FIXME: quick&dirty cast
-	    AudioSoftAmplifier((int16_t *) p, bi.bytes);
-	    // FIXME: if not all are written, we double amplify them
+	amplify = AudioSoftVolume && !AudioRing[AudioRingRead].Passthrough;
+	if (amplify) {			// amplify a copy, ring stays unmodified
+	    if (bi.bytes > (int)sizeof(buf)) {
+		bi.bytes = sizeof(buf) - sizeof(buf) %
+		    (AudioRing[AudioRingRead].HwChannels *
+		    AudioBytesProSample);
+	    }
+	    AudioSoftAmplifier(p, buf, bi.bytes);
+	    p = buf;
 	}
 	for (;;) {
 	    n = write(OssPcmFildes, p, bi.bytes);
@@ -1587,8 +2508,7 @@ static int OssThread(void)
 	if (err < 0) {			// underrun error
 	    return -1;
 	}
-	pthread_yield();
-	usleep(OssFragmentTime * 1000);	// let fill/empty the buffers
+	AudioThreadWait(OssFragmentTime);	// let fill the buffers
 	return 0;
     }
 
@@ -1918,35 +2838,150 @@ static void OssExit(void)
 	close(OssPcmFildes);
 	OssPcmFildes = -1;
     }
-    if (OssMixerFildes != -1) {
-	close(OssMixerFildes);
-	OssMixerFildes = -1;
+    if (OssMixerFildes != -1) {
+	close(OssMixerFildes);
+	OssMixerFildes = -1;
+    }
+}
+
+/**
+**	OSS module.
+*/
+static const AudioModule OssModule = {
+    .Name = "oss",
+#ifdef USE_AUDIO_THREAD
+    .Thread = OssThread,
+#endif
+    .FlushBuffers = OssFlushBuffers,
+    .GetDelay = OssGetDelay,
+    .SetVolume = OssSetVolume,
+    .Setup = OssSetup,
+    .Play = OssPlay,
+    .Pause = OssPause,
+    .Init = OssInit,
+    .Exit = OssExit,
+};
+
+#endif // USE_OSS
+
+//============================================================================
+//	Noop
+//============================================================================
+
+/**
+**	The noop module discards all samples.  As sink it plays into a
+**	virtual device, which runs with the sample rate (real time) or
+**	takes all samples at once (fast), so the audio clock works without
+**	a sound card.
+*/
+
+#define NOOP_BUFFER_TIME 80		///< ms buffered in virtual device
+#define NOOP_PERIOD_TIME 10		///< ms period of virtual device
+
+static uint64_t NoopWritten;		///< bytes written to virtual device
+static uint64_t NoopStartTime;		///< us start of virtual device
+
+/**
+**	Get the monotonic time in us.
+*/
+static uint64_t NoopTime(void)
+{
+    struct timespec tspec;
+
+    clock_gettime(CLOCK_MONOTONIC, &tspec);
+    return tspec.tv_sec * UINT64_C(1000000) + tspec.tv_nsec / 1000;
+}
+
+/**
+**	Get bytes buffered in the virtual device.
+**
+**	@param bytes_per_second	bytes played per second
+*/
+static uint64_t NoopBuffered(int bytes_per_second)
+{
+    uint64_t start;
+    uint64_t played;
+
+    if (!(start = NoopStartTime)) {
+	return 0;
+    }
+    played = ((NoopTime() - start) * bytes_per_second) / 1000000;
+    if (played >= NoopWritten) {	// virtual device run empty
+	return 0;
+    }
+    return NoopWritten - played;
+}
+
+/**
+**	Flush noop buffers.
+*/
+static void NoopFlushBuffers(void)
+{
+    NoopStartTime = 0;
+    NoopWritten = 0;
+}
+
+#ifdef USE_AUDIO_THREAD
+
+/**
+**	Noop thread, play samples into the virtual device.
+**
+**	@retval -1	error
+**	@retval 0	underrun
+**	@retval 1	running
+*/
+static int NoopThread(void)
+{
+    const void *p;
+    int frame_size;
+    int bytes_per_second;
+    int64_t room;
+    int n;
+
+    frame_size = AudioRing[AudioRingRead].HwChannels * AudioBytesProSample;
+    bytes_per_second = AudioRing[AudioRingRead].HwSampleRate * frame_size;
+    if (!AudioNoopSink || !bytes_per_second) {
+	usleep(NOOP_PERIOD_TIME * 1000);
+	return -1;
+    }
+    if (AudioPaused) {
+	usleep(NOOP_PERIOD_TIME * 1000);
+	return 1;
+    }
+
+    n = RingBufferGetReadPointer(AudioRing[AudioRingRead].RingBuffer, &p);
+    if (!n) {				// ring buffer empty
+	return 0;
+    }
+    if (AudioNoopSink > 1) {		// fast: take everything
+	RingBufferReadAdvance(AudioRing[AudioRingRead].RingBuffer, n);
+	return 1;
+    }
+
+    if (!NoopBuffered(bytes_per_second)) {	// restart the clock
+	NoopStartTime = 0;
+	NoopWritten = 0;
+    }
+    room = (NOOP_BUFFER_TIME * bytes_per_second) / 1000
+	- NoopBuffered(bytes_per_second);
+    room -= room % frame_size;
+    if (room <= 0) {			// virtual device full
+	usleep(NOOP_PERIOD_TIME * 1000);
+	return 1;
     }
+    if (n > room) {
+	n = room;
+    }
+    if (!NoopStartTime) {
+	NoopStartTime = NoopTime();
+    }
+    NoopWritten += n;
+    RingBufferReadAdvance(AudioRing[AudioRingRead].RingBuffer, n);
+
+    return 1;
 }
 
-/**
-**	OSS module.
-*/
-static const AudioModule OssModule = {
-    .Name = "oss",
-#ifdef USE_AUDIO_THREAD
-    .Thread = OssThread,
 #endif
-    .FlushBuffers = OssFlushBuffers,
-    .GetDelay = OssGetDelay,
-    .SetVolume = OssSetVolume,
-    .Setup = OssSetup,
-    .Play = OssPlay,
-    .Pause = OssPause,
-    .Init = OssInit,
-    .Exit = OssExit,
-};
-
-#endif // USE_OSS
-
-//============================================================================
-//	Noop
-//============================================================================
 
 /**
 **	Get audio delay in time stamps.
@@ -1955,7 +2990,15 @@ static const AudioModule OssModule = {
 */
 static int64_t NoopGetDelay(void)
 {
-    return 0L;
+    int bytes_per_second;
+
+    bytes_per_second = AudioRing[AudioRingRead].HwSampleRate *
+	AudioRing[AudioRingRead].HwChannels * AudioBytesProSample;
+    if (AudioNoopSink != 1 || !bytes_per_second) {
+	return 0L;
+    }
+    return ((int64_t) NoopBuffered(bytes_per_second) * 90 * 1000)
+	/ bytes_per_second;
 }
 
 /**
@@ -1974,12 +3017,19 @@ static void NoopSetVolume( __attribute__ ((unused))
 **	@param freq		sample frequency
 **	@param channels		number of channels
 **	@param passthrough	use pass-through (AC-3, ...) device
+**
+**	@retval 0	sink accepts every format
+**	@retval -1	no sink
 */
 static int NoopSetup( __attribute__ ((unused))
     int *channels, __attribute__ ((unused))
     int *freq, __attribute__ ((unused))
     int passthrough)
 {
+    if (AudioNoopSink) {
+	NoopFlushBuffers();
+	return 0;
+    }
     return -1;
 }
 
@@ -1995,7 +3045,10 @@ static void NoopVoid(void)
 */
 static const AudioModule NoopModule = {
     .Name = "noop",
-    .FlushBuffers = NoopVoid,
+#ifdef USE_AUDIO_THREAD
+    .Thread = NoopThread,
+#endif
+    .FlushBuffers = NoopFlushBuffers,
     .GetDelay = NoopGetDelay,
     .SetVolume = NoopSetVolume,
     .Setup = NoopSetup,
@@ -2009,6 +3062,30 @@ static const AudioModule NoopModule = {
 //	thread playback
 //----------------------------------------------------------------------------
 
+/**
+**	Get start threshold of an audio ring buffer.
+**
+**	With early start the audio starts, if more than the measured
+**	enqueue gap is buffered, otherwise with the configured buffer time.
+**
+**	@param ring	audio ring buffer index
+**
+**	@returns the number of bytes to buffer before start.
+*/
+static unsigned AudioGetStartThreshold(int ring)
+{
+    unsigned threshold;
+
+    if (!AudioEarlyStart || !AudioEnqueueGap) {
+	return AudioStartThreshold;
+    }
+    threshold =
+	(((AudioEnqueueGap >> AUDIO_GAP_SHIFT) + AUDIO_EARLY_MARGIN)
+	* AudioRing[ring].HwSampleRate / 1000) * AudioRing[ring].HwChannels *
+	AudioBytesProSample;
+    return threshold < AudioStartThreshold ? threshold : AudioStartThreshold;
+}
+
 #ifdef USE_AUDIO_THREAD
 
 /**
@@ -2053,7 +3130,7 @@ static int AudioNextRing(void)
     }
     if (remain <= AUDIO_MIN_BUFFER_FREE || ((AudioVideoIsReady
 		|| !SoftIsPlayingVideo)
-	    && AudioStartThreshold < used)) {
+	    && AudioGetStartThreshold(AudioRingRead) < used)) {
 	return 0;
     }
     return 1;
@@ -2077,10 +3154,12 @@ static void *AudioPlayHandlerThread(void *dummy)
 	Debug(3, "audio: wait on start condition\n");
 	pthread_mutex_lock(&AudioMutex);
 	AudioRunning = 0;
-	do {
+	// cond_wait can return, without signal!
+	// a flush queued before, doesn't need a wakeup
+	while (!AudioRunning && !AudioCmdFlushPending()) {
 	    pthread_cond_wait(&AudioStartCond, &AudioMutex);
-	    // cond_wait can return, without signal!
-	} while (!AudioRunning);
+	}
+	AudioRunning = 1;
 	pthread_mutex_unlock(&AudioMutex);
 
 	Debug(3, "audio: ----> %dms start\n", (AudioUsedBytes() * 1000)
@@ -2090,36 +3169,21 @@ static void *AudioPlayHandlerThread(void *dummy)
 		AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample));
 
 	do {
-	    int filled;
-	    int read;
+	    unsigned serial;
 	    int flush;
 	    int err;
-	    int i;
 
 	    // check if we should stop the thread
 	    if (AudioThreadStop) {
 		Debug(3, "audio: play thread stopped\n");
 		return PTHREAD_CANCELED;
 	    }
-	    // look if there is a flush command in the queue
-	    flush = 0;
-	    filled = atomic_read(&AudioRingFilled);
-	    read = AudioRingRead;
-	    i = filled;
-	    while (i--) {
-		read = (read + 1) % AUDIO_RING_MAX;
-		if (AudioRing[read].FlushBuffers) {
-		    AudioRing[read].FlushBuffers = 0;
-		    AudioRingRead = read;
-		    // handle all flush in queue
-		    flush = filled - i;
-		}
-	    }
-
-	    if (flush) {
+	    // handle play/pause and flush commands in the queue
+	    if ((flush = AudioCmdHandle(&serial))) {
 		Debug(3, "audio: flush %d ring buffer(s)\n", flush);
 		AudioUsedModule->FlushBuffers();
 		atomic_sub(flush, &AudioRingFilled);
+		AudioCmdDone(serial);
 		if (AudioNextRing()) {
 		    Debug(3, "audio: break after flush\n");
 		    break;
@@ -2131,8 +3195,16 @@ static void *AudioPlayHandlerThread(void *dummy)
 	    if (RingBufferUsedBytes(AudioRing[AudioRingRead].RingBuffer)) {
 		err = AudioUsedModule->Thread();
 	    }
+	    if (AudioRing[AudioRingRead].HwSampleRate) {
+		StatsSample(StatsAudioFill,
+		    (RingBufferUsedBytes(AudioRing[AudioRingRead].RingBuffer)
+			* 1000) / (AudioRing[AudioRingRead].HwSampleRate *
+			AudioRing[AudioRingRead].HwChannels *
+			AudioBytesProSample));
+	    }
 	    // underrun, check if new ring buffer is available
 	    if (!err) {
+		int ring;
 		int passthrough;
 		int sample_rate;
 		int channels;
@@ -2141,7 +3213,8 @@ static void *AudioPlayHandlerThread(void *dummy)
 		int old_channels;
 
 		// underrun, and no new ring buffer, goto sleep.
-		if (!atomic_read(&AudioRingFilled)) {
+		if ((ring = AudioCmdNextRing()) < 0) {
+		    StatsCount(StatsAudioUnderruns, 1);
 		    break;
 		}
 
@@ -2151,7 +3224,8 @@ static void *AudioPlayHandlerThread(void *dummy)
 		old_channels = AudioRing[AudioRingRead].HwChannels;
 
 		atomic_dec(&AudioRingFilled);
-		AudioRingRead = (AudioRingRead + 1) % AUDIO_RING_MAX;
+		AudioRingRead = ring;
+		AudioCmdDone(0);
 
 		passthrough = AudioRing[AudioRingRead].Passthrough;
 		sample_rate = AudioRing[AudioRingRead].HwSampleRate;
@@ -2171,7 +3245,6 @@ static void *AudioPlayHandlerThread(void *dummy)
 		    AudioResetNormalizer();
 		}
 	    }
-	    // FIXME: check AudioPaused ...Thread()
 	    if (AudioPaused) {
 		break;
 	    }
@@ -2185,9 +3258,16 @@ static void *AudioPlayHandlerThread(void *dummy)
 */
 static void AudioInitThread(void)
 {
+    pthread_condattr_t condattr;
+
     AudioThreadStop = 0;
     pthread_mutex_init(&AudioMutex, NULL);
-    pthread_cond_init(&AudioStartCond, NULL);
+    // timeouts are relative to the monotonic clock
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&AudioStartCond, &condattr);
+    pthread_cond_init(&AudioDoneCond, &condattr);
+    pthread_condattr_destroy(&condattr);
     pthread_create(&AudioThread, NULL, AudioPlayHandlerThread, NULL);
     pthread_setname_np(AudioThread, "softhddev audio");
 }
@@ -2203,11 +3283,11 @@ static void AudioExitThread(void)
 
     if (AudioThread) {
 	AudioThreadStop = 1;
-	AudioRunning = 1;		// wakeup thread, if needed
-	pthread_cond_signal(&AudioStartCond);
+	AudioThreadWakeup(1);		// wakeup thread, if needed
 	if (pthread_join(AudioThread, &retval) || retval != PTHREAD_CANCELED) {
 	    Error(_("audio: can't cancel play thread\n"));
 	}
+	pthread_cond_destroy(&AudioDoneCond);
 	pthread_cond_destroy(&AudioStartCond);
 	pthread_mutex_destroy(&AudioMutex);
 	AudioThread = 0;
@@ -2232,6 +3312,187 @@ static const AudioModule *AudioModules[] = {
     &NoopModule,
 };
 
+/**
+**	Measure the time between enqueued audio packets.
+**
+**	The max. gap depends on the muxing and bitrate of the stream, a
+**	fast attack slow decay filter keeps the max. of the last packets.
+**	The gap is fixed-point, the decay of 1/64 must not truncate to 0.
+*/
+static void AudioMeasureGap(void)
+{
+    uint32_t tick;
+    int gap;
+
+    tick = GetMsTicks();
+    gap = tick - AudioEnqueueTick;
+    if (!AudioEnqueueTick || gap > 1000) {	// first, pause
+	AudioEnqueueTick = tick ? tick : 1;
+	return;
+    }
+    AudioEnqueueTick = tick ? tick : 1;
+    gap <<= AUDIO_GAP_SHIFT;
+    if (gap > AudioEnqueueGap) {
+	AudioEnqueueGap = gap;
+    } else {
+	AudioEnqueueGap += (gap - AudioEnqueueGap) / 64;
+    }
+}
+
+/**
+**	Get used bytes of an audio ring buffer, without queued skips.
+**
+**	@param ring	audio ring buffer index
+*/
+static size_t AudioRingUsedBytes(int ring)
+{
+    size_t used;
+    int skip;
+
+    used = RingBufferUsedBytes(AudioRing[ring].RingBuffer);
+    skip = atomic_read(&AudioRing[ring].Skip);
+    return used > (size_t) skip ? used - skip : 0;
+}
+
+/**
+**	Skip bytes of the written audio ring buffer.
+**
+**	The audio thread is the only reader of the ring buffers, the skip
+**	is queued and done by the audio thread, before it plays the ring
+**	buffer.
+**
+**	@param skip	number of bytes to skip
+*/
+static void AudioRingSkip(int skip)
+{
+    if (skip <= 0) {
+	return;
+    }
+    pthread_mutex_lock(&AudioCmdMutex);
+    atomic_add(skip, &AudioRing[AudioRingWrite].Skip);
+    if (AudioCmdPush(AudioCmdSkip, AudioRingWrite, skip)) {
+	atomic_sub(skip, &AudioRing[AudioRingWrite].Skip);
+	Debug(3, "audio: command queue full, skip lost\n");
+    }
+    pthread_mutex_unlock(&AudioCmdMutex);
+}
+
+/**
+**	Early start: sync buffered audio to the running video.
+**
+**	The video is shown from its first frame on and runs free.  Audio
+**	older than the video clock is dropped, so the audio starts in sync
+**	and the rest is corrected by the resampler without a jump.
+**
+**	@param count	bytes written, but not yet added to the ring PTS
+**
+**	@returns true if the audio is in front of the video and must wait.
+*/
+static int AudioEarlySync(int count)
+{
+    int64_t video_clock;
+    int64_t audio_pts;
+    int64_t skip;
+    size_t used;
+    int bytes_per_second;
+
+    if (!AudioEarlyStart
+	|| AudioVideoStartPts == (int64_t) INT64_C(0x8000000000000000)
+	|| AudioRing[AudioRingWrite].PTS ==
+	(int64_t) INT64_C(0x8000000000000000)) {
+	return 0;
+    }
+    bytes_per_second =
+	AudioRing[AudioRingWrite].HwSampleRate *
+	AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample;
+    used = AudioRingUsedBytes(AudioRingWrite);
+    // time stamp of the first buffered sample
+    audio_pts =
+	AudioRing[AudioRingWrite].PTS + (((int64_t) count - (int64_t) used)
+	* 90 * 1000) / bytes_per_second;
+    video_clock = AudioVideoStartPts - VideoAudioDelay
+	+ (int64_t) (GetMsTicks() - AudioVideoStartTicks) * 90;
+
+    skip = video_clock - audio_pts;
+    if (skip < 0) {
+	return 1;
+    }
+    // guard against old PTS
+    if (skip >= 2000 * 90) {
+	return 0;
+    }
+    skip = ((skip * AudioRing[AudioRingWrite].HwSampleRate) / (1000 * 90))
+	* AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample;
+    if ((size_t) skip > used) {
+	skip = used;
+    }
+    if (skip) {
+	Debug(3, "audio: early start skip %dms\n",
+	    (int)(skip * 1000 / bytes_per_second));
+	AudioRingSkip(skip);
+    }
+    return 0;
+}
+
+/**
+**	Start audio thread and update audio clock after enqueue.
+**
+**	@param count	number of bytes placed in audio output queue
+*/
+static void AudioEnqueueUpdate(int count)
+{
+    size_t n;
+
+    if (AudioEarlyStart) {
+	AudioMeasureGap();
+    }
+    if (!AudioRunning) {		// check, if we can start the thread
+	int skip;
+	int wait;
+	size_t remain;
+
+	n = AudioRingUsedBytes(AudioRingWrite);
+	skip = AudioSkip;
+	// FIXME: round to packet size
+
+	Debug(3, "audio: start? %4zdms skip %dms\n", (n * 1000)
+	    / (AudioRing[AudioRingWrite].HwSampleRate *
+		AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample),
+	    (skip * 1000)
+	    / (AudioRing[AudioRingWrite].HwSampleRate *
+		AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample));
+
+	if (skip) {
+	    if (n < (unsigned)skip) {
+		skip = n;
+	    }
+	    AudioSkip -= skip;
+	    AudioRingSkip(skip);
+	}
+	wait = AudioEarlySync(count);
+	n = AudioRingUsedBytes(AudioRingWrite);
+	// forced start or enough video + audio buffered
+	remain = RingBufferFreeBytes(AudioRing[AudioRingRead].RingBuffer);
+	if (remain <= AUDIO_MIN_BUFFER_FREE) {
+	    Debug(3, "audio: force start\n");
+	}
+	if (remain <= AUDIO_MIN_BUFFER_FREE || ((AudioVideoIsReady
+		    || !SoftIsPlayingVideo) && !wait
+		&& AudioGetStartThreshold(AudioRingWrite) < n)) {
+	    // restart play-back
+	    AudioThreadWakeup(1);
+	}
+    } else if (count) {			// output waits for new samples?
+	AudioThreadSignal();
+    }
+    // Update audio clock (stupid gcc developers thinks INT64_C is unsigned)
+    if (AudioRing[AudioRingWrite].PTS != (int64_t) INT64_C(0x8000000000000000)) {
+	AudioRing[AudioRingWrite].PTS += ((int64_t) count * 90 * 1000)
+	    / (AudioRing[AudioRingWrite].HwSampleRate *
+	    AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample);
+    }
+}
+
 /**
 **	Place samples in audio output queue.
 **
@@ -2270,20 +3531,9 @@ void AudioEnqueue(const void *samples, int count)
 	    || AudioRing[AudioRingWrite].InChannels !=
 	    AudioRing[AudioRingWrite].HwChannels)) {
 	int frames;
+	void *p;
 
-	// resample into ring-buffer is too complex in the case of a roundabout
-	// just use a temporary buffer
-	frames =
-	    count / (AudioRing[AudioRingWrite].InChannels *
-	    AudioBytesProSample);
-	buffer =
-	    alloca(frames * AudioRing[AudioRingWrite].HwChannels *
-	    AudioBytesProSample);
-#ifdef USE_AUDIO_MIXER
-	// Convert / resample input to hardware format
-	AudioResample(samples, AudioRing[AudioRingWrite].InChannels, frames,
-	    buffer, AudioRing[AudioRingWrite].HwChannels);
-#else
+#ifndef USE_AUDIO_MIXER
 #ifdef DEBUG
 	if (AudioRing[AudioRingWrite].InChannels !=
 	    AudioRing[AudioRingWrite].HwChannels) {
@@ -2291,18 +3541,27 @@ void AudioEnqueue(const void *samples, int count)
 	    return;
 	}
 #endif
-	memcpy(buffer, samples, count);
 #endif
+	frames =
+	    count / (AudioRing[AudioRingWrite].InChannels *
+	    AudioBytesProSample);
 	count =
 	    frames * AudioRing[AudioRingWrite].HwChannels *
 	    AudioBytesProSample;
 
-	if (AudioCompression) {		// in place operation
-	    AudioCompressor(buffer, count);
-	}
-	if (AudioNormalize) {		// in place operation
-	    AudioNormalizer(buffer, count);
+	// convert / remix input to hardware format directly into the
+	// ring-buffer, in the case of a roundabout use a temporary buffer
+	if (RingBufferGetWritePointer(AudioRing[AudioRingWrite].RingBuffer,
+		&p) >= (size_t) count) {
+	    AudioDsp(samples, AudioRing[AudioRingWrite].InChannels, frames, p,
+		AudioRing[AudioRingWrite].HwChannels);
+	    RingBufferWriteAdvance(AudioRing[AudioRingWrite].RingBuffer, count);
+	    AudioEnqueueUpdate(count);
+	    return;
 	}
+	buffer = alloca(count);
+	AudioDsp(samples, AudioRing[AudioRingWrite].InChannels, frames, buffer,
+	    AudioRing[AudioRingWrite].HwChannels);
     }
 
     n = RingBufferWrite(AudioRing[AudioRingWrite].RingBuffer, buffer, count);
@@ -2314,49 +3573,59 @@ void AudioEnqueue(const void *samples, int count)
 	// FIXME: round to channel + sample border
     }
 
-    if (!AudioRunning) {		// check, if we can start the thread
-	int skip;
-	size_t remain;
+    AudioEnqueueUpdate(count);
+}
 
-	n = RingBufferUsedBytes(AudioRing[AudioRingWrite].RingBuffer);
-	skip = AudioSkip;
-	// FIXME: round to packet size
+/**
+**	Get buffer to place samples directly in audio output queue.
+**
+**	This avoids the copy of AudioEnqueue, it is only possible if the
+**	samples need no channel conversion.
+**
+**	@param[out] buf	write pointer into audio output ring buffer
+**
+**	@returns number of contiguous free bytes at write pointer, 0 if
+**	samples must be placed with AudioEnqueue.
+*/
+int AudioGetEnqueueBuffer(void **buf)
+{
+    if (!AudioRing[AudioRingWrite].HwSampleRate
+	|| AudioRing[AudioRingWrite].InChannels !=
+	AudioRing[AudioRingWrite].HwChannels) {
+	return 0;
+    }
+    return RingBufferGetWritePointer(AudioRing[AudioRingWrite].RingBuffer,
+	buf);
+}
 
-	Debug(3, "audio: start? %4zdms skip %dms\n", (n * 1000)
-	    / (AudioRing[AudioRingWrite].HwSampleRate *
-		AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample),
-	    (skip * 1000)
-	    / (AudioRing[AudioRingWrite].HwSampleRate *
-		AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample));
+/**
+**	Commit samples placed directly in audio output queue.
+**
+**	@param count	number of bytes placed into the buffer returned by
+**	AudioGetEnqueueBuffer
+*/
+void AudioEnqueueCommit(int count)
+{
+    void *p;
 
-	if (skip) {
-	    if (n < (unsigned)skip) {
-		skip = n;
-	    }
-	    AudioSkip -= skip;
-	    RingBufferReadAdvance(AudioRing[AudioRingWrite].RingBuffer, skip);
-	    n = RingBufferUsedBytes(AudioRing[AudioRingWrite].RingBuffer);
-	}
-	// forced start or enough video + audio buffered
-	remain = RingBufferFreeBytes(AudioRing[AudioRingRead].RingBuffer);
-	if (remain <= AUDIO_MIN_BUFFER_FREE) {
-	    Debug(3, "audio: force start\n");
-	}
-	if (remain <= AUDIO_MIN_BUFFER_FREE || ((AudioVideoIsReady
-		    || !SoftIsPlayingVideo)
-		&& AudioStartThreshold < n)) {
-	    // restart play-back
-	    // no lock needed, can wakeup next time
-	    AudioRunning = 1;
-	    pthread_cond_signal(&AudioStartCond);
-	}
+    if (!count) {
+	return;
     }
-    // Update audio clock (stupid gcc developers thinks INT64_C is unsigned)
-    if (AudioRing[AudioRingWrite].PTS != (int64_t) INT64_C(0x8000000000000000)) {
-	AudioRing[AudioRingWrite].PTS += ((int64_t) count * 90 * 1000)
-	    / (AudioRing[AudioRingWrite].HwSampleRate *
-	    AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample);
+    // save packet size
+    if (!AudioRing[AudioRingWrite].PacketSize) {
+	AudioRing[AudioRingWrite].PacketSize = count;
+	Debug(3, "audio: a/v packet size %d bytes\n", count);
+    }
+    RingBufferGetWritePointer(AudioRing[AudioRingWrite].RingBuffer, &p);
+    if (!AudioRing[AudioRingWrite].Passthrough && (AudioCompression
+	    || AudioNormalize)) {	// in place operation
+	AudioDsp(p, AudioRing[AudioRingWrite].HwChannels,
+	    count / (AudioRing[AudioRingWrite].HwChannels *
+		AudioBytesProSample), p, AudioRing[AudioRingWrite].HwChannels);
     }
+    RingBufferWriteAdvance(AudioRing[AudioRingWrite].RingBuffer, count);
+
+    AudioEnqueueUpdate(count);
 }
 
 /**
@@ -2373,6 +3642,8 @@ void AudioVideoReady(int64_t pts)
 	Debug(3, "audio: a/v start, no valid video\n");
 	return;
     }
+    AudioVideoStartPts = pts;
+    AudioVideoStartTicks = GetMsTicks();
     // no valid audio known
     if (!AudioRing[AudioRingWrite].HwSampleRate
 	|| !AudioRing[AudioRingWrite].HwChannels
@@ -2384,7 +3655,7 @@ void AudioVideoReady(int64_t pts)
     }
     // Audio.PTS = next written sample time stamp
 
-    used = RingBufferUsedBytes(AudioRing[AudioRingWrite].RingBuffer);
+    used = AudioRingUsedBytes(AudioRingWrite);
     audio_pts =
 	AudioRing[AudioRingWrite].PTS -
 	(used * 90 * 1000) / (AudioRing[AudioRingWrite].HwSampleRate *
@@ -2397,7 +3668,14 @@ void AudioVideoReady(int64_t pts)
 	Timestamp2String(pts), Timestamp2String(audio_pts),
 	(int)(pts - audio_pts) / 90, AudioRunning ? "running" : "ready");
 
-    if (!AudioRunning) {
+    if (!AudioRunning && AudioEarlyStart) {
+	// video runs free, start audio at the video clock
+	if (!AudioEarlySync(0)
+	    && AudioGetStartThreshold(AudioRingWrite) <
+	    AudioRingUsedBytes(AudioRingWrite)) {
+	    AudioThreadWakeup(1);
+	}
+    } else if (!AudioRunning) {
 	int skip;
 
 	// buffer ~15 video frames
@@ -2423,16 +3701,15 @@ void AudioVideoReady(int64_t pts)
 		AudioSkip = skip - used;
 		skip = used;
 	    }
-	    RingBufferReadAdvance(AudioRing[AudioRingWrite].RingBuffer, skip);
+	    AudioRingSkip(skip);
 
-	    used = RingBufferUsedBytes(AudioRing[AudioRingWrite].RingBuffer);
+	    used = AudioRingUsedBytes(AudioRingWrite);
 	}
 	// FIXME: skip<0 we need bigger audio buffer
 
 	// enough video + audio buffered
 	if (AudioStartThreshold < used) {
-	    AudioRunning = 1;
-	    pthread_cond_signal(&AudioStartCond);
+	    AudioThreadWakeup(1);
 	}
     }
 
@@ -2486,26 +3763,25 @@ void AudioFlushBuffers(void)
 {
     int old;
     int i;
-
-    if (atomic_read(&AudioRingFilled) >= AUDIO_RING_MAX) {
-	// wait for space in ring buffer, should never happen
-	for (i = 0; i < 24 * 2; ++i) {
-	    if (atomic_read(&AudioRingFilled) < AUDIO_RING_MAX) {
-		break;
-	    }
-	    Debug(3, "audio: flush out of ring buffers\n");
-	    usleep(1 * 1000);		// avoid hot polling
-	}
-	if (atomic_read(&AudioRingFilled) >= AUDIO_RING_MAX) {
+    unsigned serial;
+
+    pthread_mutex_lock(&AudioCmdMutex);
+    // wait for space in ring buffer, should never happen
+    for (i = 0; atomic_read(&AudioRingFilled) >= AUDIO_RING_MAX
+	|| AudioCmdFull(); ++i) {
+	if (i == 24 * 2 || !AudioThread) {
+	    pthread_mutex_unlock(&AudioCmdMutex);
 	    // FIXME: We can set the flush flag in the last wrote ring buffer
 	    Error(_("audio: flush out of ring buffers\n"));
 	    return;
 	}
+	Debug(3, "audio: flush out of ring buffers\n");
+	AudioThreadWakeup(1);
+	AudioCmdWait(0, 1);
     }
 
     old = AudioRingWrite;
     AudioRingWrite = (AudioRingWrite + 1) % AUDIO_RING_MAX;
-    AudioRing[AudioRingWrite].FlushBuffers = 1;
     AudioRing[AudioRingWrite].Passthrough = AudioRing[old].Passthrough;
     AudioRing[AudioRingWrite].HwSampleRate = AudioRing[old].HwSampleRate;
     AudioRing[AudioRingWrite].HwChannels = AudioRing[old].HwChannels;
@@ -2516,23 +3792,27 @@ void AudioFlushBuffers(void)
 	RingBufferUsedBytes(AudioRing[AudioRingWrite].RingBuffer));
     Debug(3, "audio: reset video ready\n");
     AudioVideoIsReady = 0;
+    AudioVideoStartPts = INT64_C(0x8000000000000000);
     AudioSkip = 0;
+    // the new stream can have another muxing
+    AudioEnqueueTick = 0;
+    AudioEnqueueGap = 0;
 
     atomic_inc(&AudioRingFilled);
+    serial = ++AudioFlushSerial;
+    if (!serial) {			// 0 is no flush
+	serial = ++AudioFlushSerial;
+    }
+    AudioCmdPush(AudioCmdFlush, AudioRingWrite, serial);
+    pthread_mutex_unlock(&AudioCmdMutex);
 
-    // FIXME: wait for flush complete needed?
-    for (i = 0; i < 24 * 2; ++i) {
-	if (!AudioRunning) {		// wakeup thread to flush buffers
-	    AudioRunning = 1;
-	    pthread_cond_signal(&AudioStartCond);
-	}
-	// FIXME: waiting on zero isn't correct, but currently works
-	if (!atomic_read(&AudioRingFilled)) {
-	    break;
-	}
-	usleep(1 * 1000);		// avoid hot polling
+    // wakeup thread to flush buffers and wait until done
+    if (AudioThread) {
+	AudioThreadWakeup(1);
+	AudioCmdWait(serial, 24 * 2);
+	Debug(3, "audio: audio flush %s\n",
+	    (int)(AudioFlushDone - serial) >= 0 ? "done" : "timeout");
     }
-    Debug(3, "audio: audio flush %dms\n", i);
 }
 
 /**
@@ -2680,17 +3960,43 @@ int AudioSetup(int *freq, int *channels, int passthrough)
     return AudioRingAdd(*freq, *channels, passthrough);
 }
 
+/**
+**	Send play/pause command to audio thread.
+**
+**	@param type	AudioCmdPlay or AudioCmdPause
+*/
+static void AudioSendCmd(AudioCmdType type)
+{
+    int i;
+
+    if (!AudioThread) {
+	AudioPaused = type == AudioCmdPause;
+	return;
+    }
+    pthread_mutex_lock(&AudioCmdMutex);
+    for (i = 0; AudioCmdPush(type, 0, 0); ++i) {
+	if (i == 24 * 2) {
+	    Error(_("audio: command queue full\n"));
+	    break;
+	}
+	AudioCmdWait(0, 1);
+    }
+    pthread_mutex_unlock(&AudioCmdMutex);
+    AudioThreadSignal();
+}
+
 /**
 **	Play audio.
 */
 void AudioPlay(void)
 {
-    if (!AudioPaused) {
+    if (!AudioPauseRequested) {
 	Debug(3, "audio: not paused, check the code\n");
 	return;
     }
     Debug(3, "audio: resumed\n");
-    AudioPaused = 0;
+    AudioPauseRequested = 0;
+    AudioSendCmd(AudioCmdPlay);
     AudioEnqueue(NULL, 0);		// wakeup thread
 }
 
@@ -2699,12 +4005,13 @@ void AudioPlay(void)
 */
 void AudioPause(void)
 {
-    if (AudioPaused) {
+    if (AudioPauseRequested) {
 	Debug(3, "audio: already paused, check the code\n");
 	return;
     }
     Debug(3, "audio: paused\n");
-    AudioPaused = 1;
+    AudioPauseRequested = 1;
+    AudioSendCmd(AudioCmdPause);
 }
 
 /**
@@ -2723,6 +4030,20 @@ void AudioSetBufferTime(int delay)
     AudioBufferTime = delay;
 }
 
+/**
+**	Set early start of audio at the running video.
+**
+**	The video is shown without waiting for audio, the audio starts
+**	in sync with the running video.  The start threshold follows the
+**	measured gap between the audio packets.
+**
+**	@param onoff	enable / disable the early start
+*/
+void AudioSetEarlyStart(int onoff)
+{
+    AudioEarlyStart = onoff;
+}
+
 /**
 **	Enable/disable software volume.
 **
@@ -3044,6 +4365,7 @@ void AudioExit(void)
     AudioRingExit();
     AudioRunning = 0;
     AudioPaused = 0;
+    AudioPauseRequested = 0;
 }
 
 #ifdef AUDIO_TEST
@@ -28,6 +28,8 @@
 //----------------------------------------------------------------------------
 
 extern void AudioEnqueue(const void *, int);	///< buffer audio samples
+extern int AudioGetEnqueueBuffer(void **);	///< get direct sample buffer
+extern void AudioEnqueueCommit(int);	///< commit direct audio samples
 extern void AudioFlushBuffers(void);	///< flush audio buffers
 extern void AudioPoller(void);		///< poll audio events/handling
 extern int AudioFreeBytes(void);	///< free bytes in audio output
@@ -42,6 +44,7 @@ extern void AudioPlay(void);		///< play audio
 extern void AudioPause(void);		///< pause audio
 
 extern void AudioSetBufferTime(int);	///< set audio buffer time
+extern void AudioSetEarlyStart(int);	///< set early start at video
 extern void AudioSetSoftvol(int);	///< enable/disable softvol
 extern void AudioSetNormalize(int, int);	///< set normalize parameters
 extern void AudioSetCompression(int, int);	///< set compression parameters
@@ -63,5 +66,7 @@ extern void AudioExit(void);		///< cleanup and exit audio module
 extern char AudioAlsaDriverBroken;	///< disable broken driver message
 extern char AudioAlsaNoCloseOpen;	///< disable alsa close/open fix
 extern char AudioAlsaCloseOpenDelay;	///< enable alsa close/open delay fix
+extern char AudioAlsaNoMmap;		///< disable alsa mmap access
+extern char AudioNoopSink;		///< noop plays: 1 real time, 2 fast
 
 /// @}
@@ -0,0 +1,639 @@
+///
+///	@file avsync.c	@brief Audio/video sync module
+///
+///	Copyright (c) 2014 by Johns.  All Rights Reserved.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+///
+///	@defgroup AvSync The audio/video sync module.
+///
+///	Estimates the difference between the video and the audio clock
+///	and its drift with a kalman filter.  The video output module feeds
+///	the measured difference of each displayed frame.
+///
+///	The drift and small differences are corrected by a PLL, which
+///	speeds up or slows down the audio resampler by a few ppm.  Only if
+///	the audio can't be resampled (pass-through) or the difference is
+///	too big, frames are duplicated or dropped.
+///
+///	A 50 Hz stream on a 50.0x Hz display drifts some 100 ppm, which
+///	was corrected by a duplicated frame each few minutes before.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+
+#include <libintl.h>
+#define _(str) gettext(str)		///< gettext shortcut
+#define _N(str) str			///< gettext_noop shortcut
+
+#include "misc.h"
+#include "avsync.h"
+
+//----------------------------------------------------------------------------
+//	Defines
+//----------------------------------------------------------------------------
+
+#define AVSYNC_LOST (5000 * 90)		///< difference too big (5s)
+#define AVSYNC_DUP (55 * 90)		///< duplicate frame difference
+#define AVSYNC_DROP (-25 * 90)		///< drop frame difference
+#define AVSYNC_GATE (100 * 90)		///< measurement is a jump
+#define AVSYNC_JUMP 3			///< jumps until filter restarts
+
+#define AVSYNC_MAX_PPM 1000		///< maximal audio correction
+#define AVSYNC_SLEW_PPM 2		///< maximal correction change a frame
+#define AVSYNC_TAU 500			///< pll time constant in frames
+
+#define AVSYNC_NOISE (3.0 * 90)		///< measurement noise
+#define AVSYNC_DIFF_NOISE 1.0		///< difference process noise
+#define AVSYNC_DRIFT_NOISE 1e-7		///< drift process noise
+
+#define AVSYNC_PCR_WINDOW (10 * 1000 * 1000)	///< pcr window (10s in us)
+#define AVSYNC_PCR_JUMP (1000 * 1000)	///< pcr jump (1s in us)
+
+//----------------------------------------------------------------------------
+//	Variables
+//----------------------------------------------------------------------------
+
+///
+///	Audio/video sync.
+///
+///	All times are in 1/90 ms.
+///
+struct _av_sync_
+{
+    int Valid;				///< flag: filter is running
+    int Jumps;				///< number of gated measurements
+    int Hold;				///< frames to wait for next action
+    double Diff;			///< estimated video - audio difference
+    double Drift;			///< estimated drift each frame
+    double P[2][2];			///< estimate covariance
+    double Duration;			///< estimated frame duration
+    int64_t LastVideo;			///< video clock of last update
+    int AudioPpm;			///< audio correction of this sync
+};
+
+    /// sync which drives the audio speed, the main video stream
+static AvSync *AvSyncAudio;
+
+    /// audio speed correction in ppm, positive plays faster
+static volatile int AvSyncAudioPpm;
+
+    /// flag: audio resampler applies the correction
+static volatile char AvSyncAudioResample;
+
+///
+///	Program clock reference recovery of the live stream.
+///
+///	The stream clock runs with the clock of the broadcaster.  The
+///	smallest offset to the local clock of each window, the packet
+///	with the least delay, gives the drift between both clocks.
+///
+static struct _av_sync_pcr_
+{
+    int Valid;				///< flag: pcr received
+    int Windows;			///< finished windows since restart
+    int64_t Pcr;			///< last program clock reference (27MHz)
+    uint32_t Ticks;			///< local clock of last pcr (us)
+    int64_t Stream;			///< stream time since restart (27MHz)
+    int64_t Local;			///< local time since restart (us)
+    int64_t WindowEnd;			///< local time of window end (us)
+    int64_t Min;			///< smallest offset of the window (us)
+    int64_t FirstMin;			///< smallest offset of first window
+    int64_t FirstTime;			///< local time of first window end
+} AvSyncPcrClock;
+
+    /// drift of the stream clock in ppm, positive runs faster
+static volatile int AvSyncPcrPpm;
+
+//----------------------------------------------------------------------------
+//	Filter
+//----------------------------------------------------------------------------
+
+///
+///	Start the filter with a measurement.
+///
+///	@param sync	audio/video sync
+///	@param diff	measured video - audio difference
+///
+static void AvSyncStart(AvSync * sync, double diff)
+{
+    sync->Valid = 1;
+    sync->Jumps = 0;
+    sync->Diff = diff;			// drift is kept, clocks didn't change
+    sync->P[0][0] = AVSYNC_NOISE * AVSYNC_NOISE;
+    sync->P[0][1] = 0.0;
+    sync->P[1][0] = 0.0;
+    sync->P[1][1] = 1.0;		// 1/90 ms a frame, 5% at 50 Hz
+}
+
+///
+///	Kalman filter step.
+///
+///	State is the difference and the drift of the difference each
+///	frame.  The known audio correction is the control input.
+///
+///	@param sync	audio/video sync
+///	@param diff	measured video - audio difference
+///	@param control	known change of the difference this frame
+///
+///	@returns false if the measurement was gated.
+///
+static int AvSyncFilter(AvSync * sync, double diff, double control)
+{
+    double p00;
+    double p01;
+    double p10;
+    double p11;
+    double s;
+    double k0;
+    double k1;
+    double y;
+
+    // predict: x = F x + u, P = F P F' + Q
+    sync->Diff += sync->Drift + control;
+    p00 = sync->P[0][0] + sync->P[0][1] + sync->P[1][0] + sync->P[1][1]
+	+ AVSYNC_DIFF_NOISE;
+    p01 = sync->P[0][1] + sync->P[1][1];
+    p10 = sync->P[1][0] + sync->P[1][1];
+    p11 = sync->P[1][1] + AVSYNC_DRIFT_NOISE;
+
+    y = diff - sync->Diff;
+    if (fabs(y) > AVSYNC_GATE) {	// jump or outlier
+	sync->P[0][0] = p00;
+	sync->P[0][1] = p01;
+	sync->P[1][0] = p10;
+	sync->P[1][1] = p11;
+	return 0;
+    }
+    // update: K = P H' / (H P H' + R), x += K y, P = (I - K H) P
+    s = p00 + AVSYNC_NOISE * AVSYNC_NOISE;
+    k0 = p00 / s;
+    k1 = p10 / s;
+    sync->Diff += k0 * y;
+    sync->Drift += k1 * y;
+    sync->P[0][0] = (1.0 - k0) * p00;
+    sync->P[0][1] = (1.0 - k0) * p01;
+    sync->P[1][0] = p10 - k1 * p00;
+    sync->P[1][1] = p11 - k1 * p01;
+
+    return 1;
+}
+
+//----------------------------------------------------------------------------
+//	Sync
+//----------------------------------------------------------------------------
+
+///
+///	Update audio/video sync with the clock difference of a frame.
+///
+///	Called once for each displayed frame or field.
+///
+///	@param sync	audio/video sync
+///	@param diff	video - audio clock difference (1/90 ms)
+///	@param video_clock	video clock of the frame
+///	@param can_drop	flag: enough frames are buffered to drop one
+///
+///	@returns the needed frame action.
+///
+AvSyncAction AvSyncUpdate(AvSync * sync, int64_t diff, int64_t video_clock,
+    int can_drop)
+{
+    double control;
+    double ppm;
+    int64_t delta;
+    int resample;
+
+    if (llabs(diff) > AVSYNC_LOST) {
+	AvSyncReset(sync);
+	return AvSyncLost;
+    }
+    // frame duration, skip frames around duplicated or dropped frames
+    delta = video_clock - sync->LastVideo;
+    sync->LastVideo = video_clock;
+    if (!sync->Hold && delta >= 10 * 90 && delta <= 50 * 90) {
+	sync->Duration += (delta - sync->Duration) / 64.0;
+    }
+
+    // only the audio sync stream can change the audio speed
+    resample = AvSyncAudioResample && sync == AvSyncAudio;
+    if (!sync->Valid) {
+	AvSyncStart(sync, diff);
+    } else {
+	// faster audio reduces the difference
+	control = resample ? -sync->AudioPpm * sync->Duration / 1e6 : 0.0;
+	if (AvSyncFilter(sync, diff, control)) {
+	    sync->Jumps = 0;
+	} else if (++sync->Jumps >= AVSYNC_JUMP) {
+	    Debug(3, "avsync: jump %+" PRId64 "ms\n", diff / 90);
+	    AvSyncStart(sync, diff);
+	}
+    }
+
+    // pll: cancel the drift and pull the difference to zero
+    if (resample) {
+	ppm = (sync->Drift + sync->Diff / AVSYNC_TAU) * 1e6 / sync->Duration;
+	if (ppm > sync->AudioPpm + AVSYNC_SLEW_PPM) {
+	    ppm = sync->AudioPpm + AVSYNC_SLEW_PPM;
+	} else if (ppm < sync->AudioPpm - AVSYNC_SLEW_PPM) {
+	    ppm = sync->AudioPpm - AVSYNC_SLEW_PPM;
+	}
+	if (ppm > AVSYNC_MAX_PPM) {
+	    ppm = AVSYNC_MAX_PPM;
+	} else if (ppm < -AVSYNC_MAX_PPM) {
+	    ppm = -AVSYNC_MAX_PPM;
+	}
+	sync->AudioPpm = lrint(ppm);
+    } else {
+	sync->AudioPpm = 0;
+    }
+    if (sync == AvSyncAudio) {
+	AvSyncAudioPpm = sync->AudioPpm;
+    }
+
+    if (sync->Hold) {
+	--sync->Hold;
+	return AvSyncNone;
+    }
+    // last resort: the difference is too big for the pll
+    if (sync->Diff > AVSYNC_DUP) {
+	sync->Diff -= sync->Duration;
+	sync->Hold = 1;
+	return AvSyncDup;
+    }
+    if (sync->Diff < AVSYNC_DROP && can_drop) {
+	sync->Diff += sync->Duration;
+	sync->Hold = 1;
+	return AvSyncDrop;
+    }
+    return AvSyncNone;
+}
+
+///
+///	Get filtered audio/video difference.
+///
+///	@param sync	audio/video sync
+///
+///	@returns filtered video - audio difference in 1/90 ms.
+///
+int AvSyncGetDiff(const AvSync * sync)
+{
+    return sync->Diff;
+}
+
+///
+///	Get audio speed correction for the resampler.
+///
+///	Called by the audio decoder for each packet.
+///
+///	@param resample	flag: audio can be resampled
+///
+///	@returns audio speed correction in ppm, positive plays faster.
+///
+int AvSyncAudioCorrection(int resample)
+{
+    AvSyncAudioResample = resample;
+    return resample ? AvSyncAudioPpm : 0;
+}
+
+///
+///	Restart program clock reference recovery.
+///
+///	@param pcr	program clock reference (27MHz)
+///	@param ticks	local clock of pcr (us)
+///
+static void AvSyncPcrRestart(int64_t pcr, uint32_t ticks)
+{
+    AvSyncPcrClock.Valid = 1;
+    AvSyncPcrClock.Windows = 0;
+    AvSyncPcrClock.Pcr = pcr;
+    AvSyncPcrClock.Ticks = ticks;
+    AvSyncPcrClock.Stream = 0;
+    AvSyncPcrClock.Local = 0;
+    AvSyncPcrClock.WindowEnd = AVSYNC_PCR_WINDOW;
+    AvSyncPcrClock.Min = INT64_MAX;
+    AvSyncPcrPpm = 0;
+}
+
+///
+///	Update program clock reference of the live stream.
+///
+///	Called by the transport stream demuxer for each PCR of the main
+///	video stream.
+///
+///	@param pcr	program clock reference (27MHz)
+///	@param discontinuity	flag: discontinuity indicator is set
+///
+void AvSyncPcr(int64_t pcr, int discontinuity)
+{
+    uint32_t ticks;
+    int64_t delta;
+    int64_t local;
+    int64_t offset;
+
+    ticks = GetUsTicks();
+    delta = pcr - AvSyncPcrClock.Pcr;
+    if (AvSyncPcrClock.Valid && !discontinuity && !delta) {
+	return;				// same packet again
+    }
+    local = (uint32_t) (ticks - AvSyncPcrClock.Ticks);
+    // discontinuity, wrap around, replay jump or pause
+    if (!AvSyncPcrClock.Valid || discontinuity || delta < 0
+	|| llabs(local - delta / 27) > AVSYNC_PCR_JUMP) {
+	Debug(4, "avsync: pcr restart\n");
+	AvSyncPcrRestart(pcr, ticks);
+	return;
+    }
+    AvSyncPcrClock.Pcr = pcr;
+    AvSyncPcrClock.Ticks = ticks;
+    AvSyncPcrClock.Stream += delta;
+    AvSyncPcrClock.Local += local;
+
+    offset = AvSyncPcrClock.Local - AvSyncPcrClock.Stream / 27;
+    if (offset < AvSyncPcrClock.Min) {
+	AvSyncPcrClock.Min = offset;
+    }
+    if (AvSyncPcrClock.Local < AvSyncPcrClock.WindowEnd) {
+	return;
+    }
+    if (!AvSyncPcrClock.Windows++) {
+	AvSyncPcrClock.FirstMin = AvSyncPcrClock.Min;
+	AvSyncPcrClock.FirstTime = AvSyncPcrClock.Local;
+    } else {
+	// faster stream clock reduces the offset
+	AvSyncPcrPpm = (AvSyncPcrClock.FirstMin - AvSyncPcrClock.Min)
+	    * 1000000 / (AvSyncPcrClock.Local - AvSyncPcrClock.FirstTime);
+	Debug(4, "avsync: pcr drift %+dppm\n", AvSyncPcrPpm);
+    }
+    AvSyncPcrClock.Min = INT64_MAX;
+    AvSyncPcrClock.WindowEnd = AvSyncPcrClock.Local + AVSYNC_PCR_WINDOW;
+}
+
+///
+///	Get drift of the stream clock against the local clock.
+///
+///	@returns drift recovered from the program clock reference in ppm,
+///	positive if the stream clock runs faster, 0 if unknown.
+///
+int AvSyncGetPcrDrift(void)
+{
+    return AvSyncPcrPpm;
+}
+
+///
+///	Reset audio/video sync at start of new stream.
+///
+///	@param sync	audio/video sync
+///
+void AvSyncReset(AvSync * sync)
+{
+    sync->Valid = 0;
+    sync->Jumps = 0;
+    sync->Hold = 0;
+    sync->Diff = 0.0;
+    sync->Drift = 0.0;
+    sync->Duration = 20 * 90;
+    sync->LastVideo = 0;
+    sync->AudioPpm = 0;
+    if (sync == AvSyncAudio) {
+	AvSyncAudioPpm = 0;
+    }
+}
+
+///
+///	Create new audio/video sync.
+///
+///	The sync of the main video stream drives the audio speed
+///	correction, PIP syncs only dup or drop frames.
+///
+///	@param role	main video or PIP
+///
+///	@returns new audio/video sync, NULL if out of memory.
+///
+AvSync *AvSyncNew(AvSyncRole role)
+{
+    AvSync *sync;
+
+    if (!(sync = calloc(1, sizeof(*sync)))) {
+	Error(_("avsync: out of memory\n"));
+	return NULL;
+    }
+    AvSyncReset(sync);
+    if (role == AvSyncMain) {
+	AvSyncAudio = sync;
+	AvSyncAudioPpm = 0;
+    }
+    return sync;
+}
+
+///
+///	Free audio/video sync.
+///
+///	@param sync	audio/video sync
+///
+void AvSyncDel(AvSync * sync)
+{
+    if (sync == AvSyncAudio) {
+	AvSyncAudio = NULL;
+	AvSyncAudioPpm = 0;
+    }
+    free(sync);
+}
+
+#ifdef AVSYNC_TEST
+
+//----------------------------------------------------------------------------
+//	Simulation
+//----------------------------------------------------------------------------
+
+#include <getopt.h>
+
+int LogLevel;				///< required
+
+///
+///	Uniform random number.
+///
+///	@returns random number between -1 and 1.
+///
+static double AvSyncTestRandom(void)
+{
+    return 2.0 * rand() / RAND_MAX - 1.0;
+}
+
+///
+///	Simulate a stream displayed with a slightly wrong refresh rate.
+///
+///	The video advances one frame each display refresh, the audio plays
+///	with the wall clock and the requested speed correction.  The old
+///	sync with fixed thresholds and a two sample average is simulated
+///	for comparison.
+///
+///	@param refresh	display refresh rate in Hz
+///	@param resample	flag: audio can be resampled
+///	@param noise	measurement noise in ms
+///	@param seconds	simulated time
+///	@param old	flag: use old threshold sync
+///
+static void AvSyncSimulate(double refresh, int resample, double noise,
+    int seconds, int old)
+{
+    AvSync *sync;
+    double video;
+    double audio;
+    double max_diff;
+    double sum_diff;
+    int frames;
+    int dup;
+    int drop;
+    int counter;
+    int last;
+    int i;
+    int ppm;
+    int delay[20];
+
+    sync = AvSyncNew(AvSyncMain);
+    memset(delay, 0, sizeof(delay));
+    video = 40 * 90;			// start with video before audio
+    audio = 0;
+    max_diff = 0.0;
+    sum_diff = 0.0;
+    dup = 0;
+    drop = 0;
+    counter = 0;
+    last = 0;
+    ppm = 0;
+    frames = seconds * refresh;
+    for (i = 0; i < frames; ++i) {
+	double diff;
+	int action;
+
+	// audio plays wall clock time, video a frame each refresh
+	// the correction is delayed by the audio buffer
+	audio += 90000.0 / refresh * (1.0 + delay[i % 20] / 1e6);
+	diff = video - audio + noise * 90 * AvSyncTestRandom();
+	if (i > frames / 10) {		// after start
+	    double d;
+
+	    d = fabs(video - audio);
+	    sum_diff += d;
+	    if (d > max_diff) {
+		max_diff = d;
+	    }
+	}
+
+	action = AvSyncNone;
+	if (old) {
+	    if (counter && counter--) {
+		goto skip;
+	    }
+	    last = (last + (int)diff) / 2;
+	    if (last > 55 * 90) {
+		action = AvSyncDup;
+		counter = 1;
+	    } else if (last < -25 * 90) {
+		action = AvSyncDrop;
+		counter = 1;
+	    }
+	} else {
+	    action = AvSyncUpdate(sync, diff, video, 1);
+	    ppm = AvSyncAudioCorrection(resample);
+	}
+	delay[i % 20] = ppm;
+      skip:
+	switch (action) {
+	    case AvSyncDup:
+		++dup;
+		break;
+	    case AvSyncDrop:
+		++drop;
+		video += 2 * 20 * 90;
+		break;
+	    default:
+		video += 20 * 90;
+		break;
+	}
+    }
+    printf("%-7s %8.3fHz %-8s: %4d dup %4d drop, diff max %5.1fms avg "
+	"%5.1fms, ppm %d\n", old ? "old" : "avsync", refresh,
+	resample ? "resample" : "no", dup, drop, max_diff / 90,
+	sum_diff / 90 / (frames - frames / 10 - 1), ppm);
+    AvSyncDel(sync);
+}
+
+///
+///	Print usage.
+///
+static void PrintUsage(void)
+{
+    printf("Usage: avsync_test [-?h] [-n noise] [-t seconds]\n"
+	"\t-n noise\tmeasurement noise in ms (default 3)\n"
+	"\t-t seconds\tsimulated time (default 3600)\n"
+	"\t-? -h\tdisplay this message\n");
+}
+
+///
+///	Main entry point.
+///
+///	@param argc	number of arguments
+///	@param argv	arguments vector
+///
+///	@returns -1 on failures, 0 clean exit.
+///
+int main(int argc, char *const argv[])
+{
+    static const double rates[] = { 50.0, 50.006, 50.02, 49.97 };
+    double noise;
+    int seconds;
+    unsigned u;
+
+    noise = 3.0;
+    seconds = 3600;
+    for (;;) {
+	switch (getopt(argc, argv, "h?n:t:")) {
+	    case 'n':
+		noise = atof(optarg);
+		continue;
+	    case 't':
+		seconds = atoi(optarg);
+		continue;
+	    case EOF:
+		break;
+	    case '?':
+	    case 'h':
+	    default:
+		PrintUsage();
+		return 0;
+	}
+	break;
+    }
+
+    for (u = 0; u < sizeof(rates) / sizeof(*rates); ++u) {
+	AvSyncSimulate(rates[u], 0, noise, seconds, 1);
+	AvSyncSimulate(rates[u], 0, noise, seconds, 0);
+	AvSyncSimulate(rates[u], 1, noise, seconds, 0);
+    }
+
+    return 0;
+}
+
+#endif
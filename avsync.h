@@ -0,0 +1,69 @@
+///
+///	@file avsync.h	@brief Audio/video sync module header file
+///
+///	Copyright (c) 2014 by Johns.  All Rights Reserved.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+/// @addtogroup AvSync
+/// @{
+
+    /// audio/video sync typedef
+typedef struct _av_sync_ AvSync;
+
+    /// audio/video sync actions
+typedef enum _av_sync_actions_
+{
+    AvSyncNone,				///< in sync or fine corrected
+    AvSyncDup,				///< video before audio, duplicate frame
+    AvSyncDrop,				///< video after audio, drop frame
+    AvSyncLost,				///< difference too big
+} AvSyncAction;
+
+    /// audio/video sync roles
+typedef enum _av_sync_roles_
+{
+    AvSyncMain,				///< main video, drives the audio speed
+    AvSyncPip,				///< picture in picture, only dup/drop
+} AvSyncRole;
+
+    /// create new audio/video sync
+extern AvSync *AvSyncNew(AvSyncRole);
+
+    /// free audio/video sync
+extern void AvSyncDel(AvSync *);
+
+    /// reset audio/video sync at start of new stream
+extern void AvSyncReset(AvSync *);
+
+    /// update audio/video sync with the clock difference of a frame
+extern AvSyncAction AvSyncUpdate(AvSync *, int64_t, int64_t, int);
+
+    /// get filtered audio/video difference
+extern int AvSyncGetDiff(const AvSync *);
+
+    /// get audio speed correction for the resampler
+extern int AvSyncAudioCorrection(int);
+
+    /// update program clock reference of the live stream
+extern void AvSyncPcr(int64_t, int);
+
+    /// get drift of the stream clock against the local clock
+extern int AvSyncGetPcrDrift(void);
+
+/// @}
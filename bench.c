@@ -0,0 +1,1332 @@
+///
+///	@file bench.c	@brief Headless replay benchmark
+///
+///	Copyright (c) 2014 by Johns.  All Rights Reserved.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+///
+///	@defgroup Bench The headless replay benchmark.
+///
+///	Replays VDR recordings (.ts or old .vdr PES files) through the
+///	plugin ingest, demux, decode and sync code without VDR, X11, GPU
+///	or sound card.  Fast (default) replays as fast as possible, real
+///	time plays with the audio clock like a real device.
+///
+///	The video module is replaced by a noop output, which takes the
+///	software decoded frames and paces them in real time mode.  The
+///	audio uses the noop module as sink.
+///
+///	Reports frames/s, cpu time of ingest, decoder and other threads,
+///	allocations and the runtime statistics (decode time, a/v offset).
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <pthread.h>
+
+#include <libavcodec/avcodec.h>
+
+#include "misc.h"
+#include "softhddev.h"
+#include "audio.h"
+#include "video.h"
+#include "codec.h"
+#include "stats.h"
+
+//----------------------------------------------------------------------------
+//	Defines
+//----------------------------------------------------------------------------
+
+#define TS_PACKET_SIZE	188		///< transport stream packet size
+#define BENCH_READ_SIZE (1024 * 1024)	///< file read buffer size
+#define BENCH_STALL_TIME 5000		///< ms without progress is a stall
+
+//----------------------------------------------------------------------------
+//	Variables
+//----------------------------------------------------------------------------
+
+    // required by softhddev.c, audio.c and codec.c
+int ConfigAudioBufferTime;		///< config size ms of audio buffer
+int ConfigVideoClearOnSwitch;		///< clear decoder on channel switch
+char ConfigVideoFastSwitch;		///< keep decoder on channel switch
+int ConfigVideoBufferTime;		///< config size ms of video buffer
+int ConfigVideoBufferSize;		///< config size KiB of video buffer
+int ConfigPipBufferSize;		///< config size KiB of pip buffer
+int SysLogLevel;			///< VDR's global log level
+volatile char SoftIsPlayingVideo = 1;	///< stream contains video data
+signed char VideoHardwareDecoder;	///< flag use hardware decoder
+char VideoIgnoreRepeatPict;		///< disable repeat pict warning
+int VideoAudioDelay;			///< audio/video delay
+
+extern void AudioVideoReady(int64_t);	///< tell audio video is ready
+
+static char BenchRealTime;		///< flag replay in real time
+static volatile char BenchStop;		///< flag stop decoder thread
+static int BenchStalls;			///< packets dropped after stall
+
+static pthread_t BenchThread;		///< decoder thread
+static pthread_mutex_t BenchMutex;	///< wakeup mutex
+static pthread_cond_t BenchWakeupCond;	///< wakeup condition variable
+
+static uint8_t BenchBuffer[BENCH_READ_SIZE];	///< file read buffer
+
+///
+///	Noop video hardware decoder.
+///
+struct _video_hw_decoder_
+{
+    VideoStream *Stream;		///< video stream of decoder
+    int64_t PTS;			///< video clock of last frame
+    int64_t PacePTS;			///< pts of wall clock pace start
+    uint64_t PaceTime;			///< us of wall clock pace start
+    int Width;				///< frame width
+    int Height;				///< frame height
+    int FramesDisplayed;		///< number of frames displayed
+    int FramesMissed;			///< number of frames too late
+};
+
+static VideoHwDecoder BenchDecoder[1];	///< the only video decoder
+
+//----------------------------------------------------------------------------
+//	Allocations
+//----------------------------------------------------------------------------
+
+#ifdef __GLIBC__
+
+static uint64_t BenchAllocCount;	///< number of allocations
+static uint64_t BenchAllocBytes;	///< bytes allocated
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+
+///
+///	Count an allocation.
+///
+///	@param size	bytes allocated
+///
+static void BenchCountAlloc(size_t size)
+{
+    __atomic_fetch_add(&BenchAllocCount, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&BenchAllocBytes, size, __ATOMIC_RELAXED);
+}
+
+///
+///	Counting malloc, ffmpeg and the plugin allocate through these.
+///
+void *malloc(size_t size)
+{
+    BenchCountAlloc(size);
+    return __libc_malloc(size);
+}
+
+///
+///	Counting calloc.
+///
+void *calloc(size_t nmemb, size_t size)
+{
+    BenchCountAlloc(nmemb * size);
+    return __libc_calloc(nmemb, size);
+}
+
+///
+///	Counting realloc.
+///
+void *realloc(void *ptr, size_t size)
+{
+    BenchCountAlloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+///
+///	Counting memalign.
+///
+void *memalign(size_t alignment, size_t size)
+{
+    BenchCountAlloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+///
+///	Counting aligned_alloc.
+///
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    BenchCountAlloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+///
+///	Counting posix_memalign, used by av_malloc.
+///
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if (!alignment || alignment % sizeof(void *)
+	|| (alignment & (alignment - 1))) {
+	return EINVAL;
+    }
+    BenchCountAlloc(size);
+    if (!(ptr = __libc_memalign(alignment, size))) {
+	return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+//	Helper
+//----------------------------------------------------------------------------
+
+///
+///	Get the monotonic time in us.
+///
+static uint64_t BenchTime(void)
+{
+    struct timespec tspec;
+
+    clock_gettime(CLOCK_MONOTONIC, &tspec);
+    return tspec.tv_sec * UINT64_C(1000000) + tspec.tv_nsec / 1000;
+}
+
+///
+///	Get the cpu time of a clock in us.
+///
+///	@param clock_id	cpu time clock
+///
+static uint64_t BenchCpuTime(clockid_t clock_id)
+{
+    struct timespec tspec;
+
+    if (clock_gettime(clock_id, &tspec)) {
+	return 0;
+    }
+    return tspec.tv_sec * UINT64_C(1000000) + tspec.tv_nsec / 1000;
+}
+
+//----------------------------------------------------------------------------
+//	Noop video output
+//----------------------------------------------------------------------------
+
+///
+///	Allocate new noop video decoder.
+///
+///	@param stream	video stream
+///	@param pip	flag stream is picture in picture
+///
+VideoHwDecoder *VideoNewHwDecoder(VideoStream * stream,
+    __attribute__ ((unused)) int pip)
+{
+    memset(BenchDecoder, 0, sizeof(BenchDecoder));
+    BenchDecoder->Stream = stream;
+    BenchDecoder->PTS = AV_NOPTS_VALUE;
+    return BenchDecoder;
+}
+
+///
+///	Destroy a noop video decoder, the only decoder is kept.
+///
+void VideoDelHwDecoder( __attribute__ ((unused))
+    VideoHwDecoder * hw_decoder)
+{
+}
+
+///
+///	Noop has no hardware surfaces.
+///
+unsigned VideoGetSurface( __attribute__ ((unused))
+    VideoHwDecoder * hw_decoder, __attribute__ ((unused))
+    const AVCodecContext * video_ctx)
+{
+    return 0;
+}
+
+///
+///	Noop has no hardware surfaces.
+///
+void VideoReleaseSurface( __attribute__ ((unused))
+    VideoHwDecoder * hw_decoder, __attribute__ ((unused))
+    unsigned surface)
+{
+}
+
+///
+///	Callback to negotiate the PixelFormat, always decode by software.
+///
+///	@param hw_decoder	video hardware decoder
+///	@param video_ctx	ffmpeg video codec context
+///	@param fmt		is the list of formats which are supported by
+///				the codec, it is terminated by -1 as 0 is a
+///				valid format, the formats are ordered by
+///				quality.
+///
+enum AVPixelFormat Video_get_format( __attribute__ ((unused))
+    VideoHwDecoder * hw_decoder, AVCodecContext * video_ctx,
+    const enum AVPixelFormat *fmt)
+{
+    return avcodec_default_get_format(video_ctx, fmt);
+}
+
+///
+///	Noop has no hwaccel context.
+///
+void *VideoGetHwAccelContext( __attribute__ ((unused))
+    VideoHwDecoder * hw_decoder)
+{
+    return NULL;
+}
+
+///
+///	Pace a frame in real time mode.
+///
+///	The frame is shown, when the audio clock reaches its pts.  Without
+///	audio clock the frame follows the wall clock.
+///
+///	@param hw_decoder	video hardware decoder
+///	@param duration		frame duration in pts
+///
+static void BenchSyncFrame(VideoHwDecoder * hw_decoder, int duration)
+{
+    int64_t audio_clock;
+    int64_t diff;
+    uint64_t now;
+    uint64_t due;
+
+    if (!BenchRealTime || hw_decoder->PTS == (int64_t) AV_NOPTS_VALUE) {
+	return;
+    }
+
+    audio_clock = AudioGetClock();
+    if (audio_clock != (int64_t) AV_NOPTS_VALUE) {
+	diff = hw_decoder->PTS - audio_clock - VideoAudioDelay;
+	StatsSample(StatsAvOffset, diff / 90);
+	hw_decoder->PaceTime = 0;
+	if (diff < -duration) {		// too late, no wait
+	    ++hw_decoder->FramesMissed;
+	} else if (diff > 0 && diff < 2000 * 90) {
+	    usleep((diff * 1000) / 90);
+	}
+	return;
+    }
+
+    now = BenchTime();
+    diff = hw_decoder->PTS - hw_decoder->PacePTS;
+    if (!hw_decoder->PaceTime || diff < 0 || diff > 2000 * 90) {
+	hw_decoder->PacePTS = hw_decoder->PTS;
+	hw_decoder->PaceTime = now;
+	return;
+    }
+    due = hw_decoder->PaceTime + (diff * 1000) / 90;
+    if (due > now) {
+	usleep(due - now);
+    } else if (now - due > (uint64_t) (duration * 1000) / 90) {
+	++hw_decoder->FramesMissed;
+    }
+}
+
+///
+///	Display a ffmpeg frame.
+///
+///	@param hw_decoder	video hardware decoder
+///	@param video_ctx	ffmpeg video codec context
+///	@param frame		frame to display
+///
+void VideoRenderFrame(VideoHwDecoder * hw_decoder,
+    const AVCodecContext * video_ctx, const AVFrame * frame)
+{
+    int64_t pts;
+    int duration;
+
+    duration = 40 * 90;
+    if (video_ctx->framerate.num && video_ctx->framerate.den) {
+	duration = (90000 * video_ctx->framerate.den)
+	    / video_ctx->framerate.num;
+    }
+
+    pts = frame->pkt_pts;
+    if (pts == (int64_t) AV_NOPTS_VALUE || !pts) {
+	pts = frame->pkt_dts;
+    }
+    if (pts && pts != (int64_t) AV_NOPTS_VALUE) {
+	if (hw_decoder->PTS == (int64_t) AV_NOPTS_VALUE) {
+	    AudioVideoReady(pts);
+	}
+	hw_decoder->PTS = pts;
+    } else if (hw_decoder->PTS != (int64_t) AV_NOPTS_VALUE) {
+	hw_decoder->PTS += duration;
+    }
+    hw_decoder->Width = frame->width;
+    hw_decoder->Height = frame->height;
+
+    BenchSyncFrame(hw_decoder, duration);
+
+    ++hw_decoder->FramesDisplayed;
+    StatsCount(StatsVideoFrames, 1);
+}
+
+///
+///	Get video clock.
+///
+///	@param hw_decoder	video hardware decoder
+///
+int64_t VideoGetClock(const VideoHwDecoder * hw_decoder)
+{
+    if (hw_decoder) {
+	return hw_decoder->PTS;
+    }
+    return AV_NOPTS_VALUE;
+}
+
+///
+///	Set closing stream flag, the next stream starts a new clock.
+///
+///	@param hw_decoder	video hardware decoder
+///
+void VideoSetClosing(VideoHwDecoder * hw_decoder)
+{
+    if (hw_decoder) {
+	hw_decoder->PTS = AV_NOPTS_VALUE;
+    }
+}
+
+///
+///	Reset start of frame counter.
+///
+///	@param hw_decoder	video hardware decoder
+///
+void VideoResetStart(VideoHwDecoder * hw_decoder)
+{
+    if (hw_decoder) {
+	hw_decoder->PaceTime = 0;
+    }
+}
+
+///
+///	Noop trick speed.
+///
+void VideoSetTrickSpeed( __attribute__ ((unused))
+    VideoHwDecoder * hw_decoder, __attribute__ ((unused))
+    int speed)
+{
+}
+
+///
+///	Get decoder statistics.
+///
+///	@param hw_decoder	video hardware decoder
+///	@param[out] missed	missed frames
+///	@param[out] duped	duplicated frames
+///	@param[out] dropped	dropped frames
+///	@param[out] counter	number of decoder frames
+///
+void VideoGetStats(VideoHwDecoder * hw_decoder, int *missed, int *duped,
+    int *dropped, int *counter)
+{
+    *missed = hw_decoder->FramesMissed;
+    *duped = 0;
+    *dropped = 0;
+    *counter = hw_decoder->FramesDisplayed;
+}
+
+///
+///	Get decoder video stream size.
+///
+///	@param hw_decoder	video hardware decoder
+///	@param[out] width	video stream width
+///	@param[out] height	video stream height
+///	@param[out] aspect_num	video stream aspect numerator
+///	@param[out] aspect_den	video stream aspect denominator
+///
+void VideoGetVideoSize(VideoHwDecoder * hw_decoder, int *width, int *height,
+    int *aspect_num, int *aspect_den)
+{
+    *width = hw_decoder->Width ? hw_decoder->Width : 1920;
+    *height = hw_decoder->Height ? hw_decoder->Height : 1080;
+    *aspect_num = 16;
+    *aspect_den = 9;
+}
+
+///
+///	Wakeup the decoder thread.
+///
+void VideoDisplayWakeup(void)
+{
+    pthread_mutex_lock(&BenchMutex);
+    pthread_cond_signal(&BenchWakeupCond);
+    pthread_mutex_unlock(&BenchMutex);
+}
+
+///
+///	Noop has no grab.
+///
+uint8_t *VideoGrab( __attribute__ ((unused))
+    int *size, __attribute__ ((unused))
+    int *width, __attribute__ ((unused))
+    int *height, __attribute__ ((unused))
+    int write_header)
+{
+    return NULL;
+}
+
+///
+///	Get the video driver name.
+///
+const char *VideoGetDriverName(void)
+{
+    return "noop";
+}
+
+///
+///	Noop output position.
+///
+void VideoSetOutputPosition( __attribute__ ((unused))
+    VideoHwDecoder * hw_decoder, __attribute__ ((unused))
+    int x, __attribute__ ((unused))
+    int y, __attribute__ ((unused))
+    int width, __attribute__ ((unused))
+    int height)
+{
+}
+
+///
+///	Noop OSD draw.
+///
+void VideoOsdDrawARGB( __attribute__ ((unused))
+    int xi, __attribute__ ((unused))
+    int yi, __attribute__ ((unused))
+    int width, __attribute__ ((unused))
+    int height, __attribute__ ((unused))
+    int pitch, __attribute__ ((unused))
+    const uint8_t * argb, __attribute__ ((unused))
+    int x, __attribute__ ((unused))
+    int y)
+{
+}
+
+///
+///	Get OSD size.
+///
+///	@param[out] width	OSD width
+///	@param[out] height	OSD height
+///
+void VideoGetOsdSize(int *width, int *height)
+{
+    *width = 1920;
+    *height = 1080;
+}
+
+///
+///	Noop geometry.
+///
+int VideoSetGeometry( __attribute__ ((unused))
+    const char *geometry)
+{
+    return 0;
+}
+
+///
+///	Noop device.
+///
+void VideoSetDevice( __attribute__ ((unused))
+    const char *device)
+{
+}
+
+///
+///	Noop fullscreen.
+///
+void VideoSetFullscreen( __attribute__ ((unused))
+    int onoff)
+{
+}
+
+///
+///	Noop setup, there is no X11.
+///
+void VideoInit( __attribute__ ((unused))
+    const char *display_name)
+{
+}
+
+void VideoExit(void)			///< noop
+{
+}
+
+void VideoOsdInit(void)			///< noop
+{
+}
+
+void VideoOsdExit(void)			///< noop
+{
+}
+
+void VideoOsdClear(void)		///< noop
+{
+}
+
+    /// required by softhddev.c, no jpeg
+uint8_t *CreateJpeg( __attribute__ ((unused))
+    uint8_t * image, __attribute__ ((unused))
+    int *size, __attribute__ ((unused))
+    int quality, __attribute__ ((unused))
+    int width, __attribute__ ((unused))
+    int height)
+{
+    return NULL;
+}
+
+void DelPip(void)			///< required by softhddev.c
+{
+}
+
+//----------------------------------------------------------------------------
+//	Decoder thread
+//----------------------------------------------------------------------------
+
+///
+///	Decoder thread, decodes and displays the video packets.
+///
+///	@param dummy	unused thread argument
+///
+static void *BenchDecoderThread( __attribute__ ((unused))
+    void *dummy)
+{
+    while (!BenchStop) {
+	VideoStream *stream;
+
+	if ((stream = BenchDecoder->Stream) && !VideoDecodeInput(stream)) {
+	    continue;
+	}
+	// nothing decoded, wait for new input
+	pthread_mutex_lock(&BenchMutex);
+	if (!BenchStop) {
+	    struct timespec abstime;
+
+	    clock_gettime(CLOCK_REALTIME, &abstime);
+	    abstime.tv_nsec += 10 * 1000 * 1000;
+	    if (abstime.tv_nsec >= 1000 * 1000 * 1000) {
+		abstime.tv_sec++;
+		abstime.tv_nsec -= 1000 * 1000 * 1000;
+	    }
+	    pthread_cond_timedwait(&BenchWakeupCond, &BenchMutex, &abstime);
+	}
+	pthread_mutex_unlock(&BenchMutex);
+    }
+    return NULL;
+}
+
+//----------------------------------------------------------------------------
+//	Replay
+//----------------------------------------------------------------------------
+
+///
+///	Replay state of a transport stream.
+///
+typedef struct _bench_ts_
+{
+    int PmtPid;				///< pid of the program map table
+    int VideoPid;			///< pid of the video stream
+    int AudioPid;			///< pid of the audio stream
+#ifndef USE_TS_VIDEO
+    uint8_t *Video;			///< video PES packet assembly
+    int VideoSize;			///< size of assembled video PES
+    int VideoMax;			///< allocated size of video PES
+#endif
+} BenchTs;
+
+static int BenchAudioId;		///< PES id of the replayed audio
+
+///
+///	Wait until the plugin accepts the packet.
+///
+///	@param ret	return of a play function, 0 buffers full
+///	@param start	ms ticks of the first try
+///
+///	@returns true if the packet must be given again.
+///
+static int BenchRetry(int ret, uint32_t start)
+{
+    if (ret) {
+	return 0;
+    }
+    if (GetMsTicks() - start > BENCH_STALL_TIME) {
+	Warning("bench: no progress for %dms, packet dropped\n",
+	    BENCH_STALL_TIME);
+	++BenchStalls;
+	return 0;
+    }
+    if (Poll(100)) {			// not full, but not accepted
+	usleep(1000);
+    }
+    return 1;
+}
+
+///
+///	Play a video PES packet.
+///
+///	@param data	PES packet
+///	@param size	size of PES packet
+///
+static void BenchPlayVideo(const uint8_t * data, int size)
+{
+    uint32_t start;
+    int n;
+
+    start = GetMsTicks();
+    do {
+	n = PlayVideo(data, size);
+    } while (BenchRetry(n, start));
+    if (n > 0) {
+	StatsCount(StatsVideoPackets, 1);
+	StatsCount(StatsVideoBytes, n);
+    }
+}
+
+///
+///	Play an audio PES packet.
+///
+///	@param data	PES packet
+///	@param size	size of PES packet
+///	@param id	PES stream id or sub-stream id of private stream 1
+///
+static void BenchPlayAudio(const uint8_t * data, int size, uint8_t id)
+{
+    uint32_t start;
+    int n;
+
+    start = GetMsTicks();
+    do {
+	n = PlayAudio(data, size, id);
+    } while (BenchRetry(n, start));
+    if (n > 0) {
+	StatsCount(StatsAudioPackets, 1);
+	StatsCount(StatsAudioBytes, n);
+    }
+}
+
+///
+///	Handle a PES packet of a VDR .vdr recording.
+///
+///	Only the first video and audio stream is replayed.
+///
+///	@param data	PES packet
+///	@param size	size of PES packet
+///
+static void BenchPesPacket(const uint8_t * data, int size)
+{
+    int id;
+
+    id = data[3];
+    if ((id & 0xF0) == 0xE0) {
+	if (id == 0xE0) {
+	    BenchPlayVideo(data, size);
+	}
+	return;
+    }
+    if (id == 0xBD) {			// private stream 1: use sub-stream id
+	if (size < 10 || 9 + data[8] >= size) {
+	    return;
+	}
+	id = data[9 + data[8]];
+    } else if (id < 0xC0 || id > 0xDF) {
+	return;
+    }
+    if (!BenchAudioId) {
+	BenchAudioId = id;
+    }
+    if (id == BenchAudioId) {
+	BenchPlayAudio(data, size, id);
+    }
+}
+
+///
+///	Parse PES packets of a VDR .vdr recording.
+///
+///	@param data	buffered file data
+///	@param size	size of buffered data
+///
+///	@returns number of bytes consumed.
+///
+static int BenchParsePes(const uint8_t * data, int size)
+{
+    int offset;
+
+    offset = 0;
+    while (size - offset >= 6) {
+	const uint8_t *p;
+	int n;
+
+	p = data + offset;
+	if (p[0] || p[1] || p[2] != 0x01) {	// resync
+	    ++offset;
+	    continue;
+	}
+	switch (p[3]) {
+	    case 0xB9:			// program end
+		offset += 4;
+		continue;
+	    case 0xBA:			// pack header
+		if (size - offset < 14) {
+		    return offset;
+		}
+		offset += (p[4] & 0xC0) == 0x40 ? 14 + (p[13] & 0x07) : 12;
+		continue;
+	}
+	n = 6 + ((p[4] << 8) | p[5]);
+	if (n == 6) {			// unbounded packet, resync
+	    offset += 4;
+	    continue;
+	}
+	if (size - offset < n) {	// need more data
+	    break;
+	}
+	BenchPesPacket(p, n);
+	offset += n;
+    }
+    return offset;
+}
+
+///
+///	Parse the PAT and PMT of a transport stream.
+///
+///	Only sections in one TS packet are supported, like VDR writes them.
+///
+///	@param ts	transport stream state
+///	@param pid	pid of the packet
+///	@param p	payload of the packet
+///	@param n	size of payload
+///
+static void BenchParsePsi(BenchTs * ts, int pid, const uint8_t * p, int n)
+{
+    int length;
+    int i;
+
+    if (n < 1 || n < 1 + p[0] + 12) {
+	return;
+    }
+    n -= 1 + p[0];			// skip pointer field
+    p += 1 + p[0];
+    length = 3 + (((p[1] & 0x0F) << 8) | p[2]) - 4;	// without crc
+    if (length > n) {
+	return;
+    }
+
+    if (!pid && p[0] == 0x00) {		// program association table
+	for (i = 8; i + 4 <= length; i += 4) {
+	    if (p[i] || p[i + 1]) {	// first program
+		ts->PmtPid = ((p[i + 2] & 0x1F) << 8) | p[i + 3];
+		return;
+	    }
+	}
+	return;
+    }
+
+    if (p[0] != 0x02 || ts->VideoPid || ts->AudioPid) {
+	return;
+    }
+    // program map table: first video and audio stream
+    for (i = 12 + (((p[10] & 0x0F) << 8) | p[11]); i + 5 <= length;) {
+	int type;
+	int es_pid;
+	int info;
+	int audio;
+	int j;
+
+	type = p[i];
+	es_pid = ((p[i + 1] & 0x1F) << 8) | p[i + 2];
+	info = ((p[i + 3] & 0x0F) << 8) | p[i + 4];
+
+	audio = 0;
+	switch (type) {
+	    case 0x01:			// MPEG-1 video
+	    case 0x02:			// MPEG-2 video
+	    case 0x1B:			// H.264
+	    case 0x24:			// HEVC
+		if (!ts->VideoPid) {
+		    ts->VideoPid = es_pid;
+		}
+		break;
+	    case 0x03:			// MPEG-1 audio
+	    case 0x04:			// MPEG-2 audio
+	    case 0x0F:			// AAC
+	    case 0x11:			// AAC LATM
+	    case 0x81:			// AC-3
+		audio = 1;
+		break;
+	    case 0x06:			// private: AC-3/E-AC-3 descriptor
+		for (j = i + 5; j + 2 <= i + 5 + info && j + 2 <= length;
+		    j += 2 + p[j + 1]) {
+		    if (p[j] == 0x6A || p[j] == 0x7A) {
+			audio = 1;
+		    }
+		}
+		break;
+	}
+	if (audio && !ts->AudioPid) {
+	    ts->AudioPid = es_pid;
+	}
+	i += 5 + info;
+    }
+    Debug(3, "bench: pmt pid %d video pid %d audio pid %d\n", ts->PmtPid,
+	ts->VideoPid, ts->AudioPid);
+}
+
+#ifndef USE_TS_VIDEO
+
+///
+///	Play the assembled video PES packet.
+///
+///	@param ts	transport stream state
+///
+static void BenchFlushVideo(BenchTs * ts)
+{
+    if (ts->VideoSize) {
+	BenchPlayVideo(ts->Video, ts->VideoSize);
+	ts->VideoSize = 0;
+    }
+}
+
+#endif
+
+///
+///	Handle a transport stream packet.
+///
+///	Without the TS video parser the video PES packets are assembled
+///	like VDR does.  Audio uses the TS audio parser, if available.
+///
+///	@param ts	transport stream state
+///	@param data	transport stream packet
+///
+static void BenchTsPacket(BenchTs * ts, const uint8_t * data)
+{
+    int pid;
+    int offset;
+
+    if (data[1] & 0x80) {		// transport error
+	return;
+    }
+    pid = ((data[1] & 0x1F) << 8) | data[2];
+    offset = 4;
+    if (data[3] & 0x20) {		// adaptation field
+	offset += 1 + data[4];
+    }
+    if (!(data[3] & 0x10) || offset >= TS_PACKET_SIZE) {	// no payload
+	return;
+    }
+
+    if (!pid || (pid == ts->PmtPid && ts->PmtPid)) {
+	if (data[1] & 0x40) {
+	    BenchParsePsi(ts, pid, data + offset, TS_PACKET_SIZE - offset);
+	}
+	return;
+    }
+
+    if (pid == ts->VideoPid) {
+#ifdef USE_TS_VIDEO
+	uint32_t start;
+	int n;
+
+	start = GetMsTicks();
+	do {
+	    n = PlayTsVideo(data, TS_PACKET_SIZE);
+	} while (BenchRetry(n, start));
+	if (n > 0) {
+	    StatsCount(StatsVideoPackets, 1);
+	    StatsCount(StatsVideoBytes, n);
+	}
+#else
+	int n;
+
+	if (data[1] & 0x40) {		// payload unit start
+	    BenchFlushVideo(ts);
+	} else if (!ts->VideoSize) {	// wait for start
+	    return;
+	}
+	n = TS_PACKET_SIZE - offset;
+	if (ts->VideoSize + n > ts->VideoMax) {
+	    ts->VideoMax = (ts->VideoSize + n) * 2;
+	    ts->Video = realloc(ts->Video, ts->VideoMax);
+	}
+	memcpy(ts->Video + ts->VideoSize, data + offset, n);
+	ts->VideoSize += n;
+#endif
+	return;
+    }
+
+    if (pid == ts->AudioPid) {
+#ifndef NO_TS_AUDIO
+	uint32_t start;
+	int n;
+
+	start = GetMsTicks();
+	do {
+	    n = PlayTsAudio(data, TS_PACKET_SIZE);
+	} while (BenchRetry(n, start));
+	if (n > 0) {
+	    StatsCount(StatsAudioPackets, 1);
+	    StatsCount(StatsAudioBytes, n);
+	}
+#else
+	// FIXME: assemble audio PES for the PES audio parser
+	Error("bench: TS audio parser disabled, audio not replayed\n");
+	ts->AudioPid = -1;
+#endif
+    }
+}
+
+///
+///	Parse transport stream packets.
+///
+///	@param ts	transport stream state
+///	@param data	buffered file data
+///	@param size	size of buffered data
+///
+///	@returns number of bytes consumed.
+///
+static int BenchParseTs(BenchTs * ts, const uint8_t * data, int size)
+{
+    int offset;
+
+    offset = 0;
+    while (size - offset >= TS_PACKET_SIZE) {
+	if (data[offset] != 0x47) {	// resync
+	    ++offset;
+	    continue;
+	}
+	BenchTsPacket(ts, data + offset);
+	offset += TS_PACKET_SIZE;
+    }
+    return offset;
+}
+
+///
+///	Replay a recording file.
+///
+///	@param name	file name of .ts or .vdr recording
+///	@param ts	transport stream state
+///
+///	@returns -1 on failures, 0 replayed.
+///
+static int BenchReplay(const char *name, BenchTs * ts)
+{
+    FILE *file;
+    int length;
+    int is_ts;
+
+    if (!(file = fopen(name, "rb"))) {
+	fprintf(stderr, "bench: can't open '%s': %s\n", name,
+	    strerror(errno));
+	return -1;
+    }
+    length = 0;
+    is_ts = -1;
+    for (;;) {
+	int n;
+	int offset;
+
+	n = fread(BenchBuffer + length, 1, sizeof(BenchBuffer) - length,
+	    file);
+	length += n;
+	if (is_ts < 0 && length >= TS_PACKET_SIZE + 1) {
+	    is_ts = BenchBuffer[0] == 0x47
+		&& BenchBuffer[TS_PACKET_SIZE] == 0x47;
+	    Debug(3, "bench: '%s' is %s\n", name, is_ts ? "ts" : "pes");
+	}
+	if (is_ts < 0) {
+	    offset = 0;
+	} else if (is_ts) {
+	    offset = BenchParseTs(ts, BenchBuffer, length);
+	} else {
+	    offset = BenchParsePes(BenchBuffer, length);
+	}
+	length -= offset;
+	memmove(BenchBuffer, BenchBuffer + offset, length);
+	if (!n) {			// end of file
+	    break;
+	}
+    }
+    fclose(file);
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+//	Report
+//----------------------------------------------------------------------------
+
+///
+///	Print the benchmark report.
+///
+///	@param wall	us replay time
+///	@param ingest	us cpu time of ingest and audio decode (main thread)
+///	@param decoder	us cpu time of video decode and sync
+///	@param total	us cpu time of the process
+///	@param allocs	number of allocations
+///	@param bytes	bytes allocated
+///
+static void BenchReport(uint64_t wall, uint64_t ingest, uint64_t decoder,
+    uint64_t total, uint64_t allocs, uint64_t bytes)
+{
+    static const char *const names[StatsHistogramMax] = {
+	"packet queue", "decode mpeg2 us", "decode h264 us",
+	"decode hevc us", "surface queue", "render us", "vsync jitter us",
+	"a/v offset ms", "audio fill ms", "osd upload us"
+    };
+    double seconds;
+    uint64_t frames;
+    int i;
+
+    seconds = wall ? wall / 1e6 : 1.0;
+    frames = StatsGetCounter(StatsVideoFrames);
+
+    printf("mode %s time %.2fs\n", BenchRealTime ? "real time" : "fast",
+	seconds);
+    printf("video frames %llu %.2f/s missed %d audio underruns %llu"
+	" stalls %d\n", (unsigned long long)frames, frames / seconds,
+	BenchDecoder->FramesMissed,
+	(unsigned long long)StatsGetCounter(StatsAudioUnderruns),
+	BenchStalls);
+    printf("video packets %llu bytes %llu %.2f Mbit/s\n",
+	(unsigned long long)StatsGetCounter(StatsVideoPackets),
+	(unsigned long long)StatsGetCounter(StatsVideoBytes),
+	StatsGetCounter(StatsVideoBytes) * 8 / seconds / 1e6);
+    printf("audio packets %llu bytes %llu %.2f Mbit/s\n",
+	(unsigned long long)StatsGetCounter(StatsAudioPackets),
+	(unsigned long long)StatsGetCounter(StatsAudioBytes),
+	StatsGetCounter(StatsAudioBytes) * 8 / seconds / 1e6);
+    printf("cpu ingest+audio decode %.2fs video decode+sync %.2fs"
+	" other %.2fs total %.2fs %.0f%%\n", ingest / 1e6, decoder / 1e6,
+	(total > ingest + decoder ? total - ingest - decoder : 0) / 1e6,
+	total / 1e6, (total * 100.0) / (wall ? wall : 1));
+#ifdef __GLIBC__
+    printf("allocations %llu bytes %llu %.1f/frame\n",
+	(unsigned long long)allocs, (unsigned long long)bytes,
+	frames ? (double)allocs / frames : 0.0);
+#else
+    (void)allocs;
+    (void)bytes;
+    printf("allocations not counted\n");
+#endif
+
+    for (i = 0; i < StatsHistogramMax; ++i) {
+	StatsHistogram hist;
+
+	StatsGetHistogram((StatsHistograms) i, &hist);
+	if (!hist.Count) {
+	    continue;
+	}
+	printf("%s n %llu avg %lld min %lld max %lld |p50| %lld |p99| %lld\n",
+	    names[i], (unsigned long long)hist.Count,
+	    (long long)(hist.Sum / (int64_t) hist.Count), (long long)hist.Min,
+	    (long long)hist.Max, (long long)StatsPercentile(&hist, 50),
+	    (long long)StatsPercentile(&hist, 99));
+    }
+}
+
+//----------------------------------------------------------------------------
+//	Main
+//----------------------------------------------------------------------------
+
+///
+///	Print version.
+///
+static void PrintVersion(void)
+{
+    printf("bench: replay benchmark Version " VERSION
+#ifdef GIT_REV
+	"(GIT-" GIT_REV ")"
+#endif
+	",\n\t(c) 2009 - 2014 by Johns\n"
+	"\tLicense AGPLv3: GNU Affero General Public License version 3\n");
+}
+
+///
+///	Print usage.
+///
+static void PrintUsage(void)
+{
+    printf("Usage: bench [-?dhrv] [-t threads] recording...\n"
+	"\t-d\tenable debug, more -d increase the verbosity\n"
+	"\t-r\treplay in real time, default as fast as possible\n"
+	"\t-t n\tuse n software video decoder threads\n"
+	"\t-? -h\tdisplay this message\n" "\t-v\tdisplay version information\n"
+	"\trecording .ts or .vdr files, replayed one after the other\n"
+	"Only idiots print usage on stderr!\n");
+}
+
+///
+///	Main entry point.
+///
+///	@param argc	number of arguments
+///	@param argv	arguments vector
+///
+///	@returns -1 on failures, 0 clean exit.
+///
+int main(int argc, char *const argv[])
+{
+    BenchTs ts[1];
+    clockid_t decoder_clock;
+    uint64_t wall;
+    uint64_t ingest;
+    uint64_t decoder;
+    uint64_t total;
+    uint64_t allocs;
+    uint64_t bytes;
+    uint32_t tick;
+    int threads;
+    int ret;
+
+    LogLevel = 0;
+    threads = 0;
+
+    //
+    //	Parse command line arguments
+    //
+    for (;;) {
+	switch (getopt(argc, argv, "hv?-drt:")) {
+	    case 'd':			// enabled debug
+		++LogLevel;
+		continue;
+	    case 'r':			// real time
+		BenchRealTime = 1;
+		continue;
+	    case 't':			// decoder threads
+		threads = atoi(optarg);
+		continue;
+
+	    case EOF:
+		break;
+	    case 'v':			// print version
+		PrintVersion();
+		return 0;
+	    case '?':
+	    case 'h':			// help usage
+		PrintVersion();
+		PrintUsage();
+		return 0;
+	    case '-':
+		PrintVersion();
+		PrintUsage();
+		fprintf(stderr, "\nWe need no long options\n");
+		return -1;
+	    case ':':
+		PrintVersion();
+		fprintf(stderr, "Missing argument for option '%c'\n", optopt);
+		return -1;
+	    default:
+		PrintVersion();
+		fprintf(stderr, "Unknown option '%c'\n", optopt);
+		return -1;
+	}
+	break;
+    }
+    if (optind >= argc) {
+	PrintVersion();
+	PrintUsage();
+	return -1;
+    }
+    //
+    //	setup plugin with noop outputs
+    //
+    AudioSetDevice("");			// noop module
+    AudioNoopSink = BenchRealTime ? 1 : 2;
+    CodecSetVideoThreads(threads, 0, 0);
+
+    pthread_mutex_init(&BenchMutex, NULL);
+    pthread_cond_init(&BenchWakeupCond, NULL);
+
+    Start();
+    if (!BenchDecoder->Stream) {
+	fprintf(stderr, "bench: video stream not opened\n");
+	return -1;
+    }
+    pthread_create(&BenchThread, NULL, BenchDecoderThread, NULL);
+    pthread_getcpuclockid(BenchThread, &decoder_clock);
+    SetPlayMode(1);
+
+    StatsReset();
+#ifdef __GLIBC__
+    allocs = __atomic_load_n(&BenchAllocCount, __ATOMIC_RELAXED);
+    bytes = __atomic_load_n(&BenchAllocBytes, __ATOMIC_RELAXED);
+#else
+    allocs = 0;
+    bytes = 0;
+#endif
+    wall = BenchTime();
+    ingest = BenchCpuTime(CLOCK_THREAD_CPUTIME_ID);
+    decoder = BenchCpuTime(decoder_clock);
+    total = BenchCpuTime(CLOCK_PROCESS_CPUTIME_ID);
+
+    //
+    //	replay
+    //
+    memset(ts, 0, sizeof(ts));
+    ret = 0;
+    while (optind < argc) {
+	if (BenchReplay(argv[optind++], ts)) {
+	    ret = -1;
+	}
+    }
+#ifndef USE_TS_VIDEO
+    BenchFlushVideo(ts);
+    free(ts->Video);
+#endif
+
+    // wait until all buffered packets and samples are played
+    tick = GetMsTicks();
+    while (GetMsTicks() - tick < BENCH_STALL_TIME) {
+	if (!VideoGetBuffers(BenchDecoder->Stream) && !AudioUsedBytes()) {
+	    break;
+	}
+	usleep(10 * 1000);
+    }
+
+    wall = BenchTime() - wall;
+    ingest = BenchCpuTime(CLOCK_THREAD_CPUTIME_ID) - ingest;
+    decoder = BenchCpuTime(decoder_clock) - decoder;
+    total = BenchCpuTime(CLOCK_PROCESS_CPUTIME_ID) - total;
+#ifdef __GLIBC__
+    allocs = __atomic_load_n(&BenchAllocCount, __ATOMIC_RELAXED) - allocs;
+    bytes = __atomic_load_n(&BenchAllocBytes, __ATOMIC_RELAXED) - bytes;
+#endif
+
+    BenchReport(wall, ingest, decoder, total, allocs, bytes);
+
+    //
+    //	cleanup
+    //
+    BenchStop = 1;
+    VideoDisplayWakeup();
+    pthread_join(BenchThread, NULL);
+    SetPlayMode(0);
+    SoftHdDeviceExit();
+
+    return ret;
+}
@@ -45,6 +45,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <math.h>
 #ifdef __FreeBSD__
 #include <sys/endian.h>
 #else
@@ -60,6 +61,8 @@
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
 // support old ffmpeg versions <1.0
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55,18,102)
 #define AVCodecID CodecID
@@ -85,6 +88,12 @@
 #endif
 #include <pthread.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #ifdef MAIN_H
 #include MAIN_H
 #endif
@@ -93,6 +102,7 @@
 #include "video.h"
 #include "audio.h"
 #include "codec.h"
+#include "avsync.h"
 
 //----------------------------------------------------------------------------
 
@@ -123,6 +133,11 @@ char CodecUsePossibleDefectFrames;
 //	Video
 //----------------------------------------------------------------------------
 
+static int CodecVideoThreads;		///< software decoder threads (0/1 off)
+static int CodecVideoThreadType;	///< thread type (0 slice, 1 frame)
+static int CodecVideoThreadLatency;	///< max. frames delay by frame threads
+static volatile int CodecVideoThreadConfig;	///< thread setup generation
+
 //----------------------------------------------------------------------------
 //	Call-backs
 //----------------------------------------------------------------------------
@@ -140,6 +155,8 @@ static enum AVPixelFormat Codec_get_format(AVCodecContext * video_ctx,
     const enum AVPixelFormat *fmt)
 {
     VideoDecoder *decoder;
+    enum AVPixelFormat pix_fmt;
+    const AVPixFmtDescriptor *desc;
 
     decoder = video_ctx->opaque;
 #if LIBAVCODEC_VERSION_INT == AV_VERSION_INT(54,86,100)
@@ -161,7 +178,41 @@ static enum AVPixelFormat Codec_get_format(AVCodecContext * video_ctx,
     }
 
     decoder->GetFormatDone = 1;
-    return Video_get_format(decoder->HwDecoder, video_ctx, fmt);
+
+    // threaded decoder: hardware surfaces aren't thread safe, offer only
+    // the software formats to the video module
+    if (video_ctx->active_thread_type) {
+	enum AVPixelFormat sw_fmts[64];
+	const enum AVPixelFormat *fmt_idx;
+	int n;
+
+	n = 0;
+	for (fmt_idx = fmt; *fmt_idx != AV_PIX_FMT_NONE; fmt_idx++) {
+	    desc = av_pix_fmt_desc_get(*fmt_idx);
+	    if (desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)
+		&& n < (int)(sizeof(sw_fmts) / sizeof(*sw_fmts)) - 1) {
+		sw_fmts[n++] = *fmt_idx;
+	    }
+	}
+	sw_fmts[n] = AV_PIX_FMT_NONE;
+	if (n) {
+	    return Video_get_format(decoder->HwDecoder, video_ctx, sw_fmts);
+	}
+	Error(_("codec/video: no software format for threaded decoder\n"));
+	return Video_get_format(decoder->HwDecoder, video_ctx, fmt);
+    }
+
+    pix_fmt = Video_get_format(decoder->HwDecoder, video_ctx, fmt);
+
+    // remember software fallback, next open can use decoder threads
+    desc = av_pix_fmt_desc_get(pix_fmt);
+    if (!desc || !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+	decoder->SoftwareCodecId = video_ctx->codec_id;
+    } else {
+	decoder->SoftwareCodecId = AV_CODEC_ID_NONE;
+    }
+
+    return pix_fmt;
 }
 
 static void Codec_free_buffer(void *opaque, uint8_t *data);
@@ -383,6 +434,81 @@ void CodecVideoDelDecoder(VideoDecoder * decoder)
     free(decoder);
 }
 
+/**
+**	Setup ffmpeg decoder threads.
+**
+**	Threads are only used for streams, which are decoded by software:
+**	hardware decoding is disabled by config or the last stream with
+**	this codec wasn't accepted by the hardware decoder.  The video
+**	hardware surfaces are handed out only to the unthreaded decoder.
+**
+**	Frame threads delay the output by one frame per thread, the number
+**	of frame threads is limited by the latency budget.  Without budget
+**	slice threads are used.
+**
+**	@param decoder	private video decoder
+**	@param codec_id	video codec id
+*/
+static void CodecVideoSetupThreads(VideoDecoder * decoder, int codec_id)
+{
+    AVCodecContext *video_ctx;
+    const AVCodec *video_codec;
+    int count;
+    int type;
+
+    video_ctx = decoder->VideoCtx;
+    video_codec = decoder->VideoCodec;
+    video_ctx->thread_count = 1;
+    decoder->ThreadConfig = CodecVideoThreadConfig;
+
+    if (CodecVideoThreads <= 1) {
+	return;
+    }
+    if (video_codec->capabilities & (CODEC_CAP_HWACCEL_VDPAU |
+	    CODEC_CAP_HWACCEL)) {
+	return;
+    }
+    if (VideoHardwareDecoder && (codec_id != AV_CODEC_ID_MPEG2VIDEO
+	    || VideoHardwareDecoder != 1)
+	&& decoder->SoftwareCodecId != codec_id) {
+	return;				// hardware decoder expected
+    }
+
+    count = CodecVideoThreads;
+    type = 0;
+#ifdef CODEC_CAP_FRAME_THREADS
+    if (CodecVideoThreadType
+	&& (video_codec->capabilities & CODEC_CAP_FRAME_THREADS)) {
+	if (count > CodecVideoThreadLatency + 1) {
+	    count = CodecVideoThreadLatency + 1;
+	}
+	if (count > 1) {
+	    type = FF_THREAD_FRAME;
+	} else {
+	    count = CodecVideoThreads;
+	}
+    }
+#endif
+#ifdef CODEC_CAP_SLICE_THREADS
+    if (!type && (video_codec->capabilities & CODEC_CAP_SLICE_THREADS)) {
+	type = FF_THREAD_SLICE;
+    }
+#endif
+    if (!type) {
+	Debug(3, "codec: codec supports no usable threads\n");
+	return;
+    }
+
+    Debug(3, "codec: using %d %s threads\n", count,
+	type == FF_THREAD_FRAME ? "frame" : "slice");
+    video_ctx->thread_count = count;
+    video_ctx->thread_type = type;
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58,134,100)
+    // only software buffers are used with threads
+    video_ctx->thread_safe_callbacks = 1;
+#endif
+}
+
 /**
 **	Open video decoder.
 **
@@ -425,8 +551,7 @@ void CodecVideoOpen(VideoDecoder * decoder, int codec_id)
     if (!(decoder->VideoCtx = avcodec_alloc_context3(video_codec))) {
 	Fatal(_("codec: can't allocate video codec context\n"));
     }
-    // FIXME: for software decoder use all cpus, otherwise 1
-    decoder->VideoCtx->thread_count = 1;
+    CodecVideoSetupThreads(decoder, codec_id);
     pthread_mutex_lock(&CodecLockMutex);
     // open codec
 #if LIBAVCODEC_VERSION_INT <= AV_VERSION_INT(53,5,0)
@@ -442,8 +567,6 @@ void CodecVideoOpen(VideoDecoder * decoder, int codec_id)
 	// taken from mplayer vd_ffmpeg.c
 	decoder->VideoCtx->slice_flags =
 	    SLICE_FLAG_CODED_ORDER | SLICE_FLAG_ALLOW_FIELD;
-	decoder->VideoCtx->thread_count = 1;
-	decoder->VideoCtx->active_thread_type = 0;
     }
 
     if (avcodec_open2(decoder->VideoCtx, video_codec, NULL) < 0) {
@@ -466,7 +589,10 @@ void CodecVideoOpen(VideoDecoder * decoder, int codec_id)
 #ifndef USE_MPEG_COMPLETE
 	// we send incomplete frames, for old PES recordings
 	// this breaks the decoder for some stations
-	decoder->VideoCtx->flags |= CODEC_FLAG_TRUNCATED;
+	// frame threads can't handle truncated packets
+	if (!(decoder->VideoCtx->active_thread_type & FF_THREAD_FRAME)) {
+	    decoder->VideoCtx->flags |= CODEC_FLAG_TRUNCATED;
+	}
 #endif
     }
     // FIXME: own memory management for video frames.
@@ -491,16 +617,15 @@ void CodecVideoOpen(VideoDecoder * decoder, int codec_id)
 	decoder->VideoCtx->draw_horiz_band = Codec_draw_horiz_band;
 	decoder->VideoCtx->slice_flags =
 	    SLICE_FLAG_CODED_ORDER | SLICE_FLAG_ALLOW_FIELD;
-	decoder->VideoCtx->thread_count = 1;
-	decoder->VideoCtx->active_thread_type = 0;
     } else {
 	decoder->VideoCtx->get_format = Codec_get_format;
 	decoder->VideoCtx->get_buffer2 = Codec_get_buffer2;
-	decoder->VideoCtx->thread_count = 1;
-	decoder->VideoCtx->active_thread_type = 0;
 	decoder->VideoCtx->draw_horiz_band = NULL;
-	decoder->VideoCtx->hwaccel_context =
-	    VideoGetHwAccelContext(decoder->HwDecoder);
+	// threaded decoder uses only software buffers
+	if (!decoder->VideoCtx->active_thread_type) {
+	    decoder->VideoCtx->hwaccel_context =
+		VideoGetHwAccelContext(decoder->HwDecoder);
+	}
     }
 
 #if 0
@@ -534,6 +659,52 @@ void CodecVideoOpen(VideoDecoder * decoder, int codec_id)
 #endif
 }
 
+/**
+**	Set video decoder threads for software decoding.
+**
+**	Used with the next opened video codec.
+**
+**	@param count	number of decoder threads (0 or 1 disables threads)
+**	@param type	thread type (0 slice, 1 frame threads)
+**	@param latency	max. frames output delay allowed for frame threads
+*/
+void CodecSetVideoThreads(int count, int type, int latency)
+{
+    if (count < 0) {
+	count = 0;
+    } else if (count > CODEC_VIDEO_THREADS_MAX) {
+	count = CODEC_VIDEO_THREADS_MAX;
+    }
+    if (latency < 0) {
+	latency = 0;
+    } else if (latency > CODEC_VIDEO_THREADS_MAX) {
+	latency = CODEC_VIDEO_THREADS_MAX;
+    }
+    type = type ? 1 : 0;
+    if (count != CodecVideoThreads || type != CodecVideoThreadType
+	|| latency != CodecVideoThreadLatency) {
+	CodecVideoThreads = count;
+	CodecVideoThreadType = type;
+	CodecVideoThreadLatency = latency;
+	++CodecVideoThreadConfig;
+    }
+}
+
+/**
+**	Check if the video decoder threads setup changed.
+**
+**	An open codec keeps the threads it was opened with, a codec kept
+**	for a fast channel switch must be reopened to use the new setup.
+**
+**	@param decoder	video decoder data
+**
+**	@returns true if the codec was opened with an older thread setup.
+*/
+int CodecVideoThreadsChanged(const VideoDecoder * decoder)
+{
+    return decoder->ThreadConfig != CodecVideoThreadConfig;
+}
+
 /**
 **	Close video decoder.
 **
@@ -685,6 +856,22 @@ void CodecVideoFlushBuffers(VideoDecoder * decoder)
     }
 }
 
+/**
+**	Restart the video decoder for a new stream.
+**
+**	The codec context is kept open, output starts again with the
+**	first decodable picture.
+**
+**	@param decoder	video decoder data
+*/
+void CodecVideoRestart(VideoDecoder * decoder)
+{
+    CodecVideoFlushBuffers(decoder);
+#ifdef FFMPEG_WORKAROUND_ARTIFACTS
+    decoder->FirstKeyFrame = 1;
+#endif
+}
+
 //----------------------------------------------------------------------------
 //	Audio
 //----------------------------------------------------------------------------
@@ -711,9 +898,7 @@ struct _audio_decoder_
     int HwSampleRate;			///< hw sample rate
     int HwChannels;			///< hw channels
 
-#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(56,28,1)
     AVFrame *Frame;			///< decoded audio frame buffer
-#endif
 
 #if !defined(USE_SWRESAMPLE) && !defined(USE_AVRESAMPLE)
     ReSampleContext *ReSample;		///< old resampling context
@@ -740,6 +925,10 @@ struct _audio_decoder_
     int Drift;				///< accumulated audio drift
     int DriftCorr;			///< audio drift correction value
     int DriftFrac;			///< audio drift fraction for ac3
+    int SyncPpm;			///< audio/video sync correction in ppm
+    int SyncDistance;			///< resample compensation distance
+    int Resampling;			///< flag: samples go through resample
+    int ResampleUsed;			///< flag: resample may buffer samples
 
 #if !defined(USE_SWRESAMPLE) && !defined(USE_AVRESAMPLE)
     struct AVResampleContext *AvResample;	///< second audio resample context
@@ -795,6 +984,10 @@ AudioDecoder *CodecAudioNewDecoder(void)
     if (!(audio_decoder->Frame = av_frame_alloc())) {
 	Fatal(_("codec: can't allocate audio decoder frame buffer\n"));
     }
+#else
+    if (!(audio_decoder->Frame = avcodec_alloc_frame())) {
+	Fatal(_("codec: can't allocate audio decoder frame buffer\n"));
+    }
 #endif
 
     return audio_decoder;
@@ -809,6 +1002,8 @@ void CodecAudioDelDecoder(AudioDecoder * decoder)
 {
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(56,28,1)
     av_frame_free(&decoder->Frame);	// callee does checks
+#else
+    av_freep(&decoder->Frame);
 #endif
     free(decoder);
 }
@@ -924,6 +1119,8 @@ void CodecAudioClose(AudioDecoder * audio_decoder)
 	avresample_free(&audio_decoder->Resample);
     }
 #endif
+    audio_decoder->Resampling = 0;
+    audio_decoder->ResampleUsed = 0;
     if (audio_decoder->AudioCtx) {
 	pthread_mutex_lock(&CodecLockMutex);
 	avcodec_close(audio_decoder->AudioCtx);
@@ -1032,6 +1229,240 @@ static void CodecReorderAudioFrame(int16_t * buf, int size, int channels)
     }
 }
 
+#if defined(USE_SWRESAMPLE) || defined(USE_AVRESAMPLE)
+
+/**
+**	Convert float sample to signed 16 bit sample.
+**
+**	Rounds to nearest like the vector versions, so the output doesn't
+**	depend on the cpu.
+**
+**	@param f	float sample -1.0 .. 1.0
+*/
+static inline int16_t CodecAudioFloatToS16(float f)
+{
+    f *= 32768.0f;
+    if (f >= 32767.0f) {
+	return 32767;
+    }
+    if (!(f > -32768.0f)) {		// also catches NaN
+	return -32768;
+    }
+    return lrintf(f);
+}
+
+#if defined(__SSE2__)
+
+/**
+**	Convert four float samples to 32 bit, like CodecAudioFloatToS16.
+**
+**	@param src	input float samples
+*/
+static inline __m128i CodecAudioFloat4ToS32(const float *src)
+{
+    __m128 f;
+
+    f = _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(32768.0f));
+    // max returns the second operand for NaN
+    f = _mm_min_ps(_mm_max_ps(f, _mm_set1_ps(-32768.0f)),
+	_mm_set1_ps(32767.0f));
+    return _mm_cvtps_epi32(f);		// rounds to nearest
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+/**
+**	Convert four float samples to 32 bit, like CodecAudioFloatToS16.
+**
+**	@param src	input float samples
+*/
+static inline int32x4_t CodecAudioFloat4ToS32(const float *src)
+{
+    float32x4_t f;
+
+    f = vmulq_n_f32(vld1q_f32(src), 32768.0f);
+    f = vbslq_f32(vceqq_f32(f, f), f, vdupq_n_f32(-32768.0f));	// NaN
+    f = vminq_f32(vmaxq_f32(f, vdupq_n_f32(-32768.0f)),
+	vdupq_n_f32(32767.0f));
+    return vcvtnq_s32_f32(f);		// rounds to nearest
+}
+
+#endif
+
+/**
+**	Convert interleaved float samples to interleaved 16 bit samples.
+**
+**	@param dst	output sample buffer
+**	@param src	input float samples
+**	@param n	number of samples (all channels)
+*/
+static void CodecAudioFltToS16(int16_t * dst, const float *src, int n)
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    for (; i + 8 <= n; i += 8) {
+	_mm_storeu_si128((__m128i *) (dst + i),
+	    _mm_packs_epi32(CodecAudioFloat4ToS32(src + i),
+		CodecAudioFloat4ToS32(src + i + 4)));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 8 <= n; i += 8) {
+	vst1q_s16(dst + i,
+	    vcombine_s16(vqmovn_s32(CodecAudioFloat4ToS32(src + i)),
+		vqmovn_s32(CodecAudioFloat4ToS32(src + i + 4))));
+    }
+#endif
+    for (; i < n; ++i) {
+	dst[i] = CodecAudioFloatToS16(src[i]);
+    }
+}
+
+/**
+**	Interleave planar float samples into 16 bit samples.
+**
+**	@param dst	output sample buffer
+**	@param src	input float sample planes
+**	@param channels	number of channels (planes)
+**	@param n	number of samples per channel
+*/
+static void CodecAudioFltPToS16(int16_t * dst, const float *const *src,
+    int channels, int n)
+{
+    int i;
+    int ch;
+
+    i = 0;
+    if (channels == 2) {		// stereo fast path
+#if defined(__SSE2__)
+	for (; i + 8 <= n; i += 8) {
+	    __m128i l;
+	    __m128i r;
+
+	    l = _mm_packs_epi32(CodecAudioFloat4ToS32(src[0] + i),
+		CodecAudioFloat4ToS32(src[0] + i + 4));
+	    r = _mm_packs_epi32(CodecAudioFloat4ToS32(src[1] + i),
+		CodecAudioFloat4ToS32(src[1] + i + 4));
+	    _mm_storeu_si128((__m128i *) (dst + 2 * i),
+		_mm_unpacklo_epi16(l, r));
+	    _mm_storeu_si128((__m128i *) (dst + 2 * i + 8),
+		_mm_unpackhi_epi16(l, r));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for (; i + 8 <= n; i += 8) {
+	    int16x8x2_t lr;
+
+	    lr.val[0] =
+		vcombine_s16(vqmovn_s32(CodecAudioFloat4ToS32(src[0] + i)),
+		vqmovn_s32(CodecAudioFloat4ToS32(src[0] + i + 4)));
+	    lr.val[1] =
+		vcombine_s16(vqmovn_s32(CodecAudioFloat4ToS32(src[1] + i)),
+		vqmovn_s32(CodecAudioFloat4ToS32(src[1] + i + 4)));
+	    vst2q_s16(dst + 2 * i, lr);
+	}
+#endif
+    }
+    for (; i < n; ++i) {
+	for (ch = 0; ch < channels; ++ch) {
+	    dst[i * channels + ch] = CodecAudioFloatToS16(src[ch][i]);
+	}
+    }
+}
+
+#endif
+
+/**
+**	Interleave planar 16 bit samples.
+**
+**	@param dst	output sample buffer
+**	@param src	input sample planes
+**	@param channels	number of channels (planes)
+**	@param n	number of samples per channel
+*/
+static void CodecAudioS16PToS16(int16_t * dst, const int16_t * const *src,
+    int channels, int n)
+{
+    int i;
+    int ch;
+
+    i = 0;
+    if (channels == 2) {		// stereo fast path
+#if defined(__SSE2__)
+	for (; i + 8 <= n; i += 8) {
+	    __m128i l;
+	    __m128i r;
+
+	    l = _mm_loadu_si128((const __m128i *)(src[0] + i));
+	    r = _mm_loadu_si128((const __m128i *)(src[1] + i));
+	    _mm_storeu_si128((__m128i *) (dst + 2 * i),
+		_mm_unpacklo_epi16(l, r));
+	    _mm_storeu_si128((__m128i *) (dst + 2 * i + 8),
+		_mm_unpackhi_epi16(l, r));
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 8 <= n; i += 8) {
+	    int16x8x2_t lr;
+
+	    lr.val[0] = vld1q_s16(src[0] + i);
+	    lr.val[1] = vld1q_s16(src[1] + i);
+	    vst2q_s16(dst + 2 * i, lr);
+	}
+#endif
+    }
+    for (; i < n; ++i) {
+	for (ch = 0; ch < channels; ++ch) {
+	    dst[i * channels + ch] = src[ch][i];
+	}
+    }
+}
+
+#if defined(USE_SWRESAMPLE) || defined(USE_AVRESAMPLE)
+
+/**
+**	Convert decoded audio frame to interleaved 16 bit samples.
+**
+**	Handles the common decoder output formats without resampling, the
+**	channel count and sample rate are not changed.
+**
+**	@param dst		output sample buffer
+**	@param frame		decoded audio frame
+**	@param sample_fmt	sample format of frame
+**	@param channels		number of channels in frame
+**
+**	@returns number of bytes written to dst, -1 if the sample format
+**	isn't supported.
+*/
+static int CodecAudioConvertFrame(int16_t * dst, const AVFrame * frame,
+    enum AVSampleFormat sample_fmt, int channels)
+{
+    int n;
+
+    n = frame->nb_samples;
+    switch (sample_fmt) {
+	case AV_SAMPLE_FMT_S16:
+	    memcpy(dst, frame->extended_data[0], n * channels * 2);
+	    break;
+	case AV_SAMPLE_FMT_S16P:
+	    CodecAudioS16PToS16(dst,
+		(const int16_t * const *)frame->extended_data, channels, n);
+	    break;
+	case AV_SAMPLE_FMT_FLT:
+	    CodecAudioFltToS16(dst, (const float *)frame->extended_data[0],
+		n * channels);
+	    break;
+	case AV_SAMPLE_FMT_FLTP:
+	    CodecAudioFltPToS16(dst,
+		(const float *const *)frame->extended_data, channels, n);
+	    break;
+	default:
+	    return -1;
+    }
+    return n * channels * 2;
+}
+
+#endif
+
 /**
 **	Handle audio format changes helper.
 **
@@ -1490,35 +1921,74 @@ void CodecAudioEnqueue(AudioDecoder * audio_decoder, int16_t * data, int count)
     AudioEnqueue(data, count);
 }
 
-int myavcodec_decode_audio3(AVCodecContext *avctx, int16_t *samples, int *frame_size_ptr, AVPacket *avpkt)
+/**
+**	Decode audio frame into interleaved sample buffer.
+**
+**	Emulates the removed avcodec_decode_audio3 with the persistent
+**	decoder frame, no frame is allocated per packet.
+**
+**	@param audio_decoder	audio decoder data
+**	@param samples		output sample buffer
+**	@param[in,out] frame_size_ptr	size of sample buffer, bytes decoded
+**	@param avpkt		audio packet
+*/
+static int CodecAudioDecodeFrame(AudioDecoder * audio_decoder,
+    int16_t * samples, int *frame_size_ptr, AVPacket * avpkt)
 {
-    AVFrame *frame = av_frame_alloc();
-    int ret, got_frame = 0;
+    AVCodecContext *audio_ctx;
+    AVFrame *frame;
+    int ret;
+    int got_frame;
+
+    audio_ctx = audio_decoder->AudioCtx;
+    frame = audio_decoder->Frame;
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(56,28,1)
+    avcodec_get_frame_defaults(frame);
+#else
+    av_frame_unref(frame);
+#endif
 
-    if (!frame)
-	return AVERROR(ENOMEM);
-    ret = avcodec_decode_audio4(avctx, frame, &got_frame, avpkt);
+    got_frame = 0;
+    ret = avcodec_decode_audio4(audio_ctx, frame, &got_frame, avpkt);
     if (ret >= 0 && got_frame) {
-	int i, ch;
-	int planar = av_sample_fmt_is_planar(avctx->sample_fmt);
-	int data_size = av_get_bytes_per_sample(avctx->sample_fmt);
-	if (data_size < 0) {
-	    /* This should not occur, checking just for paranoia */
-	    fprintf(stderr, "Failed to calculate data size\n");
-	    exit(1);
+	int data_size;
+	int n;
+
+	data_size = av_get_bytes_per_sample(audio_ctx->sample_fmt);
+	n = data_size * audio_ctx->channels * frame->nb_samples;
+	if (data_size <= 0 || n > *frame_size_ptr) {
+	    Error(_("codec/audio: unsupported audio frame\n"));
+	    *frame_size_ptr = 0;
+	    return ret;
 	}
-	for (i = 0; i < frame->nb_samples; i++)
-	    for (ch = 0; ch < avctx->channels; ch++) {
-		memcpy(samples, frame->extended_data[ch] + data_size * i, data_size);
-		samples = (char *)samples + data_size;
+	if (av_sample_fmt_is_planar(audio_ctx->sample_fmt)) {
+	    if (audio_ctx->sample_fmt == AV_SAMPLE_FMT_S16P) {
+		CodecAudioS16PToS16(samples,
+		    (const int16_t * const *)frame->extended_data,
+		    audio_ctx->channels, frame->nb_samples);
+	    } else {
+		uint8_t *out;
+		int i;
+		int ch;
+
+		out = (uint8_t *) samples;
+		for (i = 0; i < frame->nb_samples; i++) {
+		    for (ch = 0; ch < audio_ctx->channels; ch++) {
+			memcpy(out, frame->extended_data[ch] + data_size * i,
+			    data_size);
+			out += data_size;
+		    }
+		}
 	    }
-	*frame_size_ptr = data_size * avctx->channels * frame->nb_samples;
+	} else {
+	    memcpy(samples, frame->extended_data[0], n);
+	}
+	*frame_size_ptr = n;
     } else {
 	*frame_size_ptr = 0;
     }
-    av_frame_free(&frame);
     return ret;
- }
+}
 
 /**
 **	Decode an audio packet.
@@ -1540,7 +2010,8 @@ void CodecAudioDecode(AudioDecoder * audio_decoder, const AVPacket * avpkt)
 
     // FIXME: don't need to decode pass-through codecs
     buf_sz = sizeof(buf);
-    l = myavcodec_decode_audio3(audio_ctx, buf, &buf_sz, (AVPacket *) avpkt);
+    l = CodecAudioDecodeFrame(audio_decoder, buf, &buf_sz,
+	(AVPacket *) avpkt);
     if (avpkt->size != l) {
 	if (l == AVERROR(EAGAIN)) {
 	    Error(_("codec: latm\n"));
@@ -1653,6 +2124,63 @@ void CodecAudioDecode(AudioDecoder * audio_decoder, const AVPacket * avpkt)
 
 #if defined(USE_SWRESAMPLE) || defined(USE_AVRESAMPLE)
 
+/**
+**	Set resample compensation.
+**
+**	Combines the wall clock drift correction with the audio/video sync
+**	correction.
+**
+**	@param audio_decoder	audio decoder data
+**	@param distance		compensation distance in samples
+*/
+static void CodecAudioCompensate(AudioDecoder * audio_decoder, int distance)
+{
+    int delta;
+
+    audio_decoder->SyncDistance = distance;
+    delta = audio_decoder->DriftCorr / 10
+	- (audio_decoder->SyncPpm * (int64_t) distance) / (1000 * 1000);
+
+#ifdef USE_SWRESAMPLE
+    if (swr_set_compensation(audio_decoder->Resample, delta, distance)) {
+	Debug(3, "codec/audio: swr_set_compensation failed\n");
+    }
+#endif
+#ifdef USE_AVRESAMPLE
+    if (avresample_set_compensation(audio_decoder->Resample, delta,
+	    distance)) {
+	Debug(3, "codec/audio: avresample_set_compensation failed\n");
+    }
+#endif
+}
+
+/**
+**	Apply audio/video sync correction.
+**
+**	The video sync asks for a small audio speed change, instead of
+**	duping or dropping video frames.  This is only possible, if the
+**	audio goes through the resampler.  A pending correction keeps the
+**	samples off the direct path, see CodecAudioDecode.
+**
+**	@param audio_decoder	audio decoder data
+*/
+static void CodecAudioSyncCorrection(AudioDecoder * audio_decoder)
+{
+    int resample;
+    int ppm;
+
+    // not for SPDIF/HDMI pass-through or without resample context
+    resample = audio_decoder->Resampling;
+
+    ppm = AvSyncAudioCorrection(resample);
+    if (!resample || ppm == audio_decoder->SyncPpm) {
+	return;
+    }
+    audio_decoder->SyncPpm = ppm;
+    CodecAudioCompensate(audio_decoder, audio_decoder->SyncDistance ?
+	audio_decoder->SyncDistance : 10 * audio_decoder->HwSampleRate);
+}
+
 /**
 **	Set/update audio pts clock.
 **
@@ -1668,9 +2196,12 @@ static void CodecAudioSetClock(AudioDecoder * audio_decoder, int64_t pts)
     int64_t pts_diff;
     int drift;
     int corr;
+#endif
 
     AudioSetClock(pts);
+    CodecAudioSyncCorrection(audio_decoder);
 
+#ifdef USE_AUDIO_DRIFT_CORRECTION
     delay = AudioGetDelay();
     if (!delay) {
 	return;
@@ -1741,33 +2272,22 @@ static void CodecAudioSetClock(AudioDecoder * audio_decoder, int64_t pts)
 	}
     }
 
-#ifdef USE_SWRESAMPLE
-    if (audio_decoder->Resample && audio_decoder->DriftCorr) {
+    if (audio_decoder->Resample && (audio_decoder->DriftCorr
+	    || audio_decoder->SyncPpm)) {
 	int distance;
 
+#ifdef USE_SWRESAMPLE
 	// try workaround for buggy ffmpeg 0.10
 	if (abs(audio_decoder->DriftCorr) < 2000) {
 	    distance = (pts_diff * audio_decoder->HwSampleRate) / (900 * 1000);
 	} else {
 	    distance = (pts_diff * audio_decoder->HwSampleRate) / (90 * 1000);
 	}
-	if (swr_set_compensation(audio_decoder->Resample,
-		audio_decoder->DriftCorr / 10, distance)) {
-	    Debug(3, "codec/audio: swr_set_compensation failed\n");
-	}
-    }
-#endif
-#ifdef USE_AVRESAMPLE
-    if (audio_decoder->Resample && audio_decoder->DriftCorr) {
-	int distance;
-
+#else
 	distance = (pts_diff * audio_decoder->HwSampleRate) / (900 * 1000);
-	if (avresample_set_compensation(audio_decoder->Resample,
-		audio_decoder->DriftCorr / 10, distance)) {
-	    Debug(3, "codec/audio: swr_set_compensation failed\n");
-	}
-    }
 #endif
+	CodecAudioCompensate(audio_decoder, distance);
+    }
     if (1) {
 	static int c;
 
@@ -1776,8 +2296,6 @@ static void CodecAudioSetClock(AudioDecoder * audio_decoder, int64_t pts)
 		audio_decoder->DriftCorr, drift * 1000 / 90, corr);
 	}
     }
-#else
-    AudioSetClock(pts);
 #endif
 }
 
@@ -1791,6 +2309,12 @@ static void CodecAudioUpdateFormat(AudioDecoder * audio_decoder)
     int passthrough;
     const AVCodecContext *audio_ctx;
 
+    // new resample context, sync correction must be set again
+    audio_decoder->Resampling = 0;
+    audio_decoder->ResampleUsed = 0;
+    audio_decoder->SyncPpm = 0;
+    audio_decoder->SyncDistance = 0;
+
     if (CodecAudioUpdateHelper(audio_decoder, &passthrough)) {
 	// FIXME: handle swresample format conversions.
 	return;
@@ -1817,7 +2341,7 @@ static void CodecAudioUpdateFormat(AudioDecoder * audio_decoder)
 	audio_ctx->channel_layout, audio_ctx->sample_fmt,
 	audio_ctx->sample_rate, 0, NULL);
     if (audio_decoder->Resample) {
-	swr_init(audio_decoder->Resample);
+	audio_decoder->Resampling = swr_init(audio_decoder->Resample) >= 0;
     } else {
 	Error(_("codec/audio: can't setup resample\n"));
     }
@@ -1847,6 +2371,47 @@ static void CodecAudioUpdateFormat(AudioDecoder * audio_decoder)
 	Error(_("codec/audio: can't open resample\n"));
 	return;
     }
+    audio_decoder->Resampling = 1;
+#endif
+}
+
+/**
+**	Drain the samples buffered in the resample context.
+**
+**	Called before samples take the direct path again, so the samples
+**	delayed by the resampler are played and not lost.  The context is
+**	restarted, this also ends a rate compensation.
+**
+**	@param audio_decoder	audio decoder data
+*/
+static void CodecAudioResampleDrain(AudioDecoder * audio_decoder)
+{
+    uint8_t outbuf[8192 * 2 * 8];
+    uint8_t *out[1];
+    int n;
+
+    audio_decoder->ResampleUsed = 0;
+    out[0] = outbuf;
+#ifdef USE_SWRESAMPLE
+    n = swr_convert(audio_decoder->Resample, out,
+	sizeof(outbuf) / (2 * audio_decoder->HwChannels), NULL, 0);
+#else
+    n = avresample_convert(audio_decoder->Resample, out, 0,
+	sizeof(outbuf) / (2 * audio_decoder->HwChannels), NULL, 0, 0);
+#endif
+    if (n > 0) {
+	Debug(4, "codec/audio: %d samples drained from resample\n", n);
+	if (!(audio_decoder->Passthrough & CodecPCM)) {
+	    CodecReorderAudioFrame((int16_t *) outbuf,
+		n * 2 * audio_decoder->HwChannels, audio_decoder->HwChannels);
+	}
+	AudioEnqueue(outbuf, n * 2 * audio_decoder->HwChannels);
+    }
+#ifdef USE_SWRESAMPLE
+    audio_decoder->Resampling = swr_init(audio_decoder->Resample) >= 0;
+#else
+    avresample_close(audio_decoder->Resample);
+    audio_decoder->Resampling = !avresample_open(audio_decoder->Resample);
 #endif
 }
 
@@ -1864,11 +2429,7 @@ void CodecAudioDecode(AudioDecoder * audio_decoder, const AVPacket * avpkt)
 {
     AVCodecContext *audio_ctx;
 
-#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(56,28,1)
-    AVFrame frame[1];
-#else
     AVFrame *frame;
-#endif
     int got_frame;
     int n;
 
@@ -1876,11 +2437,11 @@ void CodecAudioDecode(AudioDecoder * audio_decoder, const AVPacket * avpkt)
 
     // FIXME: don't need to decode pass-through codecs
 
-    // new AVFrame API
+    // persistent frame, no allocation per packet
+    frame = audio_decoder->Frame;
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(56,28,1)
     avcodec_get_frame_defaults(frame);
 #else
-    frame = audio_decoder->Frame;
     av_frame_unref(frame);
 #endif
 
@@ -1939,22 +2500,57 @@ void CodecAudioDecode(AudioDecoder * audio_decoder, const AVPacket * avpkt)
 	    "codec/audio: channels %d samples %d plane %d data %d\n",
 	    audio_ctx->channels, frame->nb_samples, plane_sz, data_sz);
     }
+    //
+    //	no rate change and no drift or sync correction needed: convert
+    //	directly into the audio output ring buffer, without resample context.
+    //
+    if (!audio_decoder->DriftCorr && !audio_decoder->SyncPpm
+	&& audio_decoder->HwSampleRate == audio_ctx->sample_rate
+	&& audio_decoder->HwChannels == audio_ctx->channels) {
+	void *p;
+
+	if (audio_decoder->ResampleUsed) {	// keep the delayed samples
+	    CodecAudioResampleDrain(audio_decoder);
+	}
+	n = frame->nb_samples * 2 * audio_decoder->HwChannels;
+	if (AudioGetEnqueueBuffer(&p) >= n
+	    && CodecAudioConvertFrame(p, frame, audio_ctx->sample_fmt,
+		audio_ctx->channels) == n) {
+	    if (!(audio_decoder->Passthrough & CodecPCM)) {
+		CodecReorderAudioFrame(p, n, audio_decoder->HwChannels);
+	    }
+	    AudioEnqueueCommit(n);
+	    return;
+	}
+    }
 #ifdef USE_SWRESAMPLE
     if (audio_decoder->Resample) {
 	uint8_t outbuf[8192 * 2 * 8];
 	uint8_t *out[1];
-
-	out[0] = outbuf;
-	n = swr_convert(audio_decoder->Resample, out,
-	    sizeof(outbuf) / (2 * audio_decoder->HwChannels),
+	int max;
+
+	// resample directly into ring buffer, if enough contiguous space
+	max = (frame->nb_samples * audio_decoder->HwSampleRate) /
+	    audio_ctx->sample_rate + 64;
+	if (AudioGetEnqueueBuffer((void **)out) <
+	    max * 2 * audio_decoder->HwChannels) {
+	    out[0] = outbuf;
+	    max = sizeof(outbuf) / (2 * audio_decoder->HwChannels);
+	}
+	n = swr_convert(audio_decoder->Resample, out, max,
 	    (const uint8_t **)frame->extended_data, frame->nb_samples);
+	audio_decoder->ResampleUsed = 1;
 	if (n > 0) {
 	    if (!(audio_decoder->Passthrough & CodecPCM)) {
-		CodecReorderAudioFrame((int16_t *) outbuf,
+		CodecReorderAudioFrame((int16_t *) out[0],
 		    n * 2 * audio_decoder->HwChannels,
 		    audio_decoder->HwChannels);
 	    }
-	    AudioEnqueue(outbuf, n * 2 * audio_decoder->HwChannels);
+	    if (out[0] == outbuf) {
+		AudioEnqueue(outbuf, n * 2 * audio_decoder->HwChannels);
+	    } else {
+		AudioEnqueueCommit(n * 2 * audio_decoder->HwChannels);
+	    }
 	}
 	return;
     }
@@ -1964,19 +2560,31 @@ void CodecAudioDecode(AudioDecoder * audio_decoder, const AVPacket * avpkt)
     if (audio_decoder->Resample) {
 	uint8_t outbuf[8192 * 2 * 8];
 	uint8_t *out[1];
-
-	out[0] = outbuf;
-	n = avresample_convert(audio_decoder->Resample, out, 0,
-	    sizeof(outbuf) / (2 * audio_decoder->HwChannels),
+	int max;
+
+	// resample directly into ring buffer, if enough contiguous space
+	max = (frame->nb_samples * audio_decoder->HwSampleRate) /
+	    audio_ctx->sample_rate + 64;
+	if (AudioGetEnqueueBuffer((void **)out) <
+	    max * 2 * audio_decoder->HwChannels) {
+	    out[0] = outbuf;
+	    max = sizeof(outbuf) / (2 * audio_decoder->HwChannels);
+	}
+	n = avresample_convert(audio_decoder->Resample, out, 0, max,
 	    (uint8_t **) frame->extended_data, 0, frame->nb_samples);
+	audio_decoder->ResampleUsed = 1;
 	// FIXME: set out_linesize, in_linesize correct
 	if (n > 0) {
 	    if (!(audio_decoder->Passthrough & CodecPCM)) {
-		CodecReorderAudioFrame((int16_t *) outbuf,
+		CodecReorderAudioFrame((int16_t *) out[0],
 		    n * 2 * audio_decoder->HwChannels,
 		    audio_decoder->HwChannels);
 	    }
-	    AudioEnqueue(outbuf, n * 2 * audio_decoder->HwChannels);
+	    if (out[0] == outbuf) {
+		AudioEnqueue(outbuf, n * 2 * audio_decoder->HwChannels);
+	    } else {
+		AudioEnqueueCommit(n * 2 * audio_decoder->HwChannels);
+	    }
 	}
 	return;
     }
@@ -1997,7 +2605,14 @@ void CodecAudioDecode(AudioDecoder * audio_decoder, const AVPacket * avpkt)
 */
 void CodecAudioFlushBuffers(AudioDecoder * decoder)
 {
-    avcodec_flush_buffers(decoder->AudioCtx);
+    if (decoder->AudioCtx) {
+	avcodec_flush_buffers(decoder->AudioCtx);
+    }
+    decoder->SpdifIndex = 0;		// drop partial pass-through frame
+    decoder->SpdifCount = 0;
+#ifdef USE_AUDIO_DRIFT_CORRECTION
+    decoder->LastDelay = 0;		// restart drift measurement
+#endif
 }
 
 //----------------------------------------------------------------------------
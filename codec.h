@@ -60,6 +60,8 @@ struct _video_decoder_
      AVCodecContext *VideoCtx;           ///< video codec context
      int FirstKeyFrame;                  ///< flag first frame
      AVFrame *Frame;                     ///< decoded video frame
+     int SoftwareCodecId;                ///< codec last decoded by software
+     int ThreadConfig;                   ///< thread setup used at open
 
      /* hwaccel options */
      enum HWAccelID hwaccel_id;
@@ -91,9 +93,15 @@ typedef struct _audio_decoder_ AudioDecoder;
 //	Variables
 //----------------------------------------------------------------------------
 
+    /// Maximal number of software video decoder threads
+#define CODEC_VIDEO_THREADS_MAX	16
+
     /// Flag prefer fast xhannel switch
 extern char CodecUsePossibleDefectFrames;
 
+    /// Set video decoder threads for software decoding.
+extern void CodecSetVideoThreads(int, int, int);
+
 //----------------------------------------------------------------------------
 //	Prototypes
 //----------------------------------------------------------------------------
@@ -116,6 +124,12 @@ extern void CodecVideoDecode(VideoDecoder *, const AVPacket *);
     /// Flush video buffers.
 extern void CodecVideoFlushBuffers(VideoDecoder *);
 
+    /// Restart video decoder for a new stream with the same codec.
+extern void CodecVideoRestart(VideoDecoder *);
+
+    /// Check if the thread setup changed since the codec was opened.
+extern int CodecVideoThreadsChanged(const VideoDecoder *);
+
     /// Allocate a new audio decoder context.
 extern AudioDecoder *CodecAudioNewDecoder(void);
 
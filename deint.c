@@ -0,0 +1,1255 @@
+///
+///	@file deint.c	@brief Software deinterlace module
+///
+///	Copyright (c) 2014 by Johns.  All Rights Reserved.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+///
+///	@defgroup Deint The software deinterlace module.
+///
+///	Deinterlaces 8 bit YUV 4:2:0 frames (NV12 or planar) with the CPU
+///	into two progressive frames, one for each field.  It is independent
+///	of the video output module, the caller copies the interlaced frame
+///	into the buffer of the deinterlacer and gets two frames back.
+///
+///	Modes:
+///	- bob: average of the lines above and below
+///	- spatial: ELA edge based line average
+///	- yadif: motion adaptive, uses the previous frame.  The next frame
+///	  isn't used, it would delay the video for one frame.
+///
+///	The line kernels work on 16 bit lanes with AVX2, SSE2 or NEON, the
+///	pixels at the left and right edge are done by the C version.  The
+///	rows of a frame are split into bands, the bands are processed by a
+///	pool of worker threads together with the calling thread.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libintl.h>
+#define _(str) gettext(str)		///< gettext shortcut
+#define _N(str) str			///< gettext_noop shortcut
+
+#ifndef __USE_GNU
+#define __USE_GNU
+#endif
+#include <pthread.h>
+#ifndef HAVE_PTHREAD_NAME
+    /// only available with newer glibc
+#define pthread_setname_np(thread, name)
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "misc.h"
+#include "deint.h"
+
+//----------------------------------------------------------------------------
+//	Defines
+//----------------------------------------------------------------------------
+
+#define DEINT_THREADS_MAX 16		///< maximal number of worker threads
+#define DEINT_THREADS_AUTO 4		///< maximal automatic worker threads
+#define DEINT_ALIGN 64			///< alignment of buffer lines
+
+    /// Return the absolute value of an integer.
+#define ABS(i)	((i) >= 0 ? (i) : (-(i)))
+
+//----------------------------------------------------------------------------
+//	Declarations
+//----------------------------------------------------------------------------
+
+///
+///	Software deinterlacer.
+///
+///	Holds the current and the previous interlaced frame.
+///
+struct _deint_
+{
+    int Width;				///< frame width
+    int Height;				///< frame height
+    int Nv12;				///< frame is NV12, otherwise planar
+
+    int Planes;				///< number of planes
+    int Offset[3];			///< offset of planes in buffer
+    int Pitch[3];			///< pitch of planes in buffer
+    uint8_t *Buffer[2];			///< frame buffers
+    int Index;				///< buffer of the current frame
+    int HavePrev;			///< other buffer has previous frame
+};
+
+///
+///	Software deinterlace plane job.
+///
+typedef struct _deint_plane_
+{
+    uint8_t *Dst;			///< output plane
+    int DstPitch;			///< pitch of output plane
+    const uint8_t *Cur;			///< current interlaced plane
+    const uint8_t *Prev;		///< previous interlaced plane
+    int Pitch;				///< pitch of input planes
+    int Width;				///< plane width in bytes
+    int Height;				///< plane height in rows
+    int Step;				///< bytes between horizontal neighbours
+    int Field;				///< kept field, 0 top, 1 bottom
+    int Second;				///< second field of the frame
+    int Copy;				///< copy plane, don't deinterlace
+    DeintModes Mode;			///< deinterlace mode
+} DeintPlane;
+
+///
+///	Software deinterlace job.
+///
+typedef struct _deint_job_
+{
+    DeintPlane Plane[6];		///< planes of both output frames
+    int PlaneN;				///< number of planes
+    int BandN;				///< number of row bands
+} DeintJob;
+
+///
+///	Input rows of the yadif filter.
+///
+typedef struct _deint_rows_
+{
+    const uint8_t *Above;		///< current frame row above
+    const uint8_t *Below;		///< current frame row below
+    const uint8_t *PrevAbove;		///< previous frame row above
+    const uint8_t *PrevBelow;		///< previous frame row below
+    const uint8_t *TempPrev;		///< earlier field of missing row
+    const uint8_t *TempNext;		///< later field of missing row
+    const uint8_t *TempPrevUp;		///< earlier field two rows above
+    const uint8_t *TempNextUp;		///< later field two rows above
+    const uint8_t *TempPrevDown;	///< earlier field two rows below
+    const uint8_t *TempNextDown;	///< later field two rows below
+} DeintRows;
+
+//----------------------------------------------------------------------------
+//	Variables
+//----------------------------------------------------------------------------
+
+    /// serializes deinterlacer users
+static pthread_mutex_t DeintMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t DeintJobMutex;	///< job mutex
+static pthread_cond_t DeintJobCond;	///< new job wakeup
+static pthread_cond_t DeintDoneCond;	///< job done wakeup
+static pthread_t DeintThread[DEINT_THREADS_MAX];	///< worker threads
+static int DeintThreadN;		///< number of running worker threads
+static int DeintThreadsWanted = -1;	///< configured threads, -1 auto
+static char DeintThreadsStarted;	///< flag worker threads started
+static const DeintJob *DeintJobCurrent;	///< current job
+static unsigned DeintJobSerial;		///< serial number of current job
+static unsigned DeintStartSerial;	///< job serial at worker start
+static int DeintJobPending;		///< worker threads still running
+static char DeintJobExit;		///< flag worker threads should exit
+
+//----------------------------------------------------------------------------
+//	Line kernels
+//----------------------------------------------------------------------------
+
+#if defined(__AVX2__)
+
+#define DEINT_LANES 16			///< pixels per vector
+
+typedef __m256i DeintVec;		///< 16 bit lanes
+
+    /// load and widen pixels
+#define DeintLoad(p) \
+    _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p)))
+    /// narrow and store pixels
+#define DeintStore(p, v) \
+    _mm_storeu_si128((__m128i *)(p), _mm_packus_epi16( \
+	_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)))
+#define DeintSet(i)		_mm256_set1_epi16(i)	///< broadcast
+#define DeintAdd(a, b)		_mm256_add_epi16(a, b)	///< a + b
+#define DeintSub(a, b)		_mm256_sub_epi16(a, b)	///< a - b
+#define DeintMin(a, b)		_mm256_min_epi16(a, b)	///< min(a, b)
+#define DeintMax(a, b)		_mm256_max_epi16(a, b)	///< max(a, b)
+#define DeintAbs(a)		_mm256_abs_epi16(a)	///< abs(a)
+#define DeintHalf(a)		_mm256_srai_epi16(a, 1)	///< a / 2
+#define DeintLess(a, b)		_mm256_cmpgt_epi16(b, a)	///< a < b
+#define DeintAnd(a, b)		_mm256_and_si256(a, b)	///< a & b
+    /// m ? a : b
+#define DeintSelect(m, a, b)	_mm256_blendv_epi8(b, a, m)
+
+#elif defined(__SSE2__)
+
+#define DEINT_LANES 8			///< pixels per vector
+
+typedef __m128i DeintVec;		///< 16 bit lanes
+
+    /// load and widen pixels
+#define DeintLoad(p) _mm_unpacklo_epi8(_mm_loadl_epi64( \
+	(const __m128i *)(p)), _mm_setzero_si128())
+    /// narrow and store pixels
+#define DeintStore(p, v) \
+    _mm_storel_epi64((__m128i *)(p), _mm_packus_epi16(v, v))
+#define DeintSet(i)		_mm_set1_epi16(i)	///< broadcast
+#define DeintAdd(a, b)		_mm_add_epi16(a, b)	///< a + b
+#define DeintSub(a, b)		_mm_sub_epi16(a, b)	///< a - b
+#define DeintMin(a, b)		_mm_min_epi16(a, b)	///< min(a, b)
+#define DeintMax(a, b)		_mm_max_epi16(a, b)	///< max(a, b)
+    /// abs(a)
+#define DeintAbs(a) \
+    _mm_max_epi16(a, _mm_sub_epi16(_mm_setzero_si128(), a))
+#define DeintHalf(a)		_mm_srai_epi16(a, 1)	///< a / 2
+#define DeintLess(a, b)		_mm_cmplt_epi16(a, b)	///< a < b
+#define DeintAnd(a, b)		_mm_and_si128(a, b)	///< a & b
+    /// m ? a : b
+#define DeintSelect(m, a, b) \
+    _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b))
+
+#elif defined(__ARM_NEON)
+
+#define DEINT_LANES 8			///< pixels per vector
+
+typedef int16x8_t DeintVec;		///< 16 bit lanes
+
+    /// load and widen pixels
+#define DeintLoad(p)		vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p)))
+    /// narrow and store pixels
+#define DeintStore(p, v)	vst1_u8(p, vqmovun_s16(v))
+#define DeintSet(i)		vdupq_n_s16(i)	///< broadcast
+#define DeintAdd(a, b)		vaddq_s16(a, b)	///< a + b
+#define DeintSub(a, b)		vsubq_s16(a, b)	///< a - b
+#define DeintMin(a, b)		vminq_s16(a, b)	///< min(a, b)
+#define DeintMax(a, b)		vmaxq_s16(a, b)	///< max(a, b)
+#define DeintAbs(a)		vabsq_s16(a)	///< abs(a)
+#define DeintHalf(a)		vshrq_n_s16(a, 1)	///< a / 2
+    /// a < b
+#define DeintLess(a, b)		vreinterpretq_s16_u16(vcltq_s16(a, b))
+#define DeintAnd(a, b)		vandq_s16(a, b)	///< a & b
+    /// m ? a : b
+#define DeintSelect(m, a, b) \
+    vbslq_s16(vreinterpretq_u16_s16(m), a, b)
+
+#endif
+
+#ifdef DEINT_LANES
+
+    /// sum of three absolute differences
+#define DeintSad3(a0, b0, a1, b1, a2, b2) \
+    DeintAdd(DeintAdd(DeintAbs(DeintSub(a0, b0)), \
+	DeintAbs(DeintSub(a1, b1))), DeintAbs(DeintSub(a2, b2)))
+
+///
+///	ELA spatial prediction of vector pixels.
+///
+///	@param above	row above the missing row
+///	@param below	row below the missing row
+///	@param step	bytes between horizontal neighbours
+///	@param bias	bias of the vertical score
+///
+///	@returns predicted pixels
+///
+static inline DeintVec DeintSpatialVec(const uint8_t * above,
+    const uint8_t * below, int step, DeintVec bias)
+{
+    DeintVec a_3, a_2, a_1, a0, a1, a2, a3;
+    DeintVec b_3, b_2, b_1, b0, b1, b2, b3;
+    DeintVec pred;
+    DeintVec score;
+    DeintVec sc;
+    DeintVec m1;
+    DeintVec m;
+
+    a_3 = DeintLoad(above - 3 * step);
+    a_2 = DeintLoad(above - 2 * step);
+    a_1 = DeintLoad(above - 1 * step);
+    a0 = DeintLoad(above);
+    a1 = DeintLoad(above + 1 * step);
+    a2 = DeintLoad(above + 2 * step);
+    a3 = DeintLoad(above + 3 * step);
+    b_3 = DeintLoad(below - 3 * step);
+    b_2 = DeintLoad(below - 2 * step);
+    b_1 = DeintLoad(below - 1 * step);
+    b0 = DeintLoad(below);
+    b1 = DeintLoad(below + 1 * step);
+    b2 = DeintLoad(below + 2 * step);
+    b3 = DeintLoad(below + 3 * step);
+
+    pred = DeintHalf(DeintAdd(a0, b0));
+    score = DeintAdd(DeintSad3(a_1, b_1, a0, b0, a1, b1), bias);
+
+    // 1 pixel
+    sc = DeintSad3(a_2, b0, a_1, b1, a0, b2);
+    m1 = DeintLess(sc, score);
+    score = DeintSelect(m1, sc, score);
+    pred = DeintSelect(m1, DeintHalf(DeintAdd(a_1, b1)), pred);
+    // 2 pixel
+    sc = DeintSad3(a_3, b1, a_2, b2, a_1, b3);
+    m = DeintAnd(m1, DeintLess(sc, score));
+    score = DeintSelect(m, sc, score);
+    pred = DeintSelect(m, DeintHalf(DeintAdd(a_2, b2)), pred);
+
+    // -1 pixel
+    sc = DeintSad3(a0, b_2, a1, b_1, a2, b0);
+    m1 = DeintLess(sc, score);
+    score = DeintSelect(m1, sc, score);
+    pred = DeintSelect(m1, DeintHalf(DeintAdd(a1, b_1)), pred);
+    // -2 pixel
+    sc = DeintSad3(a1, b_3, a2, b_2, a3, b_1);
+    m = DeintAnd(m1, DeintLess(sc, score));
+    pred = DeintSelect(m, DeintHalf(DeintAdd(a2, b_2)), pred);
+
+    return pred;
+}
+
+#endif
+
+///
+///	Clamp horizontal neighbour into the row.
+///
+///	@param x	byte position of the neighbour
+///	@param step	bytes between horizontal neighbours
+///	@param width	row width in bytes
+///
+static inline int DeintClampX(int x, int step, int width)
+{
+    while (x < 0) {
+	x += step;
+    }
+    while (x >= width) {
+	x -= step;
+    }
+    return x;
+}
+
+///
+///	ELA spatial prediction of one pixel.
+///
+///	Edge-based Line Averaging, Low-Complexity Interpolation Method
+///
+///	abcdefg	   abcdefg	abcdefg	 abcdefg    abcdefg
+///	   x	     x		  x	    x		 x
+///	hijklmn	 hijklmn    hijklmn	   hijklmn	 hijklmn
+///
+///	@param above	row above the missing row
+///	@param below	row below the missing row
+///	@param x	byte position in row
+///	@param step	bytes between horizontal neighbours
+///	@param width	row width in bytes
+///	@param bias	bias of the vertical score
+///
+///	@returns predicted pixel
+///
+static int DeintSpatialPixel(const uint8_t * above, const uint8_t * below,
+    int x, int step, int width, int bias)
+{
+    int a, b, c, d, e, f, g, h, i, j, k, l, m, n;
+    int pred;
+    int score;
+    int sc;
+
+    a = above[DeintClampX(x - 3 * step, step, width)];
+    b = above[DeintClampX(x - 2 * step, step, width)];
+    c = above[DeintClampX(x - 1 * step, step, width)];
+    d = above[x];
+    e = above[DeintClampX(x + 1 * step, step, width)];
+    f = above[DeintClampX(x + 2 * step, step, width)];
+    g = above[DeintClampX(x + 3 * step, step, width)];
+
+    h = below[DeintClampX(x - 3 * step, step, width)];
+    i = below[DeintClampX(x - 2 * step, step, width)];
+    j = below[DeintClampX(x - 1 * step, step, width)];
+    k = below[x];
+    l = below[DeintClampX(x + 1 * step, step, width)];
+    m = below[DeintClampX(x + 2 * step, step, width)];
+    n = below[DeintClampX(x + 3 * step, step, width)];
+
+    pred = (d + k) >> 1;		// 0 pixel
+    score = ABS(c - j) + ABS(d - k) + ABS(e - l) + bias;
+
+    sc = ABS(b - k) + ABS(c - l) + ABS(d - m);
+    if (sc < score) {
+	pred = (c + l) >> 1;		// 1 pixel
+	score = sc;
+	sc = ABS(a - l) + ABS(b - m) + ABS(c - n);
+	if (sc < score) {
+	    pred = (b + m) >> 1;	// 2 pixel
+	    score = sc;
+	}
+    }
+    sc = ABS(d - i) + ABS(e - j) + ABS(f - k);
+    if (sc < score) {
+	pred = (e + j) >> 1;		// -1 pixel
+	score = sc;
+	sc = ABS(e - h) + ABS(f - i) + ABS(g - j);
+	if (sc < score) {
+	    pred = (f + i) >> 1;	// -2 pixel
+	}
+    }
+    return pred;
+}
+
+///
+///	Yadif prediction of one pixel.
+///
+///	@param rows	input rows
+///	@param x	byte position in row
+///	@param step	bytes between horizontal neighbours
+///	@param width	row width in bytes
+///
+///	@returns predicted pixel
+///
+static int DeintYadifPixel(const DeintRows * rows, int x, int step,
+    int width)
+{
+    int c, d, e, b, f;
+    int diff;
+    int t;
+    int hi;
+    int lo;
+    int pred;
+
+    c = rows->Above[x];
+    e = rows->Below[x];
+    d = (rows->TempPrev[x] + rows->TempNext[x]) >> 1;
+
+    // temporal difference
+    diff = ABS(rows->TempPrev[x] - rows->TempNext[x]) >> 1;
+    t = (ABS(rows->PrevAbove[x] - c) + ABS(rows->PrevBelow[x] - e)) >> 1;
+    if (t > diff) {
+	diff = t;
+    }
+    // spatial interlacing check
+    b = (rows->TempPrevUp[x] + rows->TempNextUp[x]) >> 1;
+    f = (rows->TempPrevDown[x] + rows->TempNextDown[x]) >> 1;
+    hi = d - e > d - c ? d - e : d - c;
+    t = b - c < f - e ? b - c : f - e;
+    hi = hi > t ? hi : t;
+    lo = d - e < d - c ? d - e : d - c;
+    t = b - c > f - e ? b - c : f - e;
+    lo = lo < t ? lo : t;
+    if (lo > diff) {
+	diff = lo;
+    }
+    if (-hi > diff) {
+	diff = -hi;
+    }
+
+    pred = DeintSpatialPixel(rows->Above, rows->Below, x, step, width, -1);
+    if (pred > d + diff) {
+	pred = d + diff;
+    } else if (pred < d - diff) {
+	pred = d - diff;
+    }
+    return pred;
+}
+
+///
+///	Bob deinterlace a row.
+///
+///	@param dst	output row
+///	@param above	row above
+///	@param below	row below
+///	@param width	row width in bytes
+///
+static void DeintLineBob(uint8_t * dst, const uint8_t * above,
+    const uint8_t * below, int width)
+{
+    int x;
+
+    x = 0;
+#ifdef DEINT_LANES
+    for (; x + DEINT_LANES <= width; x += DEINT_LANES) {
+	DeintStore(dst + x, DeintHalf(DeintAdd(DeintLoad(above + x),
+		    DeintLoad(below + x))));
+    }
+#endif
+    for (; x < width; ++x) {
+	dst[x] = (above[x] + below[x]) >> 1;
+    }
+}
+
+///
+///	Spatial deinterlace a row.
+///
+///	@param dst	output row
+///	@param above	row above
+///	@param below	row below
+///	@param width	row width in bytes
+///	@param step	bytes between horizontal neighbours
+///
+static void DeintLineSpatial(uint8_t * dst, const uint8_t * above,
+    const uint8_t * below, int width, int step)
+{
+    int x;
+
+    for (x = 0; x < width && x < 3 * step; ++x) {
+	dst[x] = DeintSpatialPixel(above, below, x, step, width, 0);
+    }
+#ifdef DEINT_LANES
+    for (; x + DEINT_LANES + 3 * step <= width; x += DEINT_LANES) {
+	DeintStore(dst + x, DeintSpatialVec(above + x, below + x, step,
+		DeintSet(0)));
+    }
+#endif
+    for (; x < width; ++x) {
+	dst[x] = DeintSpatialPixel(above, below, x, step, width, 0);
+    }
+}
+
+///
+///	Yadif deinterlace a row.
+///
+///	@param dst	output row
+///	@param rows	input rows
+///	@param width	row width in bytes
+///	@param step	bytes between horizontal neighbours
+///
+static void DeintLineYadif(uint8_t * dst, const DeintRows * rows, int width,
+    int step)
+{
+    int x;
+
+    for (x = 0; x < width && x < 3 * step; ++x) {
+	dst[x] = DeintYadifPixel(rows, x, step, width);
+    }
+#ifdef DEINT_LANES
+    for (; x + DEINT_LANES + 3 * step <= width; x += DEINT_LANES) {
+	DeintVec c, d, e, b, f;
+	DeintVec p, n;
+	DeintVec diff;
+	DeintVec hi;
+	DeintVec lo;
+	DeintVec pred;
+
+	c = DeintLoad(rows->Above + x);
+	e = DeintLoad(rows->Below + x);
+	p = DeintLoad(rows->TempPrev + x);
+	n = DeintLoad(rows->TempNext + x);
+	d = DeintHalf(DeintAdd(p, n));
+
+	// temporal difference
+	diff = DeintHalf(DeintAbs(DeintSub(p, n)));
+	diff = DeintMax(diff,
+	    DeintHalf(DeintAdd(DeintAbs(DeintSub(DeintLoad(rows->PrevAbove +
+			    x), c)), DeintAbs(DeintSub(DeintLoad(rows->
+			    PrevBelow + x), e)))));
+
+	// spatial interlacing check
+	b = DeintHalf(DeintAdd(DeintLoad(rows->TempPrevUp + x),
+		DeintLoad(rows->TempNextUp + x)));
+	f = DeintHalf(DeintAdd(DeintLoad(rows->TempPrevDown + x),
+		DeintLoad(rows->TempNextDown + x)));
+	hi = DeintMax(DeintMax(DeintSub(d, e), DeintSub(d, c)),
+	    DeintMin(DeintSub(b, c), DeintSub(f, e)));
+	lo = DeintMin(DeintMin(DeintSub(d, e), DeintSub(d, c)),
+	    DeintMax(DeintSub(b, c), DeintSub(f, e)));
+	diff = DeintMax(DeintMax(diff, lo), DeintSub(DeintSet(0), hi));
+
+	pred = DeintSpatialVec(rows->Above + x, rows->Below + x, step,
+	    DeintSet(-1));
+	pred = DeintMin(DeintMax(pred, DeintSub(d, diff)), DeintAdd(d, diff));
+	DeintStore(dst + x, pred);
+    }
+#endif
+    for (; x < width; ++x) {
+	dst[x] = DeintYadifPixel(rows, x, step, width);
+    }
+}
+
+//----------------------------------------------------------------------------
+//	Jobs
+//----------------------------------------------------------------------------
+
+///
+///	Deinterlace rows of a plane.
+///
+///	@param plane	plane job
+///	@param y0	first row
+///	@param y1	last row + 1
+///
+static void DeintPlaneRows(const DeintPlane * plane, int y0, int y1)
+{
+    int y;
+
+    for (y = y0; y < y1; ++y) {
+	uint8_t *dst;
+	const uint8_t *cur;
+	const uint8_t *above;
+	const uint8_t *below;
+	int up;
+	int down;
+
+	dst = plane->Dst + y * plane->DstPitch;
+	cur = plane->Cur + y * plane->Pitch;
+	if (plane->Copy || plane->Height < 2 || (y & 1) == plane->Field) {
+	    memcpy(dst, cur, plane->Width);
+	    continue;
+	}
+	// missing row, mirror at the top and bottom
+	up = y ? -plane->Pitch : plane->Pitch;
+	down = y + 1 < plane->Height ? plane->Pitch : -plane->Pitch;
+	above = cur + up;
+	below = cur + down;
+
+	switch (plane->Mode) {
+	    case DeintBob:
+		DeintLineBob(dst, above, below, plane->Width);
+		break;
+	    case DeintSpatial:
+		DeintLineSpatial(dst, above, below, plane->Width,
+		    plane->Step);
+		break;
+	    case DeintYadif:
+		{
+		    DeintRows rows;
+		    const uint8_t *prev;
+		    const uint8_t *temp_prev;
+		    const uint8_t *temp_next;
+		    int up2;
+		    int down2;
+
+		    prev = plane->Prev + y * plane->Pitch;
+		    // first field: missing field of prev and cur frame
+		    // second field: only cur frame, next isn't waited for
+		    temp_prev = plane->Second ? cur : prev;
+		    temp_next = cur;
+		    up2 = y >= 2 ? -2 * plane->Pitch : 0;
+		    down2 = y + 2 < plane->Height ? 2 * plane->Pitch : 0;
+
+		    rows.Above = above;
+		    rows.Below = below;
+		    rows.PrevAbove = prev + up;
+		    rows.PrevBelow = prev + down;
+		    rows.TempPrev = temp_prev;
+		    rows.TempNext = temp_next;
+		    rows.TempPrevUp = temp_prev + up2;
+		    rows.TempNextUp = temp_next + up2;
+		    rows.TempPrevDown = temp_prev + down2;
+		    rows.TempNextDown = temp_next + down2;
+		    DeintLineYadif(dst, &rows, plane->Width, plane->Step);
+		}
+		break;
+	}
+    }
+}
+
+///
+///	Run band of a job.
+///
+///	@param job	deinterlace job
+///	@param band	band number
+///
+static void DeintJobRun(const DeintJob * job, int band)
+{
+    int i;
+
+    for (i = 0; i < job->PlaneN; ++i) {
+	const DeintPlane *plane;
+	int y0;
+	int y1;
+
+	plane = job->Plane + i;
+	y0 = (plane->Height * band / job->BandN) & ~1;
+	y1 = band + 1 < job->BandN ?
+	    (plane->Height * (band + 1) / job->BandN) & ~1 : plane->Height;
+	DeintPlaneRows(plane, y0, y1);
+    }
+}
+
+///
+///	Deinterlace worker thread.
+///
+///	@param arg	band number of the thread
+///
+static void *DeintWorkerThread(void *arg)
+{
+    unsigned serial;
+    int band;
+
+    band = (intptr_t) arg;
+    Debug(3, "deint: worker thread %d started\n", band);
+
+    pthread_mutex_lock(&DeintJobMutex);
+    serial = DeintStartSerial;
+    for (;;) {
+	const DeintJob *job;
+
+	while (!DeintJobExit && serial == DeintJobSerial) {
+	    pthread_cond_wait(&DeintJobCond, &DeintJobMutex);
+	}
+	if (DeintJobExit) {
+	    break;
+	}
+	serial = DeintJobSerial;
+	job = DeintJobCurrent;
+	pthread_mutex_unlock(&DeintJobMutex);
+
+	if (band < job->BandN) {
+	    DeintJobRun(job, band);
+	}
+
+	pthread_mutex_lock(&DeintJobMutex);
+	if (!--DeintJobPending) {
+	    pthread_cond_signal(&DeintDoneCond);
+	}
+    }
+    pthread_mutex_unlock(&DeintJobMutex);
+
+    Debug(3, "deint: worker thread %d stopped\n", band);
+    return NULL;
+}
+
+///
+///	Start worker threads.
+///
+///	@note called with deinterlace lock
+///
+static void DeintThreadsStart(void)
+{
+    int n;
+
+    DeintThreadsStarted = 1;
+    n = DeintThreadsWanted;
+    if (n < 0) {			// automatic
+	n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if (n > DEINT_THREADS_AUTO) {
+	    n = DEINT_THREADS_AUTO;
+	}
+    }
+    if (n > DEINT_THREADS_MAX) {
+	n = DEINT_THREADS_MAX;
+    }
+
+    DeintJobExit = 0;
+    // workers could start after the first job is queued
+    DeintStartSerial = DeintJobSerial;
+    for (DeintThreadN = 0; DeintThreadN < n; ++DeintThreadN) {
+	if (pthread_create(&DeintThread[DeintThreadN], NULL,
+		DeintWorkerThread, (void *)(intptr_t) (DeintThreadN + 1))) {
+	    Error(_("deint: can't create worker thread\n"));
+	    break;
+	}
+	pthread_setname_np(DeintThread[DeintThreadN], "softhddev deint");
+    }
+    Debug(3, "deint: %d worker threads\n", DeintThreadN);
+}
+
+///
+///	Stop worker threads.
+///
+///	@note called with deinterlace lock
+///
+static void DeintThreadsStop(void)
+{
+    int i;
+
+    pthread_mutex_lock(&DeintJobMutex);
+    DeintJobExit = 1;
+    pthread_cond_broadcast(&DeintJobCond);
+    pthread_mutex_unlock(&DeintJobMutex);
+
+    for (i = 0; i < DeintThreadN; ++i) {
+	pthread_join(DeintThread[i], NULL);
+    }
+    DeintThreadN = 0;
+    DeintThreadsStarted = 0;
+}
+
+///
+///	Run job on all threads.
+///
+///	@param job	deinterlace job
+///
+///	@note called with deinterlace lock
+///
+static void DeintJobStart(DeintJob * job)
+{
+    if (!DeintThreadsStarted) {
+	DeintThreadsStart();
+    }
+    job->BandN = DeintThreadN + 1;
+
+    if (DeintThreadN) {
+	pthread_mutex_lock(&DeintJobMutex);
+	DeintJobCurrent = job;
+	DeintJobPending = DeintThreadN;
+	++DeintJobSerial;
+	pthread_cond_broadcast(&DeintJobCond);
+	pthread_mutex_unlock(&DeintJobMutex);
+    }
+
+    DeintJobRun(job, 0);
+
+    if (DeintThreadN) {
+	pthread_mutex_lock(&DeintJobMutex);
+	while (DeintJobPending) {
+	    pthread_cond_wait(&DeintDoneCond, &DeintJobMutex);
+	}
+	pthread_mutex_unlock(&DeintJobMutex);
+    }
+}
+
+//----------------------------------------------------------------------------
+//	Deinterlacer
+//----------------------------------------------------------------------------
+
+///
+///	Create a new software deinterlacer.
+///
+///	@returns the new deinterlacer.
+///
+Deint *DeintNew(void)
+{
+    Deint *deint;
+
+    if (!(deint = calloc(1, sizeof(*deint)))) {
+	Error(_("deint: out of memory\n"));
+	return NULL;
+    }
+    return deint;
+}
+
+///
+///	Free a software deinterlacer.
+///
+///	@param deint	deinterlacer
+///
+void DeintDel(Deint * deint)
+{
+    if (deint) {
+	free(deint->Buffer[0]);
+	free(deint->Buffer[1]);
+	free(deint);
+    }
+}
+
+///
+///	Forget the previous frame.
+///
+///	Must be called on stream changes, the next frame is deinterlaced
+///	without temporal information.
+///
+///	@param deint	deinterlacer
+///
+void DeintReset(Deint * deint)
+{
+    deint->HavePrev = 0;
+}
+
+///
+///	Get buffer for the next interlaced frame.
+///
+///	The caller copies the interlaced frame into the returned planes,
+///	before it calls DeintFrame().
+///
+///	@param deint	deinterlacer
+///	@param width	frame width
+///	@param height	frame height
+///	@param nv12	frame is NV12, otherwise planar 4:2:0
+///	@param[out] data	planes of the buffer
+///	@param[out] pitch	pitches of the planes
+///
+void DeintGetBuffer(Deint * deint, int width, int height, int nv12,
+    uint8_t * data[3], int pitch[3])
+{
+    int p;
+
+    if (deint->Width != width || deint->Height != height
+	|| deint->Nv12 != nv12 || !deint->Buffer[0]) {
+	int chroma_height;
+	size_t size;
+	void *buf[2];
+
+	Debug(3, "deint: buffer %dx%d %s\n", width, height,
+	    nv12 ? "nv12" : "planar");
+	free(deint->Buffer[0]);
+	free(deint->Buffer[1]);
+	deint->Buffer[0] = NULL;
+	deint->Buffer[1] = NULL;
+	deint->HavePrev = 0;
+	deint->Index = 0;
+
+	deint->Width = width;
+	deint->Height = height;
+	deint->Nv12 = nv12;
+	chroma_height = (height + 1) / 2;
+	deint->Pitch[0] = (width + DEINT_ALIGN - 1) & ~(DEINT_ALIGN - 1);
+	deint->Offset[0] = 0;
+	deint->Offset[1] = deint->Pitch[0] * height;
+	if (nv12) {
+	    deint->Planes = 2;
+	    deint->Pitch[1] = deint->Pitch[0];
+	    deint->Pitch[2] = 0;
+	    deint->Offset[2] = 0;
+	    size = deint->Offset[1] + deint->Pitch[1] * chroma_height;
+	} else {
+	    deint->Planes = 3;
+	    deint->Pitch[1] = ((width + 1) / 2 + DEINT_ALIGN - 1)
+		& ~(DEINT_ALIGN - 1);
+	    deint->Pitch[2] = deint->Pitch[1];
+	    deint->Offset[2] = deint->Offset[1] + deint->Pitch[1]
+		* chroma_height;
+	    size = deint->Offset[2] + deint->Pitch[2] * chroma_height;
+	}
+
+	if (posix_memalign(&buf[0], DEINT_ALIGN, size)
+	    || posix_memalign(&buf[1], DEINT_ALIGN, size)) {
+	    Fatal(_("deint: out of memory\n"));
+	}
+	deint->Buffer[0] = buf[0];
+	deint->Buffer[1] = buf[1];
+    }
+
+    for (p = 0; p < 3; ++p) {
+	data[p] = p < deint->Planes ?
+	    deint->Buffer[deint->Index] + deint->Offset[p] : NULL;
+	pitch[p] = deint->Pitch[p];
+    }
+}
+
+///
+///	Deinterlace the frame into two progressive frames.
+///
+///	@param deint	deinterlacer
+///	@param mode	deinterlace mode
+///	@param top_field_first	top field is the first field
+///	@param skip_chroma	don't deinterlace the chroma planes
+///	@param dst1	planes of first field output frame
+///	@param dst1_pitch	pitches of first field output planes
+///	@param dst2	planes of second field output frame
+///	@param dst2_pitch	pitches of second field output planes
+///
+///	The frame must be filled into the buffer of DeintGetBuffer().
+///
+void DeintFrame(Deint * deint, DeintModes mode, int top_field_first,
+    int skip_chroma, uint8_t * const dst1[3], const int dst1_pitch[3],
+    uint8_t * const dst2[3], const int dst2_pitch[3])
+{
+    DeintJob job;
+    const uint8_t *cur;
+    const uint8_t *prev;
+    int field;
+    int p;
+
+    cur = deint->Buffer[deint->Index];
+    prev = deint->HavePrev ? deint->Buffer[!deint->Index] : NULL;
+    if (mode == DeintYadif && !prev) {
+	mode = DeintSpatial;
+    }
+
+    job.PlaneN = 0;
+    for (field = 0; field < 2; ++field) {
+	for (p = 0; p < deint->Planes; ++p) {
+	    DeintPlane *plane;
+
+	    plane = job.Plane + job.PlaneN++;
+	    plane->Dst = field ? dst2[p] : dst1[p];
+	    plane->DstPitch = field ? dst2_pitch[p] : dst1_pitch[p];
+	    plane->Cur = cur + deint->Offset[p];
+	    plane->Prev = prev ? prev + deint->Offset[p] : NULL;
+	    plane->Pitch = deint->Pitch[p];
+	    if (!p) {
+		plane->Width = deint->Width;
+		plane->Height = deint->Height;
+		plane->Step = 1;
+	    } else if (deint->Nv12) {
+		plane->Width = (deint->Width + 1) & ~1;
+		plane->Height = (deint->Height + 1) / 2;
+		plane->Step = 2;
+	    } else {
+		plane->Width = (deint->Width + 1) / 2;
+		plane->Height = (deint->Height + 1) / 2;
+		plane->Step = 1;
+	    }
+	    plane->Field = field ^ !top_field_first;
+	    plane->Second = field;
+	    plane->Copy = skip_chroma && p;
+	    plane->Mode = mode;
+	}
+    }
+
+    pthread_mutex_lock(&DeintMutex);
+    DeintJobStart(&job);
+    pthread_mutex_unlock(&DeintMutex);
+
+    deint->Index = !deint->Index;
+    deint->HavePrev = 1;
+}
+
+///
+///	Set number of deinterlace worker threads.
+///
+///	@param threads	number of worker threads, -1 for automatic
+///
+///	The calling thread works too, 0 disables the worker threads.
+///
+void DeintSetThreads(int threads)
+{
+    pthread_mutex_lock(&DeintMutex);
+    DeintThreadsWanted = threads;
+    if (DeintThreadsStarted) {		// restarted with next frame
+	DeintThreadsStop();
+    }
+    pthread_mutex_unlock(&DeintMutex);
+}
+
+///
+///	Software deinterlace module init.
+///
+void DeintInit(void)
+{
+    pthread_mutex_init(&DeintJobMutex, NULL);
+    pthread_cond_init(&DeintJobCond, NULL);
+    pthread_cond_init(&DeintDoneCond, NULL);
+}
+
+///
+///	Software deinterlace module exit.
+///
+void DeintExit(void)
+{
+    pthread_mutex_lock(&DeintMutex);
+    if (DeintThreadsStarted) {
+	DeintThreadsStop();
+    }
+    pthread_mutex_unlock(&DeintMutex);
+
+    pthread_cond_destroy(&DeintDoneCond);
+    pthread_cond_destroy(&DeintJobCond);
+    pthread_mutex_destroy(&DeintJobMutex);
+}
+
+#ifdef DEINT_TEST
+
+//----------------------------------------------------------------------------
+//	Benchmark
+//----------------------------------------------------------------------------
+
+#include <getopt.h>
+
+int LogLevel;				///< required
+
+///
+///	Fill frame with a moving interlaced test pattern.
+///
+///	@param data	planes
+///	@param pitch	pitches of planes
+///	@param width	frame width
+///	@param height	frame height
+///	@param frame	frame number
+///
+static void DeintTestPattern(uint8_t * data[3], const int pitch[3],
+    int width, int height, int frame)
+{
+    int x;
+    int y;
+
+    for (y = 0; y < height; ++y) {
+	int t;
+
+	t = 2 * frame + (y & 1);	// field time
+	for (x = 0; x < width; ++x) {
+	    data[0][y * pitch[0] + x] =
+		((x + 4 * t) & 64) ? 235 : ((x * 3 + y * 5) & 63) + 16;
+	}
+    }
+    for (y = 0; y < (height + 1) / 2; ++y) {
+	for (x = 0; x < (width + 1) / 2; ++x) {
+	    data[1][y * pitch[1] + x] = 128 + ((x + y + frame) & 31);
+	    data[2][y * pitch[2] + x] = 128 - ((x - y + frame) & 31);
+	}
+    }
+}
+
+///
+///	Compare vector kernels with the C version.
+///
+///	@returns number of different pixels.
+///
+static int DeintTestKernels(void)
+{
+    uint8_t row[10][256];
+    uint8_t vec[256];
+    DeintRows rows;
+    int errors;
+    int i;
+    int j;
+    int x;
+
+    errors = 0;
+    for (i = 0; i < 200; ++i) {
+	int step;
+
+	for (j = 0; j < 10; ++j) {
+	    for (x = 0; x < 256; ++x) {
+		// mix of noise and flat areas
+		row[j][x] = (i & 1) ? rand() : (x / 16 + j) * 11 + (rand() & 7);
+	    }
+	}
+	step = 1 + (i & 1);
+	DeintLineSpatial(vec, row[0], row[1], 256, step);
+	for (x = 0; x < 256; ++x) {
+	    errors += vec[x] !=
+		DeintSpatialPixel(row[0], row[1], x, step, 256, 0);
+	}
+	rows.Above = row[0];
+	rows.Below = row[1];
+	rows.PrevAbove = row[2];
+	rows.PrevBelow = row[3];
+	rows.TempPrev = row[4];
+	rows.TempNext = row[5];
+	rows.TempPrevUp = row[6];
+	rows.TempNextUp = row[7];
+	rows.TempPrevDown = row[8];
+	rows.TempNextDown = row[9];
+	DeintLineYadif(vec, &rows, 256, step);
+	for (x = 0; x < 256; ++x) {
+	    errors += vec[x] != DeintYadifPixel(&rows, x, step, 256);
+	}
+    }
+    return errors;
+}
+
+///
+///	Print usage.
+///
+static void PrintUsage(void)
+{
+    printf("Usage: deint_test [-?h] [-f frames] [-s WxH] [-t threads]\n"
+	"\t-f frames\tnumber of frames for each mode (default 200)\n"
+	"\t-s WxH\tframe size (default 1920x1080)\n"
+	"\t-t threads\tworker threads, -1 automatic (default)\n"
+	"\t-? -h\tdisplay this message\n");
+}
+
+///
+///	Main entry point.
+///
+///	@param argc	number of arguments
+///	@param argv	arguments vector
+///
+///	@returns -1 on failures, 0 clean exit.
+///
+int main(int argc, char *const argv[])
+{
+    static const char *const names[] = { "bob", "spatial", "yadif" };
+    int width;
+    int height;
+    int frames;
+    int threads;
+    int errors;
+    int mode;
+    uint8_t *out[2][3];
+    int out_pitch[3];
+
+    width = 1920;
+    height = 1080;
+    frames = 200;
+    threads = -1;
+    for (;;) {
+	switch (getopt(argc, argv, "h?f:s:t:")) {
+	    case 'f':
+		frames = atoi(optarg);
+		continue;
+	    case 's':
+		if (sscanf(optarg, "%dx%d", &width, &height) != 2
+		    || width < 16 || height < 16) {
+		    PrintUsage();
+		    return -1;
+		}
+		continue;
+	    case 't':
+		threads = atoi(optarg);
+		continue;
+	    case EOF:
+		break;
+	    case '?':
+	    case 'h':
+	    default:
+		PrintUsage();
+		return 0;
+	}
+	break;
+    }
+
+    errors = DeintTestKernels();
+    printf("deint: %s kernels, %d pixels differ\n",
+#if defined(__AVX2__)
+	"avx2",
+#elif defined(__SSE2__)
+	"sse2",
+#elif defined(__ARM_NEON)
+	"neon",
+#else
+	"c",
+#endif
+	errors);
+
+    DeintInit();
+    DeintSetThreads(threads);
+
+    out_pitch[0] = width;
+    out_pitch[1] = (width + 1) / 2;
+    out_pitch[2] = (width + 1) / 2;
+    for (mode = 0; mode < 2; ++mode) {
+	out[mode][0] = malloc(width * height);
+	out[mode][1] = malloc(out_pitch[1] * ((height + 1) / 2));
+	out[mode][2] = malloc(out_pitch[2] * ((height + 1) / 2));
+    }
+
+    for (mode = DeintBob; mode <= DeintYadif; ++mode) {
+	Deint *deint;
+	uint32_t ticks;
+	uint32_t total;
+	int i;
+
+	deint = DeintNew();
+	total = 0;
+	for (i = 0; i < frames; ++i) {
+	    uint8_t *data[3];
+	    int pitch[3];
+
+	    DeintGetBuffer(deint, width, height, 0, data, pitch);
+	    DeintTestPattern(data, pitch, width, height, i);
+	    ticks = GetUsTicks();
+	    DeintFrame(deint, mode, 1, 0, out[0], out_pitch, out[1],
+		out_pitch);
+	    total += GetUsTicks() - ticks;
+	}
+	printf("deint: %-8s %dx%d %d threads %6.2f ms/frame\n", names[mode],
+	    width, height, DeintThreadN + 1, total / 1000.0 / frames);
+	DeintDel(deint);
+    }
+
+    for (mode = 0; mode < 2; ++mode) {
+	free(out[mode][0]);
+	free(out[mode][1]);
+	free(out[mode][2]);
+    }
+    DeintExit();
+
+    return errors ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,62 @@
+///
+///	@file deint.h	@brief Software deinterlace module header file
+///
+///	Copyright (c) 2014 by Johns.  All Rights Reserved.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+/// @addtogroup Deint
+/// @{
+
+    /// software deinterlacer typedef
+typedef struct _deint_ Deint;
+
+    /// software deinterlace modes
+typedef enum _deint_modes_
+{
+    DeintBob,				///< line average
+    DeintSpatial,			///< edge based line average (ELA)
+    DeintYadif,				///< yadif motion adaptive
+} DeintModes;
+
+    /// create new software deinterlacer
+extern Deint *DeintNew(void);
+
+    /// free software deinterlacer
+extern void DeintDel(Deint *);
+
+    /// forget the previous frame
+extern void DeintReset(Deint *);
+
+    /// get buffer for the next interlaced frame
+extern void DeintGetBuffer(Deint *, int, int, int, uint8_t *[3], int[3]);
+
+    /// deinterlace the frame into two progressive frames
+extern void DeintFrame(Deint *, DeintModes, int, int, uint8_t * const[3],
+    const int[3], uint8_t * const[3], const int[3]);
+
+    /// set number of deinterlace threads
+extern void DeintSetThreads(int);
+
+    /// software deinterlace module init
+extern void DeintInit(void);
+
+    /// software deinterlace module exit
+extern void DeintExit(void);
+
+/// @}
@@ -25,27 +25,124 @@
 ///
 ///	Lock free ring buffer with only one writer and one reader.
 ///
+///	The writer owns the head index, the reader the tail index.  Both
+///	are free running byte counters on their own cache line, published
+///	with release and read with acquire ordering.  The allocated
+///	capacity is always a power of 2, it divides the index range and
+///	the buffer offset stays correct, when the index wraps.  Each side keeps a
+///	cached copy of the other index and only reloads it, if the cached
+///	value doesn't satisfy the request.
+///
+///	A mirrored ring buffer maps its pages twice behind each other,
+///	reads and writes are always contiguous, even across the wrap.
+///
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 #include "iatomic.h"
 #include "ringbuffer.h"
 
+    /// cache line size used to separate reader and writer data
+#define RING_BUFFER_CACHE_LINE	64
+
+#if GCC_VERSION < 40700
+    /// load index written by the other side
+#define RingBufferLoad(ptr) \
+    ({ size_t __v = *(volatile size_t *)(ptr); __sync_synchronize(); __v; })
+    /// publish own index to the other side
+#define RingBufferStore(ptr, val) \
+    do { __sync_synchronize(); *(volatile size_t *)(ptr) = (val); } while (0)
+#else
+    /// load index written by the other side
+#define RingBufferLoad(ptr) \
+    __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+    /// publish own index to the other side
+#define RingBufferStore(ptr, val) \
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#endif
+
     /// ring buffer structure
 struct _ring_buffer_
 {
     char *Buffer;			///< ring buffer data
-    const char *BufferEnd;		///< end of buffer
-    size_t Size;			///< bytes in buffer (for faster calc)
+    size_t Size;			///< usable bytes in buffer
+    size_t Capacity;			///< allocated bytes in buffer, power of 2
+    size_t Mask;			///< capacity - 1
+    int Mirrored;			///< buffer is mapped twice
+
+    /// only modified by writer
+    struct
+    {
+	size_t Head;			///< total bytes written
+	size_t TailCache;		///< last seen tail of reader
+    } Writer __attribute__ ((aligned(RING_BUFFER_CACHE_LINE)));
+
+    /// only modified by reader
+    struct
+    {
+	size_t Tail;			///< total bytes read
+	size_t HeadCache;		///< last seen head of writer
+    } Reader __attribute__ ((aligned(RING_BUFFER_CACHE_LINE)));
+};
 
-    const char *ReadPointer;		///< only used by reader
-    char *WritePointer;			///< only used by writer
+/**
+**	Buffer offset of an index.
+**
+**	@param rb	Ring buffer.
+**	@param index	head or tail index
+*/
+static inline size_t RingBufferOffset(const RingBuffer * rb, size_t index)
+{
+    return index & rb->Mask;
+}
 
-    /// The only thing modified by both
-    atomic_t Filled;			///< how many of the buffer is used
-};
+/**
+**	Free bytes seen by the writer.
+**
+**	@param rb	Ring buffer.
+**	@param cnt	Number of bytes wanted.
+*/
+static inline size_t RingBufferWriterFree(RingBuffer * rb, size_t cnt)
+{
+    size_t n;
+
+    n = rb->Size - (rb->Writer.Head - rb->Writer.TailCache);
+    if (n < cnt) {			// reload reader index
+	rb->Writer.TailCache = RingBufferLoad(&rb->Reader.Tail);
+	n = rb->Size - (rb->Writer.Head - rb->Writer.TailCache);
+    }
+    return n;
+}
+
+/**
+**	Used bytes seen by the reader.
+**
+**	@param rb	Ring buffer.
+**	@param cnt	Number of bytes wanted.
+*/
+static inline size_t RingBufferReaderUsed(RingBuffer * rb, size_t cnt)
+{
+    size_t n;
+
+    n = rb->Reader.HeadCache - rb->Reader.Tail;
+    if (n < cnt) {			// reload writer index
+	rb->Reader.HeadCache = RingBufferLoad(&rb->Writer.Head);
+	n = rb->Reader.HeadCache - rb->Reader.Tail;
+    }
+    return n;
+}
 
 /**
 **	Reset ring buffer pointers.
@@ -54,44 +151,141 @@ struct _ring_buffer_
 */
 void RingBufferReset(RingBuffer * rb)
 {
-    rb->ReadPointer = rb->Buffer;
-    rb->WritePointer = rb->Buffer;
-    atomic_set(&rb->Filled, 0);
+    rb->Writer.TailCache = 0;
+    rb->Reader.HeadCache = 0;
+    RingBufferStore(&rb->Writer.Head, 0);
+    RingBufferStore(&rb->Reader.Tail, 0);
+}
+
+/**
+**	Map the buffer twice behind each other.
+**
+**	@param rb	Ring buffer, capacity must be a multiple of page size.
+**
+**	@returns	mapped buffer, NULL if not supported.
+*/
+static char *RingBufferMapMirror(RingBuffer * rb)
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+    int fd;
+    char *buf;
+
+    if ((fd = syscall(SYS_memfd_create, "ringbuffer", 1)) < 0) {
+	return NULL;
+    }
+    if (ftruncate(fd, rb->Capacity)) {
+	close(fd);
+	return NULL;
+    }
+    // reserve address space for both mappings
+    buf =
+	mmap(NULL, 2 * rb->Capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+	-1, 0);
+    if (buf == MAP_FAILED) {
+	close(fd);
+	return NULL;
+    }
+    if (mmap(buf, rb->Capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	    fd, 0) == MAP_FAILED
+	|| mmap(buf + rb->Capacity, rb->Capacity, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+	munmap(buf, 2 * rb->Capacity);
+	close(fd);
+	return NULL;
+    }
+    close(fd);				// mappings keep the memory
+
+    return buf;
+#else
+    (void)rb;
+
+    return NULL;
+#endif
 }
 
 /**
 **	Allocate a new ring buffer.
 **
 **	@param size	Size of the ring buffer.
-**
-**	@returns	Allocated ring buffer, must be freed with
-**			RingBufferDel(), NULL for out of memory.
+**	@param mirror	Try to map the buffer mirrored.
 */
-RingBuffer *RingBufferNew(size_t size)
+static RingBuffer *RingBufferAlloc(size_t size, int mirror)
 {
     RingBuffer *rb;
+    long page;
 
-    if (!(rb = malloc(sizeof(*rb)))) {	// allocate structure
+    if (posix_memalign((void **)&rb, RING_BUFFER_CACHE_LINE, sizeof(*rb))) {
+	return NULL;
+    }
+    memset(rb, 0, sizeof(*rb));
+    rb->Size = size;
+
+    // power of 2, the free running indices wrap at 2^32 on 32 bit
+    // systems, only a power of 2 capacity continues there seamless
+    rb->Capacity = 1;
+    page = sysconf(_SC_PAGESIZE);
+    if (mirror && page > 0) {		// also a page size multiple
+	rb->Capacity = page;
+    }
+    while (rb->Capacity < size) {
+	rb->Capacity <<= 1;
+    }
+    rb->Mask = rb->Capacity - 1;
+
+    if (mirror && page > 0 && (rb->Buffer = RingBufferMapMirror(rb))) {
+	rb->Mirrored = 1;
 	return rb;
     }
-    if (!(rb->Buffer = malloc(size))) {	// allocate buffer
+    // at most size bytes are in use, the offsets cycle through capacity
+    if (!(rb->Buffer = malloc(rb->Capacity))) {	// allocate buffer
 	free(rb);
 	return NULL;
     }
 
-    rb->Size = size;
-    rb->BufferEnd = rb->Buffer + size;
-    RingBufferReset(rb);
-
     return rb;
 }
 
+/**
+**	Allocate a new ring buffer.
+**
+**	@param size	Size of the ring buffer.
+**
+**	@returns	Allocated ring buffer, must be freed with
+**			RingBufferDel(), NULL for out of memory.
+*/
+RingBuffer *RingBufferNew(size_t size)
+{
+    return RingBufferAlloc(size, 0);
+}
+
+/**
+**	Allocate a new mirrored ring buffer.
+**
+**	Read and write pointers always have all used and free bytes
+**	contiguous behind them.  Falls back to a normal ring buffer, if
+**	the buffer can't be mapped twice.
+**
+**	@param size	Size of the ring buffer.
+**
+**	@returns	Allocated ring buffer, must be freed with
+**			RingBufferDel(), NULL for out of memory.
+*/
+RingBuffer *RingBufferNewMirrored(size_t size)
+{
+    return RingBufferAlloc(size, 1);
+}
+
 /**
 **	Free an allocated ring buffer.
 */
 void RingBufferDel(RingBuffer * rb)
 {
-    free(rb->Buffer);
+#ifdef __linux__
+    if (rb->Mirrored) {
+	munmap(rb->Buffer, 2 * rb->Capacity);
+    } else
+#endif
+	free(rb->Buffer);
     free(rb);
 }
 
@@ -107,28 +301,12 @@ size_t RingBufferWriteAdvance(RingBuffer * rb, size_t cnt)
 {
     size_t n;
 
-    n = rb->Size - atomic_read(&rb->Filled);
+    n = RingBufferWriterFree(rb, cnt);
     if (cnt > n) {			// not enough space
 	cnt = n;
     }
-    //
-    //	Hitting end of buffer?
-    //
-    n = rb->BufferEnd - rb->WritePointer;
-    if (n > cnt) {			// don't cross the end
-	rb->WritePointer += cnt;
-    } else {				// reached or cross the end
-	rb->WritePointer = rb->Buffer;
-	if (n < cnt) {
-	    n = cnt - n;
-	    rb->WritePointer += n;
-	}
-    }
+    RingBufferStore(&rb->Writer.Head, rb->Writer.Head + cnt);
 
-    //
-    //	Only atomic modification!
-    //
-    atomic_add(cnt, &rb->Filled);
     return cnt;
 }
 
@@ -144,35 +322,16 @@ size_t RingBufferWriteAdvance(RingBuffer * rb, size_t cnt)
 */
 size_t RingBufferWrite(RingBuffer * rb, const void *buf, size_t cnt)
 {
-    size_t n;
+    struct iovec vec[2];
 
-    n = rb->Size - atomic_read(&rb->Filled);
-    if (cnt > n) {			// not enough space
-	cnt = n;
-    }
-    //
-    //	Hitting end of buffer?
-    //
-    n = rb->BufferEnd - rb->WritePointer;
-    if (n > cnt) {			// don't cross the end
-	memcpy(rb->WritePointer, buf, cnt);
-	rb->WritePointer += cnt;
-    } else {				// reached or cross the end
-	memcpy(rb->WritePointer, buf, n);
-	rb->WritePointer = rb->Buffer;
-	if (n < cnt) {
-	    buf += n;
-	    n = cnt - n;
-	    memcpy(rb->WritePointer, buf, n);
-	    rb->WritePointer += n;
-	}
+    cnt = RingBufferReserve(rb, cnt, vec);
+    memcpy(vec[0].iov_base, buf, vec[0].iov_len);
+    if (vec[1].iov_len) {
+	memcpy(vec[1].iov_base, (const char *)buf + vec[0].iov_len,
+	    vec[1].iov_len);
     }
 
-    //
-    //	Only atomic modification!
-    //
-    atomic_add(cnt, &rb->Filled);
-    return cnt;
+    return RingBufferWriteAdvance(rb, cnt);
 }
 
 /**
@@ -188,22 +347,65 @@ size_t RingBufferGetWritePointer(RingBuffer * rb, void **wp)
 {
     size_t n;
     size_t cnt;
+    size_t offset;
 
     //	Total free bytes available in ring buffer
-    cnt = rb->Size - atomic_read(&rb->Filled);
-
-    *wp = rb->WritePointer;
+    cnt = RingBufferWriterFree(rb, rb->Size);
 
+    offset = RingBufferOffset(rb, rb->Writer.Head);
+    *wp = rb->Buffer + offset;
+    if (rb->Mirrored) {
+	return cnt;
+    }
     //
     //	Hitting end of buffer?
     //
-    n = rb->BufferEnd - rb->WritePointer;
+    n = rb->Capacity - offset;
     if (n <= cnt) {			// reached or cross the end
 	return n;
     }
     return cnt;
 }
 
+/**
+**	Reserve free bytes in ring buffer for writing.
+**
+**	The reserved bytes are split into two parts, if they cross the end
+**	of a not mirrored buffer.  Written bytes are committed with
+**	RingBufferWriteAdvance().
+**
+**	@param rb	Ring buffer to write to.
+**	@param cnt	Number of bytes wanted.
+**	@param[out] vec	Reserved parts, second part is empty if contiguous.
+**
+**	@returns	Number of bytes reserved in both parts.
+*/
+size_t RingBufferReserve(RingBuffer * rb, size_t cnt, struct iovec vec[2])
+{
+    size_t n;
+    size_t offset;
+
+    n = RingBufferWriterFree(rb, cnt);
+    if (cnt > n) {			// not enough space
+	cnt = n;
+    }
+
+    offset = RingBufferOffset(rb, rb->Writer.Head);
+    vec[0].iov_base = rb->Buffer + offset;
+    n = rb->Capacity - offset;
+    if (rb->Mirrored || n >= cnt) {	// don't cross the end
+	vec[0].iov_len = cnt;
+	vec[1].iov_base = NULL;
+	vec[1].iov_len = 0;
+    } else {
+	vec[0].iov_len = n;
+	vec[1].iov_base = rb->Buffer;
+	vec[1].iov_len = cnt - n;
+    }
+
+    return cnt;
+}
+
 /**
 **	Advance read pointer in ring buffer.
 **
@@ -216,28 +418,12 @@ size_t RingBufferReadAdvance(RingBuffer * rb, size_t cnt)
 {
     size_t n;
 
-    n = atomic_read(&rb->Filled);
+    n = RingBufferReaderUsed(rb, cnt);
     if (cnt > n) {			// not enough filled
 	cnt = n;
     }
-    //
-    //	Hitting end of buffer?
-    //
-    n = rb->BufferEnd - rb->ReadPointer;
-    if (n > cnt) {			// don't cross the end
-	rb->ReadPointer += cnt;
-    } else {				// reached or cross the end
-	rb->ReadPointer = rb->Buffer;
-	if (n < cnt) {
-	    n = cnt - n;
-	    rb->ReadPointer += n;
-	}
-    }
+    RingBufferStore(&rb->Reader.Tail, rb->Reader.Tail + cnt);
 
-    //
-    //	Only atomic modification!
-    //
-    atomic_sub(cnt, &rb->Filled);
     return cnt;
 }
 
@@ -252,35 +438,16 @@ size_t RingBufferReadAdvance(RingBuffer * rb, size_t cnt)
 */
 size_t RingBufferRead(RingBuffer * rb, void *buf, size_t cnt)
 {
-    size_t n;
+    struct iovec vec[2];
 
-    n = atomic_read(&rb->Filled);
-    if (cnt > n) {			// not enough filled
-	cnt = n;
-    }
-    //
-    //	Hitting end of buffer?
-    //
-    n = rb->BufferEnd - rb->ReadPointer;
-    if (n > cnt) {			// don't cross the end
-	memcpy(buf, rb->ReadPointer, cnt);
-	rb->ReadPointer += cnt;
-    } else {				// reached or cross the end
-	memcpy(buf, rb->ReadPointer, n);
-	rb->ReadPointer = rb->Buffer;
-	if (n < cnt) {
-	    buf += n;
-	    n = cnt - n;
-	    memcpy(buf, rb->ReadPointer, n);
-	    rb->ReadPointer += n;
-	}
+    cnt = RingBufferPeek(rb, cnt, vec);
+    memcpy(buf, vec[0].iov_base, vec[0].iov_len);
+    if (vec[1].iov_len) {
+	memcpy((char *)buf + vec[0].iov_len, vec[1].iov_base,
+	    vec[1].iov_len);
     }
 
-    //
-    //	Only atomic modification!
-    //
-    atomic_sub(cnt, &rb->Filled);
-    return cnt;
+    return RingBufferReadAdvance(rb, cnt);
 }
 
 /**
@@ -296,22 +463,85 @@ size_t RingBufferGetReadPointer(RingBuffer * rb, const void **rp)
 {
     size_t n;
     size_t cnt;
+    size_t offset;
 
     //	Total used bytes in ring buffer
-    cnt = atomic_read(&rb->Filled);
-
-    *rp = rb->ReadPointer;
+    cnt = RingBufferReaderUsed(rb, rb->Size);
 
+    offset = RingBufferOffset(rb, rb->Reader.Tail);
+    *rp = rb->Buffer + offset;
+    if (rb->Mirrored) {
+	return cnt;
+    }
     //
     //	Hitting end of buffer?
     //
-    n = rb->BufferEnd - rb->ReadPointer;
+    n = rb->Capacity - offset;
     if (n <= cnt) {			// reached or cross the end
 	return n;
     }
     return cnt;
 }
 
+/**
+**	Peek used bytes in ring buffer for reading.
+**
+**	The used bytes are split into two parts, if they cross the end of
+**	a not mirrored buffer.  Consumed bytes are released with
+**	RingBufferReadAdvance().
+**
+**	@param rb	Ring buffer to read from.
+**	@param cnt	Number of bytes wanted.
+**	@param[out] vec	Used parts, second part is empty if contiguous.
+**
+**	@returns	Number of bytes available in both parts.
+*/
+size_t RingBufferPeek(RingBuffer * rb, size_t cnt, struct iovec vec[2])
+{
+    size_t n;
+    size_t offset;
+
+    n = RingBufferReaderUsed(rb, cnt);
+    if (cnt > n) {			// not enough filled
+	cnt = n;
+    }
+
+    offset = RingBufferOffset(rb, rb->Reader.Tail);
+    vec[0].iov_base = rb->Buffer + offset;
+    n = rb->Capacity - offset;
+    if (rb->Mirrored || n >= cnt) {	// don't cross the end
+	vec[0].iov_len = cnt;
+	vec[1].iov_base = NULL;
+	vec[1].iov_len = 0;
+    } else {
+	vec[0].iov_len = n;
+	vec[1].iov_base = rb->Buffer;
+	vec[1].iov_len = cnt - n;
+    }
+
+    return cnt;
+}
+
+/**
+**	Get used bytes in ring buffer.
+**
+**	Could be called by reader and writer, both indices are reloaded.
+**
+**	@param rb	Ring buffer.
+*/
+static inline size_t RingBufferUsed(RingBuffer * rb)
+{
+    size_t tail;
+    size_t used;
+
+    tail = RingBufferLoad(&rb->Reader.Tail);
+    used = RingBufferLoad(&rb->Writer.Head) - tail;
+    if (used > rb->Size) {		// tail moved meanwhile
+	used = rb->Size;
+    }
+    return used;
+}
+
 /**
 **	Get free bytes in ring buffer.
 **
@@ -321,7 +551,7 @@ size_t RingBufferGetReadPointer(RingBuffer * rb, const void **rp)
 */
 size_t RingBufferFreeBytes(RingBuffer * rb)
 {
-    return rb->Size - atomic_read(&rb->Filled);
+    return rb->Size - RingBufferUsed(rb);
 }
 
 /**
@@ -333,5 +563,5 @@ size_t RingBufferFreeBytes(RingBuffer * rb)
 */
 size_t RingBufferUsedBytes(RingBuffer * rb)
 {
-    return atomic_read(&rb->Filled);
+    return RingBufferUsed(rb);
 }
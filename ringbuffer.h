@@ -26,12 +26,17 @@
     /// ring buffer typedef
 typedef struct _ring_buffer_ RingBuffer;
 
+#include <sys/uio.h>			// struct iovec
+
     /// reset ring buffer pointers
 extern void RingBufferReset(RingBuffer *);
 
     /// create new ring buffer
 extern RingBuffer *RingBufferNew(size_t);
 
+    /// create new mirrored ring buffer
+extern RingBuffer *RingBufferNewMirrored(size_t);
+
     /// free ring buffer
 extern void RingBufferDel(RingBuffer *);
 
@@ -44,6 +49,9 @@ extern size_t RingBufferGetWritePointer(RingBuffer *, void **);
     /// advance write pointer of ring buffer
 extern size_t RingBufferWriteAdvance(RingBuffer *, size_t);
 
+    /// reserve free bytes of ring buffer for writing
+extern size_t RingBufferReserve(RingBuffer *, size_t, struct iovec[2]);
+
     /// read from ring buffer
 extern size_t RingBufferRead(RingBuffer *, void *, size_t);
 
@@ -53,6 +61,9 @@ extern size_t RingBufferGetReadPointer(RingBuffer *, const void **);
     /// advance read pointer of ring buffer
 extern size_t RingBufferReadAdvance(RingBuffer *, size_t);
 
+    /// peek used bytes of ring buffer for reading
+extern size_t RingBufferPeek(RingBuffer *, size_t, struct iovec[2]);
+
     /// free bytes ring buffer
 extern size_t RingBufferFreeBytes(RingBuffer *);
 
@@ -70,6 +70,9 @@
 #include "audio.h"
 #include "video.h"
 #include "codec.h"
+#include "stats.h"
+#include "avsync.h"
+#include "startcode.h"
 
 #ifdef DEBUG
 static int DumpH264(const uint8_t * data, int size);
@@ -82,6 +85,12 @@ static void DumpMpeg(const uint8_t * data, int size);
 
 extern int ConfigAudioBufferTime;	///< config size ms of audio buffer
 extern int ConfigVideoClearOnSwitch;	///< clear decoder on channel switch
+extern char ConfigVideoFastSwitch;	///< keep decoder on channel switch
+extern int ConfigVideoBufferTime;	///< config size ms of video buffer
+extern int ConfigVideoBufferSize;	///< config size KiB of video buffer
+#ifdef USE_PIP
+extern int ConfigPipBufferSize;		///< config size KiB of pip buffer
+#endif
 char ConfigStartX11Server;		///< flag start the x11 server
 static signed char ConfigStartSuspended;	///< flag to start in suspend mode
 static char ConfigFullscreen;		///< fullscreen modus
@@ -911,6 +920,8 @@ static void PesParse(PesDemux * pesdx, const uint8_t * data, int size,
     } while (size > 0);
 }
 
+#endif
+
 //////////////////////////////////////////////////////////////////////////////
 //	Transport stream demux
 //////////////////////////////////////////////////////////////////////////////
@@ -931,8 +942,19 @@ typedef struct _ts_demux_ TsDemux;
 struct _ts_demux_
 {
     int Packets;			///< packets between PCR
+
+    int Pid;				///< PID of stream, -1 unknown
+    int CC;				///< last continuity counter, -1 unknown
+    int Start;				///< access unit assembly state
+    int NewStream;			///< flag: reset for stream switch done
+    int64_t PCR;			///< last program clock reference (27MHz)
+
+    int HeaderIndex;			///< bytes in PES header buffer
+    uint8_t Header[2 * TS_PACKET_SIZE];	///< PES header buffer
 };
 
+#ifndef NO_TS_AUDIO
+
 static PesDemux PesDemuxAudio[1];	///< audio demuxer
 
 ///
@@ -1014,6 +1036,30 @@ static int TsDemuxer(TsDemux * tsdx, const uint8_t * data, int size)
 
 #endif
 
+/**
+**	Start new audio stream after a channel switch.
+**
+**	With fast channel switch the codec is only flushed, a new stream
+**	with the same codec and format continues without a new setup.
+*/
+static void AudioNewStream(void)
+{
+    if (ConfigVideoFastSwitch && AudioCodecID != AV_CODEC_ID_NONE
+	&& AudioCodecID != AV_CODEC_ID_PCM_DVD) {
+	CodecAudioFlushBuffers(MyAudioDecoder);
+	AudioFlushBuffers();
+    } else {
+	// this clears the audio ringbuffer indirect, open and setup does it
+	CodecAudioClose(MyAudioDecoder);
+	AudioFlushBuffers();
+	AudioCodecID = AV_CODEC_ID_NONE;
+    }
+    // max time between audio packets 200ms + 24ms hw buffer
+    AudioSetBufferTime(ConfigAudioBufferTime);
+    AudioChannelID = -1;
+    NewAudioStream = 0;
+}
+
 /**
 **	Play audio packet.
 **
@@ -1035,13 +1081,7 @@ int PlayAudio(const uint8_t * data, int size, uint8_t id)
 	return 0;
     }
     if (NewAudioStream) {
-	// this clears the audio ringbuffer indirect, open and setup does it
-	CodecAudioClose(MyAudioDecoder);
-	AudioFlushBuffers();
-	AudioSetBufferTime(ConfigAudioBufferTime);
-	AudioCodecID = AV_CODEC_ID_NONE;
-	AudioChannelID = -1;
-	NewAudioStream = 0;
+	AudioNewStream();
     }
     // hard limit buffer full: don't overrun audio buffers on replay
     if (AudioFreeBytes() < AUDIO_MIN_BUFFER_FREE) {
@@ -1265,14 +1305,7 @@ int PlayTsAudio(const uint8_t * data, int size)
 	return 0;
     }
     if (NewAudioStream) {
-	// this clears the audio ringbuffer indirect, open and setup does it
-	CodecAudioClose(MyAudioDecoder);
-	AudioFlushBuffers();
-	// max time between audio packets 200ms + 24ms hw buffer
-	AudioSetBufferTime(ConfigAudioBufferTime);
-	AudioCodecID = AV_CODEC_ID_NONE;
-	AudioChannelID = -1;
-	NewAudioStream = 0;
+	AudioNewStream();
 	PesReset(PesDemuxAudio);
     }
     // hard limit buffer full: don't overrun audio buffers on replay
@@ -1315,8 +1348,28 @@ void ResetChannelId(void)
 //	Video
 //////////////////////////////////////////////////////////////////////////////
 
-#define VIDEO_BUFFER_SIZE (512 * 1024)	///< video PES buffer default size
+#define VIDEO_BUFFER_SIZE (512 * 1024)	///< video PES buffer reserve size
 #define VIDEO_PACKET_MAX 192		///< max number of video packets
+#define VIDEO_BUFFER_TIME 2000		///< default size of packet arena in ms
+#define VIDEO_BUFFER_RATE 5000		///< arena bytes per ms (40 Mbit/s)
+#define VIDEO_PIP_BUFFER_SIZE 4096	///< default size of pip arena in KiB
+
+/**
+**	Video packet descriptor.
+**
+**	The data of the packet is stored in the byte arena of the stream.
+**	The decoder gets a reference counted buffer of the data, the arena
+**	space is reused after ffmpeg released all references.
+*/
+typedef struct _video_packet_
+{
+    size_t Offset;			///< offset of packet data in arena
+    int Size;				///< number of bytes in packet
+    int64_t Pts;			///< presentation timestamp of packet
+    enum AVCodecID CodecID;		///< codec id of packet
+    char Switch;			///< close packet of a channel switch
+    atomic_t Released;			///< decoder released packet data
+} VideoPacket;
 
 /**
 **	Video output stream device structure.	Parser, decoder, display.
@@ -1329,6 +1382,11 @@ struct __video_stream__
 
     enum AVCodecID CodecID;		///< current codec id
     enum AVCodecID LastCodecID;		///< last codec id
+    enum AVCodecID WarmCodecID;		///< codec kept open for fast switch
+    signed char CodecHwDecoder;		///< hardware decoder config at open
+
+    uint32_t SwitchTicks;		///< ticks of last channel switch
+    volatile char SwitchPending;	///< waiting for first frame of switch
 
     volatile char NewStream;		///< flag new video stream
     volatile char ClosingStream;	///< flag closing video stream
@@ -1342,13 +1400,18 @@ struct __video_stream__
 
     int InvalidPesCounter;		///< counter of invalid PES packets
 
-    enum AVCodecID CodecIDRb[VIDEO_PACKET_MAX];	///< codec ids in ring buffer
-    AVPacket PacketRb[VIDEO_PACKET_MAX];	///< PES packet ring buffer
+    uint8_t *Arena;			///< byte arena of packet data
+    size_t ArenaSize;			///< size of byte arena
+    int PacketMax;			///< biggest packet seen (arena reserve)
+    int PacketPeak;			///< biggest packet of this stream
+    VideoPacket PacketRb[VIDEO_PACKET_MAX];	///< packet descriptor ring
     int StartCodeState;			///< last three bytes start code state
 
     int PacketWrite;			///< ring buffer write pointer
     int PacketRead;			///< ring buffer read pointer
+    int PacketFree;			///< ring buffer release pointer
     atomic_t PacketsFilled;		///< how many of the ring buffer is used
+    atomic_t PacketsUsed;		///< how many packets aren't released
 };
 
 static VideoStream MyVideoStream[1];	///< normal video stream
@@ -1357,6 +1420,12 @@ static VideoStream MyVideoStream[1];	///< normal video stream
 static VideoStream PipVideoStream[1];	///< pip video stream
 #endif
 
+static int SwitchCount;			///< channel switches measured
+static int SwitchFastCount;		///< channel switches with warm codec
+static int SwitchLastMs;		///< last switch time to first frame
+static int SwitchMaxMs;			///< max switch time to first frame
+static uint32_t SwitchSumMs;		///< sum of switch times
+
 #ifdef DEBUG
 uint32_t VideoSwitch;			///< debug video switch ticks
 static int VideoMaxPacketSize;		///< biggest used packet buffer
@@ -1374,24 +1443,48 @@ static volatile char Usr1Signal;	///< true got usr1 signal
 /**
 **	Initialize video packet ringbuffer.
 **
+**	One contiguous byte arena holds the data of all packets, the
+**	descriptor ring holds offset, size, pts and codec id of each packet.
+**	The size of the arena is configured in ms or in KiB.
+**
 **	@param stream	video stream
 */
 static void VideoPacketInit(VideoStream * stream)
 {
-    int i;
-
-    for (i = 0; i < VIDEO_PACKET_MAX; ++i) {
-	AVPacket *avpkt;
+    size_t size;
 
-	avpkt = &stream->PacketRb[i];
-	// build a clean ffmpeg av packet
-	if (av_new_packet(avpkt, VIDEO_BUFFER_SIZE)) {
-	    Fatal(_("[softhddev] out of memory\n"));
-	}
+    if (ConfigVideoBufferSize > 0) {
+	size = (size_t) ConfigVideoBufferSize * 1024;
+    } else {
+	size = (size_t) (ConfigVideoBufferTime > 0 ? ConfigVideoBufferTime :
+	    VIDEO_BUFFER_TIME) * VIDEO_BUFFER_RATE;
     }
+#ifdef USE_PIP
+    if (stream == PipVideoStream) {	// pip is bounded by its own limit
+	size = (size_t) (ConfigPipBufferSize > 0 ? ConfigPipBufferSize :
+	    VIDEO_PIP_BUFFER_SIZE) * 1024;
+    }
+#endif
+    // arena must at least hold a few big packets
+    if (size < 4 * VIDEO_BUFFER_SIZE) {
+	size = 4 * VIDEO_BUFFER_SIZE;
+    }
+    if (!(stream->Arena = av_malloc(size))) {
+	Fatal(_("[softhddev] out of memory\n"));
+    }
+    stream->ArenaSize = size;
+    stream->PacketMax = VIDEO_BUFFER_SIZE;
+    stream->PacketPeak = 0;
+    Debug(3, "video: packet arena %zd KiB\n", size / 1024);
 
     atomic_set(&stream->PacketsFilled, 0);
-    stream->PacketRead = stream->PacketWrite = 0;
+    atomic_set(&stream->PacketsUsed, 0);
+    stream->PacketRead = stream->PacketWrite = stream->PacketFree = 0;
+    stream->PacketRb[0].Offset = 0;
+    stream->PacketRb[0].CodecID = AV_CODEC_ID_NONE;
+    stream->PacketRb[0].Size = 0;
+    stream->PacketRb[0].Pts = AV_NOPTS_VALUE;
+    stream->StartCodeState = 0;
 }
 
 /**
@@ -1401,13 +1494,75 @@ static void VideoPacketInit(VideoStream * stream)
 */
 static void VideoPacketExit(VideoStream * stream)
 {
-    int i;
-
     atomic_set(&stream->PacketsFilled, 0);
+    atomic_set(&stream->PacketsUsed, 0);
+
+    av_freep(&stream->Arena);
+    stream->ArenaSize = 0;
+}
 
-    for (i = 0; i < VIDEO_PACKET_MAX; ++i) {
-	av_free_packet(&stream->PacketRb[i]);
+/**
+**	Get free contiguous bytes for the current packet in the arena.
+**
+**	Only called from the producer side.  The consumer only advances
+**	PacketFree, this can only increase the free space.
+**
+**	Each packet keeps FF_INPUT_BUFFER_PADDING_SIZE bytes behind its
+**	data, they are part of the reference counted decoder buffer.
+**
+**	@param stream		video stream
+**	@param[out] wrapped	free bytes, if the current packet is moved to
+**	the start of the arena, 0 if not possible
+**
+**	@returns free bytes behind the current packet.
+*/
+static size_t VideoArenaFree(const VideoStream * stream, size_t * wrapped)
+{
+    const VideoPacket *pkt;
+    size_t end;
+    size_t read;
+    size_t used;
+
+    pkt = &stream->PacketRb[stream->PacketWrite];
+    end = pkt->Offset + pkt->Size + FF_INPUT_BUFFER_PADDING_SIZE;
+    used = pkt->Size + FF_INPUT_BUFFER_PADDING_SIZE;
+    *wrapped = 0;
+
+    if (!atomic_read(&stream->PacketsUsed)) {
+	// no other packet uses the arena
+	if (pkt->Offset) {
+	    *wrapped = stream->ArenaSize - used;
+	}
+    } else {
+	read = stream->PacketRb[stream->PacketFree].Offset;
+	if (read > pkt->Offset) {	// wrapped, keep one byte gap
+	    return read > end ? read - end - 1 : 0;
+	}
+	if (read > used + 1) {
+	    *wrapped = read - used - 1;
+	}
     }
+    return stream->ArenaSize > end ? stream->ArenaSize - end : 0;
+}
+
+/**
+**	Check if the packet ringbuffer is full.
+**
+**	Full if no descriptor is free or the arena can't hold the biggest
+**	packet seen.
+**
+**	@param stream	video stream
+**	@param reserve	number of descriptors to keep free
+*/
+static int VideoPacketFull(const VideoStream * stream, int reserve)
+{
+    size_t wrapped;
+
+    if (atomic_read(&stream->PacketsUsed) >= VIDEO_PACKET_MAX - reserve) {
+	return 1;
+    }
+    return VideoArenaFree(stream, &wrapped) < (size_t) stream->PacketMax
+	&& wrapped < (size_t) stream->PacketMax;
 }
 
 /**
@@ -1421,43 +1576,74 @@ static void VideoPacketExit(VideoStream * stream)
 static void VideoEnqueue(VideoStream * stream, int64_t pts, const void *data,
     int size)
 {
-    AVPacket *avpkt;
+    VideoPacket *pkt;
+    size_t wrapped;
 
     // Debug(3, "video: enqueue %d\n", size);
 
-    avpkt = &stream->PacketRb[stream->PacketWrite];
-    if (!avpkt->stream_index) {		// add pts only for first added
-	avpkt->pts = pts;
+    pkt = &stream->PacketRb[stream->PacketWrite];
+    if (!pkt->Size) {			// add pts only for first added
+	pkt->Pts = pts;
     }
-    if (avpkt->stream_index + size >= avpkt->size) {
-
-	Warning(_("video: packet buffer too small for %d\n"),
-	    avpkt->stream_index + size);
-
-	// new + grow reserves FF_INPUT_BUFFER_PADDING_SIZE
-	av_grow_packet(avpkt, ((size + VIDEO_BUFFER_SIZE / 2)
-		/ (VIDEO_BUFFER_SIZE / 2)) * (VIDEO_BUFFER_SIZE / 2));
-	// FIXME: out of memory!
-#ifdef DEBUG
-	if (avpkt->size <= avpkt->stream_index + size) {
-	    fprintf(stderr, "%d %d %d\n", avpkt->size, avpkt->stream_index,
-		size);
-	    fflush(stderr);
-	    abort();
+    if (VideoArenaFree(stream, &wrapped) < (size_t) size) {
+	if (wrapped < (size_t) size) {
+	    Error(_("video: no space in packet arena for %d bytes\n"),
+		pkt->Size + size);
+	    return;
 	}
-#endif
+	// move packet to start of arena
+	memmove(stream->Arena, stream->Arena + pkt->Offset, pkt->Size);
+	pkt->Offset = 0;
     }
 
-    memcpy(avpkt->data + avpkt->stream_index, data, size);
-    avpkt->stream_index += size;
+    memcpy(stream->Arena + pkt->Offset + pkt->Size, data, size);
+    pkt->Size += size;
+    if (pkt->Size > stream->PacketPeak) {
+	stream->PacketPeak = pkt->Size;
+	if (pkt->Size > stream->PacketMax) {
+	    stream->PacketMax = pkt->Size;
+	}
+    }
 #ifdef DEBUG
-    if (avpkt->stream_index > VideoMaxPacketSize) {
-	VideoMaxPacketSize = avpkt->stream_index;
+    if (pkt->Size > VideoMaxPacketSize) {
+	VideoMaxPacketSize = pkt->Size;
 	Debug(3, "video: max used PES packet size: %d\n", VideoMaxPacketSize);
     }
 #endif
 }
 
+#ifdef USE_PIP
+
+/**
+**	Get start code state of the end of a buffer.
+**
+**	A start code prefix can be split over two packets.
+**
+**	@param data	buffer
+**	@param size	size of buffer
+**
+**	@retval 3	buffer ends with 0x00 0x00 0x01
+**	@retval 2	buffer ends with 0x00 0x00
+**	@retval 1	buffer ends with 0x00
+**	@retval 0	no start code prefix at the end
+*/
+static int StartCodeTail(const uint8_t * data, int size)
+{
+    if (size >= 3 && !data[size - 3] && !data[size - 2]
+	&& data[size - 1] == 0x01) {
+	return 3;
+    }
+    if (size >= 2 && !data[size - 2] && !data[size - 1]) {
+	return 2;
+    }
+    if (size >= 1 && !data[size - 1]) {
+	return 1;
+    }
+    return 0;
+}
+
+#endif
+
 /**
 **	Reset current packet.
 **
@@ -1465,15 +1651,15 @@ static void VideoEnqueue(VideoStream * stream, int64_t pts, const void *data,
 */
 static void VideoResetPacket(VideoStream * stream)
 {
-    AVPacket *avpkt;
+    VideoPacket *pkt;
 
     stream->StartCodeState = 0;		// reset start code state
 
-    stream->CodecIDRb[stream->PacketWrite] = AV_CODEC_ID_NONE;
-    avpkt = &stream->PacketRb[stream->PacketWrite];
-    avpkt->stream_index = 0;
-    avpkt->pts = AV_NOPTS_VALUE;
-    avpkt->dts = AV_NOPTS_VALUE;
+    pkt = &stream->PacketRb[stream->PacketWrite];
+    pkt->CodecID = AV_CODEC_ID_NONE;
+    pkt->Switch = 0;
+    pkt->Size = 0;
+    pkt->Pts = AV_NOPTS_VALUE;
 }
 
 /**
@@ -1484,33 +1670,41 @@ static void VideoResetPacket(VideoStream * stream)
 */
 static void VideoNextPacket(VideoStream * stream, int codec_id)
 {
-    AVPacket *avpkt;
+    VideoPacket *pkt;
+    size_t next;
 
-    avpkt = &stream->PacketRb[stream->PacketWrite];
-    if (!avpkt->stream_index) {		// ignore empty packets
+    pkt = &stream->PacketRb[stream->PacketWrite];
+    if (!pkt->Size) {			// ignore empty packets
 	if (codec_id != AV_CODEC_ID_NONE) {
 	    return;
 	}
 	Debug(3, "video: possible stream change loss\n");
     }
 
-    if (atomic_read(&stream->PacketsFilled) >= VIDEO_PACKET_MAX - 1) {
+    if (atomic_read(&stream->PacketsUsed) >= VIDEO_PACKET_MAX - 1) {
 	// no free slot available drop last packet
 	Error(_("video: no empty slot in packet ringbuffer\n"));
-	avpkt->stream_index = 0;
+	pkt->Size = 0;
 	if (codec_id == AV_CODEC_ID_NONE) {
 	    Debug(3, "video: possible stream change loss\n");
 	}
 	return;
     }
-    // clear area for decoder, always enough space allocated
-    memset(avpkt->data + avpkt->stream_index, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    // clear area for decoder, always enough space reserved
+    memset(stream->Arena + pkt->Offset + pkt->Size, 0,
+	FF_INPUT_BUFFER_PADDING_SIZE);
+
+    pkt->CodecID = codec_id;
+    atomic_set(&pkt->Released, 0);
+    //DumpH264(stream->Arena + pkt->Offset, pkt->Size);
 
-    stream->CodecIDRb[stream->PacketWrite] = codec_id;
-    //DumpH264(avpkt->data, avpkt->stream_index);
+    // next packet starts behind the padding of this one
+    next = pkt->Offset + pkt->Size + FF_INPUT_BUFFER_PADDING_SIZE;
 
     // advance packet write
     stream->PacketWrite = (stream->PacketWrite + 1) % VIDEO_PACKET_MAX;
+    stream->PacketRb[stream->PacketWrite].Offset = next;
+    atomic_inc(&stream->PacketsUsed);
     atomic_inc(&stream->PacketsFilled);
 
     VideoDisplayWakeup();
@@ -1519,6 +1713,59 @@ static void VideoNextPacket(VideoStream * stream, int codec_id)
     VideoResetPacket(stream);
 }
 
+/**
+**	Release callback of the decoder packet buffer.
+**
+**	Called by ffmpeg, when the last reference of the packet is gone.
+**	Can be called from any ffmpeg thread.
+**
+**	@param opaque	video packet descriptor
+**	@param data	packet data in arena
+*/
+static void VideoPacketRelease(void *opaque, __attribute__ ((unused))
+    uint8_t * data)
+{
+    atomic_set(&((VideoPacket *) opaque)->Released, 1);
+}
+
+/**
+**	Recycle released packets in order.
+**
+**	Only called from the consumer side.
+**
+**	@param stream	video stream
+*/
+static void VideoPacketRecycle(VideoStream * stream)
+{
+    while (stream->PacketFree != stream->PacketRead
+	&& atomic_read(&stream->PacketRb[stream->PacketFree].Released)) {
+	stream->PacketFree = (stream->PacketFree + 1) % VIDEO_PACKET_MAX;
+	atomic_dec(&stream->PacketsUsed);
+    }
+}
+
+/**
+**	Drop all queued packets.
+**
+**	Only called from the consumer side.
+**
+**	@param stream	video stream
+*/
+static void VideoPacketClear(VideoStream * stream)
+{
+    int filled;
+    int i;
+
+    filled = atomic_read(&stream->PacketsFilled);
+    for (i = 0; i < filled; ++i) {	// never given to the decoder
+	atomic_set(&stream->PacketRb[(stream->PacketRead +
+		    i) % VIDEO_PACKET_MAX].Released, 1);
+    }
+    stream->PacketRead = (stream->PacketRead + filled) % VIDEO_PACKET_MAX;
+    atomic_sub(filled, &stream->PacketsFilled);
+    VideoPacketRecycle(stream);
+}
+
 #ifdef USE_PIP
 
 /**
@@ -1528,8 +1775,6 @@ static void VideoNextPacket(VideoStream * stream, int codec_id)
 **	Split the packet into single picture packets.
 **	Nick/CC, Viva, MediaShop, Deutsches Music Fernsehen
 **
-**	FIXME: this code can be written much faster
-**
 **	@param stream	video stream
 **	@param pts	presentation timestamp of pes packet
 **	@param data	data of pes packet
@@ -1540,13 +1785,16 @@ static void VideoMpegEnqueue(VideoStream * stream, int64_t pts,
 {
     static const char startcode[3] = { 0x00, 0x00, 0x01 };
     const uint8_t *p;
+    const uint8_t *q;
+    const uint8_t *end;
     int n;
     int first;
 
     // first scan
-    first = !stream->PacketRb[stream->PacketWrite].stream_index;
+    first = !stream->PacketRb[stream->PacketWrite].Size;
     p = data;
     n = size;
+    end = data + size;
 
 #ifdef DEBUG
     if (n < 4) {
@@ -1565,7 +1813,7 @@ static void VideoMpegEnqueue(VideoStream * stream, int64_t pts,
 #ifdef DEBUG
 		fprintf(stderr, "last: %d start\n", stream->StartCodeState);
 #endif
-		stream->PacketRb[stream->PacketWrite].stream_index -= 3;
+		stream->PacketRb[stream->PacketWrite].Size -= 3;
 		VideoNextPacket(stream, AV_CODEC_ID_MPEG2VIDEO);
 		VideoEnqueue(stream, pts, startcode, 3);
 		first = p[0] == 0xb3;
@@ -1582,7 +1830,7 @@ static void VideoMpegEnqueue(VideoStream * stream, int64_t pts,
 #ifdef DEBUG
 		fprintf(stderr, "last: %d start\n", stream->StartCodeState);
 #endif
-		stream->PacketRb[stream->PacketWrite].stream_index -= 2;
+		stream->PacketRb[stream->PacketWrite].Size -= 2;
 		VideoNextPacket(stream, AV_CODEC_ID_MPEG2VIDEO);
 		VideoEnqueue(stream, pts, startcode, 2);
 		first = p[1] == 0xb3;
@@ -1599,7 +1847,7 @@ static void VideoMpegEnqueue(VideoStream * stream, int64_t pts,
 #ifdef DEBUG
 		fprintf(stderr, "last: %d start\n", stream->StartCodeState);
 #endif
-		stream->PacketRb[stream->PacketWrite].stream_index -= 1;
+		stream->PacketRb[stream->PacketWrite].Size -= 1;
 		VideoNextPacket(stream, AV_CODEC_ID_MPEG2VIDEO);
 		VideoEnqueue(stream, pts, startcode, 1);
 		first = p[2] == 0xb3;
@@ -1613,63 +1861,35 @@ static void VideoMpegEnqueue(VideoStream * stream, int64_t pts,
 
     // b3 b4 b8 00 b5 ... 00 b5 ...
 
-    while (n > 3) {
-	if (0 && !p[0] && !p[1] && p[2] == 0x01) {
-	    fprintf(stderr, " %02x", p[3]);
-	}
-	// scan for picture header 0x00000100
-	// FIXME: not perfect, must split at 0xb3 also
-	if (!p[0] && !p[1] && p[2] == 0x01 && !p[3]) {
-	    if (first) {
-		first = 0;
-		n -= 4;
-		p += 4;
-		continue;
-	    }
-	    // packet has already an picture header
-	    /*
-	       fprintf(stderr, "\nfix:%9d,%02x%02x%02x %02x ", n,
-	       p[0], p[1], p[2], p[3]);
-	     */
-	    // first packet goes only upto picture header
-	    VideoEnqueue(stream, pts, data, p - data);
-	    VideoNextPacket(stream, AV_CODEC_ID_MPEG2VIDEO);
+    // scan for picture header 0x00000100, need one byte after prefix
+    // FIXME: not perfect, must split at 0xb3 also
+    while ((q = FindStartCode(p, end - 1))) {
+	if (q[3]) {			// no picture header
+	    p = q + 3;
+	    continue;
+	}
+	if (first) {
+	    first = 0;
+	    p = q + 4;
+	    continue;
+	}
+	// packet has already an picture header
+	// first packet goes only upto picture header
+	VideoEnqueue(stream, pts, data, q - data);
+	VideoNextPacket(stream, AV_CODEC_ID_MPEG2VIDEO);
 #ifdef DEBUG
-	    fprintf(stderr, "fix\r");
+	fprintf(stderr, "fix\r");
 #endif
-	    data = p;
-	    size = n;
+	data = q;
+	size = end - q;
 
-	    // time-stamp only valid for first packet
-	    pts = AV_NOPTS_VALUE;
-	    n -= 4;
-	    p += 4;
-	    continue;
-	}
-	--n;
-	++p;
+	// time-stamp only valid for first packet
+	pts = AV_NOPTS_VALUE;
+	p = q + 4;
     }
 
-    stream->StartCodeState = 0;
-    switch (n) {			// handle packet border start code
-	case 3:
-	    if (!p[0] && !p[1] && p[2] == 0x01) {
-		stream->StartCodeState = 3;
-	    }
-	    break;
-	case 2:
-	    if (!p[0] && !p[1]) {
-		stream->StartCodeState = 2;
-	    }
-	    break;
-	case 1:
-	    if (!p[0]) {
-		stream->StartCodeState = 1;
-	    }
-	    break;
-	case 0:
-	    break;
-    }
+    // handle packet border start code
+    stream->StartCodeState = p < end ? StartCodeTail(p, end - p) : 0;
     VideoEnqueue(stream, pts, data, size);
 }
 
@@ -1692,13 +1912,16 @@ static void VideoMpegEnqueue(VideoStream * stream, int64_t pts,
 */
 static void FixPacketForFFMpeg(VideoDecoder * vdecoder, AVPacket * avpkt)
 {
-    uint8_t *p;
+    const uint8_t *p;
+    const uint8_t *q;
+    const uint8_t *end;
     int n;
     AVPacket tmp[1];
     int first;
 
     p = avpkt->data;
     n = avpkt->size;
+    end = p + n;
     *tmp = *avpkt;
 
     first = 1;
@@ -1708,37 +1931,36 @@ static void FixPacketForFFMpeg(VideoDecoder * vdecoder, AVPacket * avpkt)
     }
 #endif
 
-    while (n > 3) {
+    // scan for picture header 0x00000100, need one byte after prefix
+    while ((q = FindStartCode(p, end - 1))) {
 #if STILL_DEBUG>1
-	if (InStillPicture && !p[0] && !p[1] && p[2] == 0x01) {
-	    fprintf(stderr, " %02x", p[3]);
+	if (InStillPicture) {
+	    fprintf(stderr, " %02x", q[3]);
 	}
 #endif
-	// scan for picture header 0x00000100
-	if (!p[0] && !p[1] && p[2] == 0x01 && !p[3]) {
-	    if (first) {
-		first = 0;
-		n -= 4;
-		p += 4;
-		continue;
-	    }
-	    // packet has already an picture header
-	    tmp->size = p - tmp->data;
+	if (q[3]) {			// no picture header
+	    p = q + 3;
+	    continue;
+	}
+	p = q + 4;
+	if (first) {
+	    first = 0;
+	    continue;
+	}
+	// packet has already an picture header
+	tmp->size = q - tmp->data;
 #if STILL_DEBUG>1
-	    if (InStillPicture) {
-		fprintf(stderr, "\nfix:%9d,%02x %02x %02x %02x\n", tmp->size,
-		    tmp->data[0], tmp->data[1], tmp->data[2], tmp->data[3]);
-	    }
-#endif
-	    CodecVideoDecode(vdecoder, tmp);
-	    // time-stamp only valid for first packet
-	    tmp->pts = AV_NOPTS_VALUE;
-	    tmp->dts = AV_NOPTS_VALUE;
-	    tmp->data = p;
-	    tmp->size = n;
+	if (InStillPicture) {
+	    fprintf(stderr, "\nfix:%9d,%02x %02x %02x %02x\n", tmp->size,
+		tmp->data[0], tmp->data[1], tmp->data[2], tmp->data[3]);
 	}
-	--n;
-	++p;
+#endif
+	CodecVideoDecode(vdecoder, tmp);
+	// time-stamp only valid for first packet
+	tmp->pts = AV_NOPTS_VALUE;
+	tmp->dts = AV_NOPTS_VALUE;
+	tmp->data = (uint8_t *) q;
+	tmp->size = end - q;
     }
 
 #if STILL_DEBUG>1
@@ -1755,6 +1977,9 @@ static void FixPacketForFFMpeg(VideoDecoder * vdecoder, AVPacket * avpkt)
 /**
 **	Open video stream.
 **
+**	The main video stream drives the audio speed correction, the PIP
+**	stream only drops or duplicates frames.
+**
 **	@param stream	video stream
 */
 static void VideoStreamOpen(VideoStream * stream)
@@ -1762,8 +1987,11 @@ static void VideoStreamOpen(VideoStream * stream)
     stream->SkipStream = 1;
     stream->CodecID = AV_CODEC_ID_NONE;
     stream->LastCodecID = AV_CODEC_ID_NONE;
+    stream->WarmCodecID = AV_CODEC_ID_NONE;
+    stream->SwitchPending = 0;
 
-    if ((stream->HwDecoder = VideoNewHwDecoder(stream))) {
+    if ((stream->HwDecoder =
+	    VideoNewHwDecoder(stream, stream != MyVideoStream))) {
 	stream->Decoder = CodecVideoNewDecoder(stream->HwDecoder);
 	VideoPacketInit(stream);
 	stream->SkipStream = 0;
@@ -1831,22 +2059,77 @@ int VideoPollInput(VideoStream * stream)
 	return 1;
     }
     if (stream->ClearBuffers) {		// clear buffer request
-	atomic_set(&stream->PacketsFilled, 0);
-	stream->PacketRead = stream->PacketWrite;
+	VideoPacketClear(stream);
 	// FIXME: ->Decoder already checked
 	if (stream->Decoder) {
 	    CodecVideoFlushBuffers(stream->Decoder);
 	    VideoResetStart(stream->HwDecoder);
 	}
+	VideoPacketRecycle(stream);
 	stream->ClearBuffers = 0;
 	return 1;
     }
+    VideoPacketRecycle(stream);
     if (!atomic_read(&stream->PacketsFilled)) {
 	return -1;
     }
     return 1;
 }
 
+/**
+**	Open video codec for a new stream.
+**
+**	A codec kept open by a fast channel switch is reused, if the new
+**	stream has the same codec and the hardware decoder and decoder
+**	threads setup are unchanged.  Hardware surfaces are reused by the
+**	codec, as long as the format is unchanged.
+**
+**	@param stream	video stream
+**	@param codec_id	video codec id
+*/
+static void VideoDecoderOpen(VideoStream * stream, enum AVCodecID codec_id)
+{
+    if (stream->WarmCodecID != AV_CODEC_ID_NONE) {
+	if (stream->WarmCodecID == codec_id
+	    && stream->CodecHwDecoder == VideoHardwareDecoder
+	    && !CodecVideoThreadsChanged(stream->Decoder)) {
+	    Debug(3, "video: fast switch, reuse codec %#06x\n", codec_id);
+	    stream->WarmCodecID = AV_CODEC_ID_NONE;
+	    if (stream == MyVideoStream && stream->SwitchTicks) {
+		++SwitchFastCount;	// only channel switches are counted
+	    }
+	    return;
+	}
+	CodecVideoClose(stream->Decoder);
+	stream->WarmCodecID = AV_CODEC_ID_NONE;
+    }
+    stream->CodecHwDecoder = VideoHardwareDecoder;
+    CodecVideoOpen(stream->Decoder, codec_id);
+}
+
+/**
+**	First frame after a channel switch decoded.
+**
+**	@param stream	video stream
+*/
+static void VideoSwitchDone(VideoStream * stream)
+{
+    int ms;
+
+    if (stream != MyVideoStream || !stream->SwitchTicks) {
+	return;
+    }
+    ms = GetMsTicks() - stream->SwitchTicks;
+    stream->SwitchTicks = 0;		// count each switch only once
+    Debug(3, "video: first frame after switch %dms\n", ms);
+    ++SwitchCount;
+    SwitchLastMs = ms;
+    SwitchSumMs += ms;
+    if (ms > SwitchMaxMs) {
+	SwitchMaxMs = ms;
+    }
+}
+
 /**
 **	Decode from PES packet ringbuffer.
 **
@@ -1859,8 +2142,9 @@ int VideoPollInput(VideoStream * stream)
 int VideoDecodeInput(VideoStream * stream)
 {
     int filled;
-    AVPacket *avpkt;
-    int saved_size;
+    VideoPacket *pkt;
+    AVPacket avpkt[1];
+    uint32_t start;
 
     if (!stream->Decoder) {		// closing
 #ifdef DEBUG
@@ -1875,13 +2159,13 @@ int VideoDecodeInput(VideoStream * stream)
 	return 1;
     }
     if (stream->ClearBuffers) {		// clear buffer request
-	atomic_set(&stream->PacketsFilled, 0);
-	stream->PacketRead = stream->PacketWrite;
+	VideoPacketClear(stream);
 	// FIXME: ->Decoder already checked
 	if (stream->Decoder) {
 	    CodecVideoFlushBuffers(stream->Decoder);
 	    VideoResetStart(stream->HwDecoder);
 	}
+	VideoPacketRecycle(stream);
 	stream->ClearBuffers = 0;
 	return 1;
     }
@@ -1903,8 +2187,8 @@ int VideoDecodeInput(VideoStream * stream)
 
 	// flush buffers, if close is in the queue
 	for (f = 0; f < filled; ++f) {
-	    if (stream->CodecIDRb[(stream->PacketRead + f) % VIDEO_PACKET_MAX]
-		== AV_CODEC_ID_NONE) {
+	    if (stream->PacketRb[(stream->PacketRead + f) % VIDEO_PACKET_MAX].
+		CodecID == AV_CODEC_ID_NONE) {
 		if (f) {
 		    Debug(3, "video: cleared upto close\n");
 		    atomic_sub(f, &stream->PacketsFilled);
@@ -1922,46 +2206,67 @@ int VideoDecodeInput(VideoStream * stream)
     //
     //	handle queued commands
     //
-    avpkt = &stream->PacketRb[stream->PacketRead];
-    switch (stream->CodecIDRb[stream->PacketRead]) {
+    pkt = &stream->PacketRb[stream->PacketRead];
+    switch (pkt->CodecID) {
 	case AV_CODEC_ID_NONE:
 	    stream->ClosingStream = 0;
 	    if (stream->LastCodecID != AV_CODEC_ID_NONE) {
+		stream->WarmCodecID = stream->LastCodecID;
 		stream->LastCodecID = AV_CODEC_ID_NONE;
-		CodecVideoClose(stream->Decoder);
-		goto skip;
+	    }
+	    if (pkt->Switch) {
+		// frames of the old stream are gone, start the clock
+		VideoResetStart(stream->HwDecoder);
+		if (stream->SwitchTicks) {
+		    stream->SwitchPending = 1;
+		}
+	    }
+	    if (stream->WarmCodecID != AV_CODEC_ID_NONE) {
+		if (ConfigVideoFastSwitch) {
+		    // keep codec, hw surfaces are reused for the same format
+		    // VideoDecoderOpen closes it, if codec or setup changed
+		    CodecVideoRestart(stream->Decoder);
+		} else {
+		    CodecVideoClose(stream->Decoder);
+		    stream->WarmCodecID = AV_CODEC_ID_NONE;
+		}
 	    }
 	    // FIXME: look if more close are in the queue
 	    // size can be zero
 	    goto skip;
 	case AV_CODEC_ID_MPEG2VIDEO:
-	    if (stream->LastCodecID != AV_CODEC_ID_MPEG2VIDEO) {
-		stream->LastCodecID = AV_CODEC_ID_MPEG2VIDEO;
-		CodecVideoOpen(stream->Decoder, AV_CODEC_ID_MPEG2VIDEO);
-	    }
-	    break;
 	case AV_CODEC_ID_H264:
-	    if (stream->LastCodecID != AV_CODEC_ID_H264) {
-		stream->LastCodecID = AV_CODEC_ID_H264;
-		CodecVideoOpen(stream->Decoder, AV_CODEC_ID_H264);
+	case AV_CODEC_ID_HEVC:
+	    if (stream->LastCodecID != pkt->CodecID) {
+		stream->LastCodecID = pkt->CodecID;
+		VideoDecoderOpen(stream, pkt->CodecID);
 	    }
 	    break;
-        case AV_CODEC_ID_HEVC:
-            if (stream->LastCodecID != AV_CODEC_ID_HEVC) {
-                stream->LastCodecID = AV_CODEC_ID_HEVC;
-                CodecVideoOpen(stream->Decoder, AV_CODEC_ID_HEVC);
-            }
-            break;
 
 	default:
 	    break;
     }
 
-    // avcodec_decode_video2 needs size
-    saved_size = avpkt->size;
-    avpkt->size = avpkt->stream_index;
-    avpkt->stream_index = 0;
+    // build ffmpeg packet, which references the arena
+    // ffmpeg keeps its own reference, no copy of the data is needed
+    av_init_packet(avpkt);
+    avpkt->buf =
+	av_buffer_create(stream->Arena + pkt->Offset,
+	pkt->Size + FF_INPUT_BUFFER_PADDING_SIZE, VideoPacketRelease,
+	pkt, 0);
+    if (!avpkt->buf) {
+	Error(_("video: out of memory\n"));
+	goto skip;
+    }
+    avpkt->data = avpkt->buf->data;
+    avpkt->size = pkt->Size;
+    avpkt->pts = pkt->Pts;
+    avpkt->dts = AV_NOPTS_VALUE;
 
+    if (stream == MyVideoStream) {
+	StatsSample(StatsPacketQueue, filled);
+    }
+    start = GetUsTicks();
 #ifdef USE_PIP
     //fprintf(stderr, "[");
     //DumpMpeg(avpkt->data, avpkt->size);
@@ -1985,13 +2290,36 @@ int VideoDecodeInput(VideoStream * stream)
 	CodecVideoDecode(stream->Decoder, avpkt);
     }
 #endif
+    switch (stream->LastCodecID) {
+	case AV_CODEC_ID_MPEG2VIDEO:
+	    StatsSample(StatsDecodeMpeg2, GetUsTicks() - start);
+	    break;
+	case AV_CODEC_ID_H264:
+	    StatsSample(StatsDecodeH264, GetUsTicks() - start);
+	    break;
+	case AV_CODEC_ID_HEVC:
+	    StatsSample(StatsDecodeHevc, GetUsTicks() - start);
+	    break;
+	default:
+	    break;
+    }
 
-    avpkt->size = saved_size;
+    av_buffer_unref(&avpkt->buf);	// drop our reference
+
+    if (stream->SwitchPending
+	&& VideoGetClock(stream->HwDecoder) != (int64_t) AV_NOPTS_VALUE) {
+	stream->SwitchPending = 0;
+	VideoSwitchDone(stream);
+    }
+    goto next;
 
   skip:
+    atomic_set(&pkt->Released, 1);
+  next:
     // advance packet read
     stream->PacketRead = (stream->PacketRead + 1) % VIDEO_PACKET_MAX;
     atomic_dec(&stream->PacketsFilled);
+    VideoPacketRecycle(stream);
 
     return 0;
 }
@@ -2070,19 +2398,14 @@ static void StopVideo(void)
 */
 static void DumpMpeg(const uint8_t * data, int size)
 {
+    const uint8_t *p;
+
     fprintf(stderr, "%8d: ", size);
 
     // b3 b4 b8 00 b5 ... 00 b5 ...
 
-    while (size > 3) {
-	if (!data[0] && !data[1] && data[2] == 0x01) {
-	    fprintf(stderr, " %02x", data[3]);
-	    size -= 4;
-	    data += 4;
-	    continue;
-	}
-	--size;
-	++data;
+    for (p = data; (p = FindStartCode(p, data + size - 1)); p += 4) {
+	fprintf(stderr, " %02x", p[3]);
     }
     fprintf(stderr, "\n");
 }
@@ -2094,18 +2417,16 @@ static void DumpMpeg(const uint8_t * data, int size)
 */
 static int DumpH264(const uint8_t * data, int size)
 {
+    const uint8_t *p;
+
     printf("H264:");
-    do {
-	if (size < 4) {
-	    printf("\n");
-	    return -1;
-	}
-	if (!data[0] && !data[1] && data[2] == 0x01) {
-	    printf("%02x ", data[3]);
-	}
-	++data;
-	--size;
-    } while (size);
+    if (size < 4) {
+	printf("\n");
+	return -1;
+    }
+    for (p = data; (p = FindStartCode(p, data + size - 1)); p += 3) {
+	printf("%02x ", p[3]);
+    }
     printf("\n");
 
     return 0;
@@ -2176,11 +2497,14 @@ int PlayVideo3(VideoStream * stream, const uint8_t * data, int size)
     }
     if (stream->NewStream) {		// channel switched
 	Debug(3, "video: new stream %dms\n", GetMsTicks() - VideoSwitch);
-	if (atomic_read(&stream->PacketsFilled) >= VIDEO_PACKET_MAX - 1) {
+	if (VideoPacketFull(stream, 1)) {
 	    Debug(3, "video: new video stream lost\n");
 	    return 0;
 	}
+	// mark the close, the decoder can keep a warm codec
+	stream->PacketRb[stream->PacketWrite].Switch = 1;
 	VideoNextPacket(stream, AV_CODEC_ID_NONE);
+	stream->PacketRb[stream->PacketWrite].Switch = 0;
 	stream->CodecID = AV_CODEC_ID_NONE;
 	stream->ClosingStream = 1;
 	stream->NewStream = 0;
@@ -2216,7 +2540,7 @@ int PlayVideo3(VideoStream * stream, const uint8_t * data, int size)
 	return size;
     }
     // hard limit buffer full: needed for replay
-    if (atomic_read(&stream->PacketsFilled) >= VIDEO_PACKET_MAX - 10) {
+    if (VideoPacketFull(stream, 10)) {
 	return 0;
     }
 #ifdef USE_SOFTLIMIT
@@ -2237,6 +2561,8 @@ int PlayVideo3(VideoStream * stream, const uint8_t * data, int size)
     check = data + 9 + n;
     l = size - 9 - n;
     z = 0;
+    // only the leading zeros are scanned, start codes inside continuation
+    // payloads are found by VideoMpegEnqueue with its start code state
     while (!*check) {			// count leading zeros
 	if (l < 3) {
 	    Warning(_("[softhddev] empty video packet %d bytes\n"), size);
@@ -2394,6 +2720,271 @@ int PlayVideo(const uint8_t * data, int size)
     return PlayVideo3(MyVideoStream, data, size);
 }
 
+#if defined(USE_TS_VIDEO) || defined(USE_PIP)
+
+///
+///	Access unit assembly states of the video transport stream demuxer.
+///
+enum
+{
+    TS_VIDEO_WAIT,			///< wait for payload unit start
+    TS_VIDEO_HEADER,			///< collect PES header
+    TS_VIDEO_PAYLOAD,			///< copy payload into packet queue
+};
+
+#ifdef USE_TS_VIDEO
+static TsDemux TsDemuxVideo[1];		///< video transport stream demuxer
+#endif
+#ifdef USE_PIP
+static TsDemux PipTsDemux[1];		///< pip transport stream demuxer
+#endif
+
+/**
+**	Reset transport stream video demuxer.
+**
+**	@param tsdx	transport stream demuxer
+*/
+static void TsVideoReset(TsDemux * tsdx)
+{
+    tsdx->Pid = -1;
+    tsdx->CC = -1;
+    tsdx->Start = TS_VIDEO_WAIT;
+    tsdx->HeaderIndex = 0;
+}
+
+/**
+**	Parse adaptation field of transport stream packet.
+**
+**	The PCR of the main video stream is given to the clock recovery of
+**	the audio/video sync.
+**
+**	@param stream	video stream
+**	@param tsdx	transport stream demuxer
+**	@param p	transport stream packet with adaptation field
+**
+**	@returns true, if the discontinuity indicator is set.
+*/
+static int TsVideoAdaptation(const VideoStream * stream, TsDemux * tsdx,
+    const uint8_t * p)
+{
+    if (!p[4]) {			// empty adaptation field
+	return 0;
+    }
+    if (p[4] >= 7 && (p[5] & 0x10)) {	// PCR flag
+	int64_t base;
+
+	base =
+	    (int64_t) p[6] << 25 | p[7] << 17 | p[8] << 9 | p[9] << 1 | p[10]
+	    >> 7;
+	tsdx->PCR = base * 300 + ((p[10] & 0x01) << 8 | p[11]);
+	Debug(4, "tsdemux: video PCR %s after %d packets\n",
+	    Timestamp2String(base), tsdx->Packets);
+	tsdx->Packets = 0;
+	if (stream == MyVideoStream) {
+	    AvSyncPcr(tsdx->PCR, p[5] & 0x80);
+	}
+    }
+    return p[5] & 0x80;
+}
+
+/**
+**	Check if data can be added to the current video packet.
+**
+**	@param stream	video stream
+**	@param size	number of bytes to add
+**
+**	@returns true, if the data fits now or no queued packet can free
+**	space by waiting.
+*/
+static int VideoPacketSpace(const VideoStream * stream, int size)
+{
+    size_t wrapped;
+
+    if (!atomic_read(&stream->PacketsUsed)) {
+	return 1;
+    }
+    // mpeg2 split needs a free descriptor
+    if (atomic_read(&stream->PacketsUsed) >= VIDEO_PACKET_MAX - 1) {
+	return 0;
+    }
+    return VideoArenaFree(stream, &wrapped) >= (size_t) size
+	|| wrapped >= (size_t) size;
+}
+
+/**
+**	Play transport stream video packet.
+**
+**	The PES header with the begin of the payload is given to
+**	PlayVideo3, which detects the codec and starts a new access unit.
+**	The rest of the payload is placed directly in the packet queue.
+**
+**	@param stream	video stream
+**	@param tsdx	transport stream demuxer of the video stream
+**	@param data	data of exactly one complete TS packet
+**	@param size	size of TS packet (always TS_PACKET_SIZE)
+**
+**	@returns number of bytes consumed, 0 if internal buffers are full.
+*/
+static int PlayTsVideo3(VideoStream * stream, TsDemux * tsdx,
+    const uint8_t * data, int size)
+{
+    int pid;
+    int cc;
+    int payload;
+    int discontinuity;
+    int n;
+
+    if (!stream->Decoder) {		// no x11 video started
+	return size;
+    }
+    if (stream->SkipStream) {		// skip video stream
+	return size;
+    }
+    if (stream->Freezed) {		// stream freezed
+	return 0;
+    }
+    if (stream->NewStream) {		// channel switched
+	// only once, the PES header can be split over packets
+	if (!tsdx->NewStream) {
+	    TsVideoReset(tsdx);
+	    tsdx->NewStream = 1;
+	}
+    } else {
+	tsdx->NewStream = 0;
+    }
+    if (size < TS_PACKET_SIZE || data[0] != TS_PACKET_SYNC) {
+	Error(_("tsdemux: transport stream out of sync\n"));
+	TsVideoReset(tsdx);
+	return size;
+    }
+    ++tsdx->Packets;
+    if (data[1] & 0x80) {		// error indicator
+	Debug(3, "tsdemux: video transport error\n");
+	tsdx->Start = TS_VIDEO_WAIT;
+	return TS_PACKET_SIZE;
+    }
+    pid = (data[1] & 0x1F) << 8 | data[2];
+    if (pid != tsdx->Pid) {
+	if (!(data[1] & 0x40)) {	// wait for start of new stream
+	    return TS_PACKET_SIZE;
+	}
+	Debug(3, "tsdemux: video PID %#04x\n", pid);
+	TsVideoReset(tsdx);
+	tsdx->Pid = pid;
+    }
+
+    discontinuity = 0;
+    switch (data[3] & 0x30) {		// adaption field
+	case 0x00:			// reserved
+	default:
+	    return TS_PACKET_SIZE;
+	case 0x20:			// adaptation field only
+	    TsVideoAdaptation(stream, tsdx, data);
+	    return TS_PACKET_SIZE;
+	case 0x10:			// only payload
+	    payload = 4;
+	    break;
+	case 0x30:			// skip adapation field
+	    payload = 5 + data[4];
+	    // illegal length, ignore packet
+	    if (payload >= TS_PACKET_SIZE) {
+		Debug(3, "tsdemux: illegal adaption field length\n");
+		return TS_PACKET_SIZE;
+	    }
+	    discontinuity = TsVideoAdaptation(stream, tsdx, data);
+	    break;
+    }
+
+    //	check continuity, only packets with payload increment the counter
+    cc = data[3] & 0x0F;
+    if (tsdx->CC >= 0 && cc != ((tsdx->CC + 1) & 0x0F)) {
+	if (cc == tsdx->CC) {		// duplicate packet
+	    return TS_PACKET_SIZE;
+	}
+	if (!discontinuity) {
+	    Debug(3, "tsdemux: video discontinuity (received %d, expected %d)\n",
+		cc, (tsdx->CC + 1) & 0x0F);
+	    if (tsdx->Start == TS_VIDEO_PAYLOAD) {
+		// drop broken access unit
+		VideoResetPacket(stream);
+	    }
+	    tsdx->Start = TS_VIDEO_WAIT;
+	}
+    }
+
+    n = TS_PACKET_SIZE - payload;
+    if (data[1] & 0x40) {		// payload unit start
+	tsdx->Start = TS_VIDEO_HEADER;
+	tsdx->HeaderIndex = 0;
+    }
+    switch (tsdx->Start) {
+	case TS_VIDEO_WAIT:
+	    break;
+
+	case TS_VIDEO_HEADER:
+	    if (tsdx->HeaderIndex + n > (int)sizeof(tsdx->Header)) {
+		Error(_("tsdemux: video PES header too big\n"));
+		tsdx->Start = TS_VIDEO_WAIT;
+		break;
+	    }
+	    memcpy(tsdx->Header + tsdx->HeaderIndex, data + payload, n);
+	    tsdx->HeaderIndex += n;
+	    // need header + some bytes of payload for the codec detection
+	    if (tsdx->HeaderIndex < 9
+		|| tsdx->HeaderIndex < 9 + tsdx->Header[8] + 8) {
+		break;
+	    }
+	    if (tsdx->Header[0] || tsdx->Header[1] || tsdx->Header[2] != 0x01
+		|| (tsdx->Header[3] & 0xF0) != PES_VIDEO_STREAM_S) {
+		Debug(3, "tsdemux: no video PES packet\n");
+		tsdx->Start = TS_VIDEO_WAIT;
+		break;
+	    }
+	    if (!PlayVideo3(stream, tsdx->Header, tsdx->HeaderIndex)) {
+		tsdx->HeaderIndex -= n;	// buffers full, try again
+		return 0;
+	    }
+	    tsdx->Start = stream->CodecID == AV_CODEC_ID_NONE ? TS_VIDEO_WAIT
+		: TS_VIDEO_PAYLOAD;
+	    break;
+
+	case TS_VIDEO_PAYLOAD:
+	    if (!VideoPacketSpace(stream, n)) {
+		return 0;		// buffers full, try again
+	    }
+#ifdef USE_PIP
+	    if (stream->CodecID == AV_CODEC_ID_MPEG2VIDEO) {
+		VideoMpegEnqueue(stream, AV_NOPTS_VALUE, data + payload, n);
+		break;
+	    }
+#endif
+	    VideoEnqueue(stream, AV_NOPTS_VALUE, data + payload, n);
+	    break;
+    }
+    tsdx->CC = cc;
+
+    return TS_PACKET_SIZE;
+}
+
+#endif
+
+#ifdef USE_TS_VIDEO
+
+/**
+**	Play transport stream video packet.
+**
+**	@param data	data of exactly one complete TS packet
+**	@param size	size of TS packet (always TS_PACKET_SIZE)
+**
+**	@returns number of bytes consumed, 0 if internal buffers are full.
+*/
+int PlayTsVideo(const uint8_t * data, int size)
+{
+    return PlayTsVideo3(MyVideoStream, TsDemuxVideo, data, size);
+}
+
+#endif
+
     /// call VDR support function
 extern uint8_t *CreateJpeg(uint8_t *, int *, int, int, int);
 
@@ -2502,6 +3093,7 @@ int SetPlayMode(int play_mode)
 		if (MyVideoStream->CodecID != AV_CODEC_ID_NONE) {
 		    MyVideoStream->NewStream = 1;
 		    MyVideoStream->InvalidPesCounter = 0;
+		    MyVideoStream->SwitchTicks = GetMsTicks();
 		    // tell hw decoder we are closing stream
 		    VideoSetClosing(MyVideoStream->HwDecoder);
 		    VideoResetStart(MyVideoStream->HwDecoder);
@@ -2615,6 +3207,7 @@ void Clear(void)
 
     VideoResetPacket(MyVideoStream);	// terminate work
     MyVideoStream->ClearBuffers = 1;
+    VideoDisplayWakeup();
     if (!SkipAudio) {
 	AudioFlushBuffers();
 	//NewAudioStream = 1;
@@ -2810,7 +3403,7 @@ int Poll(int timeout)
 	// soft limit + hard limit
 	full = (used > AUDIO_MIN_BUFFER_FREE && filled > 3)
 	    || AudioFreeBytes() < AUDIO_MIN_BUFFER_FREE
-	    || filled >= VIDEO_PACKET_MAX - 10;
+	    || VideoPacketFull(MyVideoStream, 10);
 
 	if (!full || !timeout) {
 	    return !full;
@@ -2926,6 +3519,7 @@ const char *CommandLineHelp(void)
 	"\talsa-driver-broken\tdisable broken alsa driver message\n"
 	"\talsa-no-close-open\tdisable close open to fix alsa no sound bug\n"
 	"\talsa-close-open-delay\tenable close open delay to fix no sound bug\n"
+	"\talsa-no-mmap\t\tdisable alsa mmap access, use read/write\n"
 	"\tignore-repeat-pict\tdisable repeat pict message\n"
 	"\tuse-possible-defect-frames prefer faster channel switch\n"
 	"  -D\t\tstart in detached mode\n";
@@ -3012,6 +3606,8 @@ int ProcessArgs(int argc, char *const argv[])
 		    AudioAlsaNoCloseOpen = 1;
 		} else if (!strcasecmp("alsa-close-open-delay", optarg)) {
 		    AudioAlsaCloseOpenDelay = 1;
+		} else if (!strcasecmp("alsa-no-mmap", optarg)) {
+		    AudioAlsaNoMmap = 1;
 		} else if (!strcasecmp("ignore-repeat-pict", optarg)) {
 		    VideoIgnoreRepeatPict = 1;
 		} else if (!strcasecmp("use-possible-defect-frames", optarg)) {
@@ -3432,6 +4028,36 @@ void GetStats(int *missed, int *duped, int *dropped, int *counter)
     }
 }
 
+/**
+**	Get channel switch statistics.
+**
+**	@param[out] count	number of measured channel switches
+**	@param[out] fast	number of switches with reused codec
+**	@param[out] last	last time to first frame in ms
+**	@param[out] average	average time to first frame in ms
+**	@param[out] max		max. time to first frame in ms
+*/
+void GetSwitchStats(int *count, int *fast, int *last, int *average, int *max)
+{
+    *count = SwitchCount;
+    *fast = SwitchFastCount;
+    *last = SwitchLastMs;
+    *average = SwitchCount ? SwitchSumMs / SwitchCount : 0;
+    *max = SwitchMaxMs;
+}
+
+/**
+**	Reset channel switch statistics.
+*/
+void ResetSwitchStats(void)
+{
+    SwitchCount = 0;
+    SwitchFastCount = 0;
+    SwitchLastMs = 0;
+    SwitchMaxMs = 0;
+    SwitchSumMs = 0;
+}
+
 /**
 **	Scale the currently shown video.
 **
@@ -3500,6 +4126,7 @@ void PipStart(int x, int y, int width, int height, int pip_x, int pip_y,
     }
 
     if (!PipVideoStream->Decoder) {
+	TsVideoReset(PipTsDemux);
 	VideoStreamOpen(PipVideoStream);
     }
     PipSetPosition(x, y, width, height, pip_x, pip_y, pip_width, pip_height);
@@ -3519,10 +4146,12 @@ void PipStop(void)
     ScaleVideo(0, 0, 0, 0);
 
     PipVideoStream->Close = 1;
+    VideoDisplayWakeup();
     for (i = 0; PipVideoStream->Close && i < 50; ++i) {
 	usleep(1 * 1000);
     }
-    Info("[softhddev]%s: pip close %dms\n", __FUNCTION__, i);
+    Info("[softhddev]%s: pip close %dms, peak PES packet %d bytes\n",
+	__FUNCTION__, i, PipVideoStream->PacketPeak);
 }
 
 /**
@@ -3538,4 +4167,20 @@ int PipPlayVideo(const uint8_t * data, int size)
     return PlayVideo3(PipVideoStream, data, size);
 }
 
+/**
+**	PIP play transport stream video packet.
+**
+**	The PES packets are assembled directly in the packet arena of the
+**	PIP stream, which is limited by the PIP buffer size.
+**
+**	@param data	data of exactly one complete TS packet
+**	@param size	size of TS packet (always TS_PACKET_SIZE)
+**
+**	@return number of bytes used, 0 if internal buffer are full.
+*/
+int PipPlayTsVideo(const uint8_t * data, int size)
+{
+    return PlayTsVideo3(PipVideoStream, PipTsDemux, data, size);
+}
+
 #endif
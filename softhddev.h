@@ -49,7 +49,7 @@ extern "C"
     /// C plugin play video packet
     extern int PlayVideo(const uint8_t *, int);
     /// C plugin play TS video packet
-    extern void PlayTsVideo(const uint8_t *, int);
+    extern int PlayTsVideo(const uint8_t *, int);
     /// C plugin grab an image
     extern uint8_t *GrabImage(int *, int, int, int, int);
 
@@ -99,6 +99,10 @@ extern "C"
 
     /// Get decoder statistics
     extern void GetStats(int *, int *, int *, int *);
+    /// Get channel switch statistics
+    extern void GetSwitchStats(int *, int *, int *, int *, int *);
+    /// Reset channel switch statistics
+    extern void ResetSwitchStats(void);
     /// C plugin scale video
     extern void ScaleVideo(int, int, int, int);
 
@@ -110,6 +114,8 @@ extern "C"
     extern void PipStop(void);
     /// Pip play video packet
     extern int PipPlayVideo(const uint8_t *, int);
+    /// Pip play TS video packet
+    extern int PipPlayTsVideo(const uint8_t *, int);
 
     extern const char *X11DisplayName;	///< x11 display name
 #ifdef __cplusplus
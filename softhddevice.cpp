@@ -37,6 +37,12 @@
 #include "softhddevice.h"
 #include "softhddevice_service.h"
 
+#include <time.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 extern "C"
 {
 #include <stdint.h>
@@ -46,6 +52,8 @@ extern "C"
 #include "video.h"
 #include "codec.h"
 #include "misc.h"
+#include "stats.h"
+#include "avsync.h"
 }
 
 #if APIVERSNUM >= 20301
@@ -97,10 +105,21 @@ static uint32_t ConfigVideoBackground;	///< config video background color
 static int ConfigOsdWidth;		///< config OSD width
 static int ConfigOsdHeight;		///< config OSD height
 static char ConfigVideoStudioLevels;	///< config use studio levels
+static char ConfigVideoDither;		///< config dither 10 bit video
 static char ConfigVideo60HzMode;	///< config use 60Hz display mode
 static char ConfigVideoSoftStartSync;	///< config use softstart sync
+static char ConfigVideoEarlyStart;	///< config show video before audio
 static char ConfigVideoBlackPicture;	///< config enable black picture mode
 char ConfigVideoClearOnSwitch;		///< config enable Clear on channel switch
+char ConfigVideoFastSwitch;		///< config keep decoder on channel switch
+static int ConfigVideoThreads;		///< config software decoder threads
+static int ConfigVideoThreadType;	///< config decoder threads slice/frame
+static int ConfigVideoThreadLatency = 2;	///< config frame threads latency
+static int ConfigVideoDeintThreads = -1;	///< config soft deint threads
+static int ConfigGrabExportRate;	///< config grab export per second
+static int ConfigGrabExportWidth = 256;	///< config grab export width
+int ConfigVideoBufferTime;		///< config size ms of video buffer
+int ConfigVideoBufferSize;		///< config size KiB of video buffer
 
 static int ConfigVideoBrightness;	///< config video brightness
 static int ConfigVideoContrast = 1000;	///< config video contrast
@@ -176,6 +195,7 @@ static int ConfigPipAltVideoX;		///< config pip alt. video x in %
 static int ConfigPipAltVideoY;		///< config pip alt. video y in %
 static int ConfigPipAltVideoWidth;	///< config pip alt. video width in %
 static int ConfigPipAltVideoHeight = 50;	///< config pip alt. video height in %
+int ConfigPipBufferSize;		///< config size KiB of pip buffer
 #endif
 
 #ifdef USE_SCREENSAVER
@@ -191,6 +211,34 @@ static volatile int DoMakePrimary;	///< switch primary device to this
 static signed char SuspendMode;		///< suspend mode
 volatile char SoftIsPlayingVideo;       ///< stream contains video data
 
+/**
+**	Set software decoder threads config.
+**
+**	The values are clamped to the setup menu limits before they are
+**	stored, setup.conf and SVDRP can contain any value.
+**
+**	@param count	number of decoder threads (0 or 1 disables threads)
+**	@param type	thread type (0 slice, 1 frame threads)
+**	@param latency	max. frames output delay allowed for frame threads
+*/
+static void SetVideoThreads(int count, int type, int latency)
+{
+    if (count < 0) {
+	count = 0;
+    } else if (count > CODEC_VIDEO_THREADS_MAX) {
+	count = CODEC_VIDEO_THREADS_MAX;
+    }
+    if (latency < 0) {
+	latency = 0;
+    } else if (latency > CODEC_VIDEO_THREADS_MAX) {
+	latency = CODEC_VIDEO_THREADS_MAX;
+    }
+    ConfigVideoThreads = count;
+    ConfigVideoThreadType = type ? 1 : 0;
+    ConfigVideoThreadLatency = latency;
+    CodecSetVideoThreads(count, type, latency);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 //////////////////////////////////////////////////////////////////////////////
@@ -279,11 +327,328 @@ extern "C" void FeedKeyPress(const char *keymap, const char *key, int repeat,
 //	OSD
 //////////////////////////////////////////////////////////////////////////////
 
+/**
+**	Upload ARGB image to the OSD and account it.
+**
+**	@param xi	x-coordinate in argb image
+**	@param yi	y-coordinate in argb image
+**	@param w	width of image area to upload
+**	@param h	height of image area to upload
+**	@param pitch	argb image pitch in bytes
+**	@param argb	32bit ARGB image data
+**	@param x	x-coordinate on screen
+**	@param y	y-coordinate on screen
+*/
+static void OsdUploadARGB(int xi, int yi, int w, int h, int pitch,
+    const uint8_t * argb, int x, int y)
+{
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    OsdDrawARGB(xi, yi, w, h, pitch, argb, x, y);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    StatsCount(StatsOsdUploads, 1);
+    StatsCount(StatsOsdUploadBytes, (uint64_t) w * h * sizeof(uint32_t));
+    StatsSample(StatsOsdUploadTime, (end.tv_sec - start.tv_sec) * 1000000LL
+	+ (end.tv_nsec - start.tv_nsec) / 1000);
+}
+
+/**
+**	Expand a row of palette indices to ARGB.
+**
+**	@param dst	ARGB pixels
+**	@param src	palette indices
+**	@param n	number of pixels
+**	@param lut	palette lookup table with 256 entries
+*/
+static void OsdExpandPaletteRow(uint32_t * dst, const uint8_t * src, int n,
+    const uint32_t * lut)
+{
+    int i;
+
+    i = 0;
+#ifdef __AVX2__
+    for (; i + 8 <= n; i += 8) {
+	__m256i idx;
+
+	idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+	_mm256_storeu_si256((__m256i *) (dst + i),
+	    _mm256_i32gather_epi32((const int *)lut, idx, 4));
+    }
+#endif
+    for (; i + 4 <= n; i += 4) {
+	dst[i + 0] = lut[src[i + 0]];
+	dst[i + 1] = lut[src[i + 1]];
+	dst[i + 2] = lut[src[i + 2]];
+	dst[i + 3] = lut[src[i + 3]];
+    }
+    for (; i < n; ++i) {
+	dst[i] = lut[src[i]];
+    }
+}
+
+/**
+**	Soft device plugin OSD compositor.
+**
+**	Keeps a CPU side shadow of the OSD surface.  Rendered pixmaps are
+**	merged into the shadow, only tiles which really changed are marked
+**	dirty.  Neighbouring dirty tiles are uploaded as one rectangle.
+**
+**	The shadow is dropped, when the video module cleared or recreated
+**	the OSD surface (OSD generation changed).
+*/
+class cSoftOsdCompositor
+{
+  private:
+    enum
+    {
+	TileWidth = 64,			///< tile width in pixels
+	TileHeight = 16			///< tile height in pixels
+    };
+    uint32_t *Shadow;			///< shadow of the OSD surface
+    uint8_t *Tiles;			///< dirty flag of each tile
+    int Width;				///< shadow width
+    int Height;				///< shadow height
+    int TilesX;				///< tiles per row
+    int TilesY;				///< tile rows
+    unsigned Generation;		///< OSD surface generation of shadow
+
+    void UploadRect(int, int, int, int, int, int);
+  public:
+     cSoftOsdCompositor(void);		///< compositor constructor
+     ~cSoftOsdCompositor(void);		///< compositor destructor
+    bool Resize(int, int);		///< set shadow size
+    void Clear(void);			///< OSD surface was cleared
+    /// merge ARGB image into shadow
+    void Merge(const uint8_t *, int, int, int, int, int, bool);
+    void Upload(int, int);		///< upload all dirty tiles
+};
+
+/**
+**	Constructor OSD compositor.
+*/
+cSoftOsdCompositor::cSoftOsdCompositor(void)
+:  Shadow(NULL), Tiles(NULL), Width(0), Height(0), TilesX(0), TilesY(0),
+    Generation(0)
+{
+}
+
+/**
+**	Destructor OSD compositor.
+*/
+cSoftOsdCompositor::~cSoftOsdCompositor(void)
+{
+    free(Shadow);
+    free(Tiles);
+}
+
+/**
+**	Set the size of the shadow.
+**
+**	A new shadow is transparent, like a cleared OSD surface.
+**
+**	@param width	OSD width
+**	@param height	OSD height
+**
+**	@returns false, if out of memory.
+*/
+bool cSoftOsdCompositor::Resize(int width, int height)
+{
+    if (width == Width && height == Height && Shadow) {
+	return true;
+    }
+    free(Shadow);
+    free(Tiles);
+    Width = width;
+    Height = height;
+    TilesX = (width + TileWidth - 1) / TileWidth;
+    TilesY = (height + TileHeight - 1) / TileHeight;
+    Shadow = (uint32_t *) calloc((size_t) width * height, sizeof(uint32_t));
+    Tiles = (uint8_t *) calloc(TilesX * TilesY, 1);
+    Generation = VideoOsdGetGeneration();
+    if (!Shadow || !Tiles) {
+	free(Shadow);
+	free(Tiles);
+	Shadow = NULL;
+	Tiles = NULL;
+	Width = 0;
+	Height = 0;
+	return false;
+    }
+    return true;
+}
+
+/**
+**	OSD surface was cleared, clear the shadow.
+*/
+void cSoftOsdCompositor::Clear(void)
+{
+    if (Shadow) {
+	memset(Shadow, 0, (size_t) Width * Height * sizeof(uint32_t));
+	memset(Tiles, 0, TilesX * TilesY);
+    }
+    Generation = VideoOsdGetGeneration();
+}
+
+/**
+**	Merge ARGB image into the shadow.
+**
+**	@param data	32bit ARGB image data
+**	@param stride	image pitch in bytes
+**	@param x	x-coordinate in OSD
+**	@param y	y-coordinate in OSD
+**	@param w	width of image
+**	@param h	height of image
+**	@param force	mark all touched tiles dirty, even if unchanged
+*/
+void cSoftOsdCompositor::Merge(const uint8_t * data, int stride, int x,
+    int y, int w, int h, bool force)
+{
+    int row;
+
+    // surface cleared behind our back, shadow is stale
+    if (Generation != VideoOsdGetGeneration()) {
+	Clear();
+    }
+    for (row = 0; row < h; ++row) {
+	const uint32_t *src;
+	uint32_t *dst;
+	uint8_t *tiles;
+	int col;
+
+	src = (const uint32_t *)(data + row * stride);
+	dst = Shadow + (size_t) (y + row) * Width + x;
+	tiles = Tiles + ((y + row) / TileHeight) * TilesX;
+	for (col = 0; col < w;) {
+	    int tx;
+	    int n;
+
+	    // segment inside one tile
+	    tx = (x + col) / TileWidth;
+	    n = min(w - col, (tx + 1) * TileWidth - (x + col));
+	    if (force || memcmp(dst + col, src + col, n * sizeof(uint32_t))) {
+		memcpy(dst + col, src + col, n * sizeof(uint32_t));
+		tiles[tx] = 1;
+	    }
+	    col += n;
+	}
+    }
+}
+
+/**
+**	Upload a rectangle of the shadow.
+**
+**	@param x	x-coordinate in OSD
+**	@param y	y-coordinate in OSD
+**	@param w	width of rectangle
+**	@param h	height of rectangle
+**	@param left	x-coordinate of OSD on screen
+**	@param top	y-coordinate of OSD on screen
+*/
+void cSoftOsdCompositor::UploadRect(int x, int y, int w, int h, int left,
+    int top)
+{
+    int sx;
+    int sy;
+    int width;
+    int height;
+    double video_aspect;
+
+    // clip to screen
+    sx = x + left;
+    sy = y + top;
+    if (sx < 0) {
+	x -= sx;
+	w += sx;
+	sx = 0;
+    }
+    if (sy < 0) {
+	y -= sy;
+	h += sy;
+	sy = 0;
+    }
+    ::GetOsdSize(&width, &height, &video_aspect);
+    if (w > width - sx) {
+	w = width - sx;
+    }
+    if (h > height - sy) {
+	h = height - sy;
+    }
+    if (w <= 0 || h <= 0) {
+	return;
+    }
+#ifdef OSD_DEBUG
+    Debug(3, "[softhddev]%s: draw %dx%d%+d%+d -> %+d%+d\n", __FUNCTION__, w,
+	h, x, y, sx, sy);
+#endif
+    OsdUploadARGB(x, y, w, h, Width * sizeof(uint32_t),
+	(const uint8_t *)Shadow, sx, sy);
+}
+
+/**
+**	Upload all dirty tiles.
+**
+**	Runs of dirty tiles in a tile row are extended downwards, as long
+**	as the same run is dirty in the following tile rows.
+**
+**	@param left	x-coordinate of OSD on screen
+**	@param top	y-coordinate of OSD on screen
+*/
+void cSoftOsdCompositor::Upload(int left, int top)
+{
+    int ty;
+
+    for (ty = 0; ty < TilesY; ++ty) {
+	uint8_t *tiles;
+	int tx;
+
+	tiles = Tiles + ty * TilesX;
+	for (tx = 0; tx < TilesX;) {
+	    int tx2;
+	    int ty2;
+
+	    if (!tiles[tx]) {
+		++tx;
+		continue;
+	    }
+	    for (tx2 = tx + 1; tx2 < TilesX && tiles[tx2]; ++tx2) {
+	    }
+	    memset(tiles + tx, 0, tx2 - tx);
+	    for (ty2 = ty + 1; ty2 < TilesY; ++ty2) {
+		uint8_t *next;
+		int i;
+
+		next = Tiles + ty2 * TilesX;
+		for (i = tx; i < tx2 && next[i]; ++i) {
+		}
+		if (i < tx2) {
+		    break;
+		}
+		memset(next + tx, 0, tx2 - tx);
+	    }
+
+	    UploadRect(tx * TileWidth, ty * TileHeight,
+		min(tx2 * TileWidth, Width) - tx * TileWidth,
+		min(ty2 * TileHeight, Height) - ty * TileHeight, left, top);
+	    tx = tx2;
+	}
+    }
+}
+
 /**
 **	Soft device plugin OSD class.
 */
 class cSoftOsd:public cOsd
 {
+  private:
+    uint32_t *Staging;			///< ARGB staging buffer
+    size_t StagingSize;			///< pixels in staging buffer
+    cSoftOsdCompositor Compositor;	///< true color compositor
+
+    uint32_t *GetStaging(int, int, int *);
+    void DrawBitmaps(int, int, int, int, bool);
   public:
     static volatile char Dirty;		///< flag force redraw everything
     int OsdLevel;			///< current osd level FIXME: remove
@@ -325,6 +690,7 @@ void cSoftOsd::SetActive(bool on)
 	}
     } else {
 	OsdClose();
+	Compositor.Clear();
     }
 }
 
@@ -338,7 +704,7 @@ void cSoftOsd::SetActive(bool on)
 **	@param level	level of the osd (smallest is shown)
 */
 cSoftOsd::cSoftOsd(int left, int top, uint level)
-:cOsd(left, top, level)
+:cOsd(left, top, level), Staging(NULL), StagingSize(0)
 {
 #ifdef OSD_DEBUG
     /* FIXME: OsdWidth/OsdHeight not correct!
@@ -363,6 +729,7 @@ cSoftOsd::~cSoftOsd(void)
 
     SetActive(false);
     // done by SetActive: OsdClose();
+    free(Staging);
 
 #ifdef USE_YAEPG
     // support yaepghd, video window
@@ -398,11 +765,102 @@ eOsdError cSoftOsd::SetAreas(const tArea * areas, int n)
     }
     if (Active()) {
 	VideoOsdClear();
+	Compositor.Clear();
 	Dirty = 1;
     }
     return cOsd::SetAreas(areas, n);
 }
 
+/**
+**	Get the ARGB staging buffer.
+**
+**	The buffer is kept for the live time of the OSD and only grows.
+**
+**	@param width		width in pixels
+**	@param height		height in pixels
+**	@param[out] pitch	pitch in pixels, aligned to 64 bytes
+*/
+uint32_t *cSoftOsd::GetStaging(int width, int height, int *pitch)
+{
+    size_t size;
+
+    *pitch = (width + 15) & ~15;
+    size = (size_t) * pitch * height;
+    if (size > StagingSize) {
+	free(Staging);
+	if (!(Staging = (uint32_t *) malloc(size * sizeof(uint32_t)))) {
+	    StagingSize = 0;
+	    return NULL;
+	}
+	StagingSize = size;
+    }
+    return Staging;
+}
+
+/**
+**	Convert the bitmaps inside a screen rectangle and upload it.
+**
+**	Bitmaps are drawn in area order, later areas overwrite earlier.
+**
+**	@param x	screen x-coordinate of rectangle
+**	@param y	screen y-coordinate of rectangle
+**	@param w	width of rectangle
+**	@param h	height of rectangle
+**	@param clear	rectangle isn't completely covered by bitmaps
+*/
+void cSoftOsd::DrawBitmaps(int x, int y, int w, int h, bool clear)
+{
+    cBitmap *bitmap;
+    uint32_t *argb;
+    uint32_t lut[256];
+    int pitch;
+    int i;
+
+    if (!(argb = GetStaging(w, h, &pitch))) {
+	Error(tr("[softhddev]: out of memory\n"));
+	return;
+    }
+    if (clear) {
+	memset(argb, 0, (size_t) pitch * h * sizeof(uint32_t));
+    }
+
+    for (i = 0; (bitmap = GetBitmap(i)); ++i) {
+	int bx;
+	int by;
+	int x1;
+	int y1;
+	int x2;
+	int y2;
+	int c;
+
+	// intersection of bitmap and rectangle in screen coordinates
+	bx = bitmap->X0() + Left();
+	by = bitmap->Y0() + Top();
+	x1 = max(x, bx);
+	y1 = max(y, by);
+	x2 = min(x + w, bx + bitmap->Width());
+	y2 = min(y + h, by + bitmap->Height());
+	if (x1 >= x2 || y1 >= y2) {
+	    continue;
+	}
+
+	for (c = 0; c < 256; ++c) {
+	    lut[c] = bitmap->Color(c);
+	}
+	for (c = y1; c < y2; ++c) {
+	    OsdExpandPaletteRow(argb + (c - y) * pitch + x1 - x,
+		bitmap->Data(x1 - bx, c - by), x2 - x1, lut);
+	}
+    }
+
+#ifdef OSD_DEBUG
+    Debug(3, "[softhddev]%s: draw %dx%d%+d%+d bm\n", __FUNCTION__, w, h, x,
+	y);
+#endif
+    OsdUploadARGB(0, 0, w, h, pitch * sizeof(uint32_t), (uint8_t *) argb, x,
+	y);
+}
+
 /**
 **	Actually commits all data to the OSD hardware.
 */
@@ -436,6 +894,16 @@ void cSoftOsd::Flush(void)
     if (!IsTrueColor()) {
 	cBitmap *bitmap;
 	int i;
+	int n;
+	int width;
+	int height;
+	double video_aspect;
+	long area;
+	int rects[MAXOSDAREAS][4];
+	int ux1;
+	int uy1;
+	int ux2;
+	int uy2;
 
 #ifdef OSD_DEBUG
 	static char warned;
@@ -446,15 +914,16 @@ void cSoftOsd::Flush(void)
 	    warned = 1;
 	}
 #endif
-	// draw all bitmaps
-	for (i = 0; (bitmap = GetBitmap(i)); ++i) {
-	    uint8_t *argb;
-	    int xs;
-	    int ys;
-	    int x;
-	    int y;
-	    int w;
-	    int h;
+	::GetOsdSize(&width, &height, &video_aspect);
+
+	// collect dirty areas of all bitmaps in screen coordinates
+	n = 0;
+	area = 0;
+	ux1 = width;
+	uy1 = height;
+	ux2 = 0;
+	uy2 = 0;
+	for (i = 0; (bitmap = GetBitmap(i)) && n < MAXOSDAREAS; ++i) {
 	    int x1;
 	    int y1;
 	    int x2;
@@ -469,83 +938,53 @@ void cSoftOsd::Flush(void)
 	    } else if (!bitmap->Dirty(x1, y1, x2, y2)) {
 		continue;		// nothing dirty continue
 	    }
+	    bitmap->Clean();
+
 	    // convert and upload only visible dirty areas
-	    xs = bitmap->X0() + Left();
-	    ys = bitmap->Y0() + Top();
-	    // FIXME: negtative position bitmaps
-	    w = x2 - x1 + 1;
-	    h = y2 - y1 + 1;
+	    x1 += bitmap->X0() + Left();
+	    y1 += bitmap->Y0() + Top();
+	    x2 += bitmap->X0() + Left() + 1;
+	    y2 += bitmap->Y0() + Top() + 1;
 	    // clip to screen
-	    if (1) {			// just for the case it makes trouble
-		int width;
-		int height;
-		double video_aspect;
-
-		if (xs < 0) {
-		    if (xs + x1 < 0) {
-			x1 -= xs + x1;
-			w += xs + x1;
-			if (w <= 0) {
-			    continue;
-			}
-		    }
-		    xs = 0;
-		}
-		if (ys < 0) {
-		    if (ys + y1 < 0) {
-			y1 -= ys + y1;
-			h += ys + y1;
-			if (h <= 0) {
-			    continue;
-			}
-		    }
-		    ys = 0;
-		}
-		::GetOsdSize(&width, &height, &video_aspect);
-		if (w > width - xs - x1) {
-		    w = width - xs - x1;
-		    if (w <= 0) {
-			continue;
-		    }
-		    x2 = x1 + w - 1;
-		}
-		if (h > height - ys - y1) {
-		    h = height - ys - y1;
-		    if (h <= 0) {
-			continue;
-		    }
-		    y2 = y1 + h - 1;
-		}
-	    }
-#ifdef DEBUG
-	    if (w > bitmap->Width() || h > bitmap->Height()) {
-		Error(tr("[softhddev]: dirty area too big\n"));
-		abort();
+	    x1 = max(x1, 0);
+	    y1 = max(y1, 0);
+	    x2 = min(x2, width);
+	    y2 = min(y2, height);
+	    if (x1 >= x2 || y1 >= y2) {
+		continue;
 	    }
-#endif
-	    argb = (uint8_t *) malloc(w * h * sizeof(uint32_t));
-	    for (y = y1; y <= y2; ++y) {
-		for (x = x1; x <= x2; ++x) {
-		    ((uint32_t *) argb)[x - x1 + (y - y1) * w] =
-			bitmap->GetColor(x, y);
-		}
-	    }
-#ifdef OSD_DEBUG
-	    Debug(3, "[softhddev]%s: draw %dx%d%+d%+d bm\n", __FUNCTION__, w, h,
-		xs + x1, ys + y1);
-#endif
-	    OsdDrawARGB(0, 0, w, h, w * sizeof(uint32_t), argb, xs + x1,
-		ys + y1);
 
-	    bitmap->Clean();
-	    // FIXME: reuse argb
-	    free(argb);
+	    rects[n][0] = x1;
+	    rects[n][1] = y1;
+	    rects[n][2] = x2;
+	    rects[n][3] = y2;
+	    ++n;
+	    area += (long)(x2 - x1) * (y2 - y1);
+	    ux1 = min(ux1, x1);
+	    uy1 = min(uy1, y1);
+	    ux2 = max(ux2, x2);
+	    uy2 = max(uy2, y2);
+	}
+
+	// one upload, if the bounding box isn't much bigger
+	if (n > 1 && (long)(ux2 - ux1) * (uy2 - uy1) <= 2 * area) {
+	    DrawBitmaps(ux1, uy1, ux2 - ux1, uy2 - uy1, true);
+	} else {
+	    for (i = 0; i < n; ++i) {
+		DrawBitmaps(rects[i][0], rects[i][1], rects[i][2] - rects[i][0],
+		    rects[i][3] - rects[i][1], false);
+	    }
 	}
 	Dirty = 0;
 	return;
     }
 
     LOCK_PIXMAPS;
+    if (!Compositor.Resize(Width(), Height())) {
+	Error(tr("[softhddev]: out of memory\n"));
+	Dirty = 0;
+	return;
+    }
     while ((pm = (dynamic_cast < cPixmapMemory * >(RenderPixmaps())))) {
 	int xp;
 	int yp;
@@ -582,48 +1021,21 @@ void cSoftOsd::Flush(void)
 	if (h > Height() - y) {
 	    h = Height() - y;
 	}
-
-	x += Left();
-	y += Top();
-
-	// clip to screen
-	if (1) {			// just for the case it makes trouble
-	    // and it can happen!
-	    int width;
-	    int height;
-	    double video_aspect;
-
-	    if (x < 0) {
-		w += x;
-		xp += -x;
-		x = 0;
-	    }
-	    if (y < 0) {
-		h += y;
-		yp += -y;
-		y = 0;
-	    }
-
-	    ::GetOsdSize(&width, &height, &video_aspect);
-	    if (w > width - x) {
-		w = width - x;
-	    }
-	    if (h > height - y) {
-		h = height - y;
-	    }
-	}
 #ifdef OSD_DEBUG
-	Debug(3, "[softhddev]%s: draw %dx%d%+d%+d*%d -> %+d%+d %p\n",
+	Debug(3, "[softhddev]%s: merge %dx%d%+d%+d*%d -> %+d%+d %p\n",
 	    __FUNCTION__, w, h, xp, yp, stride, x, y, pm->Data());
 #endif
-	OsdDrawARGB(xp, yp, w, h, stride, pm->Data(), x, y);
-
+	if (w > 0 && h > 0) {
+	    Compositor.Merge(pm->Data() + yp * stride + xp * sizeof(tColor),
+		stride, x, y, w, h, Dirty);
+	}
 #if APIVERSNUM >= 20110
 	DestroyPixmap(pm);
 #else
 	delete pm;
 #endif
     }
+    Compositor.Upload(Left(), Top());
     Dirty = 0;
 }
 
@@ -721,10 +1133,19 @@ class cMenuSetupSoft:public cMenuSetupPage
     uint32_t Background;
     uint32_t BackgroundAlpha;
     int StudioLevels;
+    int Dither;
     int _60HzMode;
     int SoftStartSync;
+    int EarlyStart;
     int BlackPicture;
     int ClearOnSwitch;
+    int FastSwitch;
+    int DecoderThreads;
+    int DecoderThreadType;
+    int DecoderThreadLatency;
+    int DeintThreads;
+    int GrabExportRate;
+    int GrabExportWidth;
 
     int Brightness;
     int Contrast;
@@ -851,6 +1272,9 @@ void cMenuSetupSoft::Create(void)
     static const char *const audiodrift[] = {
 	"None", "PCM", "AC-3", "PCM + AC-3"
     };
+    static const char *const thread_types[] = {
+	"slice", "frame",
+    };
     static const char *const resolution[RESOLUTIONS] = {
 	"576i", "720p", "fake 1080i", "1080i", "UHD"
     };
@@ -932,14 +1356,32 @@ void cMenuSetupSoft::Create(void)
 	if (VideoIsDriverVdpau())
 		Add(new cMenuEditBoolItem(tr("Use studio levels"),
 			&StudioLevels, trVDR("no"), trVDR("yes")));
+	Add(new cMenuEditBoolItem(tr("Dither 10 bit video"), &Dither,
+		trVDR("no"), trVDR("yes")));
 	Add(new cMenuEditBoolItem(tr("60hz display mode"), &_60HzMode,
 		trVDR("no"), trVDR("yes")));
 	Add(new cMenuEditBoolItem(tr("Soft start a/v sync"), &SoftStartSync,
 		trVDR("no"), trVDR("yes")));
+	Add(new cMenuEditBoolItem(tr("Early start video before audio"),
+		&EarlyStart, trVDR("no"), trVDR("yes")));
 	Add(new cMenuEditBoolItem(tr("Black during channel switch"),
 		&BlackPicture, trVDR("no"), trVDR("yes")));
 	Add(new cMenuEditBoolItem(tr("Clear decoder on channel switch"),
 		&ClearOnSwitch, trVDR("no"), trVDR("yes")));
+	Add(new cMenuEditBoolItem(tr("Fast channel switch"), &FastSwitch,
+		trVDR("no"), trVDR("yes")));
+	Add(new cMenuEditIntItem(tr("Software decoder threads"),
+		&DecoderThreads, 0, CODEC_VIDEO_THREADS_MAX, trVDR("off")));
+	Add(new cMenuEditStraItem(tr("\040\040Decoder thread type"),
+		&DecoderThreadType, 2, thread_types));
+	Add(new cMenuEditIntItem(tr("\040\040Frame thread latency (frames)"),
+		&DecoderThreadLatency, 0, CODEC_VIDEO_THREADS_MAX));
+	Add(new cMenuEditIntItem(tr("Software deinterlace threads"),
+		&DeintThreads, -1, 16, tr("auto")));
+	Add(new cMenuEditIntItem(tr("Grab export (per second)"),
+		&GrabExportRate, 0, 50, trVDR("off")));
+	Add(new cMenuEditIntItem(tr("\040\040Grab export width (pixel)"),
+		&GrabExportWidth, 64, 1920));
 
 	if (brightness_active)
 		Add(new cMenuEditIntItem(*cString::sprintf(tr("Brightness (%d..[%d]..%d)"),
@@ -1221,10 +1663,19 @@ cMenuSetupSoft::cMenuSetupSoft(void)
     Background = ConfigVideoBackground >> 8;
     BackgroundAlpha = ConfigVideoBackground & 0xFF;
     StudioLevels = ConfigVideoStudioLevels;
+    Dither = ConfigVideoDither;
     _60HzMode = ConfigVideo60HzMode;
     SoftStartSync = ConfigVideoSoftStartSync;
+    EarlyStart = ConfigVideoEarlyStart;
     BlackPicture = ConfigVideoBlackPicture;
     ClearOnSwitch = ConfigVideoClearOnSwitch;
+    FastSwitch = ConfigVideoFastSwitch;
+    DecoderThreads = ConfigVideoThreads;
+    DecoderThreadType = ConfigVideoThreadType;
+    DecoderThreadLatency = ConfigVideoThreadLatency;
+    DeintThreads = ConfigVideoDeintThreads;
+    GrabExportRate = ConfigGrabExportRate;
+    GrabExportWidth = ConfigGrabExportWidth;
 
     Brightness = ConfigVideoBrightness;
     Contrast = ConfigVideoContrast;
@@ -1374,13 +1825,28 @@ void cMenuSetupSoft::Store(void)
     VideoSetBackground(ConfigVideoBackground);
     SetupStore("StudioLevels", ConfigVideoStudioLevels = StudioLevels);
     VideoSetStudioLevels(ConfigVideoStudioLevels);
+    SetupStore("Dither", ConfigVideoDither = Dither);
+    VideoSetDither(ConfigVideoDither);
     SetupStore("60HzMode", ConfigVideo60HzMode = _60HzMode);
     VideoSet60HzMode(ConfigVideo60HzMode);
     SetupStore("SoftStartSync", ConfigVideoSoftStartSync = SoftStartSync);
     VideoSetSoftStartSync(ConfigVideoSoftStartSync);
+    SetupStore("EarlyStart", ConfigVideoEarlyStart = EarlyStart);
+    VideoSetEarlyStart(ConfigVideoEarlyStart);
+    AudioSetEarlyStart(ConfigVideoEarlyStart);
     SetupStore("BlackPicture", ConfigVideoBlackPicture = BlackPicture);
     VideoSetBlackPicture(ConfigVideoBlackPicture);
     SetupStore("ClearOnSwitch", ConfigVideoClearOnSwitch = ClearOnSwitch);
+    SetupStore("FastSwitch", ConfigVideoFastSwitch = FastSwitch);
+    SetVideoThreads(DecoderThreads, DecoderThreadType, DecoderThreadLatency);
+    SetupStore("DecoderThreads", ConfigVideoThreads);
+    SetupStore("DecoderThreadType", ConfigVideoThreadType);
+    SetupStore("DecoderThreadLatency", ConfigVideoThreadLatency);
+    SetupStore("DeintThreads", ConfigVideoDeintThreads = DeintThreads);
+    VideoSetSoftDeintThreads(ConfigVideoDeintThreads);
+    SetupStore("GrabExportRate", ConfigGrabExportRate = GrabExportRate);
+    SetupStore("GrabExportWidth", ConfigGrabExportWidth = GrabExportWidth);
+    VideoSetGrabExport(ConfigGrabExportRate, ConfigGrabExportWidth);
 
     SetupStore("Brightness", ConfigVideoBrightness = Brightness);
     VideoSetBrightness(ConfigVideoBrightness);
@@ -1693,62 +2159,6 @@ void cSoftReceiver::Activate(bool on)
     }
 }
 
-///
-///	Parse packetized elementary stream.
-///
-///	@param data	payload data of transport stream
-///	@param size	number of payload data bytes
-///	@param is_start flag, start of pes packet
-///
-static void PipPesParse(const uint8_t * data, int size, int is_start)
-{
-    static uint8_t *pes_buf;
-    static int pes_size;
-    static int pes_index;
-
-    // FIXME: quick&dirty
-
-    if (!pes_buf) {
-	pes_size = 500 * 1024 * 1024;
-	pes_buf = (uint8_t *) malloc(pes_size);
-	if (!pes_buf) {			// out of memory, should never happen
-	    return;
-	}
-	pes_index = 0;
-    }
-    if (is_start) {			// start of pes packet
-	if (pes_index) {
-	    if (0) {
-		fprintf(stderr, "pip: PES packet %8d %02x%02x\n", pes_index,
-		    pes_buf[2], pes_buf[3]);
-	    }
-	    if (pes_buf[0] || pes_buf[1] || pes_buf[2] != 0x01) {
-		// FIXME: first should always fail
-		Error(tr("[softhddev]pip: invalid PES packet %d\n"),
-		    pes_index);
-	    } else {
-		PipPlayVideo(pes_buf, pes_index);
-		// FIXME: buffer full: pes packet is dropped
-	    }
-	    pes_index = 0;
-	}
-    }
-
-    if (pes_index + size > pes_size) {
-	Error(tr("[softhddev]pip: pes buffer too small\n"));
-	pes_size *= 2;
-	if (pes_index + size > pes_size) {
-	    pes_size = (pes_index + size) * 2;
-	}
-	pes_buf = (uint8_t *) realloc(pes_buf, pes_size);
-	if (!pes_buf) {			// out of memory, should never happen
-	    return;
-	}
-    }
-    memcpy(pes_buf + pes_index, data, size);
-    pes_index += size;
-}
-
     /// Transport stream packet size
 #define TS_PACKET_SIZE	188
     /// Transport stream packet sync byte
@@ -1770,47 +2180,18 @@ void cSoftReceiver::Receive(uchar * data, int size)
 
     p = data;
     while (size >= TS_PACKET_SIZE) {
-	int payload;
-
 	if (p[0] != TS_PACKET_SYNC) {
 	    Error(tr("[softhddev]tsdemux: transport stream out of sync\n"));
 	    // FIXME: kill all buffers
 	    return;
 	}
-	if (p[1] & 0x80) {		// error indicatord
-	    Debug(3, "[softhddev]tsdemux: transport error\n");
-	    // FIXME: kill all buffers
-	    goto next_packet;
-	}
-	if (0) {
-	    int pid;
-
-	    pid = (p[1] & 0x1F) << 8 | p[2];
-	    fprintf(stderr, "tsdemux: PID: %#04x%s%s\n", pid,
-		p[1] & 0x40 ? " start" : "", p[3] & 0x10 ? " payload" : "");
-	}
-	// skip adaptation field
-	switch (p[3] & 0x30) {		// adaption field
-	    case 0x00:			// reserved
-	    case 0x20:			// adaptation field only
-	    default:
-		goto next_packet;
-	    case 0x10:			// only payload
-		payload = 4;
-		break;
-	    case 0x30:			// skip adapation field
-		payload = 5 + p[4];
-		// illegal length, ignore packet
-		if (payload >= TS_PACKET_SIZE) {
-		    Debug(3, "[softhddev]tsdemux: illegal adaption field length\n");
-		    goto next_packet;
-		}
-		break;
+	// PES packets are assembled in the pip packet arena.  The
+	// receiver can't wait, a dropped packet breaks the continuity
+	// and the demuxer drops the rest of its access unit.
+	if (!PipPlayTsVideo(p, TS_PACKET_SIZE)) {
+	    StatsCount(StatsPipDrops, 1);
 	}
 
-	PipPesParse(p + payload, TS_PACKET_SIZE - payload, p[1] & 0x40);
-
-      next_packet:
 	p += TS_PACKET_SIZE;
 	size -= TS_PACKET_SIZE;
     }
@@ -2717,6 +3098,24 @@ void cSoftHdDevice::GetOsdSize(int &width, int &height, double &pixel_aspect)
 
 // ----------------------------------------------------------------------------
 
+/**
+**	Count the packets and bytes VDR feeds into the device.
+**
+**	@param packets	packet counter
+**	@param bytes	byte counter
+**	@param n	bytes consumed by the play function
+**
+**	@returns the consumed bytes.
+*/
+static int CountIngest(StatsCounters packets, StatsCounters bytes, int n)
+{
+    if (n > 0) {
+	StatsCount(packets, 1);
+	StatsCount(bytes, n);
+    }
+    return n;
+}
+
 /**
 **	Play a audio packet.
 **
@@ -2728,7 +3127,8 @@ int cSoftHdDevice::PlayAudio(const uchar * data, int length, uchar id)
 {
     //Debug(3, "[softhddev]%s: %p %p %d %d\n", __FUNCTION__, this, data, length, id);
 
-    return::PlayAudio(data, length, id);
+    return CountIngest(StatsAudioPackets, StatsAudioBytes,
+	::PlayAudio(data, length, id));
 }
 
 void cSoftHdDevice::SetAudioTrackDevice(
@@ -2777,7 +3177,8 @@ void cSoftHdDevice::SetVolumeDevice(int volume)
 int cSoftHdDevice::PlayVideo(const uchar * data, int length)
 {
     //Debug(3, "[softhddev]%s: %p %d\n", __FUNCTION__, data, length);
-    return::PlayVideo(data, length);
+    return CountIngest(StatsVideoPackets, StatsVideoBytes,
+	::PlayVideo(data, length));
 }
 
 #ifdef USE_TS_VIDEO
@@ -2790,6 +3191,8 @@ int cSoftHdDevice::PlayVideo(const uchar * data, int length)
 */
 int cSoftHdDevice::PlayTsVideo(const uchar * data, int length)
 {
+    return CountIngest(StatsVideoPackets, StatsVideoBytes,
+	::PlayTsVideo(data, length));
 }
 
 #endif
@@ -2812,7 +3215,8 @@ int cSoftHdDevice::PlayTsAudio(const uchar * data, int length)
 #endif
     }
 
-    return::PlayTsAudio(data, length);
+    return CountIngest(StatsAudioPackets, StatsAudioBytes,
+	::PlayTsAudio(data, length));
 #else
     AudioPoller();
 
@@ -3172,6 +3576,10 @@ bool cPluginSoftHdDevice::SetupParse(const char *name, const char *value)
 	VideoSetStudioLevels(ConfigVideoStudioLevels = atoi(value));
 	return true;
     }
+    if (!strcasecmp(name, "Dither")) {
+	VideoSetDither(ConfigVideoDither = atoi(value));
+	return true;
+    }
     if (!strcasecmp(name, "60HzMode")) {
 	VideoSet60HzMode(ConfigVideo60HzMode = atoi(value));
 	return true;
@@ -3180,6 +3588,11 @@ bool cPluginSoftHdDevice::SetupParse(const char *name, const char *value)
 	VideoSetSoftStartSync(ConfigVideoSoftStartSync = atoi(value));
 	return true;
     }
+    if (!strcasecmp(name, "EarlyStart")) {
+	VideoSetEarlyStart(ConfigVideoEarlyStart = atoi(value));
+	AudioSetEarlyStart(ConfigVideoEarlyStart);
+	return true;
+    }
     if (!strcasecmp(name, "BlackPicture")) {
 	VideoSetBlackPicture(ConfigVideoBlackPicture = atoi(value));
 	return true;
@@ -3188,6 +3601,39 @@ bool cPluginSoftHdDevice::SetupParse(const char *name, const char *value)
 	ConfigVideoClearOnSwitch = atoi(value);
 	return true;
     }
+    if (!strcasecmp(name, "FastSwitch")) {
+	ConfigVideoFastSwitch = atoi(value);
+	return true;
+    }
+    if (!strcasecmp(name, "DecoderThreads")) {
+	SetVideoThreads(atoi(value), ConfigVideoThreadType,
+	    ConfigVideoThreadLatency);
+	return true;
+    }
+    if (!strcasecmp(name, "DecoderThreadType")) {
+	SetVideoThreads(ConfigVideoThreads, atoi(value),
+	    ConfigVideoThreadLatency);
+	return true;
+    }
+    if (!strcasecmp(name, "DecoderThreadLatency")) {
+	SetVideoThreads(ConfigVideoThreads, ConfigVideoThreadType,
+	    atoi(value));
+	return true;
+    }
+    if (!strcasecmp(name, "DeintThreads")) {
+	VideoSetSoftDeintThreads(ConfigVideoDeintThreads = atoi(value));
+	return true;
+    }
+    if (!strcasecmp(name, "GrabExportRate")) {
+	VideoSetGrabExport(ConfigGrabExportRate = atoi(value),
+	    ConfigGrabExportWidth);
+	return true;
+    }
+    if (!strcasecmp(name, "GrabExportWidth")) {
+	VideoSetGrabExport(ConfigGrabExportRate, ConfigGrabExportWidth =
+	    atoi(value));
+	return true;
+    }
     if (!strcasecmp(name, "Brightness")) {
 	VideoSetBrightness(ConfigVideoBrightness = atoi(value));
 	return true;
@@ -3350,6 +3796,14 @@ bool cPluginSoftHdDevice::SetupParse(const char *name, const char *value)
 	ConfigAudioBufferTime = atoi(value);
 	return true;
     }
+    if (!strcasecmp(name, "VideoBufferTime")) {
+	ConfigVideoBufferTime = atoi(value);
+	return true;
+    }
+    if (!strcasecmp(name, "VideoBufferSize")) {
+	ConfigVideoBufferSize = atoi(value);
+	return true;
+    }
     if (!strcasecmp(name, "AudioAutoAES")) {
 	ConfigAudioAutoAES = atoi(value);
 	AudioSetAutoAES(ConfigAudioAutoAES);
@@ -3420,6 +3874,10 @@ bool cPluginSoftHdDevice::SetupParse(const char *name, const char *value)
 	ConfigPipAltVideoHeight = atoi(value);
 	return true;
     }
+    if (!strcasecmp(name, "pip.BufferSize")) {
+	ConfigPipBufferSize = atoi(value);
+	return true;
+    }
 #endif
 
 #ifdef USE_SCREENSAVER
@@ -3505,6 +3963,77 @@ bool cPluginSoftHdDevice::Service(const char *id, void *data)
 	return true;
     }
 
+    if (strcmp(id, ATMO2_GRAB_SERVICE) == 0) {
+	SoftHDDevice_AtmoGrabService_v1_2_t *r;
+	int width;
+	int height;
+
+	if (!data) {
+	    return true;
+	}
+
+	if (SuspendMode != NOT_SUSPENDED) {
+	    return false;
+	}
+
+	r = (SoftHDDevice_AtmoGrabService_v1_2_t *) data;
+	if (r->structSize != sizeof(SoftHDDevice_AtmoGrabService_v1_2_t)
+	    || r->analyseSize < 64 || r->analyseSize > 256
+	    || r->clippedOverscan < 0 || r->clippedOverscan > 200
+	    || !r->buffer || r->bufferSize <= 0) {
+	    return false;
+	}
+
+	width = r->analyseSize * -1;	// Internal marker for Atmo grab service
+	height = r->clippedOverscan;
+
+	// grab into the caller buffer, imgSize returns the needed size
+	r->imgSize = 0;
+	r->img = VideoGrabServiceBuffer((uint8_t *) r->buffer, r->bufferSize,
+	    &r->imgSize, &width, &height);
+	if (!r->img) {
+	    return false;
+	}
+	r->imgType = GRAB_IMG_RGBA_FORMAT_B8G8R8A8;
+	r->width = width;
+	r->height = height;
+	return true;
+    }
+
+    if (strcmp(id, STATS_SERVICE) == 0) {
+	SoftHDDevice_StatsService_v1_0_t *r;
+	int i;
+
+	if (!data) {
+	    return true;
+	}
+	r = (SoftHDDevice_StatsService_v1_0_t *) data;
+	if (r->structSize != sizeof(SoftHDDevice_StatsService_v1_0_t)) {
+	    return false;
+	}
+
+	r->time = StatsGetTime();
+	for (i = 0; i < StatsCounterMax && i < STATS_SERVICE_COUNTERS; ++i) {
+	    r->counter[i] = StatsGetCounter((StatsCounters) i);
+	}
+	for (i = 0; i < StatsHistogramMax && i < STATS_SERVICE_HISTOGRAMS;
+	    ++i) {
+	    StatsHistogram hist;
+
+	    StatsGetHistogram((StatsHistograms) i, &hist);
+	    r->histogram[i].count = hist.Count;
+	    r->histogram[i].sum = hist.Sum;
+	    r->histogram[i].min = hist.Min;
+	    r->histogram[i].max = hist.Max;
+	    memcpy(r->histogram[i].bucket, hist.Bucket,
+		sizeof(r->histogram[i].bucket));
+	}
+	if (r->reset) {
+	    StatsReset();
+	}
+	return true;
+    }
+
     return false;
 }
 
@@ -3512,6 +4041,60 @@ bool cPluginSoftHdDevice::Service(const char *id, void *data)
 //	cPlugin SVDRP
 //----------------------------------------------------------------------------
 
+/**
+**	Format the runtime statistics.
+**
+**	@returns one line for the counters and each histogram.
+*/
+static cString StatsReport(void)
+{
+    static const char *const names[StatsHistogramMax] = {
+	"packet queue", "decode mpeg2 us", "decode h264 us",
+	"decode hevc us", "surface queue", "render us", "vsync jitter us",
+	"a/v offset ms", "audio fill ms", "osd upload us"
+    };
+    cString report;
+    uint64_t time;
+    double seconds;
+    int i;
+
+    time = StatsGetTime();
+    seconds = time ? time / 1e6 : 1.0;
+    report = cString::sprintf("time %.1fs\n"
+	"video packets %llu bytes %llu %.2f Mbit/s\n"
+	"audio packets %llu bytes %llu %.2f Mbit/s\n"
+	"video frames %llu %.2f/s audio underruns %llu\n"
+	"osd uploads %llu bytes %llu pip drops %llu\npcr drift %d ppm",
+	seconds,
+	(unsigned long long)StatsGetCounter(StatsVideoPackets),
+	(unsigned long long)StatsGetCounter(StatsVideoBytes),
+	StatsGetCounter(StatsVideoBytes) * 8 / seconds / 1e6,
+	(unsigned long long)StatsGetCounter(StatsAudioPackets),
+	(unsigned long long)StatsGetCounter(StatsAudioBytes),
+	StatsGetCounter(StatsAudioBytes) * 8 / seconds / 1e6,
+	(unsigned long long)StatsGetCounter(StatsVideoFrames),
+	StatsGetCounter(StatsVideoFrames) / seconds,
+	(unsigned long long)StatsGetCounter(StatsAudioUnderruns),
+	(unsigned long long)StatsGetCounter(StatsOsdUploads),
+	(unsigned long long)StatsGetCounter(StatsOsdUploadBytes),
+	(unsigned long long)StatsGetCounter(StatsPipDrops),
+	AvSyncGetPcrDrift());
+
+    for (i = 0; i < StatsHistogramMax; ++i) {
+	StatsHistogram hist;
+
+	StatsGetHistogram((StatsHistograms) i, &hist);
+	report = cString::sprintf("%s\n%s n %llu avg %lld min %lld max %lld"
+	    " |p50| %lld |p99| %lld", *report, names[i],
+	    (unsigned long long)hist.Count,
+	    hist.Count ? (long long)(hist.Sum / (int64_t) hist.Count) : 0LL,
+	    (long long)hist.Min, (long long)hist.Max,
+	    (long long)StatsPercentile(&hist, 50),
+	    (long long)StatsPercentile(&hist, 99));
+    }
+    return report;
+}
+
 /**
 **	SVDRP commands help text.
 **	FIXME: translation?
@@ -3573,6 +4156,24 @@ static const char *SVDRPHelpText[] = {
     "RAIS\n" "\040   Raise softhddevice window\n\n"
 	"    If Xserver is not started by softhddevice, the window which\n"
 	"    contains the softhddevice frontend will be raised to the front.\n",
+    "THRD [n [type [latency]]]\n" "    Set software video decoder threads.\n\n"
+	"    n is the number of threads, 0 or 1 disables decoder threads.\n"
+	"    type 0 uses slice threads, type 1 frame threads.  latency is\n"
+	"    the max. number of frames, frame threads may delay the video.\n"
+	"    Used for the next stream decoded by software. Without\n"
+	"    arguments the current setting is shown.\n",
+    "STAT2 [reset]\n" "    Show runtime statistics.\n\n"
+	"    Shows the received video/audio data, displayed frames, audio\n"
+	"    underruns, OSD uploads and histograms of the packet queue,\n"
+	"    decode time per codec, surface queue, render time, vsync\n"
+	"    jitter, a/v offset, audio fill and OSD upload time.  |p50|\n"
+	"    and |p99| are upper bounds of the absolute value.  reset\n"
+	"    clears the statistics.\n",
+    "ZAPS [reset]\n" "    Show channel switch statistics.\n\n"
+	"    Shows the number of channel switches, how many kept the\n"
+	"    decoder open (fast switch) and the last, average and max.\n"
+	"    time from switch to first video frame.  reset clears the\n"
+	"    counters.\n",
     NULL
 };
 
@@ -3595,7 +4196,7 @@ const char **cPluginSoftHdDevice::SVDRPHelpPages(void)
 **	@param reply_code	reply code
 */
 cString cPluginSoftHdDevice::SVDRPCommand(const char *command,
-    const char *option, __attribute__ ((unused)) int &reply_code)
+    const char *option, int &reply_code)
 {
     if (!strcasecmp(command, "STAT")) {
 	reply_code = 910 + SuspendMode;
@@ -3762,6 +4363,57 @@ cString cPluginSoftHdDevice::SVDRPCommand(const char *command,
 	return "Window raised";
     }
 
+    if (!strcasecmp(command, "THRD")) {
+	int count;
+	int type;
+	int latency;
+
+	count = ConfigVideoThreads;
+	type = ConfigVideoThreadType;
+	latency = ConfigVideoThreadLatency;
+	if (*option) {
+	    if (sscanf(option, "%d %d %d", &count, &type, &latency) < 1) {
+		reply_code = 501;
+		return "invalid thread arguments";
+	    }
+	    SetVideoThreads(count, type, latency);
+	}
+	return cString::sprintf("decoder threads %d %s latency %d",
+	    ConfigVideoThreads, ConfigVideoThreadType ? "frame" : "slice",
+	    ConfigVideoThreadLatency);
+    }
+    if (!strcasecmp(command, "STAT2")) {
+	cString stat;
+
+	stat = StatsReport();
+	if (*option) {
+	    if (strcasecmp(option, "reset")) {
+		reply_code = 501;
+		return "invalid argument";
+	    }
+	    StatsReset();
+	}
+	return stat;
+    }
+    if (!strcasecmp(command, "ZAPS")) {
+	int count;
+	int fast;
+	int last;
+	int average;
+	int max;
+
+	GetSwitchStats(&count, &fast, &last, &average, &max);
+	if (*option) {
+	    if (strcasecmp(option, "reset")) {
+		reply_code = 501;
+		return "invalid argument";
+	    }
+	    ResetSwitchStats();
+	}
+	return cString::sprintf("switches %d fast %d first frame last %d "
+	    "average %d max %d ms", count, fast, last, average, max);
+    }
+
     return NULL;
 }
 
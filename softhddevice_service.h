@@ -22,9 +22,13 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #define ATMO_GRAB_SERVICE	"SoftHDDevice-AtmoGrabService-v1.0"
 #define ATMO1_GRAB_SERVICE	"SoftHDDevice-AtmoGrabService-v1.1"
+#define ATMO2_GRAB_SERVICE	"SoftHDDevice-AtmoGrabService-v1.2"
 #define OSD_3DMODE_SERVICE	"SoftHDDevice-Osd3DModeService-v1.0"
+#define STATS_SERVICE		"SoftHDDevice-StatsService-v1.0"
 
 enum
 { GRAB_IMG_RGBA_FORMAT_B8G8R8A8 };
@@ -63,3 +67,100 @@ typedef struct
 
     void *img;
 } SoftHDDevice_AtmoGrabService_v1_1_t;
+
+typedef struct
+{
+    int structSize;
+
+    // request data
+    int analyseSize;
+    int clippedOverscan;
+    int bufferSize;			// size of caller buffer
+    void *buffer;			// caller buffer, reused every grab
+
+    // reply data
+    int imgType;
+    int imgSize;			// image size or needed buffer size
+    int width;
+    int height;
+    void *img;				// image, same as buffer
+} SoftHDDevice_AtmoGrabService_v1_2_t;
+
+//
+//	Grab export shared memory, a ring of downscaled BGRA images.
+//
+//	The name is GRAB_EXPORT_SHM "-" X11 display name, '/' replaced by
+//	'_' (fe. "/softhddevice-grab-:0.0").
+//	The segment is only accessible by the vdr user (mode 0600).
+//	shm_open(name, O_RDONLY) and map it read only.  Image n
+//	starts at headerSize + n * slotSize.  To read the latest image, load
+//	sequence, use slot[sequence % slots], check its sequence matches,
+//	copy the image and check the slot sequence is still unchanged.
+//	A slot sequence of 0 marks an image being written.  If magic is
+//	cleared, the export was stopped or restarted: unmap and open the
+//	name again.
+//
+#define GRAB_EXPORT_SHM		"/softhddevice-grab"
+#define GRAB_EXPORT_MAGIC	0x42415247	// "GRAB"
+#define GRAB_EXPORT_VERSION	1
+#define GRAB_EXPORT_SLOTS	4
+
+typedef struct
+{
+    uint32_t sequence;			// grab sequence number, 0 writing
+    uint32_t width;
+    uint32_t height;
+    uint32_t size;			// image size
+    uint64_t timestamp;			// CLOCK_MONOTONIC in us
+} SoftHDDevice_GrabExportSlot_v1_0_t;
+
+typedef struct
+{
+    uint32_t magic;			// GRAB_EXPORT_MAGIC when ready
+    uint32_t version;
+    uint32_t headerSize;		// offset of first image
+    uint32_t slotSize;			// max. image size
+    uint32_t slots;
+    uint32_t imgType;
+    uint32_t sequence;			// sequence of latest image
+    uint32_t rate;			// grabs per second
+    SoftHDDevice_GrabExportSlot_v1_0_t slot[GRAB_EXPORT_SLOTS];
+} SoftHDDevice_GrabExport_v1_0_t;
+
+//
+//	Runtime statistics, since start or last reset.
+//
+//	Counters: video packets, video bytes, audio packets, audio bytes,
+//	video frames displayed, audio underruns, OSD uploads, OSD bytes.
+//
+//	Histograms: video packets queued, MPEG-2/H.264/HEVC decode time
+//	(us), surfaces queued, render time (us), vsync jitter (us), a/v
+//	offset (ms), audio ring fill (ms).  Bucket n counts samples with
+//	2^(n-1) <= |sample| < 2^n, bucket 0 the zeros.  Statistics added
+//	later (PIP drops, OSD upload time) are only shown by SVDRP STAT2.
+//
+#define STATS_SERVICE_COUNTERS	8
+#define STATS_SERVICE_HISTOGRAMS	9
+#define STATS_SERVICE_BUCKETS	32
+
+typedef struct
+{
+    uint64_t count;			// number of samples
+    int64_t sum;			// sum of samples
+    int64_t min;
+    int64_t max;
+    uint64_t bucket[STATS_SERVICE_BUCKETS];	// log2 buckets of |sample|
+} SoftHDDevice_StatsHistogram_v1_0_t;
+
+typedef struct
+{
+    int structSize;
+
+    // request data
+    int reset;				// reset statistics after reading
+
+    // reply data
+    uint64_t time;			// us measured
+    uint64_t counter[STATS_SERVICE_COUNTERS];
+    SoftHDDevice_StatsHistogram_v1_0_t histogram[STATS_SERVICE_HISTOGRAMS];
+} SoftHDDevice_StatsService_v1_0_t;
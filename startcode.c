@@ -0,0 +1,287 @@
+///
+///	@file startcode.c	@brief Start code scanner module
+///
+///	Copyright (c) 2014 by Johns.  All Rights Reserved.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+///
+///	@defgroup StartCode The start code scanner module.
+///
+///	Finds the start code prefix 0x00 0x00 0x01 of MPEG elementary
+///	streams.  It is used where the plugin splits MPEG-2 video into
+///	pictures (PIP/TS path and before decoding).
+///
+///	H.264 and HEVC packets aren't scanned: each PES packet starts a
+///	new access unit (access unit delimiter) and is given unsplit to
+///	ffmpeg, only the leading zeros of the payload are counted.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "startcode.h"
+
+///
+///	Find start code prefix 0x00 0x00 0x01 in buffer.
+///
+///	Checks 32 (AVX2) or 16 (SSE2, NEON) positions per step, the rest of
+///	the buffer is searched byte by byte.
+///
+///	@param data	begin of buffer
+///	@param end	end of buffer
+///
+///	@returns pointer to the first complete start code prefix in buffer,
+///	NULL if the buffer contains none.
+///
+const uint8_t *FindStartCode(const uint8_t * data, const uint8_t * end)
+{
+    const uint8_t *p;
+
+    p = data;
+#if defined(__AVX2__)
+    if (end - p >= 32 + 2) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+
+	do {
+	    __m256i m;
+	    unsigned mask;
+
+	    m = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const
+			__m256i *)p), zero),
+		_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p +
+			    1)), zero));
+	    m = _mm256_and_si256(m,
+		_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p +
+			    2)), one));
+	    if ((mask = _mm256_movemask_epi8(m))) {
+		return p + __builtin_ctz(mask);
+	    }
+	    p += 32;
+	} while (end - p >= 32 + 2);
+    }
+#elif defined(__SSE2__)
+    if (end - p >= 16 + 2) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+
+	do {
+	    __m128i m;
+	    unsigned mask;
+
+	    m = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)
+			p), zero),
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)),
+		    zero));
+	    m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i
+			    *)(p + 2)), one));
+	    if ((mask = _mm_movemask_epi8(m))) {
+		return p + __builtin_ctz(mask);
+	    }
+	    p += 16;
+	} while (end - p >= 16 + 2);
+    }
+#elif defined(__ARM_NEON)
+    while (end - p >= 16 + 2) {
+	uint8x16_t m;
+	uint64x2_t t;
+
+	m = vandq_u8(vceqq_u8(vld1q_u8(p), vdupq_n_u8(0)),
+	    vceqq_u8(vld1q_u8(p + 1), vdupq_n_u8(0)));
+	m = vandq_u8(m, vceqq_u8(vld1q_u8(p + 2), vdupq_n_u8(1)));
+	t = vreinterpretq_u64_u8(m);
+	if (vgetq_lane_u64(t, 0) | vgetq_lane_u64(t, 1)) {
+	    // prefix in this block, find it below
+	    end = p + 16 + 2;
+	    break;
+	}
+	p += 16;
+    }
+#endif
+
+    while (p + 2 < end) {
+	if (p[2] > 0x01) {		// no prefix can start at p .. p+2
+	    p += 3;
+	} else if (!p[2]) {
+	    ++p;
+	} else if (p[1] || p[0]) {
+	    p += 3;
+	} else {
+	    return p;
+	}
+    }
+    return NULL;
+}
+
+#ifdef STARTCODE_TEST
+
+//----------------------------------------------------------------------------
+//	Test
+//----------------------------------------------------------------------------
+
+#include <string.h>
+#include <time.h>
+
+#include "misc.h"
+
+int LogLevel;				///< required
+
+///
+///	Find start code prefix byte by byte.
+///
+///	@param data	begin of buffer
+///	@param end	end of buffer
+///
+///	@returns pointer to the first start code prefix, NULL if none.
+///
+static const uint8_t *StartCodeTestFind(const uint8_t * data,
+    const uint8_t * end)
+{
+    for (; data + 2 < end; ++data) {
+	if (!data[0] && !data[1] && data[2] == 0x01) {
+	    return data;
+	}
+    }
+    return NULL;
+}
+
+///
+///	Compare the scanner with the byte by byte search.
+///
+///	Buffers of all sizes and alignments with few, many or no prefixes,
+///	also at the block borders of the vector scanners.
+///
+///	@returns number of different results.
+///
+static int StartCodeTestCompare(void)
+{
+    uint8_t buf[256 + 64];
+    int errors;
+    int i;
+
+    errors = 0;
+    for (i = 0; i < 20000; ++i) {
+	const uint8_t *data;
+	const uint8_t *end;
+	const uint8_t *p;
+	int size;
+	int x;
+
+	// mostly zeros and ones make partial prefixes
+	for (x = 0; x < (int)sizeof(buf); ++x) {
+	    switch (i & 3) {
+		case 0:
+		    buf[x] = rand();
+		    break;
+		case 1:
+		    buf[x] = rand() % 3;
+		    break;
+		case 2:
+		    buf[x] = rand() % 64 ? 0 : 1;
+		    break;
+		default:
+		    buf[x] = rand() % 64 ? rand() | 0x02 : 0;
+		    break;
+	    }
+	}
+	if (i & 4) {			// prefix at a block border
+	    x = (16 * (rand() % 16) + 14 + rand() % 4) % (sizeof(buf) - 3);
+	    buf[x] = 0;
+	    buf[x + 1] = 0;
+	    buf[x + 2] = 1;
+	}
+	data = buf + rand() % 64;
+	size = rand() % 257;
+	end = data + size;
+	// scan until the end like the callers do
+	for (p = data;; p += 3) {
+	    const uint8_t *q;
+	    const uint8_t *r;
+
+	    q = FindStartCode(p, end);
+	    r = StartCodeTestFind(p, end);
+	    if (q != r) {
+		++errors;
+		break;
+	    }
+	    if (!q) {
+		break;
+	    }
+	    p = q;
+	}
+    }
+    return errors;
+}
+
+///
+///	Main entry point.
+///
+///	@returns -1 on failures, 0 clean exit.
+///
+int main(void)
+{
+    uint8_t *buf;
+    const uint8_t *p;
+    uint32_t ticks;
+    int errors;
+    int n;
+    int i;
+
+    errors = StartCodeTestCompare();
+    printf("startcode: %s scanner, %d results differ\n",
+#if defined(__AVX2__)
+	"avx2",
+#elif defined(__SSE2__)
+	"sse2",
+#elif defined(__ARM_NEON)
+	"neon",
+#else
+	"c",
+#endif
+	errors);
+
+    // 1 MB packet with some partial prefixes and a few start codes
+    buf = malloc(1024 * 1024);
+    for (i = 0; i < 1024 * 1024; ++i) {
+	buf[i] = rand() % 16 ? rand() : 0;
+    }
+    ticks = GetUsTicks();
+    n = 0;
+    for (i = 0; i < 100; ++i) {
+	for (p = buf; (p = FindStartCode(p, buf + 1024 * 1024)); p += 3) {
+	    ++n;
+	}
+    }
+    printf("startcode: %d prefixes, %6.2f us/MB\n", n / 100,
+	(GetUsTicks() - ticks) / 100.0);
+    free(buf);
+
+    return errors ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,350 @@
+///
+///	@file stats.c	@brief Runtime statistics module
+///
+///	Copyright (c) 2014 by Johns.  All Rights Reserved.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+///
+///	@defgroup Stats The runtime statistics module.
+///
+///	Always on counters and histograms of the ingest, decode, sync and
+///	display stages.  They tell, if a stutter is decode, sync or display
+///	bound.
+///
+///	Each thread writes into its own cache line aligned shard, so the
+///	atomic adds never bounce between cpus and no lock is taken.  The
+///	reader sums all shards.  If more threads than shards record, the
+///	rest share the last shard.
+///
+///	Histograms have log2 buckets, bucket n counts samples with
+///	2^(n-1) <= |v| < 2^n, bucket 0 the zeros.
+///
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "stats.h"
+
+//----------------------------------------------------------------------------
+//	Defines
+//----------------------------------------------------------------------------
+
+#define STATS_SHARDS 32			///< shards owned by a thread
+
+//----------------------------------------------------------------------------
+//	Variables
+//----------------------------------------------------------------------------
+
+///
+///	Statistics of one or more threads.
+///
+typedef struct _stats_shard_
+{
+    char Used;				///< flag: owned by a thread
+    uint64_t Counter[StatsCounterMax];	///< counters
+    StatsHistogram Histogram[StatsHistogramMax];	///< histograms
+} __attribute__ ((aligned(64))) StatsShard;
+
+    /// thread owned shards and the shared shard
+static StatsShard StatsShards[STATS_SHARDS + 1];
+
+static pthread_once_t StatsOnce = PTHREAD_ONCE_INIT;	///< init once
+static pthread_key_t StatsKey;		///< releases shard at thread exit
+static __thread StatsShard *StatsThreadShard;	///< shard of this thread
+static uint64_t StatsStartTime;		///< us start of measurement
+
+//----------------------------------------------------------------------------
+//	Shards
+//----------------------------------------------------------------------------
+
+///
+///	Get the monotonic time in us.
+///
+static uint64_t StatsTime(void)
+{
+    struct timespec tspec;
+
+    clock_gettime(CLOCK_MONOTONIC, &tspec);
+    return tspec.tv_sec * UINT64_C(1000000) + tspec.tv_nsec / 1000;
+}
+
+///
+///	Clear a shard.
+///
+///	Samples of running writers can be lost or counted half.
+///
+///	@param shard	statistic shard
+///
+static void StatsClearShard(StatsShard * shard)
+{
+    int i;
+    int j;
+
+    for (i = 0; i < StatsCounterMax; ++i) {
+	__atomic_store_n(&shard->Counter[i], 0, __ATOMIC_RELAXED);
+    }
+    for (i = 0; i < StatsHistogramMax; ++i) {
+	StatsHistogram *hist;
+
+	hist = &shard->Histogram[i];
+	__atomic_store_n(&hist->Count, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->Sum, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->Min, INT64_MAX, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->Max, INT64_MIN, __ATOMIC_RELAXED);
+	for (j = 0; j < STATS_BUCKETS; ++j) {
+	    __atomic_store_n(&hist->Bucket[j], 0, __ATOMIC_RELAXED);
+	}
+    }
+}
+
+///
+///	Release the shard of an exiting thread.
+///
+///	The recorded statistics stay in the shard.
+///
+///	@param arg	shard of the thread
+///
+static void StatsReleaseShard(void *arg)
+{
+    StatsShard *shard;
+
+    shard = arg;
+    __atomic_store_n(&shard->Used, 0, __ATOMIC_RELEASE);
+}
+
+///
+///	Initialize the statistics once.
+///
+static void StatsInit(void)
+{
+    int i;
+
+    pthread_key_create(&StatsKey, StatsReleaseShard);
+    for (i = 0; i < STATS_SHARDS + 1; ++i) {
+	StatsClearShard(&StatsShards[i]);
+    }
+    StatsStartTime = StatsTime();
+}
+
+///
+///	Get the shard of the current thread.
+///
+static StatsShard *StatsGetShard(void)
+{
+    StatsShard *shard;
+    int i;
+
+    if ((shard = StatsThreadShard)) {
+	return shard;
+    }
+    pthread_once(&StatsOnce, StatsInit);
+    for (i = 0; i < STATS_SHARDS; ++i) {
+	char expected;
+
+	expected = 0;
+	if (__atomic_compare_exchange_n(&StatsShards[i].Used, &expected, 1, 0,
+		__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+	    shard = &StatsShards[i];
+	    pthread_setspecific(StatsKey, shard);
+	    return StatsThreadShard = shard;
+	}
+    }
+    // all shards owned, share the last one
+    return StatsThreadShard = &StatsShards[STATS_SHARDS];
+}
+
+//----------------------------------------------------------------------------
+//	Record
+//----------------------------------------------------------------------------
+
+///
+///	Add to a statistic counter.
+///
+///	@param counter	statistic counter
+///	@param value	value to add
+///
+void StatsCount(StatsCounters counter, uint64_t value)
+{
+    __atomic_fetch_add(&StatsGetShard()->Counter[counter], value,
+	__ATOMIC_RELAXED);
+}
+
+///
+///	Add a sample to a statistic histogram.
+///
+///	@param histogram	statistic histogram
+///	@param value		sample value
+///
+void StatsSample(StatsHistograms histogram, int64_t value)
+{
+    StatsHistogram *hist;
+    uint64_t abs_value;
+    int64_t old;
+    int bucket;
+
+    hist = &StatsGetShard()->Histogram[histogram];
+
+    abs_value = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    bucket = abs_value ? 64 - __builtin_clzll(abs_value) : 0;
+    if (bucket >= STATS_BUCKETS) {
+	bucket = STATS_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&hist->Bucket[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->Sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->Count, 1, __ATOMIC_RELAXED);
+
+    old = __atomic_load_n(&hist->Min, __ATOMIC_RELAXED);
+    while (value < old
+	&& !__atomic_compare_exchange_n(&hist->Min, &old, value, 1,
+	    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    old = __atomic_load_n(&hist->Max, __ATOMIC_RELAXED);
+    while (value > old
+	&& !__atomic_compare_exchange_n(&hist->Max, &old, value, 1,
+	    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+//----------------------------------------------------------------------------
+//	Report
+//----------------------------------------------------------------------------
+
+///
+///	Get a statistic counter.
+///
+///	@param counter	statistic counter
+///
+///	@returns the sum of the counter over all threads.
+///
+uint64_t StatsGetCounter(StatsCounters counter)
+{
+    uint64_t sum;
+    int i;
+
+    pthread_once(&StatsOnce, StatsInit);
+    sum = 0;
+    for (i = 0; i < STATS_SHARDS + 1; ++i) {
+	sum += __atomic_load_n(&StatsShards[i].Counter[counter],
+	    __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+///
+///	Get a statistic histogram.
+///
+///	@param histogram	statistic histogram
+///	@param[out] result	histogram merged over all threads
+///
+void StatsGetHistogram(StatsHistograms histogram, StatsHistogram * result)
+{
+    int i;
+    int j;
+
+    pthread_once(&StatsOnce, StatsInit);
+    memset(result, 0, sizeof(*result));
+    result->Min = INT64_MAX;
+    result->Max = INT64_MIN;
+    for (i = 0; i < STATS_SHARDS + 1; ++i) {
+	const StatsHistogram *hist;
+	int64_t value;
+
+	hist = &StatsShards[i].Histogram[histogram];
+	result->Count += __atomic_load_n(&hist->Count, __ATOMIC_RELAXED);
+	result->Sum += __atomic_load_n(&hist->Sum, __ATOMIC_RELAXED);
+	if ((value = __atomic_load_n(&hist->Min, __ATOMIC_RELAXED))
+	    < result->Min) {
+	    result->Min = value;
+	}
+	if ((value = __atomic_load_n(&hist->Max, __ATOMIC_RELAXED))
+	    > result->Max) {
+	    result->Max = value;
+	}
+	for (j = 0; j < STATS_BUCKETS; ++j) {
+	    result->Bucket[j] +=
+		__atomic_load_n(&hist->Bucket[j], __ATOMIC_RELAXED);
+	}
+    }
+    if (!result->Count) {
+	result->Min = 0;
+	result->Max = 0;
+    }
+}
+
+///
+///	Get the time since the statistics are measured.
+///
+///	@returns time in us since start or last reset.
+///
+uint64_t StatsGetTime(void)
+{
+    pthread_once(&StatsOnce, StatsInit);
+    return StatsTime() - StatsStartTime;
+}
+
+///
+///	Estimate a percentile of a statistic histogram.
+///
+///	@param hist	statistic histogram
+///	@param percent	percentile 0 .. 100
+///
+///	@returns upper bound of |sample| of the percentile bucket.
+///
+int64_t StatsPercentile(const StatsHistogram * hist, int percent)
+{
+    uint64_t target;
+    uint64_t sum;
+    int64_t limit;
+    int i;
+
+    if (!hist->Count) {
+	return 0;
+    }
+    // never report more than the biggest |sample|
+    limit = hist->Max > -hist->Min ? hist->Max : -hist->Min;
+    target = (hist->Count * percent + 99) / 100;
+    sum = 0;
+    for (i = 0; i < STATS_BUCKETS; ++i) {
+	sum += hist->Bucket[i];
+	if (sum >= target) {
+	    int64_t bound;
+
+	    bound = i ? (INT64_C(1) << i) - 1 : 0;
+	    return bound < limit ? bound : limit;
+	}
+    }
+    return limit;
+}
+
+///
+///	Reset all statistics.
+///
+void StatsReset(void)
+{
+    int i;
+
+    pthread_once(&StatsOnce, StatsInit);
+    for (i = 0; i < STATS_SHARDS + 1; ++i) {
+	StatsClearShard(&StatsShards[i]);
+    }
+    StatsStartTime = StatsTime();
+}
@@ -0,0 +1,91 @@
+///
+///	@file stats.h	@brief Runtime statistics module header file
+///
+///	Copyright (c) 2014 by Johns.  All Rights Reserved.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+/// @addtogroup Stats
+/// @{
+
+    /// number of histogram buckets
+#define STATS_BUCKETS 32
+
+    /// statistic counters
+typedef enum _stats_counters_
+{
+    StatsVideoPackets,			///< video PES/TS packets received
+    StatsVideoBytes,			///< video PES/TS bytes received
+    StatsAudioPackets,			///< audio PES/TS packets received
+    StatsAudioBytes,			///< audio PES/TS bytes received
+    StatsVideoFrames,			///< video frames displayed
+    StatsAudioUnderruns,		///< audio ring run empty while playing
+    StatsOsdUploads,			///< OSD uploads
+    StatsOsdUploadBytes,		///< OSD bytes uploaded
+    StatsPipDrops,			///< PIP TS packets dropped, buffers full
+    StatsCounterMax			///< number of counters
+} StatsCounters;
+
+    /// statistic histograms
+typedef enum _stats_histograms_
+{
+    StatsPacketQueue,			///< video packets queued at decode
+    StatsDecodeMpeg2,			///< MPEG-2 decode time per packet (us)
+    StatsDecodeH264,			///< H.264 decode time per packet (us)
+    StatsDecodeHevc,			///< HEVC decode time per packet (us)
+    StatsSurfaceQueue,			///< decoded surfaces queued at sync
+    StatsRenderTime,			///< render and flip time per frame (us)
+    StatsVsyncJitter,			///< frame interval - refresh (us)
+    StatsAvOffset,			///< video - audio difference (ms)
+    StatsAudioFill,			///< audio ring fill (ms)
+    StatsOsdUploadTime,			///< OSD upload time (us)
+    StatsHistogramMax			///< number of histograms
+} StatsHistograms;
+
+    /// statistic histogram, bucket n counts 2^(n-1) <= |sample| < 2^n
+typedef struct _stats_histogram_
+{
+    uint64_t Count;			///< number of samples
+    int64_t Sum;			///< sum of samples
+    int64_t Min;			///< smallest sample
+    int64_t Max;			///< biggest sample
+    uint64_t Bucket[STATS_BUCKETS];	///< log2 buckets of |sample|
+} StatsHistogram;
+
+    /// add to a statistic counter
+extern void StatsCount(StatsCounters, uint64_t);
+
+    /// add a sample to a statistic histogram
+extern void StatsSample(StatsHistograms, int64_t);
+
+    /// get a statistic counter
+extern uint64_t StatsGetCounter(StatsCounters);
+
+    /// get a statistic histogram
+extern void StatsGetHistogram(StatsHistograms, StatsHistogram *);
+
+    /// get the time in us since the statistics are measured
+extern uint64_t StatsGetTime(void);
+
+    /// estimate a percentile of a statistic histogram
+extern int64_t StatsPercentile(const StatsHistogram *, int);
+
+    /// reset all statistics
+extern void StatsReset(void);
+
+/// @}
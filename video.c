@@ -58,12 +58,16 @@
 #include <sys/time.h>
 #include <sys/shm.h>
 #include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <math.h>
 
 #include <libintl.h>
@@ -173,6 +177,15 @@ typedef enum
 #include <libavutil/pixdesc.h>
 #include <libavutil/hwcontext.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(54,86,100) && \
     LIBAVCODEC_VERSION_INT < AV_VERSION_INT(56,60,100)
     ///
@@ -189,6 +202,10 @@ typedef enum
 #include "video.h"
 #include "audio.h"
 #include "codec.h"
+#include "deint.h"
+#include "avsync.h"
+#include "stats.h"
+#include "softhddevice_service.h"
 
 #define ARRAY_ELEMS(array) (sizeof(array)/sizeof(array[0]))
 
@@ -222,6 +239,7 @@ typedef enum _video_deinterlace_modes_
     VideoDeinterlaceTemporalSpatial,	///< temporal spatial deinterlace
     VideoDeinterlaceSoftBob,		///< software bob deinterlace
     VideoDeinterlaceSoftSpatial,	///< software spatial deinterlace
+    VideoDeinterlaceSoftYadif,		///< software yadif deinterlace
 } VideoDeinterlaceModes;
 
 ///
@@ -266,7 +284,7 @@ typedef struct _video_module_
     char Enabled;			///< flag output module enabled
 
     /// allocate new video hw decoder
-    VideoHwDecoder *(*const NewHwDecoder)(VideoStream *);
+    VideoHwDecoder *(*const NewHwDecoder)(VideoStream *, int);
     void (*const DelHwDecoder) (VideoHwDecoder *);
     unsigned (*const GetSurface) (VideoHwDecoder *, const AVCodecContext *);
     void (*const ReleaseSurface) (VideoHwDecoder *, unsigned);
@@ -288,6 +306,8 @@ typedef struct _video_module_
 
     /// module display handler thread
     void (*const DisplayHandlerThread) (void);
+    /// module decode handler, called from the decoder thread of a stream
+    int (*const DecodeHandler) (VideoStream *);
 
     void (*const OsdClear) (void);	///< clear OSD
     /// draw OSD ARGB area
@@ -476,7 +496,9 @@ static VideoZoomModes VideoOtherZoomMode;
 static char Video60HzMode;		///< handle 60hz displays
 static char VideoSoftStartSync;		///< soft start sync audio/video
 static const int VideoSoftStartFrames = 100;	///< soft start frames
+static char VideoEarlyStart;		///< show video before audio start
 static char VideoShowBlackPicture;	///< flag show black picture
+static char VideoConvertDither;		///< flag dither 10 -> 8 bit conversion
 
 static xcb_atom_t WmDeleteWindowAtom;	///< WM delete message atom
 static xcb_atom_t NetWmState;		///< wm-state message atom
@@ -493,6 +515,27 @@ static pthread_t VideoThread;		///< video decode thread
 static pthread_cond_t VideoWakeupCond;	///< wakeup condition variable
 static pthread_mutex_t VideoMutex;	///< video condition mutex
 static pthread_mutex_t VideoLockMutex;	///< video lock mutex
+static unsigned VideoWakeupSerial;	///< counter of wakeups
+
+#define VIDEO_DECODER_THREAD_MAX 2	///< max decoder threads (main + pip)
+#define VIDEO_MIN_WAIT 2		///< minimal wait of video threads in ms
+
+///
+///	Video decoder thread of a stream.
+///
+typedef struct _video_decoder_thread_
+{
+    VideoStream *Stream;		///< stream decoded by thread
+    pthread_t Thread;			///< decoder thread
+} VideoDecoderThread;
+
+    /// decoder threads
+static VideoDecoderThread VideoDecoderThreads[VIDEO_DECODER_THREAD_MAX];
+
+static void VideoThreadWait(const struct timespec *, int, unsigned *);
+static void VideoThreadWakeup(void);
+static void VideoDecoderThreadStart(VideoStream *);
+static void VideoDecoderThreadExit(void);
 
 #endif
 
@@ -515,6 +558,7 @@ static int OsdDirtyX;			///< osd dirty area x
 static int OsdDirtyY;			///< osd dirty area y
 static int OsdDirtyWidth;		///< osd dirty area width
 static int OsdDirtyHeight;		///< osd dirty area height
+static volatile unsigned OsdGeneration;	///< osd surface clear counter
 
 static int64_t VideoDeltaPTS;		///< FIXME: fix pts
 
@@ -531,6 +575,12 @@ static void VideoThreadLock(void);	///< lock video thread
 static void VideoThreadUnlock(void);	///< unlock video thread
 static void VideoThreadExit(void);	///< exit/kill video thread
 
+#ifdef USE_GRAB
+static void VideoGrabExportInit(void);	///< start grab export
+static void VideoGrabExportExit(void);	///< stop grab export
+static void VideoGrabThreadsStop(void);	///< stop grab scaler threads
+#endif
+
 #ifdef USE_SCREENSAVER
 static void X11SuspendScreenSaver(xcb_connection_t *, int);
 static int X11HaveDPMS(xcb_connection_t *);
@@ -619,6 +669,56 @@ static void VideoSetPts(int64_t * pts_p, int interlaced,
     }
 }
 
+    /// filtered interval of displayed frames in us, 0 unknown
+static volatile int VideoFrameInterval;
+
+///
+///	Record statistics of a displayed frame.
+///
+///	The vsync jitter is the difference of the frame interval to the
+///	filtered interval, missed vsyncs show up as one interval jitter.
+///
+///	@param shown	time in us the frame is shown
+///	@param render	time in us spent to render and queue the frame
+///
+static void VideoDisplayStats(uint64_t shown, int render)
+{
+    static uint64_t last;
+    int interval;
+    int delta;
+
+    StatsCount(StatsVideoFrames, 1);
+    StatsSample(StatsRenderTime, render);
+
+    delta = shown - last;
+    last = shown;
+    if (delta < 5 * 1000 || delta > 100 * 1000) {	// start, pause
+	return;
+    }
+    if (!(interval = VideoFrameInterval)) {
+	interval = delta;
+    }
+    StatsSample(StatsVsyncJitter, delta - interval);
+    VideoFrameInterval = interval + (delta - interval) / 64;
+}
+
+///
+///	Get part of the display frame interval.
+///
+///	@param part	part of the frame interval in percent
+///
+///	@returns time in ns, 50Hz is assumed before the first frames.
+///
+static int64_t VideoFramePart(int part)
+{
+    int interval;
+
+    if (!(interval = VideoFrameInterval)) {
+	interval = 20 * 1000;
+    }
+    return (int64_t) interval * 10 * part;	// us * 1000 / 100
+}
+
 ///
 ///	Update output for new size or aspect ratio.
 ///
@@ -774,6 +874,486 @@ static void VideoUpdateOutput(AVRational input_aspect_ratio, int input_width,
     return;
 }
 
+//----------------------------------------------------------------------------
+//	Pixel format conversion
+//----------------------------------------------------------------------------
+
+#if defined(USE_VAAPI) || defined(USE_VDPAU)
+
+///
+///	Software pixel format conversion.
+///
+///	Converts software decoded frames into 8 bit 4:2:0 planes (I420 or
+///	NV12) for the VDPAU and VA-API upload paths.  10 bit formats are
+///	converted by own kernels, other formats by swscale.  The swscale
+///	context and the destination buffer are kept until format or size
+///	changes.
+///
+typedef struct _video_convert_
+{
+#ifdef USE_SWSCALE
+    struct SwsContext *SwsCtx;		///< fallback conversion context
+#endif
+    uint8_t *Buffer;			///< pooled 8 bit destination buffer
+    size_t BufferSize;			///< size of pooled buffer
+} VideoConvert;
+
+///
+///	Free cached conversion context and buffer.
+///
+///	@param conv	conversion cache
+///
+static void VideoConvertExit(VideoConvert * conv)
+{
+#ifdef USE_SWSCALE
+    sws_freeContext(conv->SwsCtx);
+    conv->SwsCtx = NULL;
+#endif
+    av_freep(&conv->Buffer);
+    conv->BufferSize = 0;
+}
+
+///
+///	Get pooled 8 bit I420 destination planes.
+///
+///	@param conv		conversion cache
+///	@param width		picture width
+///	@param height		picture height
+///	@param[out] data	Y, U, V plane pointers
+///	@param[out] pitch	Y, U, V plane pitches
+///
+static void VideoConvertGetBuffer(VideoConvert * conv, int width, int height,
+    uint8_t * data[3], int pitch[3])
+{
+    size_t size;
+
+    pitch[0] = FFALIGN(width, 32);
+    pitch[1] = FFALIGN((width + 1) / 2, 32);
+    pitch[2] = pitch[1];
+    size = pitch[0] * height + 2 * pitch[1] * ((height + 1) / 2);
+
+    if (size > conv->BufferSize) {
+	av_free(conv->Buffer);
+	if (!(conv->Buffer = av_malloc(size))) {
+	    Fatal(_("video: out of memory\n"));
+	}
+	conv->BufferSize = size;
+    }
+    data[0] = conv->Buffer;
+    data[1] = data[0] + pitch[0] * height;
+    data[2] = data[1] + pitch[1] * ((height + 1) / 2);
+}
+
+///
+///	Ordered dither/rounding values for 16 -> 8 bit rows.
+///
+///	@param y	row number
+///	@param shift	bits to remove (>= 2)
+///	@param[out] d	values for even and odd columns
+///
+static inline void VideoConvertDitherRow(int y, int shift, unsigned d[2])
+{
+    // 2x2 bayer matrix of the two highest dropped bits
+    static const unsigned char bayer[2][2] = { {0, 2}, {3, 1} };
+
+    if (VideoConvertDither) {
+	d[0] = bayer[y & 1][0] << (shift - 2);
+	d[1] = bayer[y & 1][1] << (shift - 2);
+    } else {				// round
+	d[0] = 1 << (shift - 1);
+	d[1] = d[0];
+    }
+}
+
+///
+///	Convert a row of 16 bit samples to 8 bit.
+///
+///	@param dst	8 bit samples
+///	@param src	16 bit samples
+///	@param n	number of samples
+///	@param shift	bits to remove (2 for 10 bit low, 8 for P010)
+///	@param d	dither values for even and odd samples
+///
+static void VideoConvertRow16(uint8_t * dst, const uint16_t * src, int n,
+    int shift, const unsigned d[2])
+{
+    int i;
+    unsigned v;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+	__m128i dv;
+	__m128i sh;
+
+	dv = _mm_set_epi16(d[1], d[0], d[1], d[0], d[1], d[0], d[1], d[0]);
+	sh = _mm_cvtsi32_si128(shift);
+	for (; i + 16 <= n; i += 16) {
+	    __m128i a;
+	    __m128i b;
+
+	    a = _mm_loadu_si128((const __m128i *)(src + i));
+	    b = _mm_loadu_si128((const __m128i *)(src + i + 8));
+	    a = _mm_srl_epi16(_mm_adds_epu16(a, dv), sh);
+	    b = _mm_srl_epi16(_mm_adds_epu16(b, dv), sh);
+	    _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(a, b));
+	}
+    }
+#elif defined(__ARM_NEON)
+    {
+	uint16x8_t dv;
+	int16x8_t sh;
+	const uint16_t dd[8] = { d[0], d[1], d[0], d[1], d[0], d[1], d[0], d[1] };
+
+	dv = vld1q_u16(dd);
+	sh = vdupq_n_s16(-shift);
+	for (; i + 16 <= n; i += 16) {
+	    uint16x8_t a;
+	    uint16x8_t b;
+
+	    a = vshlq_u16(vqaddq_u16(vld1q_u16(src + i), dv), sh);
+	    b = vshlq_u16(vqaddq_u16(vld1q_u16(src + i + 8), dv), sh);
+	    vst1q_u8(dst + i, vcombine_u8(vqmovn_u16(a), vqmovn_u16(b)));
+	}
+    }
+#endif
+    for (; i < n; ++i) {
+	v = src[i] + d[i & 1];
+	v = (v > 0xFFFF ? 0xFFFF : v) >> shift;
+	dst[i] = v > 0xFF ? 0xFF : v;
+    }
+}
+
+///
+///	Convert a row of interleaved 16 bit UV samples to 8 bit U and V.
+///
+///	@param dst_u	8 bit U samples
+///	@param dst_v	8 bit V samples
+///	@param src	16 bit UV sample pairs
+///	@param n	number of sample pairs
+///	@param shift	bits to remove
+///	@param d	dither values for even and odd pairs
+///
+static void VideoConvertRow16Split(uint8_t * dst_u, uint8_t * dst_v,
+    const uint16_t * src, int n, int shift, const unsigned d[2])
+{
+    int i;
+    unsigned u;
+    unsigned v;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+	__m128i dv;
+	__m128i sh;
+
+	// lanes are u0 v0 u1 v1 ...
+	dv = _mm_set_epi16(d[1], d[1], d[0], d[0], d[1], d[1], d[0], d[0]);
+	sh = _mm_cvtsi32_si128(shift);
+	for (; i + 16 <= n; i += 16) {
+	    __m128i a;
+	    __m128i b;
+	    __m128i c;
+	    __m128i e;
+	    __m128i lo;
+	    __m128i hi;
+
+	    a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+	    b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 8));
+	    c = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+	    e = _mm_loadu_si128((const __m128i *)(src + 2 * i + 24));
+	    a = _mm_srl_epi16(_mm_adds_epu16(a, dv), sh);
+	    b = _mm_srl_epi16(_mm_adds_epu16(b, dv), sh);
+	    c = _mm_srl_epi16(_mm_adds_epu16(c, dv), sh);
+	    e = _mm_srl_epi16(_mm_adds_epu16(e, dv), sh);
+	    // U: low 16 bit of each 32 bit lane
+	    lo = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+		_mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+	    hi = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(c, 16), 16),
+		_mm_srai_epi32(_mm_slli_epi32(e, 16), 16));
+	    _mm_storeu_si128((__m128i *) (dst_u + i), _mm_packus_epi16(lo,
+		    hi));
+	    // V: high 16 bit of each 32 bit lane
+	    lo = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+	    hi = _mm_packs_epi32(_mm_srai_epi32(c, 16), _mm_srai_epi32(e, 16));
+	    _mm_storeu_si128((__m128i *) (dst_v + i), _mm_packus_epi16(lo,
+		    hi));
+	}
+    }
+#elif defined(__ARM_NEON)
+    {
+	uint16x8_t dv;
+	int16x8_t sh;
+	const uint16_t dd[8] = { d[0], d[1], d[0], d[1], d[0], d[1], d[0], d[1] };
+
+	dv = vld1q_u16(dd);
+	sh = vdupq_n_s16(-shift);
+	for (; i + 8 <= n; i += 8) {
+	    uint16x8x2_t uv;
+
+	    uv = vld2q_u16(src + 2 * i);
+	    vst1_u8(dst_u + i,
+		vqmovn_u16(vshlq_u16(vqaddq_u16(uv.val[0], dv), sh)));
+	    vst1_u8(dst_v + i,
+		vqmovn_u16(vshlq_u16(vqaddq_u16(uv.val[1], dv), sh)));
+	}
+    }
+#endif
+    for (; i < n; ++i) {
+	u = src[2 * i] + d[i & 1];
+	v = src[2 * i + 1] + d[i & 1];
+	u = (u > 0xFFFF ? 0xFFFF : u) >> shift;
+	v = (v > 0xFFFF ? 0xFFFF : v) >> shift;
+	dst_u[i] = u > 0xFF ? 0xFF : u;
+	dst_v[i] = v > 0xFF ? 0xFF : v;
+    }
+}
+
+///
+///	Convert a row of 16 bit U and V samples to interleaved 8 bit UV.
+///
+///	@param dst	8 bit UV sample pairs
+///	@param src_u	16 bit U samples
+///	@param src_v	16 bit V samples
+///	@param n	number of sample pairs
+///	@param shift	bits to remove
+///	@param d	dither values for even and odd pairs
+///
+static void VideoConvertRow16Merge(uint8_t * dst, const uint16_t * src_u,
+    const uint16_t * src_v, int n, int shift, const unsigned d[2])
+{
+    int i;
+    unsigned u;
+    unsigned v;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+	__m128i dv;
+	__m128i sh;
+
+	dv = _mm_set_epi16(d[1], d[0], d[1], d[0], d[1], d[0], d[1], d[0]);
+	sh = _mm_cvtsi32_si128(shift);
+	for (; i + 8 <= n; i += 8) {
+	    __m128i a;
+	    __m128i b;
+
+	    a = _mm_loadu_si128((const __m128i *)(src_u + i));
+	    b = _mm_loadu_si128((const __m128i *)(src_v + i));
+	    a = _mm_srl_epi16(_mm_adds_epu16(a, dv), sh);
+	    b = _mm_srl_epi16(_mm_adds_epu16(b, dv), sh);
+	    _mm_storeu_si128((__m128i *) (dst + 2 * i),
+		_mm_packus_epi16(_mm_unpacklo_epi16(a, b),
+		    _mm_unpackhi_epi16(a, b)));
+	}
+    }
+#elif defined(__ARM_NEON)
+    {
+	uint16x8_t dv;
+	int16x8_t sh;
+	const uint16_t dd[8] = { d[0], d[1], d[0], d[1], d[0], d[1], d[0], d[1] };
+
+	dv = vld1q_u16(dd);
+	sh = vdupq_n_s16(-shift);
+	for (; i + 8 <= n; i += 8) {
+	    uint8x8x2_t uv;
+
+	    uv.val[0] =
+		vqmovn_u16(vshlq_u16(vqaddq_u16(vld1q_u16(src_u + i), dv),
+		    sh));
+	    uv.val[1] =
+		vqmovn_u16(vshlq_u16(vqaddq_u16(vld1q_u16(src_v + i), dv),
+		    sh));
+	    vst2_u8(dst + 2 * i, uv);
+	}
+    }
+#endif
+    for (; i < n; ++i) {
+	u = src_u[i] + d[i & 1];
+	v = src_v[i] + d[i & 1];
+	u = (u > 0xFFFF ? 0xFFFF : u) >> shift;
+	v = (v > 0xFFFF ? 0xFFFF : v) >> shift;
+	dst[2 * i] = u > 0xFF ? 0xFF : u;
+	dst[2 * i + 1] = v > 0xFF ? 0xFF : v;
+    }
+}
+
+///
+///	Interleave a row of 8 bit U and V samples.
+///
+///	@param dst	UV sample pairs
+///	@param src_u	U samples
+///	@param src_v	V samples
+///	@param n	number of sample pairs
+///
+static void VideoConvertRow8Merge(uint8_t * dst, const uint8_t * src_u,
+    const uint8_t * src_v, int n)
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+	__m128i a;
+	__m128i b;
+
+	a = _mm_loadu_si128((const __m128i *)(src_u + i));
+	b = _mm_loadu_si128((const __m128i *)(src_v + i));
+	_mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi8(a, b));
+	_mm_storeu_si128((__m128i *) (dst + 2 * i + 16), _mm_unpackhi_epi8(a,
+		b));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= n; i += 16) {
+	uint8x16x2_t uv;
+
+	uv.val[0] = vld1q_u8(src_u + i);
+	uv.val[1] = vld1q_u8(src_v + i);
+	vst2q_u8(dst + 2 * i, uv);
+    }
+#endif
+    for (; i < n; ++i) {
+	dst[2 * i] = src_u[i];
+	dst[2 * i + 1] = src_v[i];
+    }
+}
+
+///
+///	Convert a software decoded frame into 8 bit 4:2:0 planes.
+///
+///	@param conv		conversion cache
+///	@param frame		decoded frame
+///	@param pix_fmt		pixel format of frame
+///	@param width		picture width
+///	@param height		picture height
+///	@param nv12		destination is NV12 (Y + UV), else I420
+///	@param dst		Y, U, V planes (Y, UV for NV12)
+///	@param dst_pitch	pitches of destination planes
+///
+///	@returns 0 for success, -1 for unsupported pixel format.
+///
+static int VideoConvertFrame(VideoConvert * conv, const AVFrame * frame,
+    enum AVPixelFormat pix_fmt, int width, int height, int nv12,
+    uint8_t * const dst[3], const int dst_pitch[3])
+{
+    int cw;
+    int ch;
+    int y;
+    unsigned d[2];
+
+    cw = (width + 1) / 2;
+    ch = (height + 1) / 2;
+
+    switch (pix_fmt) {
+	case AV_PIX_FMT_YUV420P:
+	case AV_PIX_FMT_YUVJ420P:
+	    for (y = 0; y < height; ++y) {
+		memcpy(dst[0] + y * dst_pitch[0],
+		    frame->data[0] + y * frame->linesize[0], width);
+	    }
+	    for (y = 0; y < ch; ++y) {
+		if (nv12) {
+		    VideoConvertRow8Merge(dst[1] + y * dst_pitch[1],
+			frame->data[1] + y * frame->linesize[1],
+			frame->data[2] + y * frame->linesize[2], cw);
+		    continue;
+		}
+		memcpy(dst[1] + y * dst_pitch[1],
+		    frame->data[1] + y * frame->linesize[1], cw);
+		memcpy(dst[2] + y * dst_pitch[2],
+		    frame->data[2] + y * frame->linesize[2], cw);
+	    }
+	    return 0;
+
+	case AV_PIX_FMT_YUV420P10LE:	// for softdecode of HEVC 10 Bit
+	    for (y = 0; y < height; ++y) {
+		VideoConvertDitherRow(y, 2, d);
+		VideoConvertRow16(dst[0] + y * dst_pitch[0],
+		    (const uint16_t *)(frame->data[0] + y * frame->linesize[0]),
+		    width, 2, d);
+	    }
+	    for (y = 0; y < ch; ++y) {
+		VideoConvertDitherRow(y, 2, d);
+		if (nv12) {
+		    VideoConvertRow16Merge(dst[1] + y * dst_pitch[1],
+			(const uint16_t *)(frame->data[1] +
+			    y * frame->linesize[1]),
+			(const uint16_t *)(frame->data[2] +
+			    y * frame->linesize[2]), cw, 2, d);
+		    continue;
+		}
+		VideoConvertRow16(dst[1] + y * dst_pitch[1],
+		    (const uint16_t *)(frame->data[1] + y * frame->linesize[1]),
+		    cw, 2, d);
+		VideoConvertRow16(dst[2] + y * dst_pitch[2],
+		    (const uint16_t *)(frame->data[2] + y * frame->linesize[2]),
+		    cw, 2, d);
+	    }
+	    return 0;
+
+	case AV_PIX_FMT_P010LE:	// 10 bit in the high bits
+	    for (y = 0; y < height; ++y) {
+		VideoConvertDitherRow(y, 8, d);
+		VideoConvertRow16(dst[0] + y * dst_pitch[0],
+		    (const uint16_t *)(frame->data[0] + y * frame->linesize[0]),
+		    width, 8, d);
+	    }
+	    for (y = 0; y < ch; ++y) {
+		VideoConvertDitherRow(y, 8, d);
+		if (nv12) {
+		    VideoConvertRow16(dst[1] + y * dst_pitch[1],
+			(const uint16_t *)(frame->data[1] +
+			    y * frame->linesize[1]), 2 * cw, 8, d);
+		    continue;
+		}
+		VideoConvertRow16Split(dst[1] + y * dst_pitch[1],
+		    dst[2] + y * dst_pitch[2],
+		    (const uint16_t *)(frame->data[1] + y * frame->linesize[1]),
+		    cw, 8, d);
+	    }
+	    return 0;
+
+	default:
+	    break;
+    }
+
+#ifdef USE_SWSCALE
+    // other formats: cached swscale context
+    conv->SwsCtx =
+	sws_getCachedContext(conv->SwsCtx, width, height, pix_fmt, width,
+	height, nv12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P,
+	SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (conv->SwsCtx) {
+	sws_scale(conv->SwsCtx, (const uint8_t * const *)frame->data,
+	    frame->linesize, 0, height, dst, dst_pitch);
+	return 0;
+    }
+#else
+    (void)conv;
+#endif
+    return -1;
+}
+
+///
+///	Get software deinterlace mode.
+///
+///	@param resolution	resolution group
+///
+static DeintModes VideoGetSoftDeintMode(int resolution)
+{
+    switch (VideoDeinterlace[resolution]) {
+	case VideoDeinterlaceSoftSpatial:
+	    return DeintSpatial;
+	case VideoDeinterlaceSoftYadif:
+	    return DeintYadif;
+	default:
+	    break;
+    }
+    return DeintBob;
+}
+
+#endif
+
 //----------------------------------------------------------------------------
 //	GLX
 //----------------------------------------------------------------------------
@@ -1700,6 +2280,8 @@ struct _vaapi_decoder_
     unsigned SurfaceDeintTable[VideoResolutionMax];
 
     enum AVPixelFormat PixFmt;		///< ffmpeg frame pixfmt
+    VideoConvert Convert[1];		///< software frame conversion
+    Deint *SoftDeint;			///< software deinterlacer
     int WrongInterlacedWarned;		///< warning about interlace flag issued
     int Interlaced;			///< ffmpeg interlaced flag
     int Deinterlaced;			///< vpp deinterlace was run / not run
@@ -1777,6 +2359,7 @@ struct _vaapi_decoder_
     int64_t PTS;			///< video PTS clock
 
     int LastAVDiff;			///< last audio - video difference
+    AvSync *Sync;			///< audio/video sync
     int SyncCounter;			///< counter to sync frames
     int StartCounter;			///< counter for video start
     int FramesDuped;			///< number of frames duplicated
@@ -2259,9 +2842,12 @@ static void VaapiInitSurfaceFlags(VaapiDecoder * decoder)
 ///
 ///	Allocate new VA-API decoder.
 ///
+///	@param stream	video stream
+///	@param pip	flag stream is picture in picture
+///
 ///	@returns a new prepared VA-API hardware decoder.
 ///
-static VaapiDecoder *VaapiNewHwDecoder(VideoStream * stream)
+static VaapiDecoder *VaapiNewHwDecoder(VideoStream * stream, int pip)
 {
     VaapiDecoder *decoder;
     int i;
@@ -2273,6 +2859,9 @@ static VaapiDecoder *VaapiNewHwDecoder(VideoStream * stream)
     if (!(decoder = calloc(1, sizeof(*decoder)))) {
 	Fatal(_("video/vaapi: out of memory\n"));
     }
+    if (!(decoder->Sync = AvSyncNew(pip ? AvSyncPip : AvSyncMain))) {
+	Fatal(_("video/vaapi: out of memory\n"));
+    }
     decoder->VaDisplay = VaDisplay;
     decoder->Window = VideoWindow;
     decoder->VideoX = 0;
@@ -2472,6 +3061,9 @@ static void VaapiCleanup(VaapiDecoder * decoder)
 #endif
 
     decoder->WrongInterlacedWarned = 0;
+    if (decoder->SoftDeint) {
+	DeintReset(decoder->SoftDeint);
+    }
 
     //	cleanup image
     if (decoder->Image->image_id != VA_INVALID_ID) {
@@ -2533,6 +3125,7 @@ static void VaapiCleanup(VaapiDecoder * decoder)
     decoder->Closing = 0;
     decoder->PTS = AV_NOPTS_VALUE;
     VideoDeltaPTS = 0;
+    AvSyncReset(decoder->Sync);
     pthread_mutex_unlock(&VideoMutex);
 }
 
@@ -2592,6 +3185,9 @@ static void VaapiDelHwDecoder(VaapiDecoder * decoder)
 #endif
 
     VaapiPrintFrames(decoder);
+    VideoConvertExit(decoder->Convert);
+    DeintDel(decoder->SoftDeint);
+    AvSyncDel(decoder->Sync);
 
     free(decoder);
 }
@@ -2943,10 +3539,12 @@ static int VaapiFindImageFormat(VaapiDecoder * decoder,
 	    // intel: NV12 is native format for H.264 decoded surfaces
 	case AV_PIX_FMT_YUV420P:
 	case AV_PIX_FMT_YUVJ420P:
+	case AV_PIX_FMT_YUV420P10LE:	// converted to 8 bit
 	    // fourcc = VA_FOURCC_YV12; // YVU
 	    fourcc = VA_FOURCC('I', '4', '2', '0');	// YUV
 	    break;
 	case AV_PIX_FMT_NV12:
+	case AV_PIX_FMT_P010LE:	// converted to 8 bit
 	    fourcc = VA_FOURCC_NV12;
 	    break;
 	case AV_PIX_FMT_BGRA:
@@ -5093,178 +5691,34 @@ static void VaapiBlackSurface(VaapiDecoder * decoder)
     usleep(1 * 1000);
 }
 
-#define noUSE_VECTOR			///< use gcc vector extension
-#ifdef USE_VECTOR
-
-typedef char v16qi __attribute__ ((vector_size(16)));
-typedef char v8qi __attribute__ ((vector_size(8)));
-typedef int16_t v4hi __attribute__ ((vector_size(4)));
-typedef int16_t v8hi __attribute__ ((vector_size(8)));
-
-///
-///	ELA Edge-based Line Averaging
-///	Low-Complexity Interpolation Method
-///
-///	abcdefg	   abcdefg	abcdefg	 abcdefg    abcdefg
-///	   x	     x		  x	    x		 x
-///	hijklmn	 hijklmn    hijklmn	   hijklmn	 hijklmn
-///
-static void FilterLineSpatial(uint8_t * dst, const uint8_t * cur, int width,
-    int above, int below, int next)
-{
-    int x;
-
-    // 8/16 128bit xmm register
-
-    for (x = 0; x < width; x += 8) {
-	v8qi c;
-	v8qi d;
-	v8qi e;
-	v8qi j;
-	v8qi k;
-	v8qi l;
-	v8qi t1;
-	v8qi t2;
-	v8qi pred;
-	v8qi score_l;
-	v8qi score_h;
-	v8qi t_l;
-	v8qi t_h;
-	v8qi zero;
-
-	// ignore bound violation
-	d = *(v8qi *) & cur[above + x];
-	k = *(v8qi *) & cur[below + x];
-	pred = __builtin_ia32_pavgb(d, k);
-
-	// score = ABS(c - j) + ABS(d - k) + ABS(e - l);
-	c = *(v8qi *) & cur[above + x - 1 * next];
-	e = *(v8qi *) & cur[above + x + 1 * next];
-	j = *(v8qi *) & cur[below + x - 1 * next];
-	l = *(v8qi *) & cur[below + x + 1 * next];
-
-	t1 = __builtin_ia32_psubusb(c, j);
-	t2 = __builtin_ia32_psubusb(j, c);
-	t1 = __builtin_ia32_pmaxub(t1, t2);
-	zero ^= zero;
-	score_l = __builtin_ia32_punpcklbw(t1, zero);
-	score_h = __builtin_ia32_punpckhbw(t1, zero);
-
-	t1 = __builtin_ia32_psubusb(d, k);
-	t2 = __builtin_ia32_psubusb(k, d);
-	t1 = __builtin_ia32_pmaxub(t1, t2);
-	t_l = __builtin_ia32_punpcklbw(t1, zero);
-	t_h = __builtin_ia32_punpckhbw(t1, zero);
-	score_l = __builtin_ia32_paddw(score_l, t_l);
-	score_h = __builtin_ia32_paddw(score_h, t_h);
-
-	t1 = __builtin_ia32_psubusb(e, l);
-	t2 = __builtin_ia32_psubusb(l, e);
-	t1 = __builtin_ia32_pmaxub(t1, t2);
-	t_l = __builtin_ia32_punpcklbw(t1, zero);
-	t_h = __builtin_ia32_punpckhbw(t1, zero);
-	score_l = __builtin_ia32_paddw(score_l, t_l);
-	score_h = __builtin_ia32_paddw(score_h, t_h);
-
-	*(v8qi *) & dst[x] = pred;
-    }
-}
-
-#else
-
-    /// Return the absolute value of an integer.
-#define ABS(i)	((i) >= 0 ? (i) : (-(i)))
-
-///
-///	ELA Edge-based Line Averaging
-///	Low-Complexity Interpolation Method
-///
-///	abcdefg	   abcdefg	abcdefg	 abcdefg    abcdefg
-///	   x	     x		  x	    x		 x
-///	hijklmn	 hijklmn    hijklmn	   hijklmn	 hijklmn
-///
-static void FilterLineSpatial(uint8_t * dst, const uint8_t * cur, int width,
-    int above, int below, int next)
-{
-    int a, b, c, d, e, f, g, h, i, j, k, l, m, n;
-    int spatial_pred;
-    int spatial_score;
-    int score;
-    int x;
-
-    for (x = 0; x < width; ++x) {
-	a = cur[above + x - 3 * next];	// ignore bound violation
-	b = cur[above + x - 2 * next];
-	c = cur[above + x - 1 * next];
-	d = cur[above + x + 0 * next];
-	e = cur[above + x + 1 * next];
-	f = cur[above + x + 2 * next];
-	g = cur[above + x + 3 * next];
-
-	h = cur[below + x - 3 * next];
-	i = cur[below + x - 2 * next];
-	j = cur[below + x - 1 * next];
-	k = cur[below + x + 0 * next];
-	l = cur[below + x + 1 * next];
-	m = cur[below + x + 2 * next];
-	n = cur[below + x + 3 * next];
-
-	spatial_pred = (d + k) / 2;	// 0 pixel
-	spatial_score = ABS(c - j) + ABS(d - k) + ABS(e - l);
-
-	score = ABS(b - k) + ABS(c - l) + ABS(d - m);
-	if (score < spatial_score) {
-	    spatial_pred = (c + l) / 2;	// 1 pixel
-	    spatial_score = score;
-	    score = ABS(a - l) + ABS(b - m) + ABS(c - n);
-	    if (score < spatial_score) {
-		spatial_pred = (b + m) / 2;	// 2 pixel
-		spatial_score = score;
-	    }
-	}
-	score = ABS(d - i) + ABS(e - j) + ABS(f - k);
-	if (score < spatial_score) {
-	    spatial_pred = (e + j) / 2;	// -1 pixel
-	    spatial_score = score;
-	    score = ABS(e - h) + ABS(f - i) + ABS(g - j);
-	    if (score < spatial_score) {
-		spatial_pred = (f + i) / 2;	// -2 pixel
-		spatial_score = score;
-	    }
-	}
-
-	dst[x + 0] = spatial_pred;
-    }
-}
-
-#endif
-
 ///
-///	Vaapi spatial deinterlace.
+///	Vaapi software deinterlace an image.
 ///
-///	@note FIXME: use common software deinterlace functions.
+///	@param decoder	VA-API decoder
+///	@param src	interlaced image
+///	@param dst1	image for the first field
+///	@param dst2	image for the second field
 ///
-static void VaapiSpatial(VaapiDecoder * decoder, VAImage * src, VAImage * dst1,
-    VAImage * dst2)
+static void VaapiDeinterlaceImage(VaapiDecoder * decoder, VAImage * src,
+    VAImage * dst1, VAImage * dst2)
 {
 #ifdef DEBUG
     uint32_t tick1;
     uint32_t tick2;
     uint32_t tick3;
     uint32_t tick4;
-    uint32_t tick5;
-    uint32_t tick6;
-    uint32_t tick7;
-    uint32_t tick8;
 #endif
     void *src_base;
     void *dst1_base;
     void *dst2_base;
-    unsigned y;
+    uint8_t *data[3];
+    int pitch[3];
+    uint8_t *dst1_data[3];
+    int dst1_pitch[3];
+    uint8_t *dst2_data[3];
+    int dst2_pitch[3];
     unsigned p;
-    uint8_t *tmp;
-    int pitch;
-    int width;
+    int y;
 
 #ifdef DEBUG
     tick1 = GetMsTicks();
@@ -5273,352 +5727,63 @@ static void VaapiSpatial(VaapiDecoder * decoder, VAImage * src, VAImage * dst1,
 	    &src_base) != VA_STATUS_SUCCESS) {
 	Fatal("video/vaapi: can't map the image!\n");
     }
-#ifdef DEBUG
-    tick2 = GetMsTicks();
-#endif
     if (vaMapBuffer(decoder->VaDisplay, dst1->buf,
 	    &dst1_base) != VA_STATUS_SUCCESS) {
 	Fatal("video/vaapi: can't map the image!\n");
     }
-#ifdef DEBUG
-    tick3 = GetMsTicks();
-#endif
     if (vaMapBuffer(decoder->VaDisplay, dst2->buf,
 	    &dst2_base) != VA_STATUS_SUCCESS) {
 	Fatal("video/vaapi: can't map the image!\n");
     }
 #ifdef DEBUG
-    tick4 = GetMsTicks();
+    tick2 = GetMsTicks();
 #endif
 
-    if (0) {				// test all updated
-	memset(dst1_base, 0x00, dst1->data_size);
-	memset(dst2_base, 0xFF, dst2->data_size);
-    }
-    // use tmp copy FIXME: only for intel needed
-    tmp = malloc(src->data_size);
-    memcpy(tmp, src_base, src->data_size);
-
-    if (src->num_planes == 2) {		// NV12
-	pitch = src->pitches[0];
-	width = src->width;
-	for (y = 0; y < (unsigned)src->height; y++) {	// Y
-	    const uint8_t *cur;
-
-	    cur = tmp + src->offsets[0] + y * pitch;
-	    if (y & 1) {
-		// copy to 2nd
-		memcpy(dst2_base + src->offsets[0] + y * pitch, cur, width);
-		// create 1st
-		FilterLineSpatial(dst1_base + src->offsets[0] + y * pitch, cur,
-		    width, y ? -pitch : pitch,
-		    y + 1 < (unsigned)src->height ? pitch : -pitch, 1);
-	    } else {
-		// copy to 1st
-		memcpy(dst1_base + src->offsets[0] + y * pitch, cur, width);
-		// create 2nd
-		FilterLineSpatial(dst2_base + src->offsets[0] + y * pitch, cur,
-		    width, y ? -pitch : pitch,
-		    y + 1 < (unsigned)src->height ? pitch : -pitch, 1);
-	    }
-	}
-	if (VideoSkipChromaDeinterlace[decoder->Resolution]) {
-	    for (y = 0; y < (unsigned)src->height / 2; y++) {	// UV
-		const uint8_t *cur;
+    if (!decoder->SoftDeint && !(decoder->SoftDeint = DeintNew())) {
+	Fatal(_("video/vaapi: out of memory\n"));
+    }
+    // read the image only once, mapped images can be uncached
+    DeintGetBuffer(decoder->SoftDeint, src->width, src->height,
+	src->num_planes == 2, data, pitch);
+    for (p = 0; p < src->num_planes && p < 3; ++p) {
+	int width;
+	int height;
 
-		cur = tmp + src->offsets[1] + y * pitch;
-		// copy to 1st
-		memcpy(dst1_base + src->offsets[1] + y * pitch, cur, width);
-		// copy to 2nd
-		memcpy(dst2_base + src->offsets[1] + y * pitch, cur, width);
-	    }
-	} else {
-	    for (y = 0; y < (unsigned)src->height / 2; y++) {	// UV
-		const uint8_t *cur;
-
-		cur = tmp + src->offsets[1] + y * pitch;
-		if (y & 1) {
-		    // copy to 2nd
-		    memcpy(dst2_base + src->offsets[1] + y * pitch, cur,
-			width);
-		    // create 1st
-		    FilterLineSpatial(dst1_base + src->offsets[1] + y * pitch,
-			cur, width, y ? -pitch : pitch,
-			y + 1 < (unsigned)src->height / 2 ? pitch : -pitch, 2);
-		} else {
-		    // copy to 1st
-		    memcpy(dst1_base + src->offsets[1] + y * pitch, cur,
-			width);
-		    // create 2nd
-		    FilterLineSpatial(dst2_base + src->offsets[1] + y * pitch,
-			cur, width, y ? -pitch : pitch,
-			y + 1 < (unsigned)src->height / 2 ? pitch : -pitch, 2);
-		}
-	    }
+	width = src->num_planes == 2 || !p ? src->width : (src->width + 1) / 2;
+	height = p ? (src->height + 1) / 2 : src->height;
+	for (y = 0; y < height; ++y) {
+	    memcpy(data[p] + y * pitch[p],
+		(uint8_t *) src_base + src->offsets[p] + y * src->pitches[p],
+		width);
 	}
-    } else {				// YV12 or I420
-	for (p = 0; p < src->num_planes; ++p) {
-	    pitch = src->pitches[p];
-	    width = src->width >> (p != 0);
-	    if (VideoSkipChromaDeinterlace[decoder->Resolution] && p) {
-		for (y = 0; y < (unsigned)(src->height >> 1); y++) {
-		    const uint8_t *cur;
-
-		    cur = tmp + src->offsets[p] + y * pitch;
-		    // copy to 1st
-		    memcpy(dst1_base + src->offsets[p] + y * pitch, cur,
-			width);
-		    // copy to 2nd
-		    memcpy(dst2_base + src->offsets[p] + y * pitch, cur,
-			width);
-		}
-	    } else {
-		for (y = 0; y < (unsigned)(src->height >> (p != 0)); y++) {
-		    const uint8_t *cur;
-
-		    cur = tmp + src->offsets[p] + y * pitch;
-		    if (y & 1) {
-			// copy to 2nd
-			memcpy(dst2_base + src->offsets[p] + y * pitch, cur,
-			    width);
-			// create 1st
-			FilterLineSpatial(dst1_base + src->offsets[p] +
-			    y * pitch, cur, width, y ? -pitch : pitch,
-			    y + 1 < (unsigned)(src->height >> (p != 0))
-			    ? pitch : -pitch, 1);
-		    } else {
-			// copy to 1st
-			memcpy(dst1_base + src->offsets[p] + y * pitch, cur,
-			    width);
-			// create 2nd
-			FilterLineSpatial(dst2_base + src->offsets[p] +
-			    y * pitch, cur, width, y ? -pitch : pitch,
-			    y + 1 < (unsigned)(src->height >> (p != 0))
-			    ? pitch : -pitch, 1);
-		    }
-		}
-	    }
-	}
-    }
-    free(tmp);
-
-#ifdef DEBUG
-    tick5 = GetMsTicks();
-#endif
-    if (vaUnmapBuffer(decoder->VaDisplay, dst2->buf) != VA_STATUS_SUCCESS) {
-	Error(_("video/vaapi: can't unmap image buffer\n"));
-    }
-#ifdef DEBUG
-    tick6 = GetMsTicks();
-#endif
-    if (vaUnmapBuffer(decoder->VaDisplay, dst1->buf) != VA_STATUS_SUCCESS) {
-	Error(_("video/vaapi: can't unmap image buffer\n"));
-    }
-#ifdef DEBUG
-    tick7 = GetMsTicks();
-#endif
-    if (vaUnmapBuffer(decoder->VaDisplay, src->buf) != VA_STATUS_SUCCESS) {
-	Error(_("video/vaapi: can't unmap image buffer\n"));
-    }
-#ifdef DEBUG
-    tick8 = GetMsTicks();
-
-    Debug(3, "video/vaapi: map=%2d/%2d/%2d deint=%2d umap=%2d/%2d/%2d\n",
-	tick2 - tick1, tick3 - tick2, tick4 - tick3, tick5 - tick4,
-	tick6 - tick5, tick7 - tick6, tick8 - tick7);
-#endif
-}
-
-///
-///	Vaapi bob deinterlace.
-///
-///	@note FIXME: use common software deinterlace functions.
-///
-static void VaapiBob(VaapiDecoder * decoder, VAImage * src, VAImage * dst1,
-    VAImage * dst2)
-{
-#ifdef DEBUG
-    uint32_t tick1;
-    uint32_t tick2;
-    uint32_t tick3;
-    uint32_t tick4;
-    uint32_t tick5;
-    uint32_t tick6;
-    uint32_t tick7;
-    uint32_t tick8;
-#endif
-    void *src_base;
-    void *dst1_base;
-    void *dst2_base;
-    unsigned y;
-    unsigned p;
-
-#ifdef DEBUG
-    tick1 = GetMsTicks();
-#endif
-    if (vaMapBuffer(decoder->VaDisplay, src->buf,
-	    &src_base) != VA_STATUS_SUCCESS) {
-	Fatal("video/vaapi: can't map the image!\n");
-    }
-#ifdef DEBUG
-    tick2 = GetMsTicks();
-#endif
-    if (vaMapBuffer(decoder->VaDisplay, dst1->buf,
-	    &dst1_base) != VA_STATUS_SUCCESS) {
-	Fatal("video/vaapi: can't map the image!\n");
+	dst1_data[p] = (uint8_t *) dst1_base + dst1->offsets[p];
+	dst1_pitch[p] = dst1->pitches[p];
+	dst2_data[p] = (uint8_t *) dst2_base + dst2->offsets[p];
+	dst2_pitch[p] = dst2->pitches[p];
     }
 #ifdef DEBUG
     tick3 = GetMsTicks();
 #endif
-    if (vaMapBuffer(decoder->VaDisplay, dst2->buf,
-	    &dst2_base) != VA_STATUS_SUCCESS) {
-	Fatal("video/vaapi: can't map the image!\n");
-    }
-#ifdef DEBUG
-    tick4 = GetMsTicks();
-#endif
-
-    if (0) {				// test all updated
-	memset(dst1_base, 0x00, dst1->data_size);
-	memset(dst2_base, 0xFF, dst2->data_size);
-	return;
-    }
-#if 0
-    // interleave
-    for (p = 0; p < src->num_planes; ++p) {
-	for (y = 0; y < (unsigned)(src->height >> (p != 0)); y += 2) {
-	    memcpy(dst1_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		src_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		src->pitches[p]);
-	    memcpy(dst1_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		src_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		src->pitches[p]);
-
-	    memcpy(dst2_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		src_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		src->pitches[p]);
-	    memcpy(dst2_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		src_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		src->pitches[p]);
-	}
-    }
-#endif
-#if 1
-    // use tmp copy
-    if (1) {
-	uint8_t *tmp;
-
-	tmp = malloc(src->data_size);
-	memcpy(tmp, src_base, src->data_size);
-
-	for (p = 0; p < src->num_planes; ++p) {
-	    for (y = 0; y < (unsigned)(src->height >> (p != 0)); y += 2) {
-		memcpy(dst1_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		    tmp + src->offsets[p] + (y + 0) * src->pitches[p],
-		    src->pitches[p]);
-		memcpy(dst1_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		    tmp + src->offsets[p] + (y + 0) * src->pitches[p],
-		    src->pitches[p]);
-
-		memcpy(dst2_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		    tmp + src->offsets[p] + (y + 1) * src->pitches[p],
-		    src->pitches[p]);
-		memcpy(dst2_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		    tmp + src->offsets[p] + (y + 1) * src->pitches[p],
-		    src->pitches[p]);
-	    }
-
-	}
-	free(tmp);
-    }
-#endif
-#if 0
-    // use multiple tmp copy
-    if (1) {
-	uint8_t *tmp_src;
-	uint8_t *tmp_dst1;
-	uint8_t *tmp_dst2;
-
-	tmp_src = malloc(src->data_size);
-	memcpy(tmp_src, src_base, src->data_size);
-	tmp_dst1 = malloc(src->data_size);
-	tmp_dst2 = malloc(src->data_size);
-
-	for (p = 0; p < src->num_planes; ++p) {
-	    for (y = 0; y < (unsigned)(src->height >> (p != 0)); y += 2) {
-		memcpy(tmp_dst1 + src->offsets[p] + (y + 0) * src->pitches[p],
-		    tmp_src + src->offsets[p] + (y + 0) * src->pitches[p],
-		    src->pitches[p]);
-		memcpy(tmp_dst1 + src->offsets[p] + (y + 1) * src->pitches[p],
-		    tmp_src + src->offsets[p] + (y + 0) * src->pitches[p],
-		    src->pitches[p]);
-
-		memcpy(tmp_dst2 + src->offsets[p] + (y + 0) * src->pitches[p],
-		    tmp_src + src->offsets[p] + (y + 1) * src->pitches[p],
-		    src->pitches[p]);
-		memcpy(tmp_dst2 + src->offsets[p] + (y + 1) * src->pitches[p],
-		    tmp_src + src->offsets[p] + (y + 1) * src->pitches[p],
-		    src->pitches[p]);
-	    }
-	}
-	memcpy(dst1_base, tmp_dst1, src->data_size);
-	memcpy(dst2_base, tmp_dst2, src->data_size);
 
-	free(tmp_src);
-	free(tmp_dst1);
-	free(tmp_dst2);
-    }
-#endif
-#if 0
-    // dst1 first
-    for (p = 0; p < src->num_planes; ++p) {
-	for (y = 0; y < (unsigned)(src->height >> (p != 0)); y += 2) {
-	    memcpy(dst1_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		src_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		src->pitches[p]);
-	    memcpy(dst1_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		src_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		src->pitches[p]);
-	}
-    }
-    // dst2 next
-    for (p = 0; p < src->num_planes; ++p) {
-	for (y = 0; y < (unsigned)(src->height >> (p != 0)); y += 2) {
-	    memcpy(dst2_base + src->offsets[p] + (y + 0) * src->pitches[p],
-		src_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		src->pitches[p]);
-	    memcpy(dst2_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		src_base + src->offsets[p] + (y + 1) * src->pitches[p],
-		src->pitches[p]);
-	}
-    }
-#endif
+    DeintFrame(decoder->SoftDeint, VideoGetSoftDeintMode(decoder->Resolution),
+	decoder->TopFieldFirst, VideoSkipChromaDeinterlace[decoder->Resolution],
+	dst1_data, dst1_pitch, dst2_data, dst2_pitch);
 
 #ifdef DEBUG
-    tick5 = GetMsTicks();
+    tick4 = GetMsTicks();
 #endif
-
     if (vaUnmapBuffer(decoder->VaDisplay, dst2->buf) != VA_STATUS_SUCCESS) {
 	Error(_("video/vaapi: can't unmap image buffer\n"));
     }
-#ifdef DEBUG
-    tick6 = GetMsTicks();
-#endif
     if (vaUnmapBuffer(decoder->VaDisplay, dst1->buf) != VA_STATUS_SUCCESS) {
 	Error(_("video/vaapi: can't unmap image buffer\n"));
     }
-#ifdef DEBUG
-    tick7 = GetMsTicks();
-#endif
     if (vaUnmapBuffer(decoder->VaDisplay, src->buf) != VA_STATUS_SUCCESS) {
 	Error(_("video/vaapi: can't unmap image buffer\n"));
     }
 #ifdef DEBUG
-    tick8 = GetMsTicks();
-
-    Debug(4, "video/vaapi: map=%2d/%2d/%2d deint=%2d umap=%2d/%2d/%2d\n",
-	tick2 - tick1, tick3 - tick2, tick4 - tick3, tick5 - tick4,
-	tick6 - tick5, tick7 - tick6, tick8 - tick7);
+    Debug(4, "video/vaapi: map=%2d copy=%2d deint=%2d umap=%2d\n",
+	tick2 - tick1, tick3 - tick2, tick4 - tick3, GetMsTicks() - tick4);
 #endif
 }
 
@@ -5771,15 +5936,7 @@ static void VaapiCpuDerive(VaapiDecoder * decoder, VASurfaceID surface)
     tick4 = GetMsTicks();
 #endif
 
-    switch (VideoDeinterlace[decoder->Resolution]) {
-	case VideoDeinterlaceSoftBob:
-	default:
-	    VaapiBob(decoder, image, dest1, dest2);
-	    break;
-	case VideoDeinterlaceSoftSpatial:
-	    VaapiSpatial(decoder, image, dest1, dest2);
-	    break;
-    }
+    VaapiDeinterlaceImage(decoder, image, dest1, dest2);
 #ifdef DEBUG
     tick5 = GetMsTicks();
 #endif
@@ -5860,17 +6017,7 @@ static void VaapiCpuPut(VaapiDecoder * decoder, VASurfaceID surface)
     tick2 = GetMsTicks();
 #endif
 
-    // FIXME: handle top_field_first
-
-    switch (VideoDeinterlace[decoder->Resolution]) {
-	case VideoDeinterlaceSoftBob:
-	default:
-	    VaapiBob(decoder, img1, img2, img3);
-	    break;
-	case VideoDeinterlaceSoftSpatial:
-	    VaapiSpatial(decoder, img1, img2, img3);
-	    break;
-    }
+    VaapiDeinterlaceImage(decoder, img1, img2, img3);
 #ifdef DEBUG
     tick3 = GetMsTicks();
 #endif
@@ -6032,7 +6179,8 @@ static void VaapiRenderFrame(VaapiDecoder * decoder,
     } else {
 	void *va_image_data;
 	int i;
-	AVPicture picture[1];
+	uint8_t *dst[3];
+	int dst_pitch[3];
 	int width;
 	int height;
 
@@ -6087,51 +6235,39 @@ static void VaapiRenderFrame(VaapiDecoder * decoder,
 	    Error(_("video/vaapi: can't map the image!\n"));
 	}
 	// crazy: intel mixes YV12 and NV12 with mpeg
+	dst[0] = va_image_data + decoder->Image->offsets[0];
+	dst_pitch[0] = decoder->Image->pitches[0];
 	if (decoder->Image->format.fourcc == VA_FOURCC_NV12) {
-	    int x;
-
 	    // intel NV12 convert YV12 to NV12
-
-	    // copy Y
-	    for (i = 0; i < height; ++i) {
-		memcpy(va_image_data + decoder->Image->offsets[0] +
-		    decoder->Image->pitches[0] * i,
-		    frame->data[0] + frame->linesize[0] * i,
-		    frame->linesize[0]);
-	    }
-	    // copy UV
-	    for (i = 0; i < height / 2; ++i) {
-		for (x = 0; x < width / 2; ++x) {
-		    ((uint8_t *) va_image_data)[decoder->Image->offsets[1]
-			+ decoder->Image->pitches[1] * i + x * 2 + 0]
-			= frame->data[1][i * frame->linesize[1] + x];
-		    ((uint8_t *) va_image_data)[decoder->Image->offsets[1]
-			+ decoder->Image->pitches[1] * i + x * 2 + 1]
-			= frame->data[2][i * frame->linesize[2] + x];
-		}
-	    }
+	    dst[1] = va_image_data + decoder->Image->offsets[1];
+	    dst_pitch[1] = decoder->Image->pitches[1];
+	    dst[2] = NULL;
+	    dst_pitch[2] = 0;
+	    i = VideoConvertFrame(decoder->Convert, frame, video_ctx->pix_fmt,
+		width, height, 1, dst, dst_pitch);
 	    // vdpau uses this
 	} else if (decoder->Image->format.fourcc == VA_FOURCC('I', '4', '2',
 		'0')) {
-	    picture->data[0] = va_image_data + decoder->Image->offsets[0];
-	    picture->linesize[0] = decoder->Image->pitches[0];
-	    picture->data[1] = va_image_data + decoder->Image->offsets[1];
-	    picture->linesize[1] = decoder->Image->pitches[2];
-	    picture->data[2] = va_image_data + decoder->Image->offsets[2];
-	    picture->linesize[2] = decoder->Image->pitches[1];
-
-	    av_picture_copy(picture, (AVPicture *) frame, video_ctx->pix_fmt,
-		width, height);
+	    dst[1] = va_image_data + decoder->Image->offsets[1];
+	    dst_pitch[1] = decoder->Image->pitches[1];
+	    dst[2] = va_image_data + decoder->Image->offsets[2];
+	    dst_pitch[2] = decoder->Image->pitches[2];
+	    i = VideoConvertFrame(decoder->Convert, frame, video_ctx->pix_fmt,
+		width, height, 0, dst, dst_pitch);
 	} else if (decoder->Image->num_planes == 3) {
-	    picture->data[0] = va_image_data + decoder->Image->offsets[0];
-	    picture->linesize[0] = decoder->Image->pitches[0];
-	    picture->data[1] = va_image_data + decoder->Image->offsets[2];
-	    picture->linesize[1] = decoder->Image->pitches[2];
-	    picture->data[2] = va_image_data + decoder->Image->offsets[1];
-	    picture->linesize[2] = decoder->Image->pitches[1];
-
-	    av_picture_copy(picture, (AVPicture *) frame, video_ctx->pix_fmt,
-		width, height);
+	    // YV12
+	    dst[1] = va_image_data + decoder->Image->offsets[2];
+	    dst_pitch[1] = decoder->Image->pitches[2];
+	    dst[2] = va_image_data + decoder->Image->offsets[1];
+	    dst_pitch[2] = decoder->Image->pitches[1];
+	    i = VideoConvertFrame(decoder->Convert, frame, video_ctx->pix_fmt,
+		width, height, 0, dst, dst_pitch);
+	} else {
+	    i = -1;
+	}
+	if (i) {
+	    Error(_("video/vaapi: can't convert pixel format %d\n"),
+		video_ctx->pix_fmt);
 	}
 
 	if (vaUnmapBuffer(VaDisplay, decoder->Image->buf)
@@ -6216,6 +6352,8 @@ static void VaapiAdvanceDecoderFrame(VaapiDecoder * decoder)
 static void VaapiDisplayFrame(void)
 {
     struct timespec nowtime;
+    uint32_t render_start;
+    int render;
 
 #ifdef DEBUG
     uint32_t start;
@@ -6225,6 +6363,9 @@ static void VaapiDisplayFrame(void)
     int i;
     VaapiDecoder *decoder;
 
+    // render time without the vsync waits, like VdpauDisplayFrame
+    render = 0;
+    render_start = GetUsTicks();
     if (VideoSurfaceModesChanged) {	// handle changed modes
 	VideoSurfaceModesChanged = 0;
 	for (i = 0; i < VaapiDecoderN; ++i) {
@@ -6243,10 +6384,12 @@ static void VaapiDisplayFrame(void)
 #ifdef VA_EXP
 	// wait for display finished
 	if (decoder->LastSurface != VA_INVALID_ID) {
+	    render += GetUsTicks() - render_start;
 	    if (vaSyncSurface(decoder->VaDisplay, decoder->LastSurface)
 		!= VA_STATUS_SUCCESS) {
 		Error(_("video/vaapi: vaSyncSurface failed\n"));
 	    }
+	    render_start = GetUsTicks();
 	}
 #endif
 
@@ -6312,8 +6455,11 @@ static void VaapiDisplayFrame(void)
 	    } else
 #endif
 	    {
+		// put surface waits for the vsync
+		render += GetUsTicks() - render_start;
 		VaapiPutSurfaceX11(decoder, surface, decoder->Interlaced,
 		    decoder->Deinterlaced, decoder->TopFieldFirst, decoder->SurfaceField);
+		render_start = GetUsTicks();
 	    }
 #ifdef DEBUG
 	    put1 = GetMsTicks();
@@ -6380,13 +6526,20 @@ static void VaapiDisplayFrame(void)
 	    // FIXME: toggle osd
 	}
 	//glFinish();
+	render += GetUsTicks() - render_start;
 	glXSwapBuffers(XlibDisplay, VideoWindow);
+	render_start = GetUsTicks();
 
 	GlxCheck();
 	//glClearColor(1.0f, 0.0f, 0.0f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
     }
 #endif
+    // put surface or swap buffers waits for the vsync
+    render += GetUsTicks() - render_start;
+    clock_gettime(CLOCK_MONOTONIC, &nowtime);
+    VideoDisplayStats(nowtime.tv_sec * UINT64_C(1000000) +
+	nowtime.tv_nsec / 1000, render);
 }
 
 ///
@@ -6497,6 +6650,9 @@ static void VaapiSyncDecoder(VaapiDecoder * decoder)
     audio_clock = AudioGetClock();
     video_clock = VaapiGetClock(decoder);
     filled = atomic_read(&decoder->SurfacesFilled);
+    if (decoder == VaapiDecoders[0]) {	// main stream
+	StatsSample(StatsSurfaceQueue, filled);
+    }
 
     // 60Hz: repeat every 5th field
     if (Video60HzMode && !(decoder->FramesDisplayed % 6)) {
@@ -6523,7 +6679,9 @@ static void VaapiSyncDecoder(VaapiDecoder * decoder)
     }
     // at start of new video stream, soft or hard sync video to audio
     // FIXME: video waits for audio, audio for video
-    if (!VideoSoftStartSync && decoder->StartCounter < VideoSoftStartFrames
+    // early start runs video free, the audio starts at the video clock
+    if (!VideoSoftStartSync && !VideoEarlyStart
+	&& decoder->StartCounter < VideoSoftStartFrames
 	&& video_clock != (int64_t) AV_NOPTS_VALUE
 	&& (audio_clock == (int64_t) AV_NOPTS_VALUE
 	    || video_clock > audio_clock + VideoAudioDelay + 120 * 90)) {
@@ -6539,32 +6697,33 @@ static void VaapiSyncDecoder(VaapiDecoder * decoder)
 
     if (audio_clock != (int64_t) AV_NOPTS_VALUE
 	&& video_clock != (int64_t) AV_NOPTS_VALUE) {
-	// both clocks are known
-	int diff;
-
-	diff = video_clock - audio_clock - VideoAudioDelay;
-	diff = (decoder->LastAVDiff + diff) / 2;
-	decoder->LastAVDiff = diff;
-
-	if (abs(diff) > 5000 * 90) {	// more than 5s
-	    err = VaapiMessage(2, "video: audio/video difference too big\n");
-	} else if (diff > 100 * 90) {
-	    // FIXME: this quicker sync step, did not work with new code!
-	    err = VaapiMessage(2, "video: slow down video, duping frame\n");
-	    ++decoder->FramesDuped;
-	    decoder->SyncCounter = 1;
-	    goto out;
-	} else if (diff > 55 * 90) {
-	    err = VaapiMessage(2, "video: slow down video, duping frame\n");
-	    ++decoder->FramesDuped;
-	    decoder->SyncCounter = 1;
-	    goto out;
-	} else if (diff < -25 * 90 && filled > 1 + 2 * decoder->Interlaced) {
-	    err = VaapiMessage(2, "video: speed up video, droping frame\n");
-	    ++decoder->FramesDropped;
-	    VaapiAdvanceDecoderFrame(decoder);
-	    decoder->SyncCounter = 1;
+	// both clocks are known, small differences are corrected by audio
+	StatsSample(StatsAvOffset,
+	    (video_clock - audio_clock - VideoAudioDelay) / 90);
+	switch (AvSyncUpdate(decoder->Sync,
+		video_clock - audio_clock - VideoAudioDelay, video_clock,
+		filled > 1 + 2 * decoder->Interlaced)) {
+	    case AvSyncLost:		// more than 5s
+		err =
+		    VaapiMessage(2, "video: audio/video difference too big\n");
+		break;
+	    case AvSyncDup:
+		err =
+		    VaapiMessage(2, "video: slow down video, duping frame\n");
+		++decoder->FramesDuped;
+		decoder->SyncCounter = 1;
+		goto out;
+	    case AvSyncDrop:
+		err =
+		    VaapiMessage(2, "video: speed up video, droping frame\n");
+		++decoder->FramesDropped;
+		VaapiAdvanceDecoderFrame(decoder);
+		decoder->SyncCounter = 1;
+		break;
+	    default:
+		break;
 	}
+	decoder->LastAVDiff = AvSyncGetDiff(decoder->Sync);
 #if defined(DEBUG) || defined(AV_INFO)
 	if (!decoder->SyncCounter && decoder->StartCounter < 1000) {
 #ifdef DEBUG
@@ -6818,8 +6977,11 @@ static void VaapiDisplayHandlerThread(void)
     pthread_mutex_unlock(&VideoLockMutex);
 
     if (!decoded) {			// nothing decoded, sleep
-	// FIXME: sleep on wakeup
-	usleep(1 * 1000);
+	static unsigned serial;
+
+	// until new input or the next frame must be displayed
+	VideoThreadWait(VaapiDecoderN ? &VaapiDecoders[0]->FrameTime : NULL,
+	    75, &serial);
     }
     // all decoder buffers are full
     // speed up filling display queue, wait on display queue empty
@@ -6829,7 +6991,7 @@ static void VaapiDisplayHandlerThread(void)
 	if ((nowtime.tv_sec -
 		VaapiDecoders[0]->FrameTime.tv_sec) * 1000 * 1000 * 1000 +
 	    (nowtime.tv_nsec - VaapiDecoders[0]->FrameTime.tv_nsec) <
-	    15 * 1000 * 1000) {
+	    VideoFramePart(75)) {
 	    return;
 	}
     }
@@ -7107,7 +7269,7 @@ static const VideoModule VaapiModule = {
     .Name = "va-api",
     .Enabled = 1,
     .NewHwDecoder =
-	(VideoHwDecoder * (*const)(VideoStream *)) VaapiNewHwDecoder,
+	(VideoHwDecoder * (*const)(VideoStream *, int))VaapiNewHwDecoder,
     .DelHwDecoder = (void (*const) (VideoHwDecoder *))VaapiDelHwDecoder,
     .GetSurface = (unsigned (*const) (VideoHwDecoder *,
 	    const AVCodecContext *))VaapiGetSurface,
@@ -7149,7 +7311,7 @@ static const VideoModule VaapiGlxModule = {
     .Name = "va-api-glx",
     .Enabled = 1,
     .NewHwDecoder =
-	(VideoHwDecoder * (*const)(VideoStream *)) VaapiNewHwDecoder,
+	(VideoHwDecoder * (*const)(VideoStream *, int))VaapiNewHwDecoder,
     .DelHwDecoder = (void (*const) (VideoHwDecoder *))VaapiDelHwDecoder,
     .GetSurface = (unsigned (*const) (VideoHwDecoder *,
 	    const AVCodecContext *))VaapiGetSurface,
@@ -7212,6 +7374,8 @@ typedef struct _vdpau_decoder_
     int OutputHeight;			///< real video output height
 
     enum AVPixelFormat PixFmt;		///< ffmpeg frame pixfmt
+    VideoConvert Convert[1];		///< software frame conversion
+    Deint *SoftDeint;			///< software deinterlacer
     int WrongInterlacedWarned;		///< warning about interlace flag issued
     int Interlaced;			///< ffmpeg interlaced flag
     int TopFieldFirst;			///< ffmpeg top field displayed first
@@ -7266,6 +7430,7 @@ typedef struct _vdpau_decoder_
     int64_t PTS;			///< video PTS clock
 
     int LastAVDiff;			///< last audio - video difference
+    AvSync *Sync;			///< audio/video sync
     int SyncCounter;			///< counter to sync frames
     int StartCounter;			///< counter for video start
     int FramesDuped;			///< number of frames duplicated
@@ -7881,10 +8046,11 @@ static void VdpauMixerCreate(VdpauDecoder * decoder)
 ///	Allocate new VDPAU decoder.
 ///
 ///	@param stream	video stream
+///	@param pip	flag stream is picture in picture
 ///
 ///	@returns a new prepared vdpau hardware decoder.
 ///
-static VdpauDecoder *VdpauNewHwDecoder(VideoStream * stream)
+static VdpauDecoder *VdpauNewHwDecoder(VideoStream * stream, int pip)
 {
     VdpauDecoder *decoder;
     int i;
@@ -7899,6 +8065,10 @@ static VdpauDecoder *VdpauNewHwDecoder(VideoStream * stream)
 	Error(_("video/vdpau: out of memory\n"));
 	return NULL;
     }
+    if (!(decoder->Sync = AvSyncNew(pip ? AvSyncPip : AvSyncMain))) {
+	free(decoder);
+	return NULL;
+    }
     decoder->Device = VdpauDevice;
     decoder->Window = VideoWindow;
     //decoder->VideoX = 0;		// done by calloc
@@ -8013,6 +8183,10 @@ static void VdpauCleanup(VdpauDecoder * decoder)
     decoder->Closing = 0;
     decoder->PTS = AV_NOPTS_VALUE;
     VideoDeltaPTS = 0;
+    AvSyncReset(decoder->Sync);
+    if (decoder->SoftDeint) {
+	DeintReset(decoder->SoftDeint);
+    }
 }
 
 ///
@@ -8034,6 +8208,9 @@ static void VdpauDelHwDecoder(VdpauDecoder * decoder)
 
 	    VdpauCleanup(decoder);
 	    VdpauPrintFrames(decoder);
+	    VideoConvertExit(decoder->Convert);
+	    DeintDel(decoder->SoftDeint);
+	    AvSyncDel(decoder->Sync);
 #ifdef USE_AUTOCROP
 	    free(decoder->AutoCropBuffer);
 #endif
@@ -9682,6 +9859,115 @@ static void VdpauQueueSurface(VdpauDecoder * decoder, VdpVideoSurface surface,
     atomic_inc(&decoder->SurfacesFilled);
 }
 
+///
+///	Software deinterlace a frame and queue both fields.
+///
+///	The interlaced frame must be in the buffer of the software
+///	deinterlacer.  Each field is queued as progressive surface.
+///
+///	@param decoder	VDPAU hw decoder
+///	@param width	frame width
+///	@param height	frame height
+///
+static void VdpauCpuDeinterlace(VdpauDecoder * decoder, int width,
+    int height)
+{
+    uint8_t *planes[3];
+    int linesize[3];
+    uint8_t *fields[2][3];
+    int field_height;
+    int i;
+
+    // both progressive frames in the pooled buffer, one after the other
+    field_height = (height + 1) & ~1;
+    VideoConvertGetBuffer(decoder->Convert, width, 2 * field_height, planes,
+	linesize);
+    for (i = 0; i < 2; ++i) {
+	fields[i][0] = planes[0] + i * linesize[0] * field_height;
+	fields[i][1] = planes[1] + i * linesize[1] * (field_height / 2);
+	fields[i][2] = planes[2] + i * linesize[2] * (field_height / 2);
+    }
+
+    DeintFrame(decoder->SoftDeint, VideoGetSoftDeintMode(decoder->Resolution),
+	decoder->TopFieldFirst, VideoSkipChromaDeinterlace[decoder->Resolution],
+	fields[0], linesize, fields[1], linesize);
+
+    for (i = 0; i < 2; ++i) {
+	VdpStatus status;
+	VdpVideoSurface surface;
+	void const *data[3];
+	uint32_t pitches[3];
+
+	surface = VdpauGetSurface0(decoder);
+	if (surface == VDP_INVALID_HANDLE) {
+	    return;
+	}
+	// convert ffmpeg order to vdpau
+	data[0] = fields[i][0];
+	data[1] = fields[i][2];
+	data[2] = fields[i][1];
+	pitches[0] = linesize[0];
+	pitches[1] = linesize[2];
+	pitches[2] = linesize[1];
+	status =
+	    VdpauVideoSurfacePutBitsYCbCr(surface, VDP_YCBCR_FORMAT_YV12, data,
+	    pitches);
+	if (status != VDP_STATUS_OK) {
+	    Error(_("video/vdpau: can't put video surface bits: %s\n"),
+		VdpauGetErrorString(status));
+	}
+	VdpauQueueSurface(decoder, surface, 1);
+    }
+}
+
+///
+///	Software deinterlace a hardware decoded surface.
+///
+///	@param decoder	VDPAU hw decoder
+///	@param surface	interlaced hardware surface
+///
+static void VdpauCpuDeinterlaceSurface(VdpauDecoder * decoder,
+    VdpVideoSurface surface)
+{
+    VdpStatus status;
+    VdpChromaType chroma_type;
+    uint32_t width;
+    uint32_t height;
+    uint8_t *planes[3];
+    int linesize[3];
+    void *data[3];
+    uint32_t pitches[3];
+
+    status =
+	VdpauVideoSurfaceGetParameters(surface, &chroma_type, &width, &height);
+    if (status != VDP_STATUS_OK || chroma_type != VDP_CHROMA_TYPE_420) {
+	// show it as it is
+	VdpauQueueSurface(decoder, surface, 0);
+	return;
+    }
+    if (!decoder->SoftDeint && !(decoder->SoftDeint = DeintNew())) {
+	Fatal(_("video/vdpau: out of memory\n"));
+    }
+    DeintGetBuffer(decoder->SoftDeint, width, height, 0, planes, linesize);
+    // convert ffmpeg order to vdpau
+    data[0] = planes[0];
+    data[1] = planes[2];
+    data[2] = planes[1];
+    pitches[0] = linesize[0];
+    pitches[1] = linesize[2];
+    pitches[2] = linesize[1];
+    status =
+	VdpauVideoSurfaceGetBitsYCbCr(surface, VDP_YCBCR_FORMAT_YV12, data,
+	pitches);
+    if (status != VDP_STATUS_OK) {
+	Error(_("video/vdpau: can't get video surface bits: %s\n"),
+	    VdpauGetErrorString(status));
+	VdpauQueueSurface(decoder, surface, 0);
+	return;
+    }
+    VdpauCpuDeinterlace(decoder, width, height);
+}
+
 ///
 ///	Render a ffmpeg frame.
 ///
@@ -9695,6 +9981,7 @@ static void VdpauRenderFrame(VdpauDecoder * decoder,
     VdpStatus status;
     VdpVideoSurface surface;
     int interlaced;
+    int soft_deint;
 
     // FIXME: some tv-stations toggle interlace on/off
     // frame->interlaced_frame isn't always correct set
@@ -9714,6 +10001,12 @@ static void VdpauRenderFrame(VdpauDecoder * decoder,
 	interlaced = 1;
     }
 #endif
+    // software deinterlace queues both fields as progressive frames
+    soft_deint = interlaced
+	&& VideoDeinterlace[decoder->Resolution] >= VideoDeinterlaceSoftBob;
+    if (soft_deint) {
+	interlaced = 0;
+    }
 
     // FIXME: should be done by init video_ctx->field_order
     if (decoder->Interlaced != interlaced
@@ -9764,12 +10057,8 @@ static void VdpauRenderFrame(VdpauDecoder * decoder,
 	    Debug(4, "video/vdpau: hw render hw surface from frame %#08x from buf%#08x\n", surface, vrs->surface);
 	}
 
-	if (interlaced
-	    && VideoDeinterlace[decoder->Resolution] >=
-	    VideoDeinterlaceSoftBob) {
-	    // FIXME: software deinterlace avpicture_deinterlace
-	    // FIXME: VdpauCpuDeinterlace(decoder, surface);
-	    VdpauQueueSurface(decoder, surface, 0);
+	if (soft_deint) {
+	    VdpauCpuDeinterlaceSurface(decoder, surface);
 	} else {
 	    VdpauQueueSurface(decoder, surface, 0);
 	}
@@ -9797,68 +10086,78 @@ static void VdpauRenderFrame(VdpauDecoder * decoder,
 	    VdpauSetupOutput(decoder);
 	}
 	//
-	//	Copy data from frame to image
+	//	Software deinterlace
 	//
-	switch (video_ctx->pix_fmt) {
-	    case AV_PIX_FMT_YUV420P:
-	    case AV_PIX_FMT_YUVJ420P:	// some streams produce this
-	    case AV_PIX_FMT_YUV420P10LE:  // for softdecode of HEVC 10 Bit
-		break;
-	    case AV_PIX_FMT_YUV422P:
-	    case AV_PIX_FMT_YUV444P:
-	    default:
-		Fatal(_("video/vdpau: pixel format %d not supported\n"),
-		    video_ctx->pix_fmt);
-		// FIXME: no fatals!
-	}
-
-	// convert ffmpeg order to vdpau
-	data[0] = frame->data[0];
-	data[1] = frame->data[2];
-	data[2] = frame->data[1];
-	pitches[0] = frame->linesize[0];
-	pitches[1] = frame->linesize[2];
-	pitches[2] = frame->linesize[1];
+	if (soft_deint) {
+	    uint8_t *planes[3];
+	    int linesize[3];
 
-#ifdef USE_SWSCALE
-	// Convert the image into YUV420 format
-	if (video_ctx->pix_fmt == AV_PIX_FMT_YUV420P10LE) {
-	    struct SwsContext *img_convert_ctx;
-	    int w = video_ctx->width;
-	    int h = video_ctx->height;
-	    data[1] = frame->data[1];
-	    data[2] = frame->data[2];
-	    img_convert_ctx = sws_getContext(w, h,
-		video_ctx->pix_fmt,
-		w, h,  AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR,
-		NULL, NULL, NULL);
-	    if (img_convert_ctx == NULL) {
-		Fatal(_("Cannot initialize the conversion context!\n"));
-		exit(1);
+	    if (!decoder->SoftDeint
+		&& !(decoder->SoftDeint = DeintNew())) {
+		Fatal(_("video/vdpau: out of memory\n"));
+	    }
+	    DeintGetBuffer(decoder->SoftDeint, video_ctx->width,
+		video_ctx->height, 0, planes, linesize);
+	    if (VideoConvertFrame(decoder->Convert, frame, video_ctx->pix_fmt,
+		    video_ctx->width, video_ctx->height, 0, planes,
+		    linesize)) {
+		Error(_("video/vdpau: pixel format %d not supported\n"),
+		    video_ctx->pix_fmt);
+		return;
 	    }
-	    sws_scale(img_convert_ctx, frame->data,
-		frame->linesize, 0,
-		h,
+	    VdpauCpuDeinterlace(decoder, video_ctx->width, video_ctx->height);
+	} else {
+	    //
+	    //	Copy data from frame to image
+	    //
+	    if (video_ctx->pix_fmt == AV_PIX_FMT_YUV420P
+		|| video_ctx->pix_fmt == AV_PIX_FMT_YUVJ420P) {
+		// convert ffmpeg order to vdpau
+		data[0] = frame->data[0];
+		data[1] = frame->data[2];
+		data[2] = frame->data[1];
+		pitches[0] = frame->linesize[0];
+		pitches[1] = frame->linesize[2];
+		pitches[2] = frame->linesize[1];
+	    } else {
+		uint8_t *planes[3];
+		int linesize[3];
+
+		// frame data is read-only, convert into pooled buffer
+		VideoConvertGetBuffer(decoder->Convert, video_ctx->width,
+		    video_ctx->height, planes, linesize);
+		if (VideoConvertFrame(decoder->Convert, frame,
+			video_ctx->pix_fmt, video_ctx->width,
+			video_ctx->height, 0, planes, linesize)) {
+		    Error(_("video/vdpau: pixel format %d not supported\n"),
+			video_ctx->pix_fmt);
+		    return;
+		}
+		data[0] = planes[0];
+		data[1] = planes[2];
+		data[2] = planes[1];
+		pitches[0] = linesize[0];
+		pitches[1] = linesize[2];
+		pitches[2] = linesize[1];
+	    }
+
+	    surface = VdpauGetSurface0(decoder);
+	    status =
+		VdpauVideoSurfacePutBitsYCbCr(surface, VDP_YCBCR_FORMAT_YV12,
 		data, pitches);
-	    data[1] = frame->data[2];
-	    data[2] = frame->data[1];
-	}
-#endif
-	surface = VdpauGetSurface0(decoder);
-	status =
-	    VdpauVideoSurfacePutBitsYCbCr(surface, VDP_YCBCR_FORMAT_YV12, data,
-	    pitches);
-	if (status != VDP_STATUS_OK) {
-	    Error(_("video/vdpau: can't put video surface bits: %s\n"),
-		VdpauGetErrorString(status));
-	}
+	    if (status != VDP_STATUS_OK) {
+		Error(_("video/vdpau: can't put video surface bits: %s\n"),
+		    VdpauGetErrorString(status));
+	    }
 
-	Debug(4, "video/vdpau: sw render hw surface %#08x\n", surface);
+	    Debug(4, "video/vdpau: sw render hw surface %#08x\n", surface);
 
-	VdpauQueueSurface(decoder, surface, 1);
+	    VdpauQueueSurface(decoder, surface, 1);
+	}
     }
 
-    if (frame->interlaced_frame) {
+    // software deinterlace has queued both fields
+    if (frame->interlaced_frame && !soft_deint) {
 	++decoder->FrameCounter;
     }
 }
@@ -10270,6 +10569,7 @@ static void VdpauDisplayFrame(void)
     VdpStatus status;
     VdpTime first_time;
     static VdpTime last_time;
+    uint32_t render_start;
     int i;
 
     if (VideoSurfaceModesChanged) {	// handle changed modes
@@ -10312,6 +10612,7 @@ static void VdpauDisplayFrame(void)
 	Error(_("video/vdpau: can't block queue: %s\n"),
 	    VdpauGetErrorString(status));
     }
+    render_start = GetUsTicks();
     // check if surface was displayed for more than 1 frame
     // FIXME: 21 only correct for 50Hz
     if (last_time && first_time > last_time + 21 * 1000 * 1000) {
@@ -10393,6 +10694,8 @@ static void VdpauDisplayFrame(void)
     VdpauSurfaceIndex = (VdpauSurfaceIndex + 1) % OUTPUT_SURFACES_MAX;
 
     xcb_flush(Connection);
+    // first_time: when the last surface of this slot was shown
+    VideoDisplayStats(first_time / 1000, GetUsTicks() - render_start);
 }
 
 ///
@@ -10512,6 +10815,9 @@ static void VdpauSyncDecoder(VdpauDecoder * decoder)
     err = 0;
     video_clock = VdpauGetClock(decoder);
     filled = atomic_read(&decoder->SurfacesFilled);
+    if (decoder == VdpauDecoders[0]) {	// main stream
+	StatsSample(StatsSurfaceQueue, filled);
+    }
 
     if (!decoder->SyncOnAudio) {
 	audio_clock = AV_NOPTS_VALUE;
@@ -10544,7 +10850,9 @@ static void VdpauSyncDecoder(VdpauDecoder * decoder)
 	goto skip_sync;
     }
     // at start of new video stream, soft or hard sync video to audio
-    if (!VideoSoftStartSync && decoder->StartCounter < VideoSoftStartFrames
+    // early start runs video free, the audio starts at the video clock
+    if (!VideoSoftStartSync && !VideoEarlyStart
+	&& decoder->StartCounter < VideoSoftStartFrames
 	&& video_clock != (int64_t) AV_NOPTS_VALUE
 	&& (audio_clock == (int64_t) AV_NOPTS_VALUE
 	    || video_clock > audio_clock + VideoAudioDelay + 120 * 90)) {
@@ -10560,32 +10868,33 @@ static void VdpauSyncDecoder(VdpauDecoder * decoder)
 
     if (audio_clock != (int64_t) AV_NOPTS_VALUE
 	&& video_clock != (int64_t) AV_NOPTS_VALUE) {
-	// both clocks are known
-	int diff;
-
-	diff = video_clock - audio_clock - VideoAudioDelay;
-	diff = (decoder->LastAVDiff + diff) / 2;
-	decoder->LastAVDiff = diff;
-
-	if (abs(diff) > 5000 * 90) {	// more than 5s
-	    err = VdpauMessage(2, "video: audio/video difference too big\n");
-	} else if (diff > 100 * 90) {
-	    // FIXME: this quicker sync step, did not work with new code!
-	    err = VdpauMessage(2, "video: slow down video, duping frame\n");
-	    ++decoder->FramesDuped;
-	    decoder->SyncCounter = 1;
-	    goto out;
-	} else if (diff > 55 * 90) {
-	    err = VdpauMessage(2, "video: slow down video, duping frame\n");
-	    ++decoder->FramesDuped;
-	    decoder->SyncCounter = 1;
-	    goto out;
-	} else if (diff < -25 * 90 && filled > 1 + 2 * decoder->Interlaced) {
-	    err = VdpauMessage(2, "video: speed up video, droping frame\n");
-	    ++decoder->FramesDropped;
-	    VdpauAdvanceDecoderFrame(decoder);
-	    decoder->SyncCounter = 1;
+	// both clocks are known, small differences are corrected by audio
+	StatsSample(StatsAvOffset,
+	    (video_clock - audio_clock - VideoAudioDelay) / 90);
+	switch (AvSyncUpdate(decoder->Sync,
+		video_clock - audio_clock - VideoAudioDelay, video_clock,
+		filled > 1 + 2 * decoder->Interlaced)) {
+	    case AvSyncLost:		// more than 5s
+		err =
+		    VdpauMessage(2, "video: audio/video difference too big\n");
+		break;
+	    case AvSyncDup:
+		err =
+		    VdpauMessage(2, "video: slow down video, duping frame\n");
+		++decoder->FramesDuped;
+		decoder->SyncCounter = 1;
+		goto out;
+	    case AvSyncDrop:
+		err =
+		    VdpauMessage(2, "video: speed up video, droping frame\n");
+		++decoder->FramesDropped;
+		VdpauAdvanceDecoderFrame(decoder);
+		decoder->SyncCounter = 1;
+		break;
+	    default:
+		break;
 	}
+	decoder->LastAVDiff = AvSyncGetDiff(decoder->Sync);
 #if defined(DEBUG) || defined(AV_INFO)
 	if (!decoder->SyncCounter && decoder->StartCounter < 1000) {
 #ifdef DEBUG
@@ -10846,57 +11155,92 @@ static void VdpauSetVideoMode(void)
 #ifdef USE_VIDEO_THREAD
 
 ///
-///	Handle a VDPAU display.
+///	Decode video of a VDPAU stream.
 ///
-static void VdpauDisplayHandlerThread(void)
+///	Called from the decoder thread of the stream.  The video lock is
+///	only held to lookup the hw decoder, the decode itself locks only
+///	the calls into the video module (surfaces, render frame).
+///
+///	@param stream	video stream
+///
+///	@retval 1	frame decoded
+///	@retval 0	nothing decoded
+///
+static int VdpauDecodeHandler(VideoStream * stream)
 {
     int i;
     int err;
-    int allfull;
-    int decoded;
-    struct timespec nowtime;
+    int full;
     VdpauDecoder *decoder;
 
-    allfull = 1;
-    decoded = 0;
+    full = 0;
+    decoder = NULL;
     pthread_mutex_lock(&VideoLockMutex);
     for (i = 0; i < VdpauDecoderN; ++i) {
-	int filled;
-
-	decoder = VdpauDecoders[i];
-
-	//
-	// fill frame output ring buffer
-	//
-	filled = atomic_read(&decoder->SurfacesFilled);
-	if (filled <= 1 + 2 * decoder->Interlaced) {
-	    // FIXME: hot polling
-	    // fetch+decode or reopen
-	    allfull = 0;
-	    err = VideoDecodeInput(decoder->Stream);
-	} else {
-	    err = VideoPollInput(decoder->Stream);
+	if (VdpauDecoders[i]->Stream == stream) {
+	    decoder = VdpauDecoders[i];
+	    full = atomic_read(&decoder->SurfacesFilled) >
+		1 + 2 * decoder->Interlaced;
+	    break;
 	}
-	// decoder can be invalid here
-	if (err) {
-	    // nothing buffered?
-	    if (err == -1 && decoder->Closing) {
-		decoder->Closing--;
-		if (!decoder->Closing) {
-		    Debug(3, "video/vdpau: closing eof\n");
-		    decoder->Closing = -1;
-		}
+    }
+    pthread_mutex_unlock(&VideoLockMutex);
+    if (!decoder) {			// stream not open
+	return 0;
+    }
+    //
+    // fill frame output ring buffer
+    //
+    if (!full) {
+	// fetch+decode or reopen
+	err = VideoDecodeInput(stream);
+    } else {
+	err = VideoPollInput(stream);
+    }
+    // decoder can be invalid here, only deleted by close with err = 1
+    if (err) {
+	// nothing buffered?
+	if (err == -1 && decoder->Closing) {
+	    pthread_mutex_lock(&VideoLockMutex);
+	    decoder->Closing--;
+	    if (!decoder->Closing) {
+		Debug(3, "video/vdpau: closing eof\n");
+		decoder->Closing = -1;
 	    }
-	    continue;
+	    pthread_mutex_unlock(&VideoLockMutex);
 	}
-	decoded = 1;
+	return 0;
     }
-    pthread_mutex_unlock(&VideoLockMutex);
+    return 1;
+}
 
-    if (!decoded) {			// nothing decoded, sleep
-	// FIXME: sleep on wakeup
-	usleep(1 * 1000);
+///
+///	Handle a VDPAU display.
+///
+///	Only sync and presentation is done here, the streams are decoded
+///	by their own decoder threads.
+///
+static void VdpauDisplayHandlerThread(void)
+{
+    static unsigned serial;
+    int i;
+    int allfull;
+    struct timespec nowtime;
+    VdpauDecoder *decoder;
+
+    allfull = VdpauDecoderN > 0;
+    pthread_mutex_lock(&VideoLockMutex);
+    for (i = 0; i < VdpauDecoderN; ++i) {
+	decoder = VdpauDecoders[i];
+
+	VideoDecoderThreadStart(decoder->Stream);
+	if (atomic_read(&decoder->SurfacesFilled) <=
+	    1 + 2 * decoder->Interlaced) {
+	    allfull = 0;
+	}
     }
+    pthread_mutex_unlock(&VideoLockMutex);
+
     // all decoder buffers are full
     // and display is not preempted
     // speed up filling display queue, wait on display queue empty
@@ -10904,7 +11248,8 @@ static void VdpauDisplayHandlerThread(void)
 	clock_gettime(CLOCK_MONOTONIC, &nowtime);
 	// time for one frame over?
 	if ((nowtime.tv_sec - VdpauFrameTime.tv_sec) * 1000 * 1000 * 1000 +
-	    (nowtime.tv_nsec - VdpauFrameTime.tv_nsec) < 15 * 1000 * 1000) {
+	    (nowtime.tv_nsec - VdpauFrameTime.tv_nsec) < VideoFramePart(75)) {
+	    VideoThreadWait(&VdpauFrameTime, 75, &serial);
 	    return;
 	}
     }
@@ -10919,11 +11264,14 @@ static void VdpauDisplayHandlerThread(void)
     pthread_mutex_lock(&VideoLockMutex);
     VdpauSyncDisplayFrame();
     pthread_mutex_unlock(&VideoLockMutex);
+
+    VideoThreadWakeup();		// surface displayed, wakeup decoders
 }
 
 #else
 
 #define VdpauDisplayHandlerThread	NULL
+#define VdpauDecodeHandler	NULL
 
 #endif
 
@@ -10957,19 +11305,40 @@ static void VdpauSetOutputPosition(VdpauDecoder * decoder, int x, int y,
 //	VDPAU OSD
 //----------------------------------------------------------------------------
 
-static const uint8_t OsdZeros[4096 * 2160 * 4];	///< 0 for clear osd
+#ifdef USE_BITMAP
+
+#define VDPAU_OSD_ZERO_WIDTH 4096	///< width of osd zero tile
+#define VDPAU_OSD_ZERO_ROWS 16		///< rows of osd zero tile
+
+    /// zero tile, source for clearing the osd bitmap surface
+static const uint8_t VdpauOsdZeros[VDPAU_OSD_ZERO_WIDTH
+    * VDPAU_OSD_ZERO_ROWS * 4];
+
+#endif
 
 ///
 ///	Clear subpicture image.
 ///
+///	Only the dirty area is cleared.  The output surface is cleared with
+///	a render, which zeros the destination without uploading any data.
+///	The bitmap surface can't be rendered to, it is cleared with a small
+///	zero tile uploaded in bands.
+///
 ///	@note looked by caller
 ///
 static void VdpauOsdClear(void)
 {
     VdpStatus status;
+    VdpRect dst_rect;
+
+#ifdef USE_BITMAP
     void const *data[1];
     uint32_t pitches[1];
-    VdpRect dst_rect;
+    int y;
+    int x;
+#else
+    VdpOutputSurfaceRenderBlendState blend_state;
+#endif
 
     if (VdpauPreemption) {		// display preempted
 	return;
@@ -10985,10 +11354,6 @@ static void VdpauOsdClear(void)
     }
 #endif
 
-    if (OsdWidth * OsdHeight > 4096 * 2160) {
-	Error(_("video/vdpau: osd too big: unsupported\n"));
-	return;
-    }
     // have dirty area.
     if (OsdDirtyWidth && OsdDirtyHeight) {
 	Debug(3, "video/vdpau: osd clear dirty %dx%d%+d%+d\n", OsdDirtyWidth,
@@ -11004,23 +11369,65 @@ static void VdpauOsdClear(void)
 	dst_rect.x1 = dst_rect.x0 + OsdWidth;
 	dst_rect.y1 = dst_rect.y0 + OsdHeight;
     }
-    data[0] = OsdZeros;
-    pitches[0] = OsdWidth * 4;
 
 #ifdef USE_BITMAP
-    status =
-	VdpauBitmapSurfacePutBitsNative(VdpauOsdBitmapSurface
-	[VdpauOsdSurfaceIndex], data, pitches, &dst_rect);
-    if (status != VDP_STATUS_OK) {
-	Error(_("video/vdpau: bitmap surface put bits failed: %s\n"),
-	    VdpauGetErrorString(status));
+    data[0] = VdpauOsdZeros;
+    pitches[0] = VDPAU_OSD_ZERO_WIDTH * 4;
+
+    for (y = dst_rect.y0; y < (int)dst_rect.y1; y += VDPAU_OSD_ZERO_ROWS) {
+	for (x = dst_rect.x0; x < (int)dst_rect.x1;
+	    x += VDPAU_OSD_ZERO_WIDTH) {
+	    VdpRect rect;
+
+	    rect.x0 = x;
+	    rect.y0 = y;
+	    rect.x1 = x + VDPAU_OSD_ZERO_WIDTH;
+	    if (rect.x1 > dst_rect.x1) {
+		rect.x1 = dst_rect.x1;
+	    }
+	    rect.y1 = y + VDPAU_OSD_ZERO_ROWS;
+	    if (rect.y1 > dst_rect.y1) {
+		rect.y1 = dst_rect.y1;
+	    }
+	    status =
+		VdpauBitmapSurfacePutBitsNative(VdpauOsdBitmapSurface
+		[VdpauOsdSurfaceIndex], data, pitches, &rect);
+	    if (status != VDP_STATUS_OK) {
+		Error(_("video/vdpau: bitmap surface put bits failed: %s\n"),
+		    VdpauGetErrorString(status));
+		return;
+	    }
+	}
     }
 #else
+    //
+    //	without source surface, source is opaque white.  Zero factors
+    //	for source and destination write transparent black.
+    //
+    blend_state.struct_version = VDP_OUTPUT_SURFACE_RENDER_BLEND_STATE_VERSION;
+    blend_state.blend_factor_source_color =
+	VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ZERO;
+    blend_state.blend_factor_source_alpha =
+	VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ZERO;
+    blend_state.blend_factor_destination_color =
+	VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ZERO;
+    blend_state.blend_factor_destination_alpha =
+	VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ZERO;
+    blend_state.blend_equation_color =
+	VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_ADD;
+    blend_state.blend_equation_alpha =
+	VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_ADD;
+    blend_state.blend_constant.red = 0.0;
+    blend_state.blend_constant.green = 0.0;
+    blend_state.blend_constant.blue = 0.0;
+    blend_state.blend_constant.alpha = 0.0;
+
     status =
-	VdpauOutputSurfacePutBitsNative(VdpauOsdOutputSurface
-	[VdpauOsdSurfaceIndex], data, pitches, &dst_rect);
+	VdpauOutputSurfaceRenderOutputSurface(VdpauOsdOutputSurface
+	[VdpauOsdSurfaceIndex], &dst_rect, VDP_INVALID_HANDLE, NULL, NULL,
+	&blend_state, VDP_OUTPUT_SURFACE_RENDER_ROTATE_0);
     if (status != VDP_STATUS_OK) {
-	Error(_("video/vdpau: output surface put bits failed: %s\n"),
+	Error(_("video/vdpau: can't clear output surface: %s\n"),
 	    VdpauGetErrorString(status));
     }
 #endif
@@ -11201,7 +11608,7 @@ static const VideoModule VdpauModule = {
     .Name = "vdpau",
     .Enabled = 1,
     .NewHwDecoder =
-	(VideoHwDecoder * (*const)(VideoStream *)) VdpauNewHwDecoder,
+	(VideoHwDecoder * (*const)(VideoStream *, int))VdpauNewHwDecoder,
     .DelHwDecoder = (void (*const) (VideoHwDecoder *))VdpauDelHwDecoder,
     .GetSurface = (unsigned (*const) (VideoHwDecoder *,
 	    const AVCodecContext *))VdpauGetSurface,
@@ -11226,6 +11633,7 @@ static const VideoModule VdpauModule = {
     .SetVideoMode = VdpauSetVideoMode,
     .ResetAutoCrop = VdpauResetAutoCrop,
     .DisplayHandlerThread = VdpauDisplayHandlerThread,
+    .DecodeHandler = VdpauDecodeHandler,
     .OsdClear = VdpauOsdClear,
     .OsdDrawARGB = VdpauOsdDrawARGB,
     .OsdInit = VdpauOsdInit,
@@ -11244,11 +11652,13 @@ static const VideoModule VdpauModule = {
 ///	Allocate new noop decoder.
 ///
 ///	@param stream	video stream
+///	@param pip	flag stream is picture in picture
 ///
 ///	@returns always NULL.
 ///
 static VideoHwDecoder *NoopNewHwDecoder(
-    __attribute__ ((unused)) VideoStream * stream)
+    __attribute__ ((unused)) VideoStream * stream,
+    __attribute__ ((unused)) int pip)
 {
     return NULL;
 }
@@ -11422,6 +11832,7 @@ void VideoOsdClear(void)
     OsdDirtyWidth = 0;
     OsdDirtyHeight = 0;
     OsdShown = 0;
+    ++OsdGeneration;			// cached copies of the osd are invalid
 
     VideoThreadUnlock();
 }
@@ -11486,6 +11897,18 @@ void VideoGetOsdSize(int *width, int *height)
     }
 }
 
+///
+///	Get OSD generation.
+///
+///	Changes each time the OSD surface is cleared or created.
+///
+///	@returns OSD surface generation counter.
+///
+unsigned VideoOsdGetGeneration(void)
+{
+    return OsdGeneration;
+}
+
 ///	Set OSD Size.
 ///
 ///	@param width	OSD width
@@ -11529,6 +11952,7 @@ void VideoOsdInit(void)
 
     VideoThreadLock();
     VideoUsedModule->OsdInit(OsdWidth, OsdHeight);
+    ++OsdGeneration;			// new surface
     VideoThreadUnlock();
     VideoOsdClear();
 }
@@ -11568,6 +11992,7 @@ static int VideoIOErrorHandler( __attribute__ ((unused)) Display * display)
 	XlibDisplay = NULL;
 	VideoWindow = XCB_NONE;
 #ifdef USE_VIDEO_THREAD
+	VideoDecoderThreadExit();
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	pthread_cond_destroy(&VideoWakeupCond);
 	pthread_mutex_destroy(&VideoLockMutex);
@@ -11712,131 +12137,1134 @@ void VideoPollEvent(void)
     }
 }
 
-//----------------------------------------------------------------------------
-//	Thread
-//----------------------------------------------------------------------------
-
-#ifdef USE_VIDEO_THREAD
-
+//----------------------------------------------------------------------------
+//	Thread
+//----------------------------------------------------------------------------
+
+#ifdef USE_VIDEO_THREAD
+
+///
+///	Lock video thread.
+///
+static void VideoThreadLock(void)
+{
+    if (VideoThread) {
+	if (pthread_mutex_lock(&VideoLockMutex)) {
+	    Error(_("video: can't lock thread\n"));
+	}
+    }
+}
+
+///
+///	Unlock video thread.
+///
+static void VideoThreadUnlock(void)
+{
+    if (VideoThread) {
+	if (pthread_mutex_unlock(&VideoLockMutex)) {
+	    Error(_("video: can't unlock thread\n"));
+	}
+    }
+}
+
+///
+///	Wait for video thread wakeup or timeout.
+///
+///	Called by the display handler and the decoder threads, when there
+///	is nothing to do.  Producers wakeup the threads with
+///	VideoDisplayWakeup, the display handler wakes the decoders after
+///	a surface is displayed.
+///
+///	The timeout is a part of the display frame interval after the
+///	last displayed frame, but at least #VIDEO_MIN_WAIT ms.  A frame
+///	time in the past (pause, radio, still picture) doesn't spin.
+///
+///	@param frame_time	time of last displayed frame (CLOCK_MONOTONIC),
+///				NULL for now
+///	@param part		maximal wait after frame_time in percent of
+///				the frame interval
+///	@param[in,out] serial	last wakeup seen by calling thread
+///
+static void VideoThreadWait(const struct timespec *frame_time, int part,
+    unsigned *serial)
+{
+    struct timespec abstime;
+    int64_t wait;
+
+    wait = VideoFramePart(part);
+    clock_gettime(CLOCK_MONOTONIC, &abstime);
+    if (frame_time) {			// time already gone since frame
+	wait -= (abstime.tv_sec - frame_time->tv_sec) * INT64_C(1000000000)
+	    + abstime.tv_nsec - frame_time->tv_nsec;
+    }
+    if (wait < VIDEO_MIN_WAIT * 1000 * 1000) {
+	wait = VIDEO_MIN_WAIT * 1000 * 1000;
+    }
+    abstime.tv_sec += wait / 1000000000;
+    abstime.tv_nsec += wait % 1000000000;
+    if (abstime.tv_nsec >= 1000 * 1000 * 1000) {
+	// avoid overflow
+	abstime.tv_sec++;
+	abstime.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    pthread_mutex_lock(&VideoMutex);
+    if (*serial == VideoWakeupSerial) {	// no wakeup since last wait
+	pthread_cond_timedwait(&VideoWakeupCond, &VideoMutex, &abstime);
+    }
+    *serial = VideoWakeupSerial;
+    pthread_mutex_unlock(&VideoMutex);
+}
+
+///
+///	Wakeup all waiting video threads.
+///
+static void VideoThreadWakeup(void)
+{
+    pthread_mutex_lock(&VideoMutex);
+    VideoWakeupSerial++;
+    pthread_cond_broadcast(&VideoWakeupCond);
+    pthread_mutex_unlock(&VideoMutex);
+}
+
+///
+///	Video decoder thread.
+///
+///	Decodes one stream into the surface queue of its hw decoder.
+///
+///	@param arg	decoder thread data
+///
+static void *VideoDecoderHandlerThread(void *arg)
+{
+    VideoDecoderThread *thread;
+    unsigned serial;
+
+    thread = arg;
+    serial = 0;
+    Debug(3, "video: decoder thread started\n");
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    for (;;) {
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	pthread_testcancel();
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	if (!VideoUsedModule->DecodeHandler
+	    || !VideoUsedModule->DecodeHandler(thread->Stream)) {
+	    // nothing decoded: no input or surface queue full
+	    VideoThreadWait(NULL, 100, &serial);
+	}
+    }
+
+    return arg;
+}
+
+///
+///	Start decoder thread of a stream, if not already running.
+///
+///	The thread runs until the video threads are stopped, the stream
+///	can be closed and reopened meanwhile.
+///
+///	@param stream	video stream
+///
+///	@note called from display thread with video lock
+///
+static void VideoDecoderThreadStart(VideoStream * stream)
+{
+    int i;
+
+    for (i = 0; i < VIDEO_DECODER_THREAD_MAX; ++i) {
+	if (VideoDecoderThreads[i].Stream == stream) {
+	    return;
+	}
+    }
+    for (i = 0; i < VIDEO_DECODER_THREAD_MAX; ++i) {
+	if (!VideoDecoderThreads[i].Stream) {
+	    VideoDecoderThreads[i].Stream = stream;
+	    if (pthread_create(&VideoDecoderThreads[i].Thread, NULL,
+		    VideoDecoderHandlerThread, VideoDecoderThreads + i)) {
+		Error(_("video: can't create decoder thread\n"));
+		VideoDecoderThreads[i].Stream = NULL;
+		return;
+	    }
+	    pthread_setname_np(VideoDecoderThreads[i].Thread,
+		"softhddev decode");
+	    return;
+	}
+    }
+    Error(_("video: too many decoder threads\n"));
+}
+
+///
+///	Stop all decoder threads.
+///
+static void VideoDecoderThreadExit(void)
+{
+    int i;
+
+    for (i = 0; i < VIDEO_DECODER_THREAD_MAX; ++i) {
+	if (VideoDecoderThreads[i].Stream) {
+	    void *retval;
+
+	    Debug(3, "video: decoder thread canceled\n");
+	    if (pthread_cancel(VideoDecoderThreads[i].Thread)) {
+		Error(_("video: can't queue cancel video decoder thread\n"));
+	    }
+	    VideoThreadWakeup();	// don't wait for timeout
+	    if (pthread_join(VideoDecoderThreads[i].Thread, &retval)
+		|| retval != PTHREAD_CANCELED) {
+		Error(_("video: can't cancel video decoder thread\n"));
+	    }
+	    VideoDecoderThreads[i].Stream = NULL;
+	}
+    }
+}
+
+///
+///	Video render thread.
+///
+static void *VideoDisplayHandlerThread(void *dummy)
+{
+    Debug(3, "video: display thread started\n");
+
+#ifdef USE_GLX
+    if (GlxEnabled) {
+	Debug(3, "video/glx: thread context %p <-> %p\n",
+	    glXGetCurrentContext(), GlxThreadContext);
+	Debug(3, "video/glx: context %p <-> %p\n", glXGetCurrentContext(),
+	    GlxContext);
+
+	GlxThreadContext =
+	    glXCreateNewContext(XlibDisplay, GlxFBConfigs[0], GLX_RGBA_TYPE,
+	    GlxSharedContext, GL_TRUE);
+
+	if (!GlxThreadContext) {
+	    Error(_("video/glx: can't create glx context\n"));
+	    return NULL;
+	}
+	// set glx context
+	GlxSetupWindow(VideoWindow, VideoWindowWidth, VideoWindowHeight,
+	    GlxThreadContext);
+    }
+#endif
+
+    for (;;) {
+	// fix dead-lock with VdpauExit
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	pthread_testcancel();
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	VideoPollEvent();
+
+	VideoUsedModule->DisplayHandlerThread();
+    }
+
+    return dummy;
+}
+
+///
+///	Initialize video threads.
+///
+static void VideoThreadInit(void)
+{
+    pthread_condattr_t condattr;
+    pthread_mutexattr_t mutexattr;
+
+#ifdef USE_GLX
+    glXMakeCurrent(XlibDisplay, None, NULL);
+#endif
+    pthread_mutex_init(&VideoMutex, NULL);
+    // decoder threads lock the module calls, also from inside locked code
+    pthread_mutexattr_init(&mutexattr);
+    pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&VideoLockMutex, &mutexattr);
+    pthread_mutexattr_destroy(&mutexattr);
+    // timeouts are relative to the monotonic frame times
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&VideoWakeupCond, &condattr);
+    pthread_condattr_destroy(&condattr);
+    VideoWakeupSerial = 0;
+    pthread_create(&VideoThread, NULL, VideoDisplayHandlerThread, NULL);
+    pthread_setname_np(VideoThread, "softhddev video");
+#ifdef USE_GRAB
+    VideoGrabExportInit();
+#endif
+}
+
+///
+///	Exit and cleanup video threads.
+///
+static void VideoThreadExit(void)
+{
+    if (VideoThread) {
+	void *retval;
+
+#ifdef USE_GRAB
+	VideoGrabExportExit();
+	VideoGrabThreadsStop();
+#endif
+	// decoders use the module, stop them first
+	VideoDecoderThreadExit();
+
+	Debug(3, "video: video thread canceled\n");
+	//VideoThreadLock();
+	// FIXME: can't cancel locked
+	if (pthread_cancel(VideoThread)) {
+	    Error(_("video: can't queue cancel video display thread\n"));
+	}
+	//VideoThreadUnlock();
+	VideoThreadWakeup();		// don't wait for timeout
+	if (pthread_join(VideoThread, &retval) || retval != PTHREAD_CANCELED) {
+	    Error(_("video: can't cancel video display thread\n"));
+	}
+	VideoThread = 0;
+	pthread_cond_destroy(&VideoWakeupCond);
+	pthread_mutex_destroy(&VideoLockMutex);
+	pthread_mutex_destroy(&VideoMutex);
+    }
+}
+
+///
+///	Video display wakeup.
+///
+///	New video arrived, wakeup video thread.
+///
+void VideoDisplayWakeup(void)
+{
+    if (!XlibDisplay) {			// not yet started
+	return;
+    }
+
+    if (!VideoThread) {			// start video thread, if needed
+	VideoThreadInit();
+	return;
+    }
+
+    VideoThreadWakeup();
+}
+
+#endif
+
+#ifdef USE_GRAB
+
+//----------------------------------------------------------------------------
+//	Grab
+//----------------------------------------------------------------------------
+
+    /// grab image pixel formats
+typedef enum _video_grab_format_
+{
+    VideoGrabFormatRGB,			///< 24 bit R G B (ppm, jpeg)
+    VideoGrabFormatRGBA,		///< 32 bit R G B A
+    VideoGrabFormatBGRA,		///< 32 bit B G R A (native surface)
+} VideoGrabFormat;
+
+#define VIDEO_GRAB_THREADS_MAX 4	///< max. grab scaler threads
+#define VIDEO_GRAB_SPLIT (512 * 1024)	///< min. source pixels for split
+
+    /// grab scaler job, a band of output rows
+typedef struct _video_grab_job_
+{
+    uint8_t *Dst;			///< destination image
+    int DstPitch;			///< destination bytes per row
+    int DstWidth;			///< destination width
+    int DstHeight;			///< destination height
+    VideoGrabFormat Format;		///< destination pixel format
+    const uint8_t *Src;			///< source BGRA image
+    int SrcPitch;			///< source bytes per row
+    int SrcWidth;			///< source width
+    int SrcHeight;			///< source height
+    int Y0;				///< first output row of band
+    int Y1;				///< last output row of band + 1
+} VideoGrabJob;
+
+    /// serializes users of the grab scaler threads
+static pthread_mutex_t VideoGrabMutex = PTHREAD_MUTEX_INITIALIZER;
+
+    /// grab scaler job mutex
+static pthread_mutex_t VideoGrabJobMutex = PTHREAD_MUTEX_INITIALIZER;
+
+    /// grab scaler new job wakeup
+static pthread_cond_t VideoGrabJobCond = PTHREAD_COND_INITIALIZER;
+
+    /// grab scaler job done wakeup
+static pthread_cond_t VideoGrabDoneCond = PTHREAD_COND_INITIALIZER;
+
+    /// grab scaler threads, band 0 is done by the caller
+static pthread_t VideoGrabThread[VIDEO_GRAB_THREADS_MAX - 1];
+static int VideoGrabThreadN;		///< number of running scaler threads
+static char VideoGrabThreadsStarted;	///< flag scaler threads started
+static const VideoGrabJob *VideoGrabJobs;	///< bands of current job
+static int VideoGrabJobN;		///< number of bands of current job
+static unsigned VideoGrabJobSerial;	///< serial number of current job
+static unsigned VideoGrabStartSerial;	///< job serial at thread start
+static int VideoGrabJobPending;		///< scaler threads still running
+static char VideoGrabJobExit;		///< flag scaler threads should exit
+
+///
+///	Convert a row of BGRA pixels to RGB.
+///
+///	@param dst	RGB pixels
+///	@param src	BGRA pixels
+///	@param n	number of pixels
+///
+static void VideoGrabRowRGB(uint8_t * dst, const uint8_t * src, int n)
+{
+    int i;
+
+    i = 0;
+#if defined(__SSSE3__)
+    {
+	__m128i shuffle;
+
+	shuffle =
+	    _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1,
+	    -1);
+	// 16 bytes are stored for 4 pixels, the 4 extra must stay in row
+	for (; i + 6 <= n; i += 4) {
+	    _mm_storeu_si128((__m128i *) (dst + 3 * i),
+		_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src +
+			    4 * i)), shuffle));
+	}
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= n; i += 16) {
+	uint8x16x4_t bgra;
+	uint8x16x3_t rgb;
+
+	bgra = vld4q_u8(src + 4 * i);
+	rgb.val[0] = bgra.val[2];
+	rgb.val[1] = bgra.val[1];
+	rgb.val[2] = bgra.val[0];
+	vst3q_u8(dst + 3 * i, rgb);
+    }
+#endif
+    for (; i < n; ++i) {
+	dst[3 * i + 0] = src[4 * i + 2];
+	dst[3 * i + 1] = src[4 * i + 1];
+	dst[3 * i + 2] = src[4 * i + 0];
+    }
+}
+
+///
+///	Convert a row of BGRA pixels to RGBA.
+///
+///	@param dst	RGBA pixels
+///	@param src	BGRA pixels
+///	@param n	number of pixels
+///
+static void VideoGrabRowRGBA(uint8_t * dst, const uint8_t * src, int n)
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+	__m128i ga;
+
+	ga = _mm_set1_epi32(0xFF00FF00);
+	for (; i + 4 <= n; i += 4) {
+	    __m128i v;
+	    __m128i rb;
+
+	    v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+	    // B 0 R 0 -> R 0 B 0: swap the 16 bit halves of each pixel
+	    rb = _mm_andnot_si128(ga, v);
+	    rb = _mm_shufflehi_epi16(_mm_shufflelo_epi16(rb, 0xB1), 0xB1);
+	    _mm_storeu_si128((__m128i *) (dst + 4 * i),
+		_mm_or_si128(_mm_and_si128(v, ga), rb));
+	}
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= n; i += 16) {
+	uint8x16x4_t px;
+	uint8x16_t t;
+
+	px = vld4q_u8(src + 4 * i);
+	t = px.val[0];
+	px.val[0] = px.val[2];
+	px.val[2] = t;
+	vst4q_u8(dst + 4 * i, px);
+    }
+#endif
+    for (; i < n; ++i) {
+	dst[4 * i + 0] = src[4 * i + 2];
+	dst[4 * i + 1] = src[4 * i + 1];
+	dst[4 * i + 2] = src[4 * i + 0];
+	dst[4 * i + 3] = src[4 * i + 3];
+    }
+}
+
+///
+///	Store a row of BGRA pixels in grab format.
+///
+///	@param dst	destination pixels
+///	@param src	BGRA pixels
+///	@param n	number of pixels
+///	@param format	destination pixel format
+///
+static void VideoGrabRow(uint8_t * dst, const uint8_t * src, int n,
+    VideoGrabFormat format)
+{
+    switch (format) {
+	case VideoGrabFormatRGB:
+	    VideoGrabRowRGB(dst, src, n);
+	    break;
+	case VideoGrabFormatRGBA:
+	    VideoGrabRowRGBA(dst, src, n);
+	    break;
+	case VideoGrabFormatBGRA:
+	    memcpy(dst, src, n * 4);
+	    break;
+    }
+}
+
+///
+///	Add a row of bytes to the column sums.
+///
+///	@param acc	column sums
+///	@param src	bytes
+///	@param n	number of bytes
+///
+static void VideoGrabRowSum(uint32_t * acc, const uint8_t * src, int n)
+{
+    int i;
+
+    i = 0;
+#if defined(__SSE2__)
+    {
+	__m128i zero;
+
+	zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+	    __m128i v;
+	    __m128i lo;
+	    __m128i hi;
+	    __m128i *a;
+
+	    v = _mm_loadu_si128((const __m128i *)(src + i));
+	    lo = _mm_unpacklo_epi8(v, zero);
+	    hi = _mm_unpackhi_epi8(v, zero);
+	    a = (__m128i *) (acc + i);
+	    _mm_storeu_si128(a + 0, _mm_add_epi32(_mm_loadu_si128(a + 0),
+		    _mm_unpacklo_epi16(lo, zero)));
+	    _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1),
+		    _mm_unpackhi_epi16(lo, zero)));
+	    _mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2),
+		    _mm_unpacklo_epi16(hi, zero)));
+	    _mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3),
+		    _mm_unpackhi_epi16(hi, zero)));
+	}
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= n; i += 16) {
+	uint8x16_t v;
+	uint16x8_t lo;
+	uint16x8_t hi;
+
+	v = vld1q_u8(src + i);
+	lo = vmovl_u8(vget_low_u8(v));
+	hi = vmovl_u8(vget_high_u8(v));
+	vst1q_u32(acc + i, vaddw_u16(vld1q_u32(acc + i), vget_low_u16(lo)));
+	vst1q_u32(acc + i + 4, vaddw_u16(vld1q_u32(acc + i + 4),
+		vget_high_u16(lo)));
+	vst1q_u32(acc + i + 8, vaddw_u16(vld1q_u32(acc + i + 8),
+		vget_low_u16(hi)));
+	vst1q_u32(acc + i + 12, vaddw_u16(vld1q_u32(acc + i + 12),
+		vget_high_u16(hi)));
+    }
+#endif
+    for (; i < n; ++i) {
+	acc[i] += src[i];
+    }
+}
+
+///
+///	Box scale a band of output rows.
+///
+///	Each output pixel is the average of the source pixels it covers,
+///	used for thumbnails and atmo analyse images.
+///
+///	@param job	grab scaler job
+///	@param acc	column sums (4 * source width)
+///	@param row	BGRA output row (4 * destination width)
+///
+static void VideoGrabBox(const VideoGrabJob * job, uint32_t * acc,
+    uint8_t * row)
+{
+    int x;
+    int y;
+    int sy;
+    int sx0;
+    int sx1;
+    int sy0;
+    int sy1;
+    int c;
+
+    for (y = job->Y0; y < job->Y1; ++y) {
+	sy0 = y * job->SrcHeight / job->DstHeight;
+	sy1 = (y + 1) * job->SrcHeight / job->DstHeight;
+	if (sy1 <= sy0) {
+	    sy1 = sy0 + 1;
+	}
+	memset(acc, 0, job->SrcWidth * 4 * sizeof(*acc));
+	for (sy = sy0; sy < sy1; ++sy) {
+	    VideoGrabRowSum(acc, job->Src + sy * job->SrcPitch,
+		job->SrcWidth * 4);
+	}
+
+	sx0 = 0;
+	for (x = 0; x < job->DstWidth; ++x) {
+	    unsigned sum[4];
+	    unsigned count;
+	    int sx;
+
+	    sx1 = (x + 1) * job->SrcWidth / job->DstWidth;
+	    if (sx1 <= sx0) {
+		sx1 = sx0 + 1;
+	    }
+	    sum[0] = 0;
+	    sum[1] = 0;
+	    sum[2] = 0;
+	    sum[3] = 0;
+	    for (sx = sx0; sx < sx1; ++sx) {
+		sum[0] += acc[sx * 4 + 0];
+		sum[1] += acc[sx * 4 + 1];
+		sum[2] += acc[sx * 4 + 2];
+		sum[3] += acc[sx * 4 + 3];
+	    }
+	    count = (sx1 - sx0) * (sy1 - sy0);
+	    for (c = 0; c < 4; ++c) {
+		row[x * 4 + c] = (sum[c] + count / 2) / count;
+	    }
+	    sx0 = sx1;
+	}
+	VideoGrabRow(job->Dst + y * job->DstPitch, row, job->DstWidth,
+	    job->Format);
+    }
+}
+
+///
+///	Source position of output pixel center.
+///
+///	@param i	output pixel
+///	@param src	source size
+///	@param dst	output size
+///
+///	@returns source position in 16.16 fixed point, clamped to image.
+///
+static int VideoGrabPosition(int i, int src, int dst)
+{
+    int64_t pos;
+
+    pos = (((int64_t) (2 * i + 1) * src) << 15) / dst - 32768;
+    if (pos < 0) {
+	return 0;
+    }
+    if (pos > (int64_t) (src - 1) << 16) {
+	return (src - 1) << 16;
+    }
+    return pos;
+}
+
+///
+///	Bilinear scale a band of output rows.
+///
+///	@param job	grab scaler job
+///	@param row	BGRA output row (4 * destination width)
+///
+static void VideoGrabBilinear(const VideoGrabJob * job, uint8_t * row)
+{
+    int x;
+    int y;
+    int c;
+
+    for (y = job->Y0; y < job->Y1; ++y) {
+	const uint8_t *r0;
+	const uint8_t *r1;
+	int sy;
+	int fy;
+
+	sy = VideoGrabPosition(y, job->SrcHeight, job->DstHeight);
+	fy = (sy >> 8) & 0xFF;
+	r0 = job->Src + (sy >> 16) * job->SrcPitch;
+	r1 = (sy >> 16) + 1 < job->SrcHeight ? r0 + job->SrcPitch : r0;
+
+	for (x = 0; x < job->DstWidth; ++x) {
+	    int sx;
+	    int fx;
+	    int x0;
+	    int x1;
+
+	    sx = VideoGrabPosition(x, job->SrcWidth, job->DstWidth);
+	    fx = (sx >> 8) & 0xFF;
+	    x0 = (sx >> 16) * 4;
+	    x1 = (sx >> 16) + 1 < job->SrcWidth ? x0 + 4 : x0;
+	    for (c = 0; c < 4; ++c) {
+		int top;
+		int bottom;
+
+		top = r0[x0 + c] * (256 - fx) + r0[x1 + c] * fx;
+		bottom = r1[x0 + c] * (256 - fx) + r1[x1 + c] * fx;
+		row[x * 4 + c] =
+		    (top * (256 - fy) + bottom * fy + 32768) >> 16;
+	    }
+	}
+	VideoGrabRow(job->Dst + y * job->DstPitch, row, job->DstWidth,
+	    job->Format);
+    }
+}
+
+///
+///	Run grab scaler job.
+///
+///	@param job	grab scaler job
+///
+static void VideoGrabJobRun(const VideoGrabJob * job)
+{
+    uint32_t *acc;
+    uint8_t *row;
+    int y;
+
+    if (job->SrcWidth == job->DstWidth && job->SrcHeight == job->DstHeight) {
+	for (y = job->Y0; y < job->Y1; ++y) {
+	    VideoGrabRow(job->Dst + y * job->DstPitch,
+		job->Src + y * job->SrcPitch, job->DstWidth, job->Format);
+	}
+	return;
+    }
+
+    if (!(row = malloc(job->DstWidth * 4))) {
+	Error(_("video: out of memory\n"));
+	return;
+    }
+    // box filter for real down scaling, bilinear for everything else
+    if (job->DstWidth * 2 <= job->SrcWidth
+	&& job->DstHeight * 2 <= job->SrcHeight) {
+	if ((acc = malloc(job->SrcWidth * 4 * sizeof(*acc)))) {
+	    VideoGrabBox(job, acc, row);
+	    free(acc);
+	} else {
+	    Error(_("video: out of memory\n"));
+	}
+    } else {
+	VideoGrabBilinear(job, row);
+    }
+    free(row);
+}
+
+///
+///	Grab scaler thread.
+///
+///	@param arg	band number of the thread
+///
+static void *VideoGrabWorkerThread(void *arg)
+{
+    unsigned serial;
+    int band;
+
+    band = (intptr_t) arg;
+
+    pthread_mutex_lock(&VideoGrabJobMutex);
+    serial = VideoGrabStartSerial;
+    for (;;) {
+	const VideoGrabJob *jobs;
+	int n;
+
+	while (!VideoGrabJobExit && serial == VideoGrabJobSerial) {
+	    pthread_cond_wait(&VideoGrabJobCond, &VideoGrabJobMutex);
+	}
+	if (VideoGrabJobExit) {
+	    break;
+	}
+	serial = VideoGrabJobSerial;
+	jobs = VideoGrabJobs;
+	n = VideoGrabJobN;
+	pthread_mutex_unlock(&VideoGrabJobMutex);
+
+	if (band < n) {
+	    VideoGrabJobRun(jobs + band);
+	}
+
+	pthread_mutex_lock(&VideoGrabJobMutex);
+	if (!--VideoGrabJobPending) {
+	    pthread_cond_signal(&VideoGrabDoneCond);
+	}
+    }
+    pthread_mutex_unlock(&VideoGrabJobMutex);
+
+    return NULL;
+}
+
+///
+///	Start grab scaler threads.
+///
+///	@note called with grab lock
+///
+static void VideoGrabThreadsStart(void)
+{
+    int n;
+
+    VideoGrabThreadsStarted = 1;
+    n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (n > VIDEO_GRAB_THREADS_MAX - 1) {
+	n = VIDEO_GRAB_THREADS_MAX - 1;
+    }
+
+    VideoGrabJobExit = 0;
+    // threads could start after the first job is queued
+    VideoGrabStartSerial = VideoGrabJobSerial;
+    for (VideoGrabThreadN = 0; VideoGrabThreadN < n; ++VideoGrabThreadN) {
+	if (pthread_create(&VideoGrabThread[VideoGrabThreadN], NULL,
+		VideoGrabWorkerThread,
+		(void *)(intptr_t) (VideoGrabThreadN + 1))) {
+	    Error(_("video: can't create grab scaler thread\n"));
+	    break;
+	}
+	pthread_setname_np(VideoGrabThread[VideoGrabThreadN],
+	    "softhddev scale");
+    }
+    Debug(3, "video: %d grab scaler threads\n", VideoGrabThreadN);
+}
+
 ///
-///	Lock video thread.
+///	Stop grab scaler threads.
 ///
-static void VideoThreadLock(void)
+static void VideoGrabThreadsStop(void)
 {
-    if (VideoThread) {
-	if (pthread_mutex_lock(&VideoLockMutex)) {
-	    Error(_("video: can't lock thread\n"));
-	}
+    int i;
+
+    pthread_mutex_lock(&VideoGrabMutex);
+    pthread_mutex_lock(&VideoGrabJobMutex);
+    VideoGrabJobExit = 1;
+    pthread_cond_broadcast(&VideoGrabJobCond);
+    pthread_mutex_unlock(&VideoGrabJobMutex);
+
+    for (i = 0; i < VideoGrabThreadN; ++i) {
+	pthread_join(VideoGrabThread[i], NULL);
     }
+    VideoGrabThreadN = 0;
+    VideoGrabThreadsStarted = 0;
+    pthread_mutex_unlock(&VideoGrabMutex);
 }
 
 ///
-///	Unlock video thread.
+///	Convert and scale a grabbed BGRA image.
 ///
-static void VideoThreadUnlock(void)
+///	Large images are split into bands of rows, converted by the
+///	grab scaler threads, which are started with the first large image.
+///
+///	@param dst		destination image
+///	@param dst_pitch	destination bytes per row
+///	@param format		destination pixel format
+///	@param dst_width	destination width
+///	@param dst_height	destination height
+///	@param src		source BGRA image
+///	@param src_pitch	source bytes per row
+///	@param src_width	source width
+///	@param src_height	source height
+///
+static void VideoGrabScale(uint8_t * dst, int dst_pitch,
+    VideoGrabFormat format, int dst_width, int dst_height,
+    const uint8_t * src, int src_pitch, int src_width, int src_height)
 {
-    if (VideoThread) {
-	if (pthread_mutex_unlock(&VideoLockMutex)) {
-	    Error(_("video: can't unlock thread\n"));
+    VideoGrabJob job[VIDEO_GRAB_THREADS_MAX];
+    int split;
+    int n;
+    int i;
+
+    n = 1;
+    split = src_width * src_height >= VIDEO_GRAB_SPLIT;
+    if (split) {
+	pthread_mutex_lock(&VideoGrabMutex);
+	if (!VideoGrabThreadsStarted) {
+	    VideoGrabThreadsStart();
+	}
+	n = VideoGrabThreadN + 1;
+	if (n > dst_height) {
+	    n = dst_height;
+	}
+    }
+
+    for (i = 0; i < n; ++i) {
+	job[i].Dst = dst;
+	job[i].DstPitch = dst_pitch;
+	job[i].DstWidth = dst_width;
+	job[i].DstHeight = dst_height;
+	job[i].Format = format;
+	job[i].Src = src;
+	job[i].SrcPitch = src_pitch;
+	job[i].SrcWidth = src_width;
+	job[i].SrcHeight = src_height;
+	job[i].Y0 = dst_height * i / n;
+	job[i].Y1 = dst_height * (i + 1) / n;
+    }
+    if (n > 1) {
+	pthread_mutex_lock(&VideoGrabJobMutex);
+	VideoGrabJobs = job;
+	VideoGrabJobN = n;
+	VideoGrabJobPending = VideoGrabThreadN;
+	++VideoGrabJobSerial;
+	pthread_cond_broadcast(&VideoGrabJobCond);
+	pthread_mutex_unlock(&VideoGrabJobMutex);
+    }
+    // band 0 is done by the caller
+    VideoGrabJobRun(&job[0]);
+    if (n > 1) {
+	pthread_mutex_lock(&VideoGrabJobMutex);
+	while (VideoGrabJobPending) {
+	    pthread_cond_wait(&VideoGrabDoneCond, &VideoGrabJobMutex);
 	}
+	pthread_mutex_unlock(&VideoGrabJobMutex);
+    }
+    if (split) {
+	pthread_mutex_unlock(&VideoGrabMutex);
     }
 }
 
+//----------------------------------------------------------------------------
+//	Grab export
+//----------------------------------------------------------------------------
+
+#define VIDEO_GRAB_EXPORT_HEADER 4096	///< page aligned images
+
+static pthread_t VideoGrabExportThread;	///< grab export thread
+static pthread_mutex_t VideoGrabExportMutex;	///< grab export mutex
+static pthread_cond_t VideoGrabExportCond;	///< grab export stop wakeup
+static char VideoGrabExportStop;	///< flag stop grab export thread
+static int VideoGrabExportRate;		///< export grabs per second, 0 off
+static int VideoGrabExportWidth = 256;	///< export image width
+static char VideoGrabExportSkipped;	///< flag image too big was logged
+
+    /// grab export shared memory
+static SoftHDDevice_GrabExport_v1_0_t *VideoGrabExportShm;
+static size_t VideoGrabExportShmSize;	///< mapped size of shared memory
+static char VideoGrabExportName[80];	///< shared memory name
+
 ///
-///	Video render thread.
+///	Grab one frame into the shared memory ring.
 ///
-static void *VideoDisplayHandlerThread(void *dummy)
+///	The slot sequence is 0 while the image is written, readers must
+///	check it is unchanged after copying the image.
+///
+static void VideoGrabExportFrame(void)
 {
-    Debug(3, "video: display thread started\n");
+    SoftHDDevice_GrabExport_v1_0_t *shm;
+    SoftHDDevice_GrabExportSlot_v1_0_t *slot;
+    struct timespec ts;
+    uint8_t *img;
+    uint32_t sequence;
+    int size;
+    int width;
+    int height;
 
-#ifdef USE_GLX
-    if (GlxEnabled) {
-	Debug(3, "video/glx: thread context %p <-> %p\n",
-	    glXGetCurrentContext(), GlxThreadContext);
-	Debug(3, "video/glx: context %p <-> %p\n", glXGetCurrentContext(),
-	    GlxContext);
+    shm = VideoGrabExportShm;
+    if (!(sequence = shm->sequence + 1)) {
+	sequence = 1;
+    }
+    slot = &shm->slot[sequence % GRAB_EXPORT_SLOTS];
+    img = (uint8_t *) shm + shm->headerSize +
+	(sequence % GRAB_EXPORT_SLOTS) * shm->slotSize;
 
-	GlxThreadContext =
-	    glXCreateNewContext(XlibDisplay, GlxFBConfigs[0], GLX_RGBA_TYPE,
-	    GlxSharedContext, GL_TRUE);
+    __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 
-	if (!GlxThreadContext) {
-	    Error(_("video/glx: can't create glx context\n"));
-	    return NULL;
+    width = -VideoGrabExportWidth;	// atmo request, aspect correct height
+    height = 0;
+    size = 0;
+    if (!VideoGrabServiceBuffer(img, shm->slotSize, &size, &width, &height)) {
+	if (size > (int)shm->slotSize && !VideoGrabExportSkipped) {
+	    Warning(_("video: grab export %dx%d doesn't fit, skipped\n"),
+		width, height);
+	    VideoGrabExportSkipped = 1;
 	}
-	// set glx context
-	GlxSetupWindow(VideoWindow, VideoWindowWidth, VideoWindowHeight,
-	    GlxThreadContext);
+	return;
     }
-#endif
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    slot->width = width;
+    slot->height = height;
+    slot->size = size;
+    slot->timestamp = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+    __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->sequence, sequence, __ATOMIC_RELEASE);
+}
+
+///
+///	Grab export thread.
+///
+static void *VideoGrabExportHandlerThread(void *dummy)
+{
+    struct timespec abstime;
+    struct timespec now;
+    long period;
+
+    period = 1000000000L / VideoGrabExportRate;
+    clock_gettime(CLOCK_MONOTONIC, &abstime);
 
+    pthread_mutex_lock(&VideoGrabExportMutex);
     for (;;) {
-	// fix dead-lock with VdpauExit
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_testcancel();
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	abstime.tv_nsec += period;
+	if (abstime.tv_nsec >= 1000000000L) {
+	    abstime.tv_sec++;
+	    abstime.tv_nsec -= 1000000000L;
+	}
+	while (!VideoGrabExportStop
+	    && pthread_cond_timedwait(&VideoGrabExportCond,
+		&VideoGrabExportMutex, &abstime) != ETIMEDOUT) {
+	}
+	if (VideoGrabExportStop) {
+	    break;
+	}
+	pthread_mutex_unlock(&VideoGrabExportMutex);
 
-	VideoPollEvent();
+	VideoGrabExportFrame();
 
-	VideoUsedModule->DisplayHandlerThread();
+	// too slow, don't try to catch up
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if ((now.tv_sec - abstime.tv_sec) * 1000000000L + now.tv_nsec -
+	    abstime.tv_nsec > period) {
+	    abstime = now;
+	}
+	pthread_mutex_lock(&VideoGrabExportMutex);
     }
+    pthread_mutex_unlock(&VideoGrabExportMutex);
 
     return dummy;
 }
 
 ///
-///	Initialize video threads.
+///	Invalidate and remove an old grab export shared memory.
 ///
-static void VideoThreadInit(void)
+///	A segment left by a crashed or restarted export can still be
+///	mapped by readers.  It isn't resized under them, the magic is
+///	cleared, readers open the new segment again.
+///
+///	@param name	shared memory name
+///
+static void VideoGrabExportUnlink(const char *name)
 {
-#ifdef USE_GLX
-    glXMakeCurrent(XlibDisplay, None, NULL);
-#endif
-    pthread_mutex_init(&VideoMutex, NULL);
-    pthread_mutex_init(&VideoLockMutex, NULL);
-    pthread_cond_init(&VideoWakeupCond, NULL);
-    pthread_create(&VideoThread, NULL, VideoDisplayHandlerThread, NULL);
-    pthread_setname_np(VideoThread, "softhddev video");
+    SoftHDDevice_GrabExport_v1_0_t *shm;
+    struct stat st;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+	return;
+    }
+    if (!fstat(fd, &st) && st.st_size >= VIDEO_GRAB_EXPORT_HEADER
+	&& (shm = mmap(NULL, VIDEO_GRAB_EXPORT_HEADER, PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0)) != MAP_FAILED) {
+	__atomic_store_n(&shm->magic, 0, __ATOMIC_RELEASE);
+	munmap(shm, VIDEO_GRAB_EXPORT_HEADER);
+    }
+    close(fd);
+    shm_unlink(name);
 }
 
 ///
-///	Exit and cleanup video threads.
+///	Create grab export shared memory and start export thread.
 ///
-static void VideoThreadExit(void)
+///	Always a new segment is created, only readable by our user.
+///
+static void VideoGrabExportInit(void)
 {
-    if (VideoThread) {
-	void *retval;
+    pthread_condattr_t condattr;
+    SoftHDDevice_GrabExport_v1_0_t *shm;
+    size_t slot_size;
+    size_t size;
+    int height;
+    int fd;
+    char *s;
 
-	Debug(3, "video: video thread canceled\n");
-	//VideoThreadLock();
-	// FIXME: can't cancel locked
-	if (pthread_cancel(VideoThread)) {
-	    Error(_("video: can't queue cancel video display thread\n"));
-	}
-	//VideoThreadUnlock();
-	if (pthread_join(VideoThread, &retval) || retval != PTHREAD_CANCELED) {
-	    Error(_("video: can't cancel video display thread\n"));
+    if (!VideoGrabExportRate || VideoGrabExportThread) {
+	return;
+    }
+    // images have the aspect of the output window, at least 4:3
+    height = VideoGrabExportWidth * 3 / 4;
+    if (VideoWindowWidth
+	&& VideoWindowHeight * 4 > VideoWindowWidth * 3) {
+	height = (VideoGrabExportWidth * VideoWindowHeight) / VideoWindowWidth;
+    }
+    slot_size = VideoGrabExportWidth * height * 4;
+    size = VIDEO_GRAB_EXPORT_HEADER + GRAB_EXPORT_SLOTS * slot_size;
+    VideoGrabExportSkipped = 0;
+
+    // one ring for each X11 display, fe. /softhddevice-grab-:0.0
+    snprintf(VideoGrabExportName, sizeof(VideoGrabExportName), "%s-%s",
+	GRAB_EXPORT_SHM, XlibDisplay ? DisplayString(XlibDisplay) : "");
+    for (s = VideoGrabExportName + 1; *s; ++s) {
+	if (*s == '/') {
+	    *s = '_';
 	}
-	VideoThread = 0;
-	pthread_cond_destroy(&VideoWakeupCond);
-	pthread_mutex_destroy(&VideoLockMutex);
-	pthread_mutex_destroy(&VideoMutex);
     }
+
+    VideoGrabExportUnlink(VideoGrabExportName);
+    fd = shm_open(VideoGrabExportName, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+	Error(_("video: can't create grab export shared memory: %s\n"),
+	    strerror(errno));
+	return;
+    }
+    if (ftruncate(fd, size)
+	|| (shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		0)) == MAP_FAILED) {
+	Error(_("video: can't map grab export shared memory: %s\n"),
+	    strerror(errno));
+	close(fd);
+	shm_unlink(VideoGrabExportName);
+	return;
+    }
+    close(fd);
+
+    memset(shm, 0, VIDEO_GRAB_EXPORT_HEADER);
+    shm->version = GRAB_EXPORT_VERSION;
+    shm->headerSize = VIDEO_GRAB_EXPORT_HEADER;
+    shm->slotSize = slot_size;
+    shm->slots = GRAB_EXPORT_SLOTS;
+    shm->imgType = GRAB_IMG_RGBA_FORMAT_B8G8R8A8;
+    shm->rate = VideoGrabExportRate;
+    // magic last, readers wait for it
+    __atomic_store_n(&shm->magic, GRAB_EXPORT_MAGIC, __ATOMIC_RELEASE);
+
+    VideoGrabExportShm = shm;
+    VideoGrabExportShmSize = size;
+
+    pthread_mutex_init(&VideoGrabExportMutex, NULL);
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&VideoGrabExportCond, &condattr);
+    pthread_condattr_destroy(&condattr);
+    VideoGrabExportStop = 0;
+    pthread_create(&VideoGrabExportThread, NULL,
+	VideoGrabExportHandlerThread, NULL);
+    pthread_setname_np(VideoGrabExportThread, "softhddev grab");
+
+    Info(_("video: grab export width %d at %d/s to %s\n"),
+	VideoGrabExportWidth, VideoGrabExportRate, VideoGrabExportName);
 }
 
 ///
-///	Video display wakeup.
-///
-///	New video arrived, wakeup video thread.
+///	Stop export thread and remove grab export shared memory.
 ///
-void VideoDisplayWakeup(void)
+static void VideoGrabExportExit(void)
 {
-    if (!XlibDisplay) {			// not yet started
-	return;
+    if (VideoGrabExportThread) {
+	pthread_mutex_lock(&VideoGrabExportMutex);
+	VideoGrabExportStop = 1;
+	pthread_cond_signal(&VideoGrabExportCond);
+	pthread_mutex_unlock(&VideoGrabExportMutex);
+	pthread_join(VideoGrabExportThread, NULL);
+	VideoGrabExportThread = 0;
+	pthread_cond_destroy(&VideoGrabExportCond);
+	pthread_mutex_destroy(&VideoGrabExportMutex);
     }
-
-    if (!VideoThread) {			// start video thread, if needed
-	VideoThreadInit();
+    if (VideoGrabExportShm) {
+	// readers see the export is gone
+	__atomic_store_n(&VideoGrabExportShm->magic, 0, __ATOMIC_RELEASE);
+	munmap(VideoGrabExportShm, VideoGrabExportShmSize);
+	VideoGrabExportShm = NULL;
+	shm_unlink(VideoGrabExportName);
     }
 }
 
@@ -11884,15 +13312,17 @@ struct _video_hw_decoder_
 ///	Allocate new video hw decoder.
 ///
 ///	@param stream	video stream
+///	@param pip	flag stream is picture in picture, the main stream
+///			drives the audio speed correction
 ///
 ///	@returns a new initialized video hardware decoder.
 ///
-VideoHwDecoder *VideoNewHwDecoder(VideoStream * stream)
+VideoHwDecoder *VideoNewHwDecoder(VideoStream * stream, int pip)
 {
     VideoHwDecoder *hw;
 
     VideoThreadLock();
-    hw = VideoUsedModule->NewHwDecoder(stream);
+    hw = VideoUsedModule->NewHwDecoder(stream, pip);
     VideoThreadUnlock();
 
     return hw;
@@ -11906,15 +13336,10 @@ VideoHwDecoder *VideoNewHwDecoder(VideoStream * stream)
 void VideoDelHwDecoder(VideoHwDecoder * hw_decoder)
 {
     if (hw_decoder) {
-#ifdef DEBUG
-	if (!pthread_equal(pthread_self(), VideoThread)) {
-	    Debug(3, "video: should only be called from inside the thread\n");
-	}
-#endif
-	// only called from inside the thread
-	//VideoThreadLock();
+	// called from inside the video or decoder thread
+	VideoThreadLock();
 	VideoUsedModule->DelHwDecoder(hw_decoder);
-	//VideoThreadUnlock();
+	VideoThreadUnlock();
     }
 }
 
@@ -11929,7 +13354,13 @@ void VideoDelHwDecoder(VideoHwDecoder * hw_decoder)
 unsigned VideoGetSurface(VideoHwDecoder * hw_decoder,
     const AVCodecContext * video_ctx)
 {
-    return VideoUsedModule->GetSurface(hw_decoder, video_ctx);
+    unsigned surface;
+
+    VideoThreadLock();
+    surface = VideoUsedModule->GetSurface(hw_decoder, video_ctx);
+    VideoThreadUnlock();
+
+    return surface;
 }
 
 ///
@@ -11941,7 +13372,9 @@ unsigned VideoGetSurface(VideoHwDecoder * hw_decoder,
 void VideoReleaseSurface(VideoHwDecoder * hw_decoder, unsigned surface)
 {
     // FIXME: must be guarded against calls, after VideoExit
+    VideoThreadLock();
     VideoUsedModule->ReleaseSurface(hw_decoder, surface);
+    VideoThreadUnlock();
 }
 
 ///
@@ -11957,6 +13390,8 @@ void VideoReleaseSurface(VideoHwDecoder * hw_decoder, unsigned surface)
 enum AVPixelFormat Video_get_format(VideoHwDecoder * hw_decoder,
     AVCodecContext * video_ctx, const enum AVPixelFormat *fmt)
 {
+    enum AVPixelFormat pix_fmt;
+
 #ifdef DEBUG
     int ms_delay;
 
@@ -11969,7 +13404,11 @@ enum AVPixelFormat Video_get_format(VideoHwDecoder * hw_decoder,
 	GetMsTicks() - VideoSwitch);
 #endif
 
-    return VideoUsedModule->get_format(hw_decoder, video_ctx, fmt);
+    VideoThreadLock();
+    pix_fmt = VideoUsedModule->get_format(hw_decoder, video_ctx, fmt);
+    VideoThreadUnlock();
+
+    return pix_fmt;
 }
 
 ///
@@ -11990,7 +13429,9 @@ void VideoRenderFrame(VideoHwDecoder * hw_decoder,
 	Warning(_("video: repeated pict %d found, but not handled\n"),
 	    frame->repeat_pict);
     }
+    VideoThreadLock();
     VideoUsedModule->RenderFrame(hw_decoder, video_ctx, frame);
+    VideoThreadUnlock();
 }
 
 ///
@@ -12002,7 +13443,13 @@ void VideoRenderFrame(VideoHwDecoder * hw_decoder,
 ///
 void *VideoGetHwAccelContext(VideoHwDecoder * hw_decoder)
 {
-    return VideoUsedModule->GetHwAccelContext(hw_decoder);
+    void *context;
+
+    VideoThreadLock();
+    context = VideoUsedModule->GetHwAccelContext(hw_decoder);
+    VideoThreadUnlock();
+
+    return context;
 }
 
 #ifdef USE_VDPAU
@@ -12030,6 +13477,7 @@ void VideoDrawRenderState(VideoHwDecoder * hw_decoder,
 	if (decoder->VideoDecoder == VDP_INVALID_HANDLE) {
 	    // must be hardware decoder!
 	    Debug(3, "video/vdpau: recover preemption\n");
+	    VideoThreadLock();
 	    status =
 		VdpauDecoderCreate(VdpauDevice, decoder->Profile,
 		decoder->InputWidth, decoder->InputHeight,
@@ -12041,9 +13489,11 @@ void VideoDrawRenderState(VideoHwDecoder * hw_decoder,
 	    }
 
 	    VdpauSetupOutput(decoder);
+	    VideoThreadUnlock();
 	    return;
 	}
 
+	// vdpau is thread safe, rendering needs no video lock
 	Debug(4, "video/vdpau: decoder render to %#010x\n", vrs->surface);
 	start = GetMsTicks();
 	status =
@@ -12118,7 +13568,9 @@ void VideoSetClosing(VideoHwDecoder * hw_decoder)
 void VideoResetStart(VideoHwDecoder * hw_decoder)
 {
     Debug(3, "video: reset start\n");
+    VideoThreadLock();
     VideoUsedModule->ResetStart(hw_decoder);
+    VideoThreadUnlock();
     // clear clock to trigger new video stream
     VideoSetClock(hw_decoder, AV_NOPTS_VALUE);
 }
@@ -12151,16 +13603,9 @@ uint8_t *VideoGrab(int *size, int *width, int *height, int write_header)
 	uint8_t *data;
 	uint8_t *rgb;
 	char buf[64];
-	int i;
 	int n;
 	int scale_width;
 	int scale_height;
-	int x;
-	int y;
-	double src_x;
-	double src_y;
-	double scale_x;
-	double scale_y;
 
 	scale_width = *width;
 	scale_height = *height;
@@ -12175,71 +13620,27 @@ uint8_t *VideoGrab(int *size, int *width, int *height, int write_header)
 	if (scale_height <= 0) {
 	    scale_height = *height;
 	}
-	// hardware didn't scale for us, use simple software scaler
-	if (scale_width != *width && scale_height != *height) {
-	    if (write_header) {
-		n = snprintf(buf, sizeof(buf), "P6\n%d\n%d\n255\n",
-		    scale_width, scale_height);
-	    }
-	    rgb = malloc(scale_width * scale_height * 3 + n);
-	    if (!rgb) {
-		Error(_("video: out of memory\n"));
-		free(data);
-		return NULL;
-	    }
-	    *size = scale_width * scale_height * 3 + n;
-	    memcpy(rgb, buf, n);	// header
-
-	    scale_x = (double)*width / scale_width;
-	    scale_y = (double)*height / scale_height;
-
-	    src_y = 0.0;
-	    for (y = 0; y < scale_height; y++) {
-		int o;
-
-		src_x = 0.0;
-		o = (int)src_y **width;
-
-		for (x = 0; x < scale_width; x++) {
-		    i = 4 * (o + (int)src_x);
-
-		    rgb[n + (x + y * scale_width) * 3 + 0] = data[i + 2];
-		    rgb[n + (x + y * scale_width) * 3 + 1] = data[i + 1];
-		    rgb[n + (x + y * scale_width) * 3 + 2] = data[i + 0];
-
-		    src_x += scale_x;
-		}
-
-		src_y += scale_y;
-	    }
-
-	    *width = scale_width;
-	    *height = scale_height;
-
-	    // grabed image of correct size convert BGRA -> RGB
-	} else {
-	    if (write_header) {
-		n = snprintf(buf, sizeof(buf), "P6\n%d\n%d\n255\n", *width,
-		    *height);
-	    }
-	    rgb = malloc(*width * *height * 3 + n);
-	    if (!rgb) {
-		Error(_("video: out of memory\n"));
-		free(data);
-		return NULL;
-	    }
-	    memcpy(rgb, buf, n);	// header
-
-	    for (i = 0; i < *size / 4; ++i) {	// convert bgra -> rgb
-		rgb[n + i * 3 + 0] = data[i * 4 + 2];
-		rgb[n + i * 3 + 1] = data[i * 4 + 1];
-		rgb[n + i * 3 + 2] = data[i * 4 + 0];
-	    }
-
-	    *size = *width * *height * 3 + n;
+	if (write_header) {
+	    n = snprintf(buf, sizeof(buf), "P6\n%d\n%d\n255\n", scale_width,
+		scale_height);
+	}
+	rgb = malloc(scale_width * scale_height * 3 + n);
+	if (!rgb) {
+	    Error(_("video: out of memory\n"));
+	    free(data);
+	    return NULL;
 	}
+	memcpy(rgb, buf, n);		// header
+
+	// convert BGRA -> RGB, hardware didn't scale for us use software
+	VideoGrabScale(rgb + n, scale_width * 3, VideoGrabFormatRGB,
+	    scale_width, scale_height, data, *width * 4, *width, *height);
 	free(data);
 
+	*size = scale_width * scale_height * 3 + n;
+	*width = scale_width;
+	*height = scale_height;
+
 	return rgb;
     } else
 #endif
@@ -12262,24 +13663,142 @@ uint8_t *VideoGrab(int *size, int *width, int *height, int write_header)
 ///	@param height[in,out]	height of image
 ///
 uint8_t *VideoGrabService(int *size, int *width, int *height)
+{
+    return VideoGrabServiceBuffer(NULL, 0, size, width, height);
+}
+
+///
+///	Grab image service into caller buffer.
+///
+///	A width <= -64 requests an atmo analyse image of -width pixels,
+///	height is then the clipped overscan in 1/1000.  Modules which can't
+///	crop and scale, get it done in software.
+///
+///	@param buf		caller buffer, NULL to allocate the image
+///	@param buf_size		size of caller buffer
+///	@param size[out]	size of image, needed size if buffer too small
+///	@param width[in,out]	width of image
+///	@param height[in,out]	height of image
+///
+///	@returns BGRA image, @a buf or allocated, NULL on failure.
+///
+uint8_t *VideoGrabServiceBuffer(uint8_t * buf, int buf_size, int *size,
+    int *width, int *height)
 {
     Debug(3, "video: grab service\n");
 
 #ifdef USE_GRAB
     if (VideoUsedModule->GrabOutput) {
-	return VideoUsedModule->GrabOutput(size, width, height);
+	uint8_t *data;
+	uint8_t *img;
+	int analyse;
+	int overscan;
+	int x0;
+	int y0;
+	int src_width;
+	int src_height;
+	int dst_width;
+	int dst_height;
+
+	analyse = 0;
+	overscan = 0;
+	if (*width <= -64) {		// atmo grab service request
+	    analyse = -*width;
+	    overscan = *height;
+	}
+	data = VideoUsedModule->GrabOutput(size, width, height);
+	if (!data) {
+	    return NULL;
+	}
+
+	x0 = 0;
+	y0 = 0;
+	src_width = *width;
+	src_height = *height;
+	dst_width = *width;
+	dst_height = *height;
+	if (analyse && analyse != *width) {
+	    // calculate aspect correct size of analyze image
+	    dst_width = analyse;
+	    dst_height = (analyse * *height) / *width;
+	    if (overscan > 0 && overscan <= 200) {
+		x0 = *width * overscan / 1000;
+		y0 = *height * overscan / 1000;
+		src_width -= 2 * x0;
+		src_height -= 2 * y0;
+	    }
+	} else if (!buf) {		// nothing to do, give the module image
+	    return data;
+	}
+
+	*size = dst_width * dst_height * 4;
+	if (buf) {
+	    if (buf_size < *size) {
+		Debug(3, "video: grab buffer too small %d < %d\n", buf_size,
+		    *size);
+		free(data);
+		return NULL;
+	    }
+	    img = buf;
+	} else if (!(img = malloc(*size))) {
+	    Error(_("video: out of memory\n"));
+	    free(data);
+	    return NULL;
+	}
+	VideoGrabScale(img, dst_width * 4, VideoGrabFormatBGRA, dst_width,
+	    dst_height, data + y0 * *width * 4 + x0 * 4, *width * 4,
+	    src_width, src_height);
+	free(data);
+
+	*width = dst_width;
+	*height = dst_height;
+	return img;
     } else
 #endif
     {
 	Warning(_("softhddev: grab unsupported\n"));
     }
 
+    (void)buf;
+    (void)buf_size;
     (void)size;
     (void)width;
     (void)height;
     return NULL;
 }
 
+///
+///	Set grab export rate and width.
+///
+///	@param rate	grabs per second, 0 disables the export
+///	@param width	width of exported images
+///
+void VideoSetGrabExport(int rate, int width)
+{
+    if (rate < 0) {
+	rate = 0;
+    } else if (rate > 50) {
+	rate = 50;
+    }
+    if (width < 64) {
+	width = 64;
+    } else if (width > 1920) {
+	width = 1920;
+    }
+#ifdef USE_GRAB
+    if (rate == VideoGrabExportRate && width == VideoGrabExportWidth) {
+	return;
+    }
+    // restart with new shared memory size
+    VideoGrabExportExit();
+    VideoGrabExportRate = rate;
+    VideoGrabExportWidth = width;
+    if (VideoThread) {
+	VideoGrabExportInit();
+    }
+#endif
+}
+
 ///
 ///	Get decoder statistics.
 ///
@@ -12667,6 +14186,16 @@ void VideoSetSoftStartSync(int onoff)
     VideoSoftStartSync = onoff;
 }
 
+///
+///	Set early start of video before audio.
+///
+///	@param onoff	enable / disable the early start.
+///
+void VideoSetEarlyStart(int onoff)
+{
+    VideoEarlyStart = onoff;
+}
+
 ///
 ///	Set show black picture during channel switch.
 ///
@@ -12677,6 +14206,16 @@ void VideoSetBlackPicture(int onoff)
     VideoShowBlackPicture = onoff;
 }
 
+///
+///	Set dither of software 10 bit to 8 bit conversion.
+///
+///	@param onoff	enable / disable dither.
+///
+void VideoSetDither(int onoff)
+{
+    VideoConvertDither = onoff;
+}
+
 #ifdef USE_VAAPI
 ///
 ///	Vaapi helper to set various video params (brightness, contrast etc.)
@@ -13254,7 +14793,8 @@ static const char *vdpau_deinterlace[] = {
     "Temporal",           ///< VideoDeinterlaceTemporal
     "TemporalSpatial",    ///< VideoDeinterlaceTemporalSpatial
     "Software Bob",       ///< VideoDeinterlaceSoftBob
-    "Software Spatial"    ///< VideoDeinterlaceSoftSpatial
+    "Software Spatial",   ///< VideoDeinterlaceSoftSpatial
+    "Software Yadif"      ///< VideoDeinterlaceSoftYadif
 };
 
 static const char *vdpau_deinterlace_short[] = {
@@ -13263,7 +14803,8 @@ static const char *vdpau_deinterlace_short[] = {
     "T",                  ///< VideoDeinterlaceTemporal
     "T+S",                ///< VideoDeinterlaceTemporalSpatial
     "S+B",                ///< VideoDeinterlaceSoftBob
-    "S+S"                 ///< VideoDeinterlaceSoftSpatial
+    "S+S",                ///< VideoDeinterlaceSoftSpatial
+    "S+Y"                 ///< VideoDeinterlaceSoftYadif
 };
 #endif
 
@@ -13335,6 +14876,16 @@ void VideoSetDeinterlace(int mode[VideoResolutionMax])
     VideoSurfaceModesChanged = 1;
 }
 
+///
+///	Set software deinterlace threads.
+///
+///	@param threads	number of worker threads, -1 for automatic
+///
+void VideoSetSoftDeintThreads(int threads)
+{
+    DeintSetThreads(threads);
+}
+
 ///
 ///	Set skip chroma deinterlace on/off.
 ///
@@ -13740,6 +15291,8 @@ void VideoInit(const char *display_name)
 
     Debug(3, "video: window prepared\n");
 
+    DeintInit();
+
     //
     //	prepare hardware decoder VA-API/VDPAU
     //
@@ -13803,6 +15356,7 @@ void VideoExit(void)
 #endif
     VideoUsedModule->Exit();
     VideoUsedModule = &NoopModule;
+    DeintExit();
 #ifdef USE_GLX
     if (GlxEnabled) {
 	GlxExit();
@@ -13971,7 +15525,7 @@ int main(int argc, char *const argv[])
     //
     VideoInit(NULL);
     VideoOsdInit();
-    video_hw_decoder = VideoNewHwDecoder(NULL);
+    video_hw_decoder = VideoNewHwDecoder(NULL, 0);
     start_tick = GetMsTicks();
     n = 0;
     for (;;) {
@@ -47,7 +47,7 @@ extern char ConfigStartX11Server;	///< flag start the x11 server
 //----------------------------------------------------------------------------
 
     /// Allocate new video hardware decoder.
-extern VideoHwDecoder *VideoNewHwDecoder(VideoStream *);
+extern VideoHwDecoder *VideoNewHwDecoder(VideoStream *, int);
 
     /// Deallocate video hardware decoder.
 extern void VideoDelHwDecoder(VideoHwDecoder *);
@@ -102,9 +102,15 @@ extern void VideoSet60HzMode(int);
     /// Set soft start audio/video sync.
 extern void VideoSetSoftStartSync(int);
 
+    /// Set early start of video before audio.
+extern void VideoSetEarlyStart(int);
+
     /// Set show black picture during channel switch.
 extern void VideoSetBlackPicture(int);
 
+    /// Set dither of 10 bit to 8 bit conversion.
+extern void VideoSetDither(int);
+
     /// Set brightness adjustment.
 extern void VideoSetBrightness(int);
 
@@ -159,6 +165,9 @@ extern int VideoGetDeinterlaceModes(const char* **long_table, const char* **shor
     /// Set deinterlace.
 extern void VideoSetDeinterlace(int[]);
 
+    /// Set software deinterlace threads.
+extern void VideoSetSoftDeintThreads(int);
+
     /// Set skip chroma deinterlace.
 extern void VideoSetSkipChromaDeinterlace(int[]);
 
@@ -212,6 +221,9 @@ extern void VideoOsdDrawARGB(int, int, int, int, int, const uint8_t *, int,
     /// Get OSD size.
 extern void VideoGetOsdSize(int *, int *);
 
+    /// Get OSD surface generation.
+extern unsigned VideoOsdGetGeneration(void);
+
     /// Set OSD size.
 extern void VideoSetOsdSize(int, int);
 
@@ -239,6 +251,12 @@ extern uint8_t *VideoGrab(int *, int *, int *, int);
     /// Grab screen raw.
 extern uint8_t *VideoGrabService(int *, int *, int *);
 
+    /// Grab screen raw into caller buffer.
+extern uint8_t *VideoGrabServiceBuffer(uint8_t *, int, int *, int *, int *);
+
+    /// Set grab export rate and width.
+extern void VideoSetGrabExport(int, int);
+
     /// Get decoder statistics.
 extern void VideoGetStats(VideoHwDecoder *, int *, int *, int *, int *);
 